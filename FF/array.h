@@ -502,13 +502,13 @@ static FFINL void ffmblk_free(ffmblk *m)
 
 
 typedef struct ffrange {
-	ushort len
+	uint len
 		, off;
 } ffrange;
 
 static FFINL void ffrang_set(ffrange *r, const char *base, const char *s, size_t len) {
-	r->off = (short)(s - base);
-	r->len = (ushort)len;
+	r->off = (uint)(s - base);
+	r->len = (uint)len;
 }
 
 static FFINL ffstr ffrang_get(const ffrange *r, const char *base) {
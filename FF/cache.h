@@ -21,6 +21,13 @@ flags: enum FFCACHE_CB
 */
 typedef int (*ffcache_onchange)(ffcache *c, ffcache_item *ci, uint flags);
 
+/** Eviction policy. */
+enum FFCACHE_POLICY {
+	FFCACHE_POLICY_LRU, //evict the least recently used item
+	FFCACHE_POLICY_SLRU, //segmented LRU: items hit twice are moved to a protected segment
+	FFCACHE_POLICY_CLOCK, //second chance: a hit only sets a flag, items aren't relinked
+};
+
 typedef struct ffcache_conf {
 	ffcache_timer timer;
 	ffcache_onchange onchange;
@@ -33,15 +40,35 @@ typedef struct ffcache_conf {
 	uint mem_limit;
 	uint def_expire;
 	uint max_expire;
+
+	/** Number of independent shards, each with its own lock, index, LRU list and limits.
+	Items are distributed across shards by key hash;  'max_items' and 'mem_limit' are split evenly.
+	0: single-threaded cache without locking.
+	>0: all functions are thread-safe.
+	 Note: 'timer' and 'onchange' are called while the item's shard is locked. */
+	uint shards;
+
+	uint policy; //enum FFCACHE_POLICY
+
 	uint key_icase :1
-		, multi :1;
+		, multi :1
+
+		/** TinyLFU admission filter:
+		 when the cache is full, a new item is stored only if its key is accessed more often than the key of eviction candidate.
+		 Access frequency is estimated by a count-min sketch. */
+		, tinylfu :1;
 } ffcache_conf;
 
+/** Cache statistics.  For a sharded cache the values are summed over all shards. */
 struct ffcache_stat {
 	uint hits;
 	uint misses;
+	uint evictions; //items deleted to free space for the new ones
+	uint rejected; //items not stored by admission filter
 	size_t items;
-	size_t memsize;
+	size_t memsize; //memory allocated for items, keys and data
+	size_t slab_total; //memory occupied by slabs
+	size_t slab_used; //memory of slab chunks in use;  slab utilisation = slab_used / slab_total
 };
 
 FF_EXTN const char* ffcache_errstr(uint code);
@@ -58,16 +85,17 @@ enum FFCACHE_E {
 	FFCACHE_ESYS,
 	FFCACHE_EEXISTS,
 	FFCACHE_ENOTFOUND,
-	FFCACHE_ECOLL,
+	FFCACHE_ECOLL, //not used
 	FFCACHE_ENUMLIMIT,
 	FFCACHE_EMEMLIMIT,
 	FFCACHE_ESZLIMIT,
 	FFCACHE_ELOCKED,
+	FFCACHE_EREJECTED,
 };
 
 struct ffcache_item {
 	void *id;
-	uint keyhash[1];
+	uint64 keyhash[1];
 	ffstr key, data;
 	uint refs;
 	uint expire; //max-age, in sec
@@ -76,6 +104,7 @@ struct ffcache_item {
 enum FFCACHE_FETCH {
 	FFCACHE_ACQUIRE = 1, //acquire item (fetch and remove from cache)
 	FFCACHE_NEXT = 2, //fetch the next item with the same key, for FFCACHE_MULTI
+	FFCACHE_PEEK = 4, //don't update statistics, TinyLFU frequency and eviction order
 };
 
 /** Fetch data.
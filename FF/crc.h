@@ -57,6 +57,10 @@ static FFINL uint ffcrc32_iget(const char *p, size_t len)
 	return crc;
 }
 
+/** Same as ffcrc32_iget(), but processes 4 bytes at a time:
+ the case of 4 characters is folded with one word operation. */
+FF_EXTN uint ffcrc32_iget4(const char *p, size_t len);
+
 /** Get CRC32 from a NULL-terminated string. */
 static FFINL uint ffcrc32_getz(const char *sz, int case_insens)
 {
@@ -46,12 +46,21 @@ enum FFCONF_T {
 	, FFCONF_TVALNEXT //"key val1 VAL2..."
 };
 
+enum FFCONF_PARSE_F {
+	/** In-situ mode: keys and quoted values reference input data, escape sequences are decoded in place.
+	Input data must be writable and must stay valid while the values are in use.
+	A value which continues in the next chunk of input data is still copied.
+	Set in ffconf.flags after ffconf_parseinit(). */
+	FFCONF_PINSITU = 1,
+};
+
 typedef struct ffconf {
 	uint state, nextst;
 	uint type; //enum FFCONF_T
 	int ret; //enum FFPARS_E
 	uint line;
 	uint ch;
+	uint flags; //enum FFCONF_PARSE_F
 	char esc[8];
 
 	ffstr val;
@@ -4,6 +4,7 @@
 
 /*
 ffconf_scheme_addctx
+ffconf_scheme_setkeyidx
 ffconf_scheme_process
 ffconf_parse_object
 */
@@ -11,6 +12,7 @@ ffconf_parse_object
 #pragma once
 
 #include <FF/data/conf2.h>
+#include <FF/data/keyidx.h>
 
 enum FFCONF_SCHEME_T {
 	FFCONF_TSTR = 1,
@@ -85,8 +87,24 @@ static inline const ffconf_arg* _ffconf_arg_ifind(const ffconf_arg *args, const
 struct ffconf_schemectx {
 	const ffconf_arg *args;
 	void *obj;
+	const ffkeyidx *keyidx; // (optional) index of 'args' set by user
 };
 
+/** Find element by name in the context */
+static inline const ffconf_arg* _ffconf_ctx_find(struct ffconf_schemectx *c, const ffstr *name, ffuint icase)
+{
+	ffuint kf = (icase) ? FFKEYIDX_ICASE : 0;
+
+	if (c->keyidx != NULL && c->keyidx->args == c->args && c->keyidx->flags == kf) {
+		int i = ffkeyidx_find(c->keyidx, name->ptr, name->len);
+		return (i >= 0) ? &c->args[i] : NULL;
+	}
+
+	if (icase)
+		return _ffconf_arg_ifind(c->args, name);
+	return _ffconf_arg_find(c->args, name);
+}
+
 typedef struct ffconf_scheme {
 	ffconf *parser;
 	ffuint flags; // enum FFCONF_SCHEME_F
@@ -105,11 +123,21 @@ enum FFCONF_SCHEME_F {
 	FFCONF_SCF_ICASE = 1,
 };
 
+/** Enter a new context */
 static inline void ffconf_scheme_addctx(ffconf_scheme *cs, const ffconf_arg *args, void *obj)
 {
 	struct ffconf_schemectx *c = ffvec_pushT(&cs->ctxs, struct ffconf_schemectx);
 	c->args = args;
 	c->obj = obj;
+	c->keyidx = NULL;
+}
+
+/** Set the index of key names for the current context.
+ki: ffkeyidx_create(args, sizeof(ffconf_arg), -1, (icase) ? FFKEYIDX_ICASE : 0);  owned by user */
+static inline void ffconf_scheme_setkeyidx(ffconf_scheme *cs, const ffkeyidx *ki)
+{
+	struct ffconf_schemectx *c = ffslice_lastT(&cs->ctxs, struct ffconf_schemectx);
+	c->keyidx = ki;
 }
 
 #define _FFCONF_ERR(c, msg) \
@@ -164,10 +192,7 @@ static inline int ffconf_scheme_process(ffconf_scheme *cs, int r)
 		break;
 
 	case FFCONF_RKEY:
-		if (cs->flags & FFCONF_SCF_ICASE)
-			cs->arg = _ffconf_arg_ifind(ctx->args, &cs->parser->val);
-		else
-			cs->arg = _ffconf_arg_find(ctx->args, &cs->parser->val);
+		cs->arg = _ffconf_ctx_find(ctx, &cs->parser->val, cs->flags & FFCONF_SCF_ICASE);
 		if (cs->arg == NULL)
 			return _FFCONF_ERR(cs, "no such key in the current context");
 		break;
@@ -19,6 +19,7 @@ static int unesc(char *dst, size_t cap, const char *text, size_t len);
 static int hdlQuote(ffconf *p, int *st, int *nextst, const char *data);
 static int val_add(ffarr *buf, const char *s, size_t len);
 static int val_store(ffarr *buf, const char *s, size_t len);
+static int val_insitu(ffarr *buf, const char *s, size_t len);
 
 enum CONF_IDX {
 	FFPARS_IWSPACE, I_ERR,
@@ -57,7 +58,10 @@ static int hdlQuote(ffconf *p, int *st, int *nextst, const char *data)
 		break;
 
 	default:
-		r = val_add(&p->buf, data, 1);
+		if (p->flags & FFCONF_PINSITU)
+			r = val_insitu(&p->buf, data, 1);
+		else
+			r = val_add(&p->buf, data, 1);
 	}
 
 	return r;
@@ -107,7 +111,10 @@ static int hdlEsc(ffconf *p, int *st, int ch)
 		return FFPARS_EESC; //invalid escape sequence
 
 	if (r != 0) {
-		r = val_store(&p->buf, buf, r);
+		if (p->flags & FFCONF_PINSITU)
+			r = val_insitu(&p->buf, buf, r);
+		else
+			r = val_store(&p->buf, buf, r);
 		if (r != 0)
 			return r; //allocation error
 		p->esc[0] = 0;
@@ -212,6 +219,26 @@ static int val_add(ffarr *buf, const char *s, size_t len)
 	return 0;
 }
 
+/** In-situ mode: append data to the value which is stored within input buffer.
+The value's data is moved back after an escape sequence is decoded. */
+static int val_insitu(ffarr *buf, const char *s, size_t len)
+{
+	if (buf->cap != 0)
+		return val_store(buf, s, len);
+
+	if (buf->ptr + buf->len != s)
+		memmove(buf->ptr + buf->len, s, len);
+	buf->len += len;
+	return 0;
+}
+
+/** Begin a quoted value at the next character. */
+static void val_quote(ffconf *p, const char *data)
+{
+	if ((p->flags & FFCONF_PINSITU) && p->buf.cap == 0)
+		ffarr_set(&p->buf, (char*)data + 1, 0);
+}
+
 int ffconf_parse(ffconf *p, const char *data, size_t *len)
 {
 	const char *datao = data;
@@ -268,6 +295,7 @@ int ffconf_parse(ffconf *p, const char *data, size_t *len)
 			if (ch == '"') {
 				st = iQuot;
 				nextst = iKey;
+				val_quote(p, data);
 
 			} else if (ch == '}') {
 				st = iRmCtx;
@@ -310,6 +338,7 @@ int ffconf_parse(ffconf *p, const char *data, size_t *len)
 			if (ch == '"') {
 				st = iQuot;
 				nextst = iVal;
+				val_quote(p, data);
 
 			} else if (ch == '{') {
 				st = iNewCtx;
@@ -403,6 +432,13 @@ int ffconf_parse(ffconf *p, const char *data, size_t *len)
 	if (r == FFPARS_MORE && p->buf.len != 0)
 		r = val_store(&p->buf, NULL, 0);
 
+	else if (r == FFPARS_MORE && (p->flags & FFCONF_PINSITU) && p->buf.cap == 0
+		&& (st == iQuot || st == iQuotEsc)) {
+		// the string continues in the next chunk: all its data will be stored in our buffer
+		if (NULL == ffarr_grow(&p->buf, 1, 256 | FFARR_GROWQUARTER))
+			r = FFPARS_ESYS;
+	}
+
 	ffstr_set2(&p->val, &p->buf);
 	p->state = st;
 	p->nextst = nextst;
@@ -741,6 +777,17 @@ int ffconf_schemfin(ffparser_schem *ps)
 
 /* Convert value of type string into integer or boolean, fail if can't.
 For a named object store the last parsed value. */
+/** Process value of the current argument.
+In-situ mode: the value references input data unless it has been copied into parser's buffer. */
+static int conf_argval(ffparser_schem *ps, const ffstr *val, void *obj)
+{
+	ffconf *p = ps->p;
+	if (ps->flags & FFPARS_INSITU)
+		return _ffpars_arg_process_ref(ps->curarg, val, obj, ps
+			, (p->flags & FFCONF_PINSITU) && p->buf.cap == 0);
+	return ffpars_arg_process(ps->curarg, val, obj, ps);
+}
+
 static int ffconf_schemval(ffparser_schem *ps)
 {
 	ffconf *p = ps->p;
@@ -784,7 +831,7 @@ static int ffconf_schemval(ffparser_schem *ps)
 		break;
 
 	default:
-		r = ffpars_arg_process(ps->curarg, &v, ffarr_back(&ps->ctxs).obj, ps);
+		r = conf_argval(ps, &v, ffarr_back(&ps->ctxs).obj);
 	}
 
 	if (ps->flags & SCF_RESETCTX)
@@ -873,7 +920,7 @@ int ffconf_schemrun(ffparser_schem *ps)
 			ctx {
 				KEY val val val
 			} */
-			r = ffpars_arg_process(ps->curarg, &c->val, ctx->obj, ps);
+			r = conf_argval(ps, &c->val, ctx->obj);
 			if (r != 0)
 				return r;
 
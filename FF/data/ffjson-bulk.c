@@ -0,0 +1,790 @@
+/** JSON bulk parser.
+Copyright (c) 2020 Simon Zolin
+*/
+
+#include <FF/data/json.h>
+#include <FF/data/utf8.h>
+#include <FF/bitops.h>
+#include <FF/number.h>
+
+
+/*
+Stage 1 (indexer) gets the bit masks of backslash, quote, whitespace and operator ({}[],:) characters
+ for each 64-byte block, then finds:
+ . quotes which aren't escaped;  the characters between quotes are in-string
+ . operators outside of strings
+ . the first characters of bare values (numbers, true, false, null)
+ . newlines inside strings (invalid JSON)
+The offsets of these characters are appended to the index.
+Block masks are linked by carry bits: backslash sequence, in-string, bare value.
+
+Stage 2 walks the index:
+ a string ends at the next element (closing quote);
+ a bare value ends at the first whitespace or operator character.
+*/
+
+enum {
+	JSON_SLICE = 32 * 1024, //max. data indexed at once
+};
+
+enum ST {
+	ST_VAL, ST_VALFIRST,
+	ST_KEY, ST_KEYFIRST,
+	ST_COLON,
+	ST_AFTERVAL,
+};
+
+enum {
+	C_BSLASH = 1,
+	C_QUOTE = 2,
+	C_WS = 4,
+	C_OP = 8,
+	C_NL = 0x10,
+};
+
+static const byte json_class[256] = {
+	['\\'] = C_BSLASH,
+	['"'] = C_QUOTE,
+	[' '] = C_WS, ['\t'] = C_WS, ['\r'] = C_WS, ['\n'] = C_WS | C_NL,
+	['{'] = C_OP, ['}'] = C_OP, ['['] = C_OP, [']'] = C_OP, [','] = C_OP, [':'] = C_OP,
+};
+
+struct blkmask {
+	uint64 bs, quote, ws, op, nl;
+};
+
+#ifdef FF_AMD64
+
+#define mm_mask(v)  ((uint64)(uint)_mm_movemask_epi8(v))
+
+static void blk_masks(const byte *d, struct blkmask *m)
+{
+	const __m128i bs = _mm_set1_epi8('\\')
+		, quote = _mm_set1_epi8('"')
+		, sp = _mm_set1_epi8(' ')
+		, tab = _mm_set1_epi8('\t')
+		, cr = _mm_set1_epi8('\r')
+		, nl = _mm_set1_epi8('\n')
+		, comma = _mm_set1_epi8(',')
+		, colon = _mm_set1_epi8(':')
+		, brace_open = _mm_set1_epi8('{')
+		, brace_close = _mm_set1_epi8('}')
+		, lower = _mm_set1_epi8(0x20);
+
+	ffmem_tzero(m);
+	for (uint i = 0;  i != 64;  i += 16) {
+		__m128i v = _mm_loadu_si128((const void*)(d + i));
+		// '[' | 0x20 == '{',  ']' | 0x20 == '}'
+		__m128i vl = _mm_or_si128(v, lower);
+		__m128i n = _mm_cmpeq_epi8(v, nl);
+
+		m->bs |= mm_mask(_mm_cmpeq_epi8(v, bs)) << i;
+		m->quote |= mm_mask(_mm_cmpeq_epi8(v, quote)) << i;
+		m->nl |= mm_mask(n) << i;
+		m->ws |= mm_mask(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, sp), _mm_cmpeq_epi8(v, tab))
+			, _mm_or_si128(_mm_cmpeq_epi8(v, cr), n))) << i;
+		m->op |= mm_mask(_mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(vl, brace_open), _mm_cmpeq_epi8(vl, brace_close))
+			, _mm_or_si128(_mm_cmpeq_epi8(v, comma), _mm_cmpeq_epi8(v, colon)))) << i;
+	}
+}
+
+#else
+
+static void blk_masks(const byte *d, struct blkmask *m)
+{
+	ffmem_tzero(m);
+	for (uint i = 0;  i != 64;  i++) {
+		uint c = json_class[d[i]];
+		if (c == 0)
+			continue;
+		uint64 bit = (uint64)1 << i;
+		if (c & C_BSLASH)
+			m->bs |= bit;
+		if (c & C_QUOTE)
+			m->quote |= bit;
+		if (c & C_WS)
+			m->ws |= bit;
+		if (c & C_OP)
+			m->op |= bit;
+		if (c & C_NL)
+			m->nl |= bit;
+	}
+}
+
+#endif
+
+/** Set all bits from a 1-bit up to the next 1-bit (exclusive). */
+static inline uint64 prefix_xor(uint64 x)
+{
+	x ^= x << 1;
+	x ^= x << 2;
+	x ^= x << 4;
+	x ^= x << 8;
+	x ^= x << 16;
+	x ^= x << 32;
+	return x;
+}
+
+/** Get the mask of characters which follow an odd-length backslash sequence.
+carry: [in] the previous block ends with an odd-length sequence;  [out] this block does */
+static uint64 escaped_mask(uint64 bs, uint64 *carry)
+{
+	const uint64 even = 0x5555555555555555ULL, odd = ~even;
+	uint64 starts = bs & ~(bs << 1);
+	uint64 even_start_mask = even ^ *carry;
+	uint64 even_starts = starts & even_start_mask;
+	uint64 odd_starts = starts & ~even_start_mask;
+
+	uint64 even_carries = bs + even_starts;
+	uint64 odd_carries = bs + odd_starts;
+	uint64 next_carry = (odd_carries < bs);
+	odd_carries |= *carry;
+	*carry = next_carry;
+
+	uint64 even_carry_ends = even_carries & ~bs;
+	uint64 odd_carry_ends = odd_carries & ~bs;
+	return (even_carry_ends & odd) | (odd_carry_ends & even);
+}
+
+static inline uint bit_count64(uint64 x)
+{
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (x * 0x0101010101010101ULL) >> 56;
+}
+
+/** Index 64-byte block.
+off: block offset within the input window */
+static void json_index_blk(ffjson_bulk *b, const byte *d, size_t off)
+{
+	struct blkmask m;
+	blk_masks(d, &m);
+
+	uint64 escaped = escaped_mask(m.bs, &b->carry_esc);
+	uint64 quote = m.quote & ~escaped;
+	uint64 in_str = prefix_xor(quote) ^ b->carry_str;
+	b->carry_str = (uint64)((int64)in_str >> 63);
+
+	uint64 scalar = ~(m.op | m.ws | m.quote);
+	uint64 scalar_starts = scalar & ~((scalar << 1) | b->carry_scalar);
+	b->carry_scalar = scalar >> 63;
+
+	uint64 s = ((m.op | scalar_starts) & ~in_str)
+		| quote
+		| (m.nl & in_str);
+	b->nlines += bit_count64(m.nl);
+
+	size_t *p = ffarr_endT(&b->idx, size_t);
+	while (s != 0) {
+		*p++ = off + ffbit_ffs64(s) - 1;
+		s &= s - 1;
+	}
+	b->idx.len = p - (size_t*)b->idx.ptr;
+}
+
+/** Index the next part of input data.
+The last incomplete block is processed only after the end of input.
+Return 0 if there's no more data to index. */
+static int json_index(ffjson_bulk *b)
+{
+	size_t n = b->in.len - b->nscan;
+	if (n == 0 || (n < 64 && !b->fin))
+		return 0;
+	n = ffmin(n, JSON_SLICE);
+	if (!b->fin)
+		n &= ~(size_t)63;
+
+	// remove the processed elements
+	if (b->iidx != 0) {
+		size_t *it = (size_t*)b->idx.ptr;
+		memmove(it, it + b->iidx, (b->idx.len - b->iidx) * sizeof(size_t));
+		b->idx.len -= b->iidx;
+		b->iidx = 0;
+	}
+	if (NULL == ffarr_growT(&b->idx, ff_align_ceil2(n, 64), JSON_SLICE / 4 | FFARR_GROWQUARTER, size_t))
+		return -1;
+
+	const byte *d = (byte*)b->in.ptr + b->nscan;
+	const byte *end = d + n;
+	for (;  d + 64 <= end;  d += 64) {
+		json_index_blk(b, d, d - (byte*)b->in.ptr);
+	}
+
+	if (d != end) {
+		// the last block is padded with whitespace
+		byte blk[64];
+		memset(blk, ' ', sizeof(blk));
+		ffmemcpy(blk, d, end - d);
+		json_index_blk(b, blk, d - (byte*)b->in.ptr);
+	}
+
+	b->nscan += n;
+	return 1;
+}
+
+/** Get the next element of the index.
+Return offset;  -1: need more data;  -2: error. */
+static ssize_t json_idx_next(ffjson_bulk *b, size_t i)
+{
+	while (i >= b->idx.len - b->iidx) {
+		int r = json_index(b);
+		if (r <= 0)
+			return (r == 0) ? -1 : -2;
+	}
+	return *ffarr_itemT(&b->idx, b->iidx + i, size_t);
+}
+
+/** Set position of the character at 'off' within the input window. */
+static void json_setpos(ffjson_bulk *b, size_t off)
+{
+	if (off <= b->nscan)
+		b->p.line = b->nlines - ffs_nfindc(b->in.ptr + off, b->nscan - off, '\n') + 1;
+	else
+		b->p.line = b->nlines + ffs_nfindc(b->in.ptr + b->nscan, off - b->nscan, '\n') + 1;
+
+	const char *s = ffs_rfind(b->in.ptr, off, '\n');
+	s = (s != b->in.ptr + off) ? s + 1 : b->in.ptr;
+	b->p.ch = b->in.ptr + off - s + 1;
+}
+
+/** Unescape string.
+Output data is never larger than input. */
+static int json_unescape(ffarr *buf, const char *s, size_t len)
+{
+	const char *end = s + len;
+	uint hiword = 0;
+
+	buf->len = 0;
+	if (NULL == ffarr_realloc(buf, len + 4))
+		return FFPARS_ESYS;
+	char *d = buf->ptr;
+
+	while (s != end) {
+		const char *bs = ffs_findc(s, end - s, '\\');
+		if (bs == NULL)
+			bs = end;
+		if (hiword != 0 && bs != s)
+			return FFPARS_EESC; //UTF-16 escaped char must follow
+		d = ffmem_copy(d, s, bs - s);
+		s = bs;
+		if (s == end)
+			break;
+
+		uint uch;
+		int r = ffjson_unescapechar(&uch, s + 1, end - (s + 1));
+		if (r <= 0)
+			return FFPARS_EESC;
+		s += 1 + r;
+
+		if (ffutf16_basic(uch)) {
+			if (hiword != 0)
+				return FFPARS_EESC;
+
+		} else if (ffutf16_highsurr(uch)) {
+			if (hiword != 0)
+				return FFPARS_EESC; //2nd high surrogate
+			hiword = uch;
+			continue;
+
+		} else {
+			if (hiword == 0)
+				return FFPARS_EESC; //low surrogate without previous high surrogate
+			uch = ffutf16_suppl(hiword, uch);
+			hiword = 0;
+		}
+
+		d += ffutf8_encode1(d, buf->cap - (d - buf->ptr), uch);
+	}
+
+	if (hiword != 0)
+		return FFPARS_EESC;
+	buf->len = d - buf->ptr;
+	return 0;
+}
+
+/** Process quoted string.
+Return 0 on success;  -1: need more data;  enum FFPARS_E on error. */
+static int json_str(ffjson_bulk *b, size_t off, size_t *errpos)
+{
+	ssize_t close = json_idx_next(b, 1);
+	if (close < 0) {
+		if (close == -2)
+			return FFPARS_ESYS;
+		if (!b->fin)
+			return -1;
+		*errpos = off;
+		return FFPARS_ENOVAL; //no closing quote
+	}
+
+	if (b->in.ptr[close] != '"') {
+		*errpos = close;
+		return FFPARS_EBADCHAR; //newline within quoted value
+	}
+
+	const char *s = b->in.ptr + off + 1;
+	size_t len = close - (off + 1);
+	if (NULL != ffs_findc(s, len, '\\')) {
+		int r = json_unescape(&b->sbuf, s, len);
+		if (r != 0) {
+			*errpos = off;
+			return r;
+		}
+		ffstr_set2(&b->p.val, &b->sbuf);
+	} else {
+		ffstr_set(&b->p.val, s, len);
+	}
+
+	b->p.type = FFJSON_TSTR;
+	b->iidx += 2;
+	return 0;
+}
+
+static const char json_words[][6] = { "true", "false", "null" };
+
+/** Process value without quotes.
+Return 0 on success;  -1: need more data;  enum FFPARS_E on error. */
+static int json_bare(ffjson_bulk *b, size_t off, size_t *errpos)
+{
+	const char *s = b->in.ptr + off;
+	const char *end = b->in.ptr + b->in.len;
+	ssize_t next = json_idx_next(b, 1);
+	if (next >= 0)
+		end = b->in.ptr + next;
+
+	const char *p;
+	for (p = s;  p != end;  p++) {
+		if (json_class[(byte)*p] & (C_WS | C_OP | C_QUOTE))
+			break;
+	}
+	if (p == b->in.ptr + b->in.len && !b->fin)
+		return -1;
+
+	size_t len = p - s, n;
+	*errpos = off;
+	b->p.val.ptr = (char*)s;
+
+	int i = -1;
+	switch (s[0]) {
+	case 't':
+		i = 0;  break;
+	case 'f':
+		i = 1;  break;
+	case 'n':
+		i = 2;  break;
+	case '/':
+		return FFPARS_EBADCMT; //comments aren't supported
+	}
+
+	if (i >= 0) {
+		n = ffsz_len(json_words[i]);
+		if (len < n || ffmemcmp(s, json_words[i], n))
+			return FFPARS_EBADVAL;
+		b->p.type = (i == 2) ? FFJSON_TNULL : FFJSON_TBOOL;
+		b->p.intval = (i == 0);
+
+	} else {
+		for (n = 0;  n != len;  n++) {
+			int ch = s[n];
+			if (!(ffchar_isdigit(ch) || ch == '-' || ch == '+' || ch == '.' || ffchar_lower(ch) == 'e'))
+				break;
+		}
+		if (n == 0)
+			return FFPARS_ENOVAL;
+
+		if (n == ffs_toint(s, n, &b->p.intval, FFS_INT64 | FFS_INTSIGN))
+			b->p.type = FFJSON_TINT;
+		else if (n == ffs_tofloat(s, n, &b->p.fltval, 0))
+			b->p.type = FFJSON_TNUM;
+		else
+			return FFPARS_EBADVAL;
+	}
+
+	b->p.val.len = n;
+	if (n != len) {
+		*errpos = off + n;
+		return FFPARS_EBADCHAR;
+	}
+
+	b->iidx++;
+	return 0;
+}
+
+static const byte ctx_type[] = { FFJSON_TOBJ, FFJSON_TARR };
+
+void ffjson_bulk_init(ffjson_bulk *b, uint flags)
+{
+	ffmem_tzero(b);
+	ffjson_parseinit(&b->p);
+	b->flags = flags;
+}
+
+void ffjson_bulk_close(ffjson_bulk *b)
+{
+	ffjson_parseclose(&b->p);
+	ffarr_free(&b->buf);
+	ffarr_free(&b->idx);
+	ffarr_free(&b->sbuf);
+}
+
+int ffjson_bulk_input(ffjson_bulk *b, const char *data, size_t len)
+{
+	if (len == 0) {
+		b->fin = 1;
+		return 0;
+	}
+
+	if (b->buf.len == 0) {
+		ffstr_set(&b->in, data, len);
+		return 0;
+	}
+
+	if (NULL == ffarr_grow(&b->buf, len, 0)
+		|| NULL == ffarr_append(&b->buf, data, len))
+		return FFPARS_ESYS;
+	ffstr_set2(&b->in, &b->buf);
+	return 0;
+}
+
+/** Move the unprocessed data to the beginning of the internal buffer. */
+static int json_keep(ffjson_bulk *b)
+{
+	size_t off = b->nscan;
+	if (b->iidx != b->idx.len)
+		off = *ffarr_itemT(&b->idx, b->iidx, size_t);
+
+	if (b->in.ptr == b->buf.ptr) {
+		_ffarr_rmleft(&b->buf, off, sizeof(char));
+	} else {
+		b->buf.len = 0;
+		if (off != b->in.len
+			&& NULL == ffarr_append(&b->buf, b->in.ptr + off, b->in.len - off))
+			return FFPARS_ESYS;
+	}
+	ffstr_set2(&b->in, &b->buf);
+
+	size_t *it = (size_t*)b->idx.ptr;
+	for (size_t i = b->iidx;  i != b->idx.len;  i++) {
+		it[i - b->iidx] = it[i] - off;
+	}
+	b->idx.len -= b->iidx;
+	b->iidx = 0;
+	b->nscan -= off;
+	return 0;
+}
+
+/*
+. Apply context change from the previous call
+. Get the next element of the index
+. Process the token
+*/
+int ffjson_bulk_parse(ffjson_bulk *b)
+{
+	ffjson *p = &b->p;
+	int r;
+	size_t errpos = 0;
+
+	if (b->ctx_push) {
+		b->ctx_push = 0;
+		char *ctx = ffarr_push(&p->ctxs, char);
+		if (ctx == NULL) {
+			r = FFPARS_ESYS;
+			goto end;
+		}
+		*ctx = p->type;
+
+	} else if (b->ctx_pop) {
+		b->ctx_pop = 0;
+		p->ctxs.len--;
+	}
+
+	for (;;) {
+		ssize_t off = json_idx_next(b, 0);
+		if (off < 0) {
+			if (off == -2) {
+				r = FFPARS_ESYS;
+				goto end;
+			}
+			goto more;
+		}
+
+		errpos = off;
+		int ch = b->in.ptr[off];
+
+		switch (b->st) {
+
+		case ST_AFTERVAL:
+			if (p->ctxs.len == 0) {
+				if (!(b->flags & FFJSON_BULK_MULTI)) {
+					r = FFPARS_EBADCHAR; //document finished. no more entities expected
+					goto end;
+				}
+				b->st = ST_VAL;
+				continue;
+			}
+
+			if (ch == ',') {
+				b->iidx++;
+				b->st = (ffarr_back(&p->ctxs) == FFJSON_TARR) ? ST_VAL : ST_KEY;
+				continue;
+			} else if (ch != ']' && ch != '}') {
+				r = FFPARS_EBADCHAR;
+				goto end;
+			}
+			goto close;
+
+		case ST_VALFIRST:
+			if (ch == ']')
+				goto close; // empty array: "[]"
+			// fallthrough
+		case ST_VAL:
+			switch (ch) {
+			case '"':
+				r = json_str(b, off, &errpos);
+				break;
+
+			case '[':
+			case '{':
+				p->type = ctx_type[ch == '['];
+				b->st = (ch == '[') ? ST_VALFIRST : ST_KEYFIRST;
+				b->ctx_push = 1;
+				b->iidx++;
+				r = FFPARS_OPEN;
+				goto end;
+
+			case ']':
+			case '}':
+			case ',':
+			case ':':
+				r = FFPARS_ENOVAL;
+				goto end;
+
+			default:
+				r = json_bare(b, off, &errpos);
+			}
+
+			if (r == -1)
+				goto more;
+			else if (r != 0)
+				goto end;
+			b->st = ST_AFTERVAL;
+			r = FFPARS_VAL;
+			goto end;
+
+		case ST_KEYFIRST:
+			if (ch == '}')
+				goto close; // empty object: "{}"
+			// fallthrough
+		case ST_KEY:
+			if (ch != '"') {
+				r = FFPARS_EBADCHAR;
+				goto end;
+			}
+			r = json_str(b, off, &errpos);
+			if (r == -1)
+				goto more;
+			else if (r != 0)
+				goto end;
+			b->st = ST_COLON;
+			r = FFPARS_KEY;
+			goto end;
+
+		case ST_COLON:
+			if (ch != ':') {
+				r = FFPARS_EKVSEP;
+				goto end;
+			}
+			b->iidx++;
+			b->st = ST_VAL;
+			continue;
+		}
+
+close:
+		FF_ASSERT(p->ctxs.len != 0);
+		if (ffarr_back(&p->ctxs) != ctx_type[ch == ']']) {
+			r = FFPARS_EBADBRACE; //closing brace should match the context type
+			goto end;
+		}
+		p->type = ctx_type[ch == ']'];
+		b->st = ST_AFTERVAL;
+		b->ctx_pop = 1;
+		b->iidx++;
+		r = FFPARS_CLOSE;
+		goto end;
+	}
+
+more:
+	if (b->fin) {
+		r = FFPARS_MORE;
+		goto end;
+	}
+	r = json_keep(b);
+	if (r != 0)
+		goto end;
+	p->ret = FFPARS_MORE;
+	return FFPARS_MORE;
+
+end:
+	if ((ffpars_iserr(r) && r != FFPARS_ESYS)
+		|| (r < 0 && !b->started)) {
+		b->started = 1;
+		json_setpos(b, errpos);
+	}
+	p->ret = r;
+	return r;
+}
+
+
+void ffjson_split_init(ffjson_split *s, uint flags)
+{
+	ffmem_tzero(s);
+	s->flags = flags;
+}
+
+/** Strip whitespace from both sides. */
+static void split_trim(ffstr *s)
+{
+	while (s->len != 0 && (json_class[(byte)s->ptr[0]] & C_WS))
+		ffstr_shift(s, 1);
+	while (s->len != 0 && (json_class[(byte)s->ptr[s->len - 1]] & C_WS))
+		s->len--;
+}
+
+/** Set record data [0..end) and skip 'skip' bytes of input. */
+static void split_rec(ffjson_split *s, ffstr *data, ffstr *rec, size_t end, size_t skip)
+{
+	ffstr_set(rec, data->ptr, end);
+	split_trim(rec);
+	ffstr_shift(data, skip);
+	s->off = 0;
+	s->carry_esc = 0;
+	s->carry_str = 0;
+}
+
+/*
+The blocks are scanned with the same masks as in stage 1 of the bulk parser,
+ but only the brackets, commas and newlines outside of strings are examined.
+A record always begins outside of a string, so the carry bits are reset on each record.
+An incomplete block at the end of data is scanned, but the state is committed only after the end of input.
+*/
+int ffjson_split_next(ffjson_split *s, ffstr *data, ffstr *rec, uint fin)
+{
+	struct blkmask m;
+	byte blk[64];
+	uint arr = s->flags & FFJSON_SPLIT_ARRAY;
+
+	for (;;) {
+next:;
+		size_t n = data->len - s->off;
+		if (n == 0)
+			break;
+
+		uint64 carry_esc = s->carry_esc, carry_str = s->carry_str;
+		uint depth = s->depth;
+		const byte *d = (byte*)data->ptr + s->off;
+		if (n < 64) {
+			// the last block is padded with whitespace
+			ffmem_fill(blk, ' ', sizeof(blk));
+			ffmem_copy(blk, d, n);
+			d = blk;
+		}
+
+		blk_masks(d, &m);
+		uint64 escaped = escaped_mask(m.bs, &s->carry_esc);
+		uint64 quote = m.quote & ~escaped;
+		uint64 in_str = prefix_xor(quote) ^ s->carry_str;
+		s->carry_str = (uint64)((int64)in_str >> 63);
+		uint64 st = (m.op | m.nl) & ~in_str;
+
+		for (;  st != 0;  st &= st - 1) {
+			size_t i = s->off + ffbit_ffs64(st) - 1;
+			int ch = data->ptr[i];
+
+			switch (ch) {
+			case '{':
+			case '[':
+				if (arr && s->depth == 0) {
+					ffstr_set(rec, data->ptr, i);
+					split_trim(rec);
+					if (ch != '[' || rec->len != 0)
+						return FFPARS_EBADCHAR; //not an array
+					// the records begin after '['
+					split_rec(s, data, rec, 0, i + 1);
+					s->depth = 1;
+					s->nrec = 0;
+					goto next;
+				}
+				s->depth++;
+				break;
+
+			case '}':
+			case ']':
+				if (s->depth == 0)
+					return FFPARS_EBADBRACE;
+				if (--s->depth == 0 && arr) {
+					if (ch != ']')
+						return FFPARS_EBADBRACE;
+					split_rec(s, data, rec, i, i + 1);
+					if (rec->len == 0) {
+						if (s->nrec == 0)
+							goto next; //empty array
+						return FFPARS_ENOVAL;
+					}
+					s->nrec++;
+					return FFPARS_VAL;
+				}
+				break;
+
+			case ',':
+				if (arr && s->depth == 1) {
+					split_rec(s, data, rec, i, i + 1);
+					if (rec->len == 0)
+						return FFPARS_ENOVAL;
+					s->nrec++;
+					return FFPARS_VAL;
+				}
+				break;
+
+			case '\n':
+				if (!arr && s->depth == 0) {
+					split_rec(s, data, rec, i, i + 1);
+					if (rec->len == 0)
+						goto next; //empty line
+					return FFPARS_VAL;
+				}
+				break;
+			}
+		}
+
+		if (n < 64 && !fin) {
+			// the incomplete block will be scanned again with more data
+			s->carry_esc = carry_esc;
+			s->carry_str = carry_str;
+			s->depth = depth;
+			break;
+		}
+		s->off += ffmin(n, 64);
+	}
+
+	if (!fin)
+		return FFPARS_MORE;
+
+	// end of input: the rest of data is the last record
+	if (arr) {
+		ffstr_set2(rec, data);
+		split_trim(rec);
+		if (s->depth != 0)
+			return FFPARS_ENOBRACE;
+		if (rec->len != 0)
+			return FFPARS_EBADCHAR;
+		return FFPARS_MORE;
+	}
+
+	split_rec(s, data, rec, data->len, data->len);
+	if (rec->len == 0)
+		return FFPARS_MORE;
+	s->depth = 0;
+	return FFPARS_VAL;
+}
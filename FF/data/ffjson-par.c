@@ -0,0 +1,268 @@
+/** Parallel decoding of JSON records.
+Copyright (c) 2020 Simon Zolin
+*/
+
+#include <FF/data/json-par.h>
+#include <FFOS/semaphore.h>
+#include <FFOS/atomic.h>
+#include <FFOS/error.h>
+
+
+struct prun;
+
+/** Chunk being processed. */
+struct pslot {
+	struct prun *pr;
+	ffthpool_task *task;
+	ffjson js;
+	ffparser_schem ps;
+	ffjson_pchunk c;
+	uint done; //set by the worker
+};
+
+struct prun {
+	const ffjson_pconf *conf;
+	ffsem sem; //signalled by a worker after a chunk is processed
+	struct pslot *slots;
+};
+
+/** Parse one record.
+The memory of the parser and the scheme is reused for every record. */
+static int prec_parse(struct pslot *s, const ffjson_pconf *conf, const ffstr *rec)
+{
+	int r = FFPARS_MORE;
+	ffstr d = *rec;
+	ffpars_ctx *ctxs = s->ps.ctxs.ptr;
+	size_t cap = s->ps.ctxs.cap;
+
+	ffjson_parsereset(&s->js);
+	ffstr_free(&s->ps.vals[0]);
+	ffpars_scheminit(&s->ps, &s->js, conf->top);
+	s->ps.ctxs.ptr = ctxs;
+	s->ps.ctxs.cap = cap;
+	s->ps.udata = s->c.obj;
+	s->ps.flags |= _FFPARS_SCOBJ | conf->schem_flags;
+
+	while (d.len != 0) {
+		ffjson_parsestr(&s->js, &d);
+		r = ffjson_schemrun(&s->ps);
+		if (ffpars_iserr(r))
+			return r;
+	}
+
+	if (r == FFPARS_MORE) {
+		// a bare value ends with the record
+		size_t n = 1;
+		ffjson_parse(&s->js, "", &n);
+		r = ffjson_schemrun(&s->ps);
+		if (ffpars_iserr(r))
+			return r;
+	}
+
+	return ffjson_schemfin(&s->ps);
+}
+
+/** Parse all records of the chunk.  Called within thread pool's worker. */
+static void pchunk_parse(ffthpool_task *t)
+{
+	struct pslot *s = t->udata;
+	const ffjson_pconf *conf = s->pr->conf;
+	ffjson_split sp;
+	ffstr d = s->c.data, rec;
+	int r;
+
+	s->c.nrecs = 0;
+	s->c.err = 0;
+	ffstr_null(&s->c.errrec);
+	if (conf->chunk_begin != NULL)
+		conf->chunk_begin(s->c.obj);
+
+	/* The chunk consists of whole records with their delimiters.
+	FFJSON_SPLIT_ARRAY: the chunk begins inside the top-level array. */
+	ffjson_split_init(&sp, conf->flags);
+	if (conf->flags & FFJSON_SPLIT_ARRAY) {
+		sp.depth = 1;
+		sp.nrec = 1;
+	}
+
+	while (d.len != 0) {
+		r = ffjson_split_next(&sp, &d, &rec, 1);
+		if (r == FFPARS_MORE)
+			break;
+		if (r != FFPARS_VAL) {
+			s->c.err = r;
+			s->c.errrec = d;
+			break;
+		}
+
+		if (0 != (r = prec_parse(s, conf, &rec))) {
+			s->c.err = r;
+			s->c.errrec = rec;
+			break;
+		}
+		s->c.nrecs++;
+	}
+
+	ffatom_fence_rel(); // the results are visible before the flag
+	FF_WRITEONCE(s->done, 1);
+	ffsem_post(s->pr->sem);
+}
+
+/** NDJSON: get the next chunk of whole lines, at least 'size' bytes long.
+The records aren't scanned:  the chunk ends with the first newline after 'size' bytes.
+Return 0 if there's no more data. */
+static int pchunk_next_lines(ffstr *d, size_t size, ffstr *chunk)
+{
+	const char *p = ffs_skipof(d->ptr, d->len, " \t\r\n", 4);
+	ffstr_shift(d, p - d->ptr);
+	if (d->len == 0)
+		return 0;
+
+	size_t n = d->len;
+	if (size < d->len
+		&& NULL != (p = ffs_findc(d->ptr + size, d->len - size, '\n')))
+		n = p + 1 - d->ptr;
+	ffstr_set(chunk, d->ptr, n);
+	ffstr_shift(d, n);
+	return 1;
+}
+
+/** FFJSON_SPLIT_ARRAY: get the next chunk of whole records, at least 'size' bytes long.
+Return 0 if there's no more data. */
+static int pchunk_next(ffjson_split *sp, ffstr *d, size_t size, ffstr *chunk, int *err)
+{
+	ffstr rec;
+	const char *start = NULL;
+
+	for (;;) {
+		int r = ffjson_split_next(sp, d, &rec, 1);
+		if (r != FFPARS_VAL) {
+			if (r != FFPARS_MORE)
+				*err = r;
+			break;
+		}
+		if (start == NULL)
+			start = rec.ptr;
+		if ((size_t)(d->ptr - start) >= size)
+			break;
+	}
+
+	if (start == NULL || *err != 0)
+		return 0;
+	ffstr_set(chunk, start, d->ptr - start);
+	return 1;
+}
+
+int ffjson_prun(const ffjson_pconf *conf, const char *data, size_t len)
+{
+	struct prun pr = {};
+	struct pslot *s;
+	ffjson_split sp;
+	ffstr d;
+	uint64 nsub = 0, ndone = 0, nwait = 0;
+	int stop = 0, err = 0, eof = 0, retry = 0;
+	uint n = conf->nslots;
+	size_t chunk_size = (conf->chunk_size != 0) ? conf->chunk_size : FFJSON_PCHUNK;
+
+	FF_ASSERT(n != 0);
+	pr.conf = conf;
+	if (FFSEM_INV == (pr.sem = ffsem_open(NULL, 0, 0)))
+		return FFPARS_ESYS;
+	if (NULL == (pr.slots = ffmem_callocT(n, struct pslot))) {
+		err = FFPARS_ESYS;
+		goto end;
+	}
+
+	for (uint i = 0;  i != n;  i++) {
+		s = &pr.slots[i];
+		if (NULL == (s->task = ffthpool_task_new(0))) {
+			err = FFPARS_ESYS;
+			goto end;
+		}
+		s->task->handler = &pchunk_parse;
+		s->task->udata = s;
+		s->pr = &pr;
+		s->c.obj = conf->objs[i];
+		ffjson_parseinit(&s->js);
+		if (conf->schem_flags & FFPARS_INSITU)
+			s->js.flags |= FFJSON_PINSITU;
+	}
+
+	ffjson_split_init(&sp, conf->flags);
+	ffstr_set(&d, data, len);
+
+	for (;;) {
+		// fill the free slots
+		while (!eof && nsub - ndone != n) {
+			s = &pr.slots[nsub % n];
+			if (!retry) {
+				int r = (conf->flags & FFJSON_SPLIT_ARRAY)
+					? pchunk_next(&sp, &d, chunk_size, &s->c.data, &err)
+					: pchunk_next_lines(&d, chunk_size, &s->c.data);
+				if (!r) {
+					eof = 1;
+					break;
+				}
+				s->c.index = nsub;
+				s->done = 0;
+			}
+			retry = 0;
+
+			if (0 != ffthpool_add(conf->thpool, s->task)) {
+				if (fferr_last() != EOVERFLOW) {
+					err = FFPARS_ESYS;
+					eof = 1;
+					break;
+				}
+				if (nsub != ndone) {
+					// the queue is full:  submit the chunk again after the next chunk is processed
+					retry = 1;
+					break;
+				}
+				pchunk_parse(s->task); // the queue is filled by other users:  parse in this thread
+			}
+			nsub++;
+		}
+
+		if (ndone == nsub)
+			break;
+
+		// deliver the next chunk in input order
+		s = &pr.slots[ndone % n];
+		while (!FF_READONCE(s->done)) {
+			ffsem_wait(pr.sem, -1);
+			nwait++;
+		}
+		ffatom_fence_acq();
+		ndone++;
+
+		if (stop == 0) {
+			int r = conf->chunk_done(conf->udata, &s->c);
+			if (r != 0)
+				stop = r;
+			else if (s->c.err != 0)
+				stop = s->c.err;
+			if (stop != 0)
+				eof = 1; // wait for the chunks being processed
+		}
+	}
+
+end:
+	// every worker has posted the semaphore
+	while (nwait != nsub) {
+		ffsem_wait(pr.sem, -1);
+		nwait++;
+	}
+
+	if (pr.slots != NULL) {
+		for (uint i = 0;  i != n;  i++) {
+			s = &pr.slots[i];
+			ffthpool_task_free(s->task);
+			ffjson_parseclose(&s->js);
+			ffpars_schemfree(&s->ps);
+		}
+		ffmem_free(pr.slots);
+	}
+	ffsem_close(pr.sem);
+	return (stop != 0) ? stop : err;
+}
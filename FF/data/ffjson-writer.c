@@ -0,0 +1,749 @@
+/** JSON fast writer.
+Copyright (c) 2020 Simon Zolin
+*/
+
+#include <FF/data/json.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/*
+Data is appended to the current chunk while it has enough space for a token.
+Strings are split into the parts which don't need escaping (found with ffjson_escape_skip())
+ and escape sequences;  a large part is either copied across several chunks
+ or, with FFJSON_WR_REF, added to the output as a separate ffiovec.
+*/
+
+enum {
+	WR_MINCHUNK = 256,
+	WR_MAXTOKEN = 32, //max. size of a token written at once (number, separators)
+};
+
+enum WR_ST {
+	WR_COMMA = 1, //',' must precede the next element
+	WR_KEY = 2, //a key is expected
+	WR_ERR = 4,
+};
+
+void ffjson_wr_init(ffjson_wr *w, size_t chunk_size, uint flags)
+{
+	ffmem_tzero(w);
+	w->flags = flags;
+	w->chunk_cap = (chunk_size == 0) ? FFJSON_WR_CHUNK : ffmax(chunk_size, WR_MINCHUNK);
+}
+
+void ffjson_wr_close(ffjson_wr *w)
+{
+	char **c;
+	FFARR_WALKT(&w->chunks, c, char*) {
+		ffmem_free(*c);
+	}
+	ffarr_free(&w->chunks);
+	ffarr_free(&w->iov);
+	ffarr_free(&w->ctxs);
+}
+
+void ffjson_wr_reset(ffjson_wr *w)
+{
+	w->st = 0;
+	w->seg = w->ptr = w->end = NULL;
+	w->nchunks_used = 0;
+	w->iov.len = 0;
+	w->total = 0;
+	w->ctxs.len = 0;
+}
+
+/** Add the data written into the current chunk to the output. */
+static int wr_flush(ffjson_wr *w)
+{
+	if (w->ptr == w->seg)
+		return 0;
+	ffiovec *iov = ffarr_push(&w->iov, ffiovec);
+	if (iov == NULL)
+		return -1;
+	ffiov_set(iov, w->seg, w->ptr - w->seg);
+	w->seg = w->ptr;
+	return 0;
+}
+
+/** Switch to the next chunk;  reuse the chunks allocated before reset. */
+static int wr_nextchunk(ffjson_wr *w)
+{
+	char *c;
+
+	if (0 != wr_flush(w))
+		return -1;
+
+	if (w->nchunks_used != w->chunks.len) {
+		c = ((char**)w->chunks.ptr)[w->nchunks_used];
+
+	} else {
+		char **pc;
+		if (NULL == (c = ffmem_alloc(w->chunk_cap)))
+			return -1;
+		if (NULL == (pc = ffarr_push(&w->chunks, char*))) {
+			ffmem_free(c);
+			return -1;
+		}
+		*pc = c;
+	}
+
+	w->nchunks_used++;
+	w->seg = w->ptr = c;
+	w->end = c + w->chunk_cap;
+	return 0;
+}
+
+/** Get free space for 'n' bytes (n <= WR_MAXTOKEN). */
+static FFINL char* wr_reserve(ffjson_wr *w, size_t n)
+{
+	if ((size_t)(w->end - w->ptr) < n
+		&& 0 != wr_nextchunk(w))
+		return NULL;
+	return w->ptr;
+}
+
+static FFINL void wr_commit(ffjson_wr *w, char *d)
+{
+	w->total += d - w->ptr;
+	w->ptr = d;
+}
+
+static int wr_copy(ffjson_wr *w, const char *s, size_t len)
+{
+	while (len != 0) {
+		if (w->ptr == w->end
+			&& 0 != wr_nextchunk(w))
+			return -1;
+		size_t n = ffmin(len, (size_t)(w->end - w->ptr));
+		ffmem_copy(w->ptr, s, n);
+		w->ptr += n;
+		w->total += n;
+		s += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int wr_ref(ffjson_wr *w, const char *s, size_t len)
+{
+	if (0 != wr_flush(w))
+		return -1;
+	ffiovec *iov = ffarr_push(&w->iov, ffiovec);
+	if (iov == NULL)
+		return -1;
+	ffiov_set(iov, s, len);
+	w->total += len;
+	return 0;
+}
+
+/** Write quoted string. */
+static int wr_qstr(ffjson_wr *w, const char *s, size_t len)
+{
+	char *d;
+	size_t n;
+
+	if (NULL == (d = wr_reserve(w, 1)))
+		return -1;
+	*d++ = '"';
+	wr_commit(w, d);
+
+	for (;;) {
+		n = ffjson_escape_skip(s, len);
+		if ((w->flags & FFJSON_WR_REF) && n >= FFJSON_WR_REFMIN) {
+			if (0 != wr_ref(w, s, n))
+				return -1;
+		} else if (0 != wr_copy(w, s, n))
+			return -1;
+		s += n;
+		len -= n;
+		if (len == 0)
+			break;
+
+		if (NULL == (d = wr_reserve(w, FFSLEN("\\uXXXX"))))
+			return -1;
+		n = ffjson_escape(d, FFSLEN("\\uXXXX"), s, 1);
+		wr_commit(w, d + n);
+		s++;
+		len--;
+	}
+
+	if (NULL == (d = wr_reserve(w, 1)))
+		return -1;
+	*d++ = '"';
+	wr_commit(w, d);
+	return 0;
+}
+
+static const char wr_digits[200] =
+	"00010203040506070809" "10111213141516171819" "20212223242526272829"
+	"30313233343536373839" "40414243444546474849" "50515253545556575859"
+	"60616263646566676869" "70717273747576777879" "80818283848586878889"
+	"90919293949596979899";
+
+/** Convert integer to decimal text: 2 digits per step.
+Return the number of bytes written (max. 20). */
+static uint wr_fromint(char *dst, int64 val)
+{
+	char buf[20], *p = buf + sizeof(buf);
+	uint64 u = (uint64)val;
+	uint n;
+
+	if (val < 0)
+		u = -u;
+
+	while (u >= 100) {
+		uint i = (u % 100) * 2;
+		u /= 100;
+		p -= 2;
+		p[0] = wr_digits[i];
+		p[1] = wr_digits[i + 1];
+	}
+	if (u >= 10) {
+		p -= 2;
+		p[0] = wr_digits[u * 2];
+		p[1] = wr_digits[u * 2 + 1];
+	} else
+		*--p = '0' + u;
+
+	n = 0;
+	if (val < 0)
+		dst[n++] = '-';
+	ffmem_copy(dst + n, p, buf + sizeof(buf) - p);
+	return n + buf + sizeof(buf) - p;
+}
+
+/*
+Shortest round-trip conversion of double: Grisu3
+ (F. Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with Integers", 2010).
+The value and its rounding boundaries are scaled by a cached power of 10
+ so that the digits are generated with 64-bit integer arithmetic.
+For ~0.5% of values the digits can't be proven to be the shortest and the closest:
+ these are converted by snprintf() with increasing precision.
+*/
+
+typedef struct wr_fp {
+	uint64 f;
+	int e; // value = f * 2^e
+} wr_fp;
+
+enum {
+	GRISU_ALPHA = -60, // binary exponent range of the scaled value
+	GRISU_POW10_MIN = -348,
+	GRISU_POW10_STEP = 8,
+};
+
+/** 10^k = f * 2^e, k = -348..340 with step 8 */
+static const struct {
+	uint64 f;
+	short e, k;
+} grisu_pow10[] = {
+	{ 0xfa8fd5a0081c0288ULL, -1220, -348 },  { 0xbaaee17fa23ebf76ULL, -1193, -340 },
+	{ 0x8b16fb203055ac76ULL, -1166, -332 },  { 0xcf42894a5dce35eaULL, -1140, -324 },
+	{ 0x9a6bb0aa55653b2dULL, -1113, -316 },  { 0xe61acf033d1a45dfULL, -1087, -308 },
+	{ 0xab70fe17c79ac6caULL, -1060, -300 },  { 0xff77b1fcbebcdc4fULL, -1034, -292 },
+	{ 0xbe5691ef416bd60cULL, -1007, -284 },  { 0x8dd01fad907ffc3cULL, -980, -276 },
+	{ 0xd3515c2831559a83ULL, -954, -268 },  { 0x9d71ac8fada6c9b5ULL, -927, -260 },
+	{ 0xea9c227723ee8bcbULL, -901, -252 },  { 0xaecc49914078536dULL, -874, -244 },
+	{ 0x823c12795db6ce57ULL, -847, -236 },  { 0xc21094364dfb5637ULL, -821, -228 },
+	{ 0x9096ea6f3848984fULL, -794, -220 },  { 0xd77485cb25823ac7ULL, -768, -212 },
+	{ 0xa086cfcd97bf97f4ULL, -741, -204 },  { 0xef340a98172aace5ULL, -715, -196 },
+	{ 0xb23867fb2a35b28eULL, -688, -188 },  { 0x84c8d4dfd2c63f3bULL, -661, -180 },
+	{ 0xc5dd44271ad3cdbaULL, -635, -172 },  { 0x936b9fcebb25c996ULL, -608, -164 },
+	{ 0xdbac6c247d62a584ULL, -582, -156 },  { 0xa3ab66580d5fdaf6ULL, -555, -148 },
+	{ 0xf3e2f893dec3f126ULL, -529, -140 },  { 0xb5b5ada8aaff80b8ULL, -502, -132 },
+	{ 0x87625f056c7c4a8bULL, -475, -124 },  { 0xc9bcff6034c13053ULL, -449, -116 },
+	{ 0x964e858c91ba2655ULL, -422, -108 },  { 0xdff9772470297ebdULL, -396, -100 },
+	{ 0xa6dfbd9fb8e5b88fULL, -369, -92 },  { 0xf8a95fcf88747d94ULL, -343, -84 },
+	{ 0xb94470938fa89bcfULL, -316, -76 },  { 0x8a08f0f8bf0f156bULL, -289, -68 },
+	{ 0xcdb02555653131b6ULL, -263, -60 },  { 0x993fe2c6d07b7facULL, -236, -52 },
+	{ 0xe45c10c42a2b3b06ULL, -210, -44 },  { 0xaa242499697392d3ULL, -183, -36 },
+	{ 0xfd87b5f28300ca0eULL, -157, -28 },  { 0xbce5086492111aebULL, -130, -20 },
+	{ 0x8cbccc096f5088ccULL, -103, -12 },  { 0xd1b71758e219652cULL, -77, -4 },
+	{ 0x9c40000000000000ULL, -50, 4 },  { 0xe8d4a51000000000ULL, -24, 12 },
+	{ 0xad78ebc5ac620000ULL, 3, 20 },  { 0x813f3978f8940984ULL, 30, 28 },
+	{ 0xc097ce7bc90715b3ULL, 56, 36 },  { 0x8f7e32ce7bea5c70ULL, 83, 44 },
+	{ 0xd5d238a4abe98068ULL, 109, 52 },  { 0x9f4f2726179a2245ULL, 136, 60 },
+	{ 0xed63a231d4c4fb27ULL, 162, 68 },  { 0xb0de65388cc8ada8ULL, 189, 76 },
+	{ 0x83c7088e1aab65dbULL, 216, 84 },  { 0xc45d1df942711d9aULL, 242, 92 },
+	{ 0x924d692ca61be758ULL, 269, 100 },  { 0xda01ee641a708deaULL, 295, 108 },
+	{ 0xa26da3999aef774aULL, 322, 116 },  { 0xf209787bb47d6b85ULL, 348, 124 },
+	{ 0xb454e4a179dd1877ULL, 375, 132 },  { 0x865b86925b9bc5c2ULL, 402, 140 },
+	{ 0xc83553c5c8965d3dULL, 428, 148 },  { 0x952ab45cfa97a0b3ULL, 455, 156 },
+	{ 0xde469fbd99a05fe3ULL, 481, 164 },  { 0xa59bc234db398c25ULL, 508, 172 },
+	{ 0xf6c69a72a3989f5cULL, 534, 180 },  { 0xb7dcbf5354e9beceULL, 561, 188 },
+	{ 0x88fcf317f22241e2ULL, 588, 196 },  { 0xcc20ce9bd35c78a5ULL, 614, 204 },
+	{ 0x98165af37b2153dfULL, 641, 212 },  { 0xe2a0b5dc971f303aULL, 667, 220 },
+	{ 0xa8d9d1535ce3b396ULL, 694, 228 },  { 0xfb9b7cd9a4a7443cULL, 720, 236 },
+	{ 0xbb764c4ca7a44410ULL, 747, 244 },  { 0x8bab8eefb6409c1aULL, 774, 252 },
+	{ 0xd01fef10a657842cULL, 800, 260 },  { 0x9b10a4e5e9913129ULL, 827, 268 },
+	{ 0xe7109bfba19c0c9dULL, 853, 276 },  { 0xac2820d9623bf429ULL, 880, 284 },
+	{ 0x80444b5e7aa7cf85ULL, 907, 292 },  { 0xbf21e44003acdd2dULL, 933, 300 },
+	{ 0x8e679c2f5e44ff8fULL, 960, 308 },  { 0xd433179d9c8cb841ULL, 986, 316 },
+	{ 0x9e19db92b4e31ba9ULL, 1013, 324 },  { 0xeb96bf6ebadf77d9ULL, 1039, 332 },
+	{ 0xaf87023b9bf0ee6bULL, 1066, 340 },
+};
+
+static const uint grisu_pow10_32[] = {
+	1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+};
+
+static FFINL wr_fp fp_norm(wr_fp x)
+{
+	while (!(x.f & 0xffc0000000000000ULL)) {
+		x.f <<= 10;
+		x.e -= 10;
+	}
+	while (!(x.f & 0x8000000000000000ULL)) {
+		x.f <<= 1;
+		x.e--;
+	}
+	return x;
+}
+
+/** Upper 64 bits of the 128-bit product, rounded */
+static FFINL wr_fp fp_mul(wr_fp x, wr_fp y)
+{
+	uint64 a = x.f >> 32, b = x.f & 0xffffffff
+		, c = y.f >> 32, d = y.f & 0xffffffff;
+	uint64 ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64 mid = (bd >> 32) + (ad & 0xffffffff) + (bc & 0xffffffff) + (1U << 31);
+	wr_fp r;
+	r.f = ac + (ad >> 32) + (bc >> 32) + (mid >> 32);
+	r.e = x.e + y.e + 64;
+	return r;
+}
+
+/** Find the cached power of 10 which brings the binary exponent of a normalized value
+ from 'e' into [ALPHA..ALPHA+27].
+Return decimal exponent. */
+static FFINL int grisu_cached_pow(int e, wr_fp *c)
+{
+	// k = ceil((ALPHA - e - 1) * log10(2));  exact for |ALPHA - e - 1| < 1651
+	int k = ((GRISU_ALPHA - e - 1) * 78913 + (1 << 18) - 1) >> 18;
+	int i = (k - GRISU_POW10_MIN - 1) / GRISU_POW10_STEP + 1;
+	c->f = grisu_pow10[i].f;
+	c->e = grisu_pow10[i].e;
+	return grisu_pow10[i].k;
+}
+
+/** Move the last digit closer to the value while it stays inside the safe interval.
+Return 0 if the result can't be proven correct. */
+static int grisu_round_weed(char *buf, uint n, uint64 dist_high_w, uint64 delta, uint64 rest, uint64 ten_kappa, uint64 unit)
+{
+	uint64 up = dist_high_w - unit, down = dist_high_w + unit;
+
+	while (rest < up && delta - rest >= ten_kappa
+		&& (rest + ten_kappa < up || up - rest >= rest + ten_kappa - up)) {
+		buf[n - 1]--;
+		rest += ten_kappa;
+	}
+
+	if (rest < down && delta - rest >= ten_kappa
+		&& (rest + ten_kappa < down || down - rest > rest + ten_kappa - down))
+		return 0;
+
+	return 2 * unit <= rest && rest <= delta - 4 * unit;
+}
+
+/** Generate the shortest digits of w within the interval (low, high).
+Return the number of digits;  0 on failure. */
+static uint grisu_digits(wr_fp low, wr_fp w, wr_fp high, char *buf, int *kappa)
+{
+	uint64 unit = 1;
+	wr_fp too_low = { low.f - unit, low.e }, too_high = { high.f + unit, high.e };
+	uint64 unsafe = too_high.f - too_low.f;
+	uint shift = -w.e;
+	uint64 one = 1ULL << shift;
+	uint p1 = (uint)(too_high.f >> shift);
+	uint64 p2 = too_high.f & (one - 1);
+	uint n = 0, div;
+
+	// the number of decimal digits in p1
+	int k = ((64 - shift + 1) * 1233 >> 12);
+	if (p1 < grisu_pow10_32[k])
+		k--;
+	div = grisu_pow10_32[k];
+	*kappa = k + 1;
+
+	while (*kappa > 0) {
+		buf[n++] = '0' + p1 / div;
+		p1 %= div;
+		(*kappa)--;
+		uint64 rest = ((uint64)p1 << shift) + p2;
+		if (rest < unsafe)
+			return grisu_round_weed(buf, n, too_high.f - w.f, unsafe, rest, (uint64)div << shift, unit) ? n : 0;
+		div /= 10;
+	}
+
+	for (;;) {
+		p2 *= 10;
+		unit *= 10;
+		unsafe *= 10;
+		buf[n++] = '0' + (uint)(p2 >> shift);
+		p2 &= one - 1;
+		(*kappa)--;
+		if (p2 < unsafe)
+			return grisu_round_weed(buf, n, (too_high.f - w.f) * unit, unsafe, p2, one, unit) ? n : 0;
+	}
+}
+
+/** Get the shortest digits of a positive finite number.
+exp10: decimal exponent of the last digit
+Return the number of digits (max. 17);  0 if Grisu3 failed. */
+static uint grisu3(double v, char *buf, int *exp10)
+{
+	union { double d; uint64 u; } u;
+	u.d = v;
+	uint64 fract = u.u & 0x000fffffffffffffULL;
+	uint bexp = (u.u >> 52) & 0x7ff;
+	wr_fp d, w, plus, minus, c;
+
+	if (bexp == 0) {
+		d.f = fract;
+		d.e = 1 - 1075;
+	} else {
+		d.f = fract | 0x0010000000000000ULL;
+		d.e = (int)bexp - 1075;
+	}
+	w = fp_norm(d);
+
+	// boundaries: half-way to the neighbours
+	plus.f = (d.f << 1) + 1;
+	plus.e = d.e - 1;
+	plus = fp_norm(plus);
+	if (fract == 0 && bexp > 1) {
+		minus.f = (d.f << 2) - 1; // the lower neighbour is closer
+		minus.e = d.e - 2;
+	} else {
+		minus.f = (d.f << 1) - 1;
+		minus.e = d.e - 1;
+	}
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+
+	int mk = grisu_cached_pow(w.e, &c);
+	w = fp_mul(w, c);
+	minus = fp_mul(minus, c);
+	plus = fp_mul(plus, c);
+
+	int kappa;
+	uint n = grisu_digits(minus, w, plus, buf, &kappa);
+	*exp10 = kappa - mk;
+	return n;
+}
+
+/** Get digits of "D[.DDD]e[+-]EXP" (decimal point may depend on locale).
+exp10: decimal exponent of the last digit */
+static uint wr_float_sci(const char *s, char *buf, int *exp10)
+{
+	uint n = 0;
+	for (;  *s != 'e';  s++) {
+		if (*s >= '0' && *s <= '9')
+			buf[n++] = *s;
+	}
+	*exp10 = (int)strtol(s + 1, NULL, 10) - (int)(n - 1);
+	return n;
+}
+
+/** Get the shortest digits with snprintf(): the first precision at which
+ the correctly rounded value or its neighbour on the other side survives the round-trip. */
+static uint wr_float_digits_libc(double v, char *buf, int *exp10)
+{
+	char s[WR_MAXTOKEN];
+	uint n;
+
+	for (uint prec = 0;  ;  prec++) {
+		snprintf(s, sizeof(s), "%.*e", prec, v);
+		double r = strtod(s, NULL);
+		n = wr_float_sci(s, buf, exp10);
+		if (r == v || prec == 16)
+			break;
+
+		uint64 m = 0;
+		for (uint i = 0;  i != n;  i++) {
+			m = m * 10 + buf[i] - '0';
+		}
+		m = (r < v) ? m + 1 : m - 1;
+		snprintf(s, sizeof(s), "%llue%d", (unsigned long long)m, *exp10);
+		if (strtod(s, NULL) == v) {
+			n = wr_fromint(buf, m);
+			break;
+		}
+	}
+
+	while (n > 1 && buf[n - 1] == '0') {
+		n--;
+		(*exp10)++;
+	}
+	return n;
+}
+
+/** Write digits*10^exp10 as a number: fixed-point notation if the decimal point is near,
+ otherwise exponential notation (as JavaScript Number.toString()).
+Return the number of bytes written (max. 24). */
+static uint wr_fmtdigits(char *dst, const char *digits, uint n, int exp10)
+{
+	int pt = n + exp10; // position of the decimal point
+	char *d = dst;
+
+	if ((int)n <= pt && pt <= 21) {
+		// DDD000
+		ffmem_copy(d, digits, n);
+		d += n;
+		ffmem_fill(d, '0', pt - n);
+		d += pt - n;
+
+	} else if (0 < pt && pt <= 21) {
+		// DD.DD
+		ffmem_copy(d, digits, pt);
+		d += pt;
+		*d++ = '.';
+		ffmem_copy(d, digits + pt, n - pt);
+		d += n - pt;
+
+	} else if (-6 < pt && pt <= 0) {
+		// 0.00DD
+		*d++ = '0';
+		*d++ = '.';
+		ffmem_fill(d, '0', -pt);
+		d += -pt;
+		ffmem_copy(d, digits, n);
+		d += n;
+
+	} else {
+		// D.DDe+XX
+		*d++ = digits[0];
+		if (n != 1) {
+			*d++ = '.';
+			ffmem_copy(d, digits + 1, n - 1);
+			d += n - 1;
+		}
+		*d++ = 'e';
+		int e = pt - 1;
+		*d++ = (e < 0) ? '-' : '+';
+		d += wr_fromint(d, (e < 0) ? -e : e);
+	}
+
+	return d - dst;
+}
+
+/** Convert float to the shortest text which is parsed back to the same value.
+Integer values are converted as integers;  otherwise Grisu3 is used with a fallback to libc.
+Return the number of bytes written (max. 25);  0 if NaN or infinity. */
+static uint wr_fromfloat(char *dst, double val)
+{
+	char digits[20];
+	int exp10;
+	uint n, i = 0;
+
+	if (!isfinite(val))
+		return 0;
+
+	// check the range first:  the conversion to int64 is undefined for |val| >= 2^63
+	if (fabs(val) < 9007199254740992.0 /*2^53*/
+		&& val == (double)(int64)val
+		&& !(val == 0 && signbit(val)))
+		return wr_fromint(dst, (int64)val);
+
+	if (signbit(val)) {
+		dst[i++] = '-';
+		val = -val;
+	}
+
+	if (val == 0) {
+		dst[i++] = '0';
+		return i;
+	}
+
+	if (0 == (n = grisu3(val, digits, &exp10)))
+		n = wr_float_digits_libc(val, digits, &exp10);
+
+	return i + wr_fmtdigits(dst + i, digits, n, exp10);
+}
+
+/** Write separators before a value. */
+static int wr_valbegin(ffjson_wr *w)
+{
+	char *d;
+
+	if (w->st & (WR_KEY | WR_ERR))
+		goto err;
+
+	if (w->st & WR_COMMA) {
+		if (NULL == (d = wr_reserve(w, 1)))
+			goto err;
+		*d++ = (w->ctxs.len != 0) ? ',' : '\n';
+		wr_commit(w, d);
+	}
+	return 0;
+
+err:
+	w->st |= WR_ERR;
+	return -1;
+}
+
+static void wr_valend(ffjson_wr *w)
+{
+	w->st = WR_COMMA;
+	if (w->ctxs.len != 0 && ffarr_back(&w->ctxs) == FFJSON_TOBJ)
+		w->st |= WR_KEY;
+}
+
+static int wr_ctx(ffjson_wr *w, uint type)
+{
+	char *d;
+	if (0 != wr_valbegin(w))
+		return FFJSON_ERR;
+
+	byte *ctx = ffarr_push(&w->ctxs, byte);
+	if (ctx == NULL
+		|| NULL == (d = wr_reserve(w, 1)))
+		goto err;
+	*ctx = type;
+	*d++ = (type == FFJSON_TOBJ) ? '{' : '[';
+	wr_commit(w, d);
+	w->st = (type == FFJSON_TOBJ) ? WR_KEY : 0;
+	return FFJSON_OK;
+
+err:
+	w->st |= WR_ERR;
+	return FFJSON_ERR;
+}
+
+int ffjson_wr_obj(ffjson_wr *w)
+{
+	return wr_ctx(w, FFJSON_TOBJ);
+}
+
+int ffjson_wr_arr(ffjson_wr *w)
+{
+	return wr_ctx(w, FFJSON_TARR);
+}
+
+int ffjson_wr_end(ffjson_wr *w)
+{
+	char *d;
+	if ((w->st & WR_ERR) || w->ctxs.len == 0)
+		goto err;
+
+	uint type = ffarr_back(&w->ctxs);
+	if (type == FFJSON_TOBJ && !(w->st & WR_KEY))
+		goto err; //value is expected after the key
+
+	if (NULL == (d = wr_reserve(w, 1)))
+		goto err;
+	*d++ = (type == FFJSON_TOBJ) ? '}' : ']';
+	wr_commit(w, d);
+	w->ctxs.len--;
+	wr_valend(w);
+	return FFJSON_OK;
+
+err:
+	w->st |= WR_ERR;
+	return FFJSON_ERR;
+}
+
+int ffjson_wr_key(ffjson_wr *w, const char *s, size_t len)
+{
+	char *d;
+	if ((w->st & (WR_KEY | WR_ERR)) != WR_KEY)
+		goto err;
+
+	if (w->st & WR_COMMA) {
+		if (NULL == (d = wr_reserve(w, 1)))
+			goto err;
+		*d++ = ',';
+		wr_commit(w, d);
+	}
+
+	if (0 != wr_qstr(w, s, len)
+		|| NULL == (d = wr_reserve(w, 1)))
+		goto err;
+	*d++ = ':';
+	wr_commit(w, d);
+	w->st = 0;
+	return FFJSON_OK;
+
+err:
+	w->st |= WR_ERR;
+	return FFJSON_ERR;
+}
+
+int ffjson_wr_str(ffjson_wr *w, const char *s, size_t len)
+{
+	if (0 != wr_valbegin(w))
+		return FFJSON_ERR;
+	if (0 != wr_qstr(w, s, len)) {
+		w->st |= WR_ERR;
+		return FFJSON_ERR;
+	}
+	wr_valend(w);
+	return FFJSON_OK;
+}
+
+int ffjson_wr_int(ffjson_wr *w, int64 val)
+{
+	char *d;
+	if (0 != wr_valbegin(w))
+		return FFJSON_ERR;
+	if (NULL == (d = wr_reserve(w, WR_MAXTOKEN))) {
+		w->st |= WR_ERR;
+		return FFJSON_ERR;
+	}
+	wr_commit(w, d + wr_fromint(d, val));
+	wr_valend(w);
+	return FFJSON_OK;
+}
+
+int ffjson_wr_float(ffjson_wr *w, double val)
+{
+	char *d;
+	uint n;
+	if (0 != wr_valbegin(w))
+		return FFJSON_ERR;
+	if (NULL == (d = wr_reserve(w, WR_MAXTOKEN))
+		|| 0 == (n = wr_fromfloat(d, val))) {
+		w->st |= WR_ERR;
+		return FFJSON_ERR;
+	}
+	wr_commit(w, d + n);
+	wr_valend(w);
+	return FFJSON_OK;
+}
+
+static int wr_word(ffjson_wr *w, const char *s, size_t len)
+{
+	char *d;
+	if (0 != wr_valbegin(w))
+		return FFJSON_ERR;
+	if (NULL == (d = wr_reserve(w, len))) {
+		w->st |= WR_ERR;
+		return FFJSON_ERR;
+	}
+	ffmem_copy(d, s, len);
+	wr_commit(w, d + len);
+	wr_valend(w);
+	return FFJSON_OK;
+}
+
+int ffjson_wr_bool(ffjson_wr *w, int val)
+{
+	if (val)
+		return wr_word(w, "true", 4);
+	return wr_word(w, "false", 5);
+}
+
+int ffjson_wr_null(ffjson_wr *w)
+{
+	return wr_word(w, "null", 4);
+}
+
+size_t ffjson_wr_iov(ffjson_wr *w, const ffiovec **iov)
+{
+	if (0 != wr_flush(w))
+		w->st |= WR_ERR;
+	*iov = (void*)w->iov.ptr;
+	return w->iov.len;
+}
@@ -4,6 +4,8 @@ Copyright (c) 2013 Simon Zolin
 
 #include <FF/data/json.h>
 #include <FF/data/utf8.h>
+#include <FF/bitops.h>
+#include <FF/number.h>
 
 
 static const char *const _ffjson_stypes[] = {
@@ -47,50 +49,89 @@ int ffjson_unescapechar(uint *dst, const char *text, size_t len)
 	return -1;
 }
 
+/* Escape sequences of the characters which must be escaped:
+ '"', '\\' and control characters:  0: not escaped;  'u': "\u00XX" */
+static const char json_esc[256] = {
+	'u','u','u','u','u','u','u','u','b','t','n','u','f','r','u','u',
+	'u','u','u','u','u','u','u','u','u','u','u','u','u','u','u','u',
+	['"'] = '"', ['\\'] = '\\', [0x7f] = 'u',
+};
+
+size_t ffjson_escape_skip(const char *s, size_t len)
+{
+	size_t i = 0;
+
+#ifdef FF_AMD64
+	const __m128i quote = _mm_set1_epi8('"')
+		, bs = _mm_set1_epi8('\\')
+		, del = _mm_set1_epi8(0x7f)
+		, ctl = _mm_set1_epi8(0x1f);
+
+	for (;  i + 16 <= len;  i += 16) {
+		__m128i v = _mm_loadu_si128((const void*)(s + i));
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bs))
+			, _mm_or_si128(_mm_cmpeq_epi8(v, del)
+				, _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v))); // v <= 0x1f
+		uint mask = _mm_movemask_epi8(m);
+		if (mask != 0)
+			return i + ffbit_ffs32(mask) - 1;
+	}
+#endif
+
+	for (;  i != len;  i++) {
+		if (json_esc[(byte)s[i]] != 0)
+			break;
+	}
+	return i;
+}
+
 size_t ffjson_escape(char *dst, size_t cap, const char *s, size_t len)
 {
-	size_t i;
+	size_t i, n;
+	char *d = dst;
 	const char *dstend = dst + cap;
-	const char *dsto = dst;
-	uint nEsc = FFSLEN("\\n");
 
 	if (dst == NULL) {
-		size_t n = 0;
-		for (i = 0; i < len; ++i) {
-			if (NULL != ffmemchr(escbyte, (byte)s[i], FFCNT(escbyte) - 1))
-				n += nEsc;
-			else if ((byte)s[i] < 0x20 || s[i] == 0x7f)
-				n += FFSLEN("\\uXXXX");
-			else
-				n++;
+		size_t total = 0;
+		for (i = 0;  ;  i++) {
+			n = ffjson_escape_skip(s + i, len - i);
+			total += n;
+			i += n;
+			if (i == len)
+				break;
+			total += (json_esc[(byte)s[i]] == 'u') ? FFSLEN("\\uXXXX") : FFSLEN("\\n");
 		}
-		return n;
+		return total;
 	}
 
-	for (i = 0; i < len; ++i) {
-		char *d;
-
-		if (dst == dstend)
+	for (i = 0;  ;  i++) {
+		// copy the characters which don't need escaping at once
+		n = ffjson_escape_skip(s + i, len - i);
+		if (n > (size_t)(dstend - d))
 			return 0;
+		ffmem_copy(d, s + i, n);
+		d += n;
+		i += n;
+		if (i == len)
+			break;
 
-		d = ffmemchr(escbyte, (byte)s[i], FFCNT(escbyte) - 1);
-		if (d != NULL) {
-			if (dst + nEsc > dstend)
+		uint e = json_esc[(byte)s[i]];
+		if (e == 'u') {
+			if (d + FFSLEN("\\uXXXX") > dstend)
 				return 0;
-			*dst++ = '\\';
-			*dst++ = escchar[d - escbyte];
+			d = ffmem_copycz(d, "\\u00");
+			d += ffs_hexbyte(d, s[i], ffHEX);
 
-		} else if ((byte)s[i] < 0x20 || s[i] == 0x7f) {
-			if (dst + FFSLEN("\\uXXXX") > dstend)
+		} else {
+			if (d + FFSLEN("\\n") > dstend)
 				return 0;
-			dst = ffmem_copycz(dst, "\\u00");
-			dst += ffs_hexbyte(dst, s[i], ffHEX);
-
-		} else
-			*dst++ = s[i];
+			*d++ = '\\';
+			*d++ = e;
+		}
 	}
 
-	return dst - dsto;
+	return d - dst;
 }
 
 
@@ -135,7 +176,7 @@ void ffjson_parsereset(ffjson *p)
 	p->line = 1;
 	p->ch = 0;
 	p->ctxs.len = 0;
-	p->flags = 0;
+	p->flags &= FFJSON_PINSITU;
 }
 
 static int val_store(ffarr *buf, const char *s, size_t len)
@@ -157,6 +198,19 @@ static int val_add(ffarr *buf, const char *s, size_t len)
 	return 0;
 }
 
+/** In-situ mode: append data to the value which is stored within input buffer.
+The value's data is moved back after an escape sequence is decoded. */
+static int val_insitu(ffarr *buf, const char *s, size_t len)
+{
+	if (buf->cap != 0)
+		return val_store(buf, s, len);
+
+	if (buf->ptr + buf->len != s)
+		memmove(buf->ptr + buf->len, s, len);
+	buf->len += len;
+	return 0;
+}
+
 const char* ffjson_errmsg(ffjson *p, int r, char *buf, size_t cap)
 {
 	char *end = buf + cap;
@@ -267,7 +321,10 @@ static int hdlQuote(ffjson *p, int *st, int *nextst, const char *data)
 		break;
 
 	default:
-		er = val_add(&p->buf, data, 1);
+		if (p->flags & FFJSON_PINSITU)
+			er = val_insitu(&p->buf, data, 1);
+		else
+			er = val_add(&p->buf, data, 1);
 	}
 
 	if ((p->flags & F_ESC_UTF16_2) && *st != iQuotEsc)
@@ -311,7 +368,10 @@ static int hdlEsc(ffjson *p, int *st, int ch)
 	}
 
 	r = ffutf8_encode1(buf, sizeof(buf), uch);
-	r = val_store(&p->buf, buf, r);
+	if (p->flags & FFJSON_PINSITU)
+		r = val_insitu(&p->buf, buf, r);
+	else
+		r = val_store(&p->buf, buf, r);
 	if (r != 0)
 		return r; //allocation error
 	*st = iQuot;
@@ -446,6 +506,8 @@ int ffjson_parse(ffjson *p, const char *data, size_t *len)
 //QUOTE
 		case iQuotFirst:
 			st = iQuot;
+			if ((p->flags & FFJSON_PINSITU) && p->buf.cap == 0)
+				ffarr_set(&p->buf, (char*)data, 0);
 			//break;
 
 		case iQuot:
@@ -561,6 +623,13 @@ int ffjson_parse(ffjson *p, const char *data, size_t *len)
 	if (er == FFPARS_MORE && p->buf.len != 0)
 		er = val_store(&p->buf, NULL, 0);
 
+	else if (er == FFPARS_MORE && (p->flags & FFJSON_PINSITU) && p->buf.cap == 0
+		&& (st == iQuot || st == iQuotEsc)) {
+		// the string continues in the next chunk: all its data will be stored in our buffer
+		if (NULL == ffarr_grow(&p->buf, 1, 256 | FFARR_GROWQUARTER))
+			er = FFPARS_ESYS;
+	}
+
 	ffstr_set2(&p->val, &p->buf);
 	p->state = st;
 	p->nextst = nextst;
@@ -755,7 +824,11 @@ val:
 			r = _ffpars_arg_process2(ps->curarg, &c->intval, ctx->obj, ps);
 			break;
 		default:
-			r = ffpars_arg_process(ps->curarg, &c->val, ctx->obj, ps);
+			if (ps->flags & FFPARS_INSITU)
+				r = _ffpars_arg_process_ref(ps->curarg, &c->val, ctx->obj, ps
+					, (c->flags & FFJSON_PINSITU) && c->buf.cap == 0);
+			else
+				r = ffpars_arg_process(ps->curarg, &c->val, ctx->obj, ps);
 		}
 		break;
 
@@ -0,0 +1,167 @@
+/**
+Copyright (c) 2020 Simon Zolin
+*/
+
+#include <FF/data/keyidx.h>
+#include <FFOS/mem.h>
+
+enum {
+	MAX_KEYS = 0xfffe,
+	MAX_KEYLEN = 0xffff,
+	MAX_DISP = 0xffff,
+	BUILD_TRIES = 8, //rebuild with another seed if keys can't be placed
+};
+
+/** Place the keys of one bucket into free slots.
+Return displacement value;  -1 if not found. */
+static int bucket_place(ffkeyidx *ki, const uint64 *hash, const uint *lens, const ushort *keys, uint n, uint *placed)
+{
+	uint d, j;
+	for (d = 0;  d <= MAX_DISP;  d++) {
+		for (j = 0;  j != n;  j++) {
+			uint k = keys[j];
+			uint s = _ffkeyidx_slot(hash[k], d, ki->smask);
+			if (ki->slots[s] != 0)
+				break;
+			ki->slots[s] = (lens[k] << 16) | (k + 1);
+			placed[j] = s;
+		}
+		if (j == n)
+			return d;
+		while (j != 0)
+			ki->slots[placed[--j]] = 0;
+	}
+	return -1;
+}
+
+/*
+. Group the keys by buckets
+. Skip duplicate names within a bucket (equal names always get into the same bucket)
+. Place the largest buckets first: find the displacement value which moves all bucket's keys to free slots
+. Retry with another seed on failure
+*/
+static ffkeyidx* keyidx_build(const void *args, size_t stride, uint n, uint flags)
+{
+	ffkeyidx *ki = NULL;
+	void *tmp = NULL;
+	uint i, nb, ns, maxcnt;
+
+	nb = ff_align_power2(ffmax((n + 1) / 2, 2));
+	ns = ff_align_power2(n * 2);
+
+	size_t tmpsize = n * sizeof(uint64) // hash[]
+		+ n * sizeof(uint) // lens[]
+		+ n * sizeof(uint) // placed[]
+		+ (nb + 1) * sizeof(uint) // bstart[]
+		+ nb * sizeof(uint) // border[]
+		+ n * sizeof(ushort) // keys[]
+		+ n * sizeof(ushort); // bkeys[]
+	if (NULL == (tmp = ffmem_alloc(tmpsize)))
+		goto err;
+	uint64 *hash = tmp;
+	uint *lens = (void*)(hash + n);
+	uint *placed = lens + n;
+	uint *bstart = placed + n;
+	uint *border = bstart + nb + 1;
+	ushort *keys = (void*)(border + nb);
+	ushort *bkeys = keys + n;
+
+	if (NULL == (ki = ffmem_calloc(1, sizeof(ffkeyidx) + ns * sizeof(uint) + nb * sizeof(ushort))))
+		goto err;
+	ki->args = args;
+	ki->stride = stride;
+	ki->n = n;
+	ki->flags = flags;
+	ki->bmask = nb - 1;
+	ki->smask = ns - 1;
+	ki->slots = (void*)(ki + 1);
+	ki->disp = (void*)(ki->slots + ns);
+
+	for (i = 0;  i != n;  i++) {
+		size_t len = ffsz_len(_FFKEYIDX_NAME(args, stride, i));
+		if (len > MAX_KEYLEN)
+			goto err;
+		lens[i] = len;
+	}
+
+	for (uint t = 0;  t != BUILD_TRIES;  t++) {
+		ki->seed = t * 0x9e3779b97f4a7c15ULL;
+		ffmem_zero(ki->slots, ns * sizeof(uint));
+		ffmem_zero(bstart, (nb + 1) * sizeof(uint));
+
+		for (i = 0;  i != n;  i++) {
+			hash[i] = _ffkeyidx_hash(_FFKEYIDX_NAME(args, stride, i), lens[i], ki->seed, flags);
+			bstart[_ffkeyidx_bucket(hash[i], ki->bmask) + 1]++;
+		}
+
+		maxcnt = 0;
+		for (i = 0;  i != nb;  i++) {
+			maxcnt = ffmax(maxcnt, bstart[i + 1]);
+			bstart[i + 1] += bstart[i];
+		}
+
+		// stable counting sort: keys of a bucket are in the order of the table
+		ffmem_copy(placed, bstart, nb * sizeof(uint));
+		for (i = 0;  i != n;  i++) {
+			keys[placed[_ffkeyidx_bucket(hash[i], ki->bmask)]++] = i;
+		}
+
+		uint nborder = 0;
+		for (uint cnt = maxcnt;  cnt != 0;  cnt--) {
+			for (i = 0;  i != nb;  i++) {
+				if (bstart[i + 1] - bstart[i] == cnt)
+					border[nborder++] = i;
+			}
+		}
+
+		for (i = 0;  i != nborder;  i++) {
+			uint b = border[i], m = 0;
+
+			for (uint j = bstart[b];  j != bstart[b + 1];  j++) {
+				uint k = keys[j], dup = 0;
+				for (uint j2 = 0;  j2 != m;  j2++) {
+					uint k2 = bkeys[j2];
+					if (hash[k] == hash[k2] && lens[k] == lens[k2]
+						&& _ffkeyidx_eq(_FFKEYIDX_NAME(args, stride, k), lens[k], _FFKEYIDX_NAME(args, stride, k2), flags)) {
+						dup = 1;
+						break;
+					}
+				}
+				if (!dup)
+					bkeys[m++] = k;
+			}
+
+			int d = bucket_place(ki, hash, lens, bkeys, m, placed);
+			if (d < 0)
+				break;
+			ki->disp[b] = d;
+		}
+
+		if (i == nborder) {
+			ffmem_free(tmp);
+			return ki;
+		}
+	}
+
+err:
+	ffmem_free(tmp);
+	ffmem_free(ki);
+	return NULL;
+}
+
+ffkeyidx* ffkeyidx_create(const void *args, size_t stride, uint n, uint flags)
+{
+	if (n == (uint)-1) {
+		for (n = 0;  n != MAX_KEYS + 1 && _FFKEYIDX_NAME(args, stride, n) != NULL;  n++) {
+		}
+	}
+
+	if (n < FFKEYIDX_MINKEYS || n > MAX_KEYS)
+		return NULL;
+	return keyidx_build(args, stride, n, flags);
+}
+
+void ffkeyidx_free(ffkeyidx *ki)
+{
+	ffmem_free(ki);
+}
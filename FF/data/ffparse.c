@@ -43,17 +43,37 @@ const char * ffpars_errstr(int code)
 }
 
 
+/** Get the index of context's arguments. */
+static const ffkeyidx* ctx_keyidx(ffpars_ctx *ctx, uint nargs, uint flags)
+{
+	uint kf = (flags & FFPARS_CTX_FKEYICASE) ? FFKEYIDX_ICASE : 0;
+	const ffkeyidx *ki = ctx->keyidx;
+
+	if (ki == NULL
+		|| ki->args != ctx->args || ki->n != nargs // built for another table
+		|| ki->flags != kf)
+		return NULL;
+	return ki;
+}
+
 const ffpars_arg* ffpars_ctx_findarg(ffpars_ctx *ctx, const char *name, size_t len, uint flags)
 {
 	const ffpars_arg *a = NULL;
 	uint i, nargs = ctx->nargs;
+	const ffkeyidx *ki;
 
 	FF_ASSERT(ctx->nargs != 0);
 
 	if ((ctx->args[nargs - 1].flags & FFPARS_FTYPEMASK) == FFPARS_TCLOSE)
 		nargs--;
 
-	if (flags & FFPARS_CTX_FKEYICASE) {
+	if (NULL != (ki = ctx_keyidx(ctx, nargs, flags))) {
+		int r = ffkeyidx_find(ki, name, len);
+		i = (uint)r;
+		if (r >= 0)
+			a = &ctx->args[r];
+
+	} else if (flags & FFPARS_CTX_FKEYICASE) {
 		for (i = 0;  i != nargs;  i++) {
 			if (0 == ffs_icmpz(name, len, ctx->args[i].name)) {
 				a = &ctx->args[i];
@@ -101,7 +121,7 @@ static int _ffpars_enum(const ffpars_arg *a, const ffstr *val, void *obj, void *
 static int _ffpars_bits(size_t f, int64 i, union ffpars_val dst);
 static int _ffpars_int(const ffpars_arg *a, int64 val, void *obj, void *ps);
 static int _ffpars_intval(const ffpars_arg *a, int64 n, void *obj, void *ps);
-static int _ffpars_str(const ffpars_arg *a, const ffstr *val, void *obj, void *ps);
+static int _ffpars_str(const ffpars_arg *a, const ffstr *val, void *obj, void *ps, uint ref);
 static int scOpenBrace(ffparser_schem *ps);
 static int scCloseBrace(ffparser_schem *ps);
 
@@ -129,9 +149,18 @@ int _ffpars_schemrun_key(ffparser_schem *ps, ffpars_ctx *ctx, const ffstr *val)
 	return 0;
 }
 
-static int _ffpars_str(const ffpars_arg *a, const ffstr *val, void *obj, void *ps)
+/** FFPARS_INSITU: the target of the argument borrows the string value. */
+#define str_borrowed(f) \
+	(((f) & FFPARS_FTYPEMASK) == FFPARS_TSTR \
+		&& ffint_mask_test(f, FFPARS_FCOPY) \
+		&& !ffint_mask_test(f, FFPARS_FSTRZ) \
+		&& !ffint_mask_test(f, FFPARS_FRECOPY))
+
+/**
+ref: FFPARS_FCOPY string references 'val' data */
+static int _ffpars_str(const ffpars_arg *a, const ffstr *val, void *obj, void *ps, uint ref)
 {
-	uint f, t;
+	uint f, t, copy;
 	ffbool func;
 	ffstr tmp = {};
 	int er = 0;
@@ -149,7 +178,10 @@ static int _ffpars_str(const ffpars_arg *a, const ffstr *val, void *obj, void *p
 		&& NULL != ffs_findc(val->ptr, val->len, '\0'))
 		return FFPARS_EBADCHAR;
 
-	if (f & FFPARS_FCOPY) {
+	copy = (f & FFPARS_FCOPY)
+		&& !(ref && str_borrowed(f));
+
+	if (copy) {
 
 		if (ffint_mask_test(f, FFPARS_FSTRZ)) {
 			if (NULL == ffstr_alloc(&tmp, val->len + 1))
@@ -195,7 +227,7 @@ static int _ffpars_str(const ffpars_arg *a, const ffstr *val, void *obj, void *p
 		}
 	}
 
-	if (func && er != 0 && (f & FFPARS_FCOPY))
+	if (func && er != 0 && copy)
 		ffstr_free(&tmp);
 	return er;
 }
@@ -418,7 +450,7 @@ int ffpars_arg_process(const ffpars_arg *a, const ffstr *val, void *obj, void *p
 
 	case FFPARS_TSTR:
 	case FFPARS_TCHARPTR:
-		er = _ffpars_str(a, val, obj, ps);
+		er = _ffpars_str(a, val, obj, ps, 0);
 		break;
 
 	case FFPARS_TENUM:
@@ -463,6 +495,16 @@ int ffpars_arg_process(const ffpars_arg *a, const ffstr *val, void *obj, void *p
 	return er;
 }
 
+int _ffpars_arg_process_ref(const ffpars_arg *a, const ffstr *val, void *obj, void *ps, uint insitu)
+{
+	if (str_borrowed(a->flags)) {
+		if (!insitu)
+			return FFPARS_EVALUNSUPP; // the value has been copied by the back-end
+		return _ffpars_str(a, val, obj, ps, 1);
+	}
+	return ffpars_arg_process(a, val, obj, ps);
+}
+
 int _ffpars_arg_process2(const ffpars_arg *a, const void *val, void *obj, void *ps)
 {
 	int r = 0;
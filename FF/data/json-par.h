@@ -0,0 +1,65 @@
+/** Parallel decoding of JSON records.
+Copyright (c) 2020 Simon Zolin
+*/
+
+/*
+The caller's thread splits input data into chunks of whole records,
+ thread pool's workers parse the records of a chunk with a scheme,
+ the results are delivered in the caller's thread in input order.
+NDJSON: a chunk ends with the first newline after 'chunk_size' bytes,
+ only the workers split it into records (ffjson_split_next()),
+ so a record must not contain newlines.
+FFJSON_SPLIT_ARRAY: the caller's thread finds the records with ffjson_split_next().
+Each of 'nslots' chunks being processed at once has its own parser and user object,
+ so the scheme's handlers don't need locking.
+
+ffjson_prun()
+*/
+
+#pragma once
+
+#include <FF/data/json.h>
+#include <FF/sys/thpool.h>
+
+
+enum {
+	FFJSON_PCHUNK = 1024 * 1024,
+};
+
+typedef struct ffjson_pchunk {
+	void *obj; //user object of the slot
+	ffstr data; //chunk data
+	uint64 index; //chunk number
+	size_t nrecs; //the number of parsed records
+	int err; //0 or enum FFPARS_E
+	ffstr errrec; //the record which couldn't be parsed
+} ffjson_pchunk;
+
+typedef struct ffjson_pconf {
+	ffthpool *thpool;
+	uint flags; //enum FFJSON_SPLIT_F
+	uint nslots; //max. chunks processed at once
+	size_t chunk_size; //min. size of a chunk.  0: default (FFJSON_PCHUNK)
+
+	/** Scheme of a record.  The object of a new context is the slot's user object. */
+	const ffpars_arg *top;
+	uint schem_flags; //enum FFPARS_SCHEMFLAG: FFPARS_KEYICASE, FFPARS_INSITU (strings borrow the input data)
+
+	void **objs; //void*[nslots]: user objects
+
+	/** Called within a worker before the chunk is parsed.  Optional. */
+	void (*chunk_begin)(void *obj);
+
+	/** Called within the caller's thread for each chunk in input order.
+	Processing stops after a chunk with error.
+	Return 0 to continue;  otherwise processing stops and ffjson_prun() returns this value. */
+	int (*chunk_done)(void *udata, ffjson_pchunk *c);
+
+	void *udata;
+} ffjson_pconf;
+
+/** Decode all records of the data in parallel.
+Block until all chunks are processed.
+Return 0 on success;  enum FFPARS_E: splitter error or the error of the first failed chunk;
+ the value returned by chunk_done(). */
+FF_EXTN int ffjson_prun(const ffjson_pconf *conf, const char *data, size_t len);
@@ -47,7 +47,7 @@ typedef struct ffjson {
 	int ret;
 	uint line;
 	uint ch;
-	uint flags;
+	uint flags; //enum FFJSON_PARSE_F
 	union {
 		int64 intval;
 		double fltval;
@@ -64,6 +64,15 @@ typedef struct ffjson {
 	ffarr ctxs;
 } ffjson;
 
+enum FFJSON_PARSE_F {
+	/** In-situ mode of ffjson_parse():
+	 keys and string values reference input data, escape sequences are decoded in place.
+	Input data must be writable and must stay valid while the values are in use.
+	A value which continues in the next chunk of input data is still copied.
+	Set in ffjson.flags after ffjson_parseinit(). */
+	FFJSON_PINSITU = 0x100,
+};
+
 /** Initialize parser. */
 FF_EXTN void ffjson_parseinit(ffjson *p);
 
@@ -87,6 +96,9 @@ Return the number of characters written.
 Return 0 if there is not enough space in destination buffer. */
 FF_EXTN size_t ffjson_escape(char *dst, size_t cap, const char *s, size_t len);
 
+/** Get the number of leading characters which don't need escaping. */
+FF_EXTN size_t ffjson_escape_skip(const char *s, size_t len);
+
 /** Parse JSON.
 Return FFPARS_E.  p->type is set to one of FFJSON_T. */
 FF_EXTN int ffjson_parse(ffjson *p, const char *data, size_t *len);
@@ -122,6 +134,103 @@ FF_EXTN int ffjson_schemfin(ffparser_schem *ps);
 FF_EXTN int ffjson_schemrun(ffparser_schem *ps);
 
 
+/* Bulk parser.
+Stage 1 finds quotes, backslashes, operators and the beginnings of bare values
+ in 64-byte blocks (SSE2 on AMD64) and builds the index of structural characters.
+Stage 2 walks the index and returns the same events as ffjson_parse().
+Comments aren't supported.
+
+ffjson_bulk_init()
+ffjson_bulk_input()
+... ffjson_bulk_parse()
+ffjson_bulk_input(NULL, 0)
+... ffjson_bulk_parse()
+ffjson_bulk_close()
+*/
+
+enum FFJSON_BULK_F {
+	FFJSON_BULK_MULTI = 1, //allow several top-level values, e.g. NDJSON
+};
+
+typedef struct ffjson_bulk {
+	/** Parser state which is used by ffjson_schemrun(): ret, type, val, intval, fltval, ctxs.
+	line, ch: position of the first entity or of the error. */
+	ffjson p;
+
+	uint flags; //enum FFJSON_BULK_F
+	uint st;
+	ffstr in; //input window:  user data or 'buf'
+	ffarr buf; //incomplete data from the previous chunk + new data
+	ffarr idx; //size_t[]: offsets of structural characters in 'in'
+	size_t iidx; //the next element of 'idx' to process
+	size_t nscan; //the number of indexed bytes in 'in'
+	uint64 carry_esc, carry_str, carry_scalar; //stage 1 state between blocks
+	uint64 nlines; //the number of newlines within the indexed data
+	ffarr sbuf; //unescaped string
+	uint ctx_push :1;
+	uint ctx_pop :1;
+	uint fin :1;
+	uint started :1;
+} ffjson_bulk;
+
+FF_EXTN void ffjson_bulk_init(ffjson_bulk *b, uint flags);
+
+FF_EXTN void ffjson_bulk_close(ffjson_bulk *b);
+
+/** Set input data.
+Data must stay valid until ffjson_bulk_parse() returns FFPARS_MORE:
+ the unprocessed part is copied to the internal buffer then.
+len: 0: no more input data
+Return 0 on success;  FFPARS_ESYS. */
+FF_EXTN int ffjson_bulk_input(ffjson_bulk *b, const char *data, size_t len);
+
+/** Get the next entity.
+b->p.val is valid until the next call.
+Return enum FFPARS_E;  FFPARS_MORE: more data is needed, or all data is processed after the end of input. */
+FF_EXTN int ffjson_bulk_parse(ffjson_bulk *b);
+
+/** Initialize bulk parser and scheme. */
+static FFINL void ffjson_bulk_scheminit(ffparser_schem *ps, ffjson_bulk *b, const ffpars_arg *top, void *obj) {
+	ffjson_bulk_init(b, 0);
+	ffpars_scheminit(ps, &b->p, top);
+	ps->udata = obj;
+	ps->flags |= _FFPARS_SCOBJ;
+}
+
+
+/* Splitter.
+Find the boundaries of records in JSON data without parsing it:
+ NDJSON: newlines outside of strings and objects;
+ FFJSON_SPLIT_ARRAY: commas between the elements of the top-level array.
+Strings are skipped with the same block masks as in the bulk parser.
+
+ffjson_split_init()
+... ffjson_split_next()
+*/
+
+enum FFJSON_SPLIT_F {
+	FFJSON_SPLIT_ARRAY = 1,
+};
+
+typedef struct ffjson_split {
+	uint flags; //enum FFJSON_SPLIT_F
+	uint depth; //nesting level;  the top-level array is 1
+	size_t off; //the number of scanned bytes of the current record
+	size_t nrec; //FFJSON_SPLIT_ARRAY: records in the current array
+	uint64 carry_esc, carry_str;
+} ffjson_split;
+
+FF_EXTN void ffjson_split_init(ffjson_split *s, uint flags);
+
+/** Get the next record.
+data: [in/out] input data which begins with the current record;  the record and its delimiter are skipped
+ With FFPARS_MORE the caller passes the same data with the next chunk appended.
+rec: [out] record data without surrounding whitespace
+fin: no more input data;  NDJSON: the rest of data is the last record
+Return FFPARS_VAL;  FFPARS_MORE: need more data or (fin) no more records;  enum FFPARS_E on error. */
+FF_EXTN int ffjson_split_next(ffjson_split *s, ffstr *data, ffstr *rec, uint fin);
+
+
 typedef struct ffjson_cook {
 	ffstr3 buf;
 	int st;
@@ -196,3 +305,80 @@ FF_EXTN int ffjson_bufadd(ffjson_cook *js, int f, const void *src);
 
 /** Add multiple items into a growing buffer. */
 FF_EXTN int ffjson_bufaddv(ffjson_cook *js, const int *types, size_t ntypes, ...);
+
+
+/* Fast writer.
+Output data is written into fixed-size chunks which are never reallocated:
+ a new chunk is allocated when the current one is full.
+The result is a list of ffiovec which reference the chunks and,
+ with FFJSON_WR_REF, large parts of user's string values.
+Top-level values are separated by '\n'.
+
+ffjson_wr_init()
+ffjson_wr_obj() | ffjson_wr_arr() | ffjson_wr_key() | ffjson_wr_str() | ... | ffjson_wr_end()
+ffjson_wr_iov()
+ffjson_wr_reset() | ffjson_wr_close()
+*/
+
+enum FFJSON_WR_F {
+	/** Reference the parts of string values which don't need escaping and are at least FFJSON_WR_REFMIN bytes long.
+	String data must stay valid until the output is consumed. */
+	FFJSON_WR_REF = 1,
+};
+
+enum {
+	FFJSON_WR_CHUNK = 16 * 1024,
+	FFJSON_WR_REFMIN = 256,
+};
+
+typedef struct ffjson_wr {
+	uint flags; //enum FFJSON_WR_F
+	uint st;
+	size_t chunk_cap;
+	char *seg; //the beginning of data in the current chunk not yet added to 'iov'
+	char *ptr, *end; //free space in the current chunk
+	ffarr chunks; //char*[]
+	uint nchunks_used;
+	ffarr iov; //ffiovec[]
+	uint64 total; //output size
+	ffarr ctxs; //byte[]: enum FFJSON_T
+} ffjson_wr;
+
+/**
+chunk_size: 0: default (FFJSON_WR_CHUNK)
+flags: enum FFJSON_WR_F */
+FF_EXTN void ffjson_wr_init(ffjson_wr *w, size_t chunk_size, uint flags);
+
+FF_EXTN void ffjson_wr_close(ffjson_wr *w);
+
+/** Clear the output but keep the allocated chunks. */
+FF_EXTN void ffjson_wr_reset(ffjson_wr *w);
+
+/** Open object or array. */
+FF_EXTN int ffjson_wr_obj(ffjson_wr *w);
+FF_EXTN int ffjson_wr_arr(ffjson_wr *w);
+
+/** Close the current object or array. */
+FF_EXTN int ffjson_wr_end(ffjson_wr *w);
+
+FF_EXTN int ffjson_wr_key(ffjson_wr *w, const char *s, size_t len);
+
+FF_EXTN int ffjson_wr_str(ffjson_wr *w, const char *s, size_t len);
+
+FF_EXTN int ffjson_wr_int(ffjson_wr *w, int64 val);
+
+/** Write the shortest representation which is parsed back to the same value.
+Integral values (less than 2^53 by absolute value) are written as integers.
+Otherwise the digits are generated by Grisu3 without libc;
+ ~0.5% of values which it rejects cost up to 17 snprintf() + strtod() calls.
+The notation is as in JavaScript: "0.001", "1.5e-7", "1e+21".
+NaN and infinity aren't allowed. */
+FF_EXTN int ffjson_wr_float(ffjson_wr *w, double val);
+
+FF_EXTN int ffjson_wr_bool(ffjson_wr *w, int val);
+
+FF_EXTN int ffjson_wr_null(ffjson_wr *w);
+
+/** Get output data.
+Return the number of elements;  w->total: overall size. */
+FF_EXTN size_t ffjson_wr_iov(ffjson_wr *w, const ffiovec **iov);
@@ -0,0 +1,98 @@
+/** Perfect hash index of key names.
+Copyright (c) 2020 Simon Zolin
+*/
+
+/*
+Tables of parser arguments (ffpars_arg[], ffconf_arg[]) are searched by key name
+ for every key in input data.
+An index is built by the user once per table and is set to the parser context:
+ a key is found with 1 hash computation, 2 table reads and 1 string comparison.
+The parsers work without it (linear search), so only the users of an index link with ffkeyidx.o.
+
+Hash-and-displace:
+ bucket = hash % nbuckets
+ slot = (hash.hi + disp[bucket] * hash.mid) % nslots
+The displacement values are chosen at build time so that every key gets its own slot.
+
+ffkeyidx_create()
+ffkeyidx_free()
+ffkeyidx_find()
+*/
+
+#pragma once
+
+#include <FF/string.h>
+#include <FF/hash.h>
+
+
+enum FFKEYIDX_F {
+	FFKEYIDX_ICASE = 1, //case-insensitive key names (ASCII)
+};
+
+enum {
+	/** Tables with fewer elements are searched faster linearly */
+	FFKEYIDX_MINKEYS = 8,
+};
+
+typedef struct ffkeyidx {
+	const void *args;
+	size_t stride;
+	uint n; //number of elements
+	uint flags; //enum FFKEYIDX_F
+	uint64 seed;
+	uint bmask; //nbuckets - 1
+	uint smask; //nslots - 1
+	ushort *disp; //ushort[nbuckets]
+	uint *slots; //uint[nslots]: (key length << 16) | (element index + 1);  0: empty slot
+} ffkeyidx;
+
+/** Build the index for a table of structures which begin with 'const char *name'.
+The table must not be modified or freed while the index is in use.
+If several elements have the same name, the first one is found.
+stride: size of an element
+n: number of elements;  -1: the table ends with an element with name=NULL
+flags: enum FFKEYIDX_F
+Return NULL if the table can't be indexed (too small, too large, out of memory). */
+FF_EXTN ffkeyidx* ffkeyidx_create(const void *args, size_t stride, uint n, uint flags);
+
+FF_EXTN void ffkeyidx_free(ffkeyidx *ki);
+
+#define _FFKEYIDX_NAME(args, stride, i) \
+	(*(const char**)((char*)(args) + (i) * (stride)))
+
+static FFINL uint64 _ffkeyidx_hash(const char *name, size_t len, uint64 seed, uint flags)
+{
+	return (flags & FFKEYIDX_ICASE) ? ffhash64_i(name, len, seed) : ffhash64(name, len, seed);
+}
+
+static FFINL uint _ffkeyidx_bucket(uint64 h, uint bmask)
+{
+	return (uint)h & bmask;
+}
+
+static FFINL uint _ffkeyidx_slot(uint64 h, uint disp, uint smask)
+{
+	return ((uint)(h >> 32) + disp * ((uint)(h >> 16) | 1)) & smask;
+}
+
+static FFINL int _ffkeyidx_eq(const char *name, size_t len, const char *s, uint flags)
+{
+	return (flags & FFKEYIDX_ICASE) ? !ffs_icmp(name, s, len) : !ffmemcmp(name, s, len);
+}
+
+/** Find element by name.
+Return element index;  -1 if not found. */
+static FFINL int ffkeyidx_find(const ffkeyidx *ki, const char *name, size_t len)
+{
+	uint64 h = _ffkeyidx_hash(name, len, ki->seed, ki->flags);
+	uint d = ki->disp[_ffkeyidx_bucket(h, ki->bmask)];
+	uint e = ki->slots[_ffkeyidx_slot(h, d, ki->smask)];
+	if ((e >> 16) != len || e == 0)
+		return -1;
+
+	uint i = (e & 0xffff) - 1;
+	if (i >= ki->n
+		|| !_ffkeyidx_eq(name, len, _FFKEYIDX_NAME(ki->args, ki->stride, i), ki->flags))
+		return -1;
+	return i;
+}
@@ -5,6 +5,7 @@ Copyright (c) 2013 Simon Zolin
 #pragma once
 
 #include <FF/array.h>
+#include <FF/data/keyidx.h>
 
 
 enum FFPARS_E {
@@ -218,6 +219,13 @@ FF_EXTN int64 ffpars_getint(const ffpars_arg *a, union ffpars_val u);
 Return 0 or enum FFPARS_E. */
 FF_EXTN int ffpars_arg_process(const ffpars_arg *a, const ffstr *val, void *obj, void *ps);
 
+/** ffpars_arg_process() for FFPARS_INSITU:
+ FFPARS_TSTR with FFPARS_FCOPY (without FFPARS_FSTRZ, FFPARS_FRECOPY) isn't copied:
+ the target references 'val' data.
+insitu: 'val' references input data
+Return FFPARS_EVALUNSUPP if such string isn't in-situ. */
+FF_EXTN int _ffpars_arg_process_ref(const ffpars_arg *a, const ffstr *val, void *obj, void *ps, uint insitu);
+
 /**
 @val: int64* | double* */
 FF_EXTN int _ffpars_arg_process2(const ffpars_arg *a, const void *val, void *obj, void *ps);
@@ -229,6 +237,7 @@ struct ffpars_ctx {
 	uint nargs;
 	const char * (*errfunc)(int ercod);
 	uint used[2];
+	const ffkeyidx *keyidx; //(optional) index of 'args' set by user
 };
 
 /** Set object and argument list. */
@@ -236,6 +245,14 @@ static FFINL void ffpars_setargs(ffpars_ctx *ctx, void *o, const ffpars_arg *arg
 	ctx->obj = o;
 	ctx->args = args;
 	ctx->nargs = nargs;
+	ctx->keyidx = NULL;
+}
+
+/** Set the index of key names for the current argument list.
+ki: ffkeyidx_create(ctx->args, sizeof(ffpars_arg), nargs_without_TCLOSE, ...);  owned by user
+The index is used only by the searches with the same case-sensitivity flag. */
+static FFINL void ffpars_setkeyidx(ffpars_ctx *ctx, const ffkeyidx *ki) {
+	ctx->keyidx = ki;
 }
 
 enum FFPARS_CTX_FIND {
@@ -258,6 +275,14 @@ enum FFPARS_SCHEMFLAG {
 	_FFPARS_SCOBJ = 4, // on new context, get object pointer from "ps.udata", not from the current context
 
 	FFPARS_KEYICASE = 0x100, // case-insensitive key names
+
+	/** Don't copy FFPARS_TSTR with FFPARS_FCOPY (without FFPARS_FSTRZ, FFPARS_FRECOPY):
+	 the target ffstr borrows input data and user must not free it.
+	Requires in-situ mode of the back-end (FFJSON_PINSITU, FFCONF_PINSITU).
+	A value which isn't in-situ (continues in the next chunk of input data) is rejected
+	 with FFPARS_EVALUNSUPP, so in practice the whole document is passed in one buffer.
+	FFPARS_FSTRZ and FFPARS_FRECOPY strings are always copied and owned by user. */
+	FFPARS_INSITU = 0x200,
 };
 
 struct ffparser_schem {
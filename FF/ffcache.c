@@ -2,68 +2,186 @@
 Copyright 2019 Simon Zolin. */
 
 #include <FF/cache.h>
-#include <FF/rbtree.h>
 #include <FF/list.h>
-#include <FF/crc.h>
+#include <FF/hash.h>
 #include <FF/array.h>
+#include <FFOS/atomic.h>
 
 
 enum {
+	IDX_BUCKET_SLOTS = (FFCPU_CACHELINE - sizeof(uint)) / (sizeof(uint) + sizeof(void*)),
 	MAX_KEYLEN = 64*1024,
-	DATA_S_SIZE = sizeof(void*),
+	MAX_SHARDS = 1024,
+	IDX_NBUCKETS_MIN = 8,
+	SKETCH_ROWS = 4,
+	SKETCH_WIDTH_MIN = 64,
+	SKETCH_SAMPLE_MUL = 10, //age counters after (width * SKETCH_SAMPLE_MUL) increments
+	SLRU_PROTECTED_PERCENT = 80,
+	SLAB_SIZE = 64*1024,
+	SLAB_HDR_SIZE = 64, //>= sizeof(cach_slab)
+	SLAB_CHUNK_MAX = 4096,
 };
 
+/** Chunk size classes. */
+static const ushort slab_sizes[] = {
+	64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, SLAB_CHUNK_MAX,
+};
+
+struct item;
+
+/** Index bucket occupying one CPU cache line. */
+typedef struct cach_bucket {
+	uint tags[IDX_BUCKET_SLOTS]; //KEYHASH_TAG();  0: empty slot
+	uint overflow; //the number of items that didn't fit into this bucket and are stored in the next ones
+	struct item *items[IDX_BUCKET_SLOTS];
+} cach_bucket;
+
+/** Open-addressing hash index: key -> the first item with this key.
+Slots are grouped into buckets;  a lookup checks the tags within a bucket
+ and moves to the next bucket only if 'overflow' is set. */
+typedef struct cach_index {
+	cach_bucket *buckets;
+	size_t mask; //number of buckets - 1
+	size_t len; //number of keys
+} cach_index;
+
+/** Count-min sketch: estimates how often a key is accessed. */
+typedef struct cach_sketch {
+	byte *rows; //byte[SKETCH_ROWS][mask + 1]
+	size_t mask;
+	size_t additions; //increments since the counters were aged
+	size_t sample_size;
+} cach_sketch;
+
+/** Slab: SLAB_SIZE memory block divided into chunks of the same size.
+The block is aligned by SLAB_SIZE, so a chunk pointer gives us its slab. */
+typedef struct cach_slab {
+	fflist_item sib; //cach_slaballoc.partial[]
+	fflist1 free; //free chunks
+	uint used; //allocated chunks
+	uint cls; //index in slab_sizes[]
+} cach_slab;
+
+/** Size-class allocator for items, keys and small data.
+Larger objects are allocated on heap. */
+typedef struct cach_slaballoc {
+	fflist partial[FFCNT(slab_sizes)]; //cach_slab[] with free chunks
+	size_t total; //memory occupied by slabs
+	size_t used; //memory occupied by allocated chunks
+} cach_slaballoc;
+
+/** Independent part of the cache.
+All items with the same key belong to the same shard. */
+typedef struct cach_shard {
+	ffcache *c;
+	fflock lk;
+	cach_index index;
+	size_t nitems;
+	fflist lastused; //item[]: LRU list;  SLRU: probation segment;  CLOCK: ring in insertion order
+	fflist prot; //item[]: SLRU: protected segment
+	size_t prot_max;
+	cach_sketch sketch; //TinyLFU
+	cach_slaballoc slab;
+	size_t memsize; //memory allocated for items, keys and data
+	size_t max_items;
+	size_t mem_limit;
+	struct ffcache_stat stat;
+} cach_shard;
+
 struct ffcache {
-	ffrbtree items;
-	fflist lastused;
-	size_t memsize; //length of keys and data
 	ffcache_conf conf;
-	struct ffcache_stat stat;
+	uint nshards;
+	uint locking :1;
+	cach_shard *shards; //cach_shard[nshards]
+	cach_shard shard1; //used when sharding is disabled
 };
 
 /** Keys are shared within a multi-item context.
-Every such item holds a reference to the instance of this struct. */
+Every such item holds a reference to the instance of this struct.
+Without ffcache_conf.multi the key is stored in the same memory chunk as its item. */
 typedef struct cach_key {
 	size_t len; //length of 'd[]'
 	uint usage;
+	uint chunk_size; //size of the memory chunk;  0: the key is a part of item's chunk
 	char d[0];
 } cach_key;
 
+/** Memory chunk layout: item, [cach_key], [data] */
 typedef struct item {
-	ffcache *c;
-	ffrbtl_node rbtnod;
+	cach_shard *sh;
+	uint64 keyhash;
+	ffchain_item sib; //circular list of items with the same key, for ffcache_conf.multi
 
 	fflist_item lastused_li;
 
 	cach_key *ckey;
 
 	ffstr data;
-	char data_s[DATA_S_SIZE]; //static data, saves the call to mem_alloc()
+	uint data_cap; //capacity of inline data area
+	uint chunk_size;
 
 	fftmrq_entry tmr; //expiration timer
 	uint usage; //the number of external references
 	uint unlinked :1; //set when the item is no longer referenced by the cache
+	uint prot :1; //SLRU: the item is in protected segment
+	uint referenced :1; //CLOCK: the item was accessed since the last pass
+	uint data_heap :1; //data is allocated on heap
 } item;
 
+static item* item_alloc(cach_shard *sh, const ffstr *key, size_t datalen);
+static size_t item_memsize(const cach_shard *sh, size_t keylen, size_t datalen);
 static uint item_tmrreset(item *cit, uint expire);
-static int item_copydata(item *cit, const ffcache_item *ci);
+static int item_copydata(cach_shard *sh, item *cit, const ffstr *data);
 static void item_fill(ffcache_item *ci, const item *cit);
-static int rm_unused_one(ffcache *c);
-static int rm_unused_mem(ffcache *c, size_t memneeded);
-static void item_rlz(ffcache *c, item *cit);
-static void item_fin(ffcache *c, item *cit);
-static void item_free(item *cit);
+static void item_rlz(cach_shard *sh, item *cit);
+static void item_fin(cach_shard *sh, item *cit);
+static void item_free(cach_shard *sh, item *cit);
+static int rm_unused_one(cach_shard *sh);
+static int rm_unused_mem(cach_shard *sh, size_t memneeded);
+static item* evict_candidate(cach_shard *sh);
+static item* evict_peek(cach_shard *sh);
+static void policy_add(cach_shard *sh, item *cit);
+static void policy_onhit(cach_shard *sh, item *cit);
+static void policy_rm(cach_shard *sh, item *cit);
+
+static int sketch_init(cach_sketch *sk, size_t items);
+static void sketch_free(cach_sketch *sk);
+static void sketch_add(cach_sketch *sk, uint64 hash);
+static uint sketch_estimate(const cach_sketch *sk, uint64 hash);
+
+static void* slab_alloc(cach_slaballoc *sa, size_t size);
+static void slab_free(cach_slaballoc *sa, void *p, size_t size);
+static size_t slab_chunksize(size_t size);
+static void slab_destroy(cach_slaballoc *sa);
+
+static int shard_init(cach_shard *sh, ffcache *c, uint n);
+static void shard_lock(cach_shard *sh);
+static void shard_unlock(cach_shard *sh);
+
+static int idx_init(cach_index *ix, size_t nbuckets);
+static void idx_free(cach_index *ix);
+static item** idx_find(cach_index *ix, uint64 hash, const char *key, size_t len, int key_icase);
+static int idx_insert(cach_index *ix, item *cit);
+static void idx_rm(cach_index *ix, item *cit);
+
+/** Get the shard by key hash. */
+#define SHARD_BYHASH(c, hash) \
+	(&(c)->shards[(uint)((hash)[0] >> 32) % (c)->nshards])
 
 /** Return TRUE if hash is not set. */
 #define KEYHASH_EMPTY(hash)  ((hash)[0] == 0)
 
 #define KEYHASH_SET(hash, key, len, key_icase) \
-	(*(hash) = (key_icase) ? ffcrc32_iget(key, len) : ffcrc32_get(key, len))
+	(*(hash) = (key_icase) ? ffhash64_i(key, len, 0) : ffhash64(key, len, 0))
+
+/** Short key hash stored in an index slot.  Never 0. */
+#define KEYHASH_TAG(hash)  ((uint)((hash) >> 32) | 1)
 
-static cach_key* key_alloc(const char *key, size_t len, int key_icase);
+static cach_key* key_alloc(cach_shard *sh, const char *key, size_t len);
+static void key_init(cach_key *ckey, const char *key, size_t len, int key_icase);
 static ffbool key_equal(const cach_key *ckey, const char *key, size_t len, int key_icase);
 static void key_ref(cach_key *ckey);
-static size_t key_unref(cach_key *ckey);
+static size_t key_unref(cach_shard *sh, cach_key *ckey);
 
 
 /** Error strings for enum FSV_CACH_E. */
@@ -72,11 +190,12 @@ static const char *const cach_serr[] = {
 	"system", //FFCACHE_ESYS
 	"already exists", //FFCACHE_EEXISTS
 	"not found", //FFCACHE_ENOTFOUND
-	"key hash collision", //FFCACHE_ECOLL
+	"key hash collision", //FFCACHE_ECOLL (not used)
 	"items number limit", //FFCACHE_ENUMLIMIT
 	"memory limit", //FFCACHE_EMEMLIMIT
 	"size limit", //FFCACHE_ESZLIMIT
 	"locked", //FFCACHE_ELOCKED
+	"rejected by admission filter", //FFCACHE_EREJECTED
 };
 
 const char * ffcache_errstr(uint code)
@@ -109,76 +228,148 @@ void ffcache_conf_init(ffcache_conf *conf)
 
 ffcache* ffcache_create(const ffcache_conf *conf)
 {
+	if (conf->shards > MAX_SHARDS
+		|| conf->policy > FFCACHE_POLICY_CLOCK) {
+		fferr_set(EINVAL);
+		return NULL;
+	}
+
 	ffcache *c = ffmem_new(ffcache);
 	if (c == NULL)
 		return NULL;
-	ffrbt_init(&c->items);
-	fflist_init(&c->lastused);
 	c->conf = *conf;
+
+	c->nshards = 1;
+	c->shards = &c->shard1;
+	if (conf->shards != 0) {
+		c->locking = 1;
+		if (conf->shards != 1) {
+			c->nshards = conf->shards;
+			if (NULL == (c->shards = ffmem_align(c->nshards * sizeof(cach_shard), FFCPU_CACHELINE))) {
+				ffmem_free(c);
+				return NULL;
+			}
+		}
+	}
+
+	for (uint i = 0;  i != c->nshards;  i++) {
+		if (0 != shard_init(&c->shards[i], c, c->nshards)) {
+			c->nshards = i;
+			ffcache_free(c);
+			return NULL;
+		}
+	}
 	return c;
 }
 
-void* ffcache_udata(ffcache *c)
+static int shard_init(cach_shard *sh, ffcache *c, uint n)
 {
-	return c->conf.udata;
+	ffmem_tzero(sh);
+	sh->c = c;
+	fflk_init(&sh->lk);
+	fflist_init(&sh->lastused);
+	fflist_init(&sh->prot);
+	for (uint i = 0;  i != FFCNT(slab_sizes);  i++) {
+		fflist_init(&sh->slab.partial[i]);
+	}
+	sh->max_items = (c->conf.max_items + n - 1) / n;
+	sh->mem_limit = c->conf.mem_limit / n;
+	sh->prot_max = sh->max_items * SLRU_PROTECTED_PERCENT / 100;
+
+	if (c->conf.tinylfu
+		&& 0 != sketch_init(&sh->sketch, sh->max_items))
+		return -1;
+
+	if (0 != idx_init(&sh->index, IDX_NBUCKETS_MIN)) {
+		sketch_free(&sh->sketch);
+		return -1;
+	}
+	return 0;
 }
 
-void ffcache_stat(ffcache *c, struct ffcache_stat *stat)
+static void shard_lock(cach_shard *sh)
 {
-	*stat = c->stat;
-	stat->items = c->items.len;
-	stat->memsize = c->memsize;
+	if (sh->c->locking)
+		fflk_lock(&sh->lk);
 }
 
-static void onclear(void *obj)
+static void shard_unlock(cach_shard *sh)
 {
-	item *cit = obj;
-	item_rlz(cit->c, cit);
+	if (sh->c->locking)
+		fflk_unlock(&sh->lk);
 }
 
-/**
-The function is only safe if ffrbtl_rm() is called before ffmem_free(). */
-static void ffrbtl_enumsafe(ffrbtree *tr, ffrbt_free_t func, size_t off)
-{
-	ffrbt_node *n, *next;
-	ffrbtl_node *nl;
-	fflist_item *li;
-
-	FFTREE_FOR(tr, n) {
-		nl = (void*)n;
-		FFCHAIN_FOR(&nl->sib, li) {
-			void *n2 = FF_PTR(ffrbtl_nodebylist(li), -(ssize_t)off);
-			li = li->next;
-			func(n2);
-		}
-		next = ffrbt_successor(tr, n);
-		void *p = FF_PTR(n, -(ssize_t)off);
-		func(p);
-		n = next;
-	}
+void* ffcache_udata(ffcache *c)
+{
+	return c->conf.udata;
 }
 
-void ffcache_reset(ffcache *c)
+void ffcache_stat(ffcache *c, struct ffcache_stat *stat)
 {
-	ffrbtl_enumsafe(&c->items, &onclear, FFOFF(item, rbtnod));
+	ffmem_tzero(stat);
+	for (uint i = 0;  i != c->nshards;  i++) {
+		cach_shard *sh = &c->shards[i];
+		shard_lock(sh);
+		stat->hits += sh->stat.hits;
+		stat->misses += sh->stat.misses;
+		stat->evictions += sh->stat.evictions;
+		stat->rejected += sh->stat.rejected;
+		stat->items += sh->nitems;
+		stat->memsize += sh->memsize;
+		stat->slab_total += sh->slab.total;
+		stat->slab_used += sh->slab.used;
+		shard_unlock(sh);
+	}
 }
 
-static void delitem(void *obj)
+void ffcache_reset(ffcache *c)
 {
-	item *cit = obj;
-	item_fin(cit->c, cit);
+	item *cit;
+	fflist_item *next;
+
+	for (uint i = 0;  i != c->nshards;  i++) {
+		cach_shard *sh = &c->shards[i];
+		shard_lock(sh);
+		FFLIST_WALKSAFE(&sh->lastused, cit, lastused_li, next) {
+			item_rlz(sh, cit);
+		}
+		FFLIST_WALKSAFE(&sh->prot, cit, lastused_li, next) {
+			item_rlz(sh, cit);
+		}
+		shard_unlock(sh);
+	}
 }
 
 void ffcache_free(ffcache *c)
 {
-	ffrbtl_freeall(&c->items, &delitem, FFOFF(item, rbtnod));
+	item *cit;
+	fflist_item *next;
+
+	if (c == NULL)
+		return;
+
+	for (uint i = 0;  i != c->nshards;  i++) {
+		cach_shard *sh = &c->shards[i];
+		FFLIST_WALKSAFE(&sh->lastused, cit, lastused_li, next) {
+			item_fin(sh, cit);
+		}
+		FFLIST_WALKSAFE(&sh->prot, cit, lastused_li, next) {
+			item_fin(sh, cit);
+		}
+		idx_free(&sh->index);
+		sketch_free(&sh->sketch);
+		slab_destroy(&sh->slab);
+	}
+	if (c->shards != &c->shard1)
+		ffmem_alignfree(c->shards);
 	ffmem_free(c);
 }
 
 int ffcache_fetch(ffcache *c, ffcache_item *ci, uint flags)
 {
-	ffrbt_node *found;
+	item **found;
 	item *cit;
+	cach_shard *sh;
 	enum FFCACHE_E er;
 
 	if (flags & FFCACHE_NEXT) {
@@ -186,21 +377,24 @@ int ffcache_fetch(ffcache *c, ffcache_item *ci, uint flags)
 		if (!c->conf.multi
 			|| ci->id == NULL) {
 			fferr_set(EINVAL);
-			er = FFCACHE_ESYS; //misuse
-			goto fail;
+			return FFCACHE_ESYS; //misuse
 		}
 
 		cit = (item*)ci->id;
-		if (cit->rbtnod.sib.next == &cit->rbtnod.sib) {
+		sh = cit->sh;
+		shard_lock(sh);
+		if (cit->sib.next == &cit->sib) {
 			er = FFCACHE_ENOTFOUND;
 			goto fail;
 		}
 
-		cit = FF_GETPTR(item, rbtnod, ffrbtl_nodebylist(cit->rbtnod.sib.next));
+		cit = FF_GETPTR(item, sib, cit->sib.next);
 
 	} else if (ci->id != NULL) {
 		// get the item by its ID
 		cit = (item*)ci->id;
+		sh = cit->sh;
+		shard_lock(sh);
 
 	} else {
 		// search for an item by name
@@ -208,21 +402,23 @@ int ffcache_fetch(ffcache *c, ffcache_item *ci, uint flags)
 		if (KEYHASH_EMPTY(ci->keyhash))
 			KEYHASH_SET(ci->keyhash, ci->key.ptr, ci->key.len, c->conf.key_icase);
 
-		found = ffrbt_find(&c->items, ci->keyhash[0], NULL);
+		sh = SHARD_BYHASH(c, ci->keyhash);
+		shard_lock(sh);
+
+		if (c->conf.tinylfu && !(flags & FFCACHE_PEEK))
+			sketch_add(&sh->sketch, ci->keyhash[0]);
+
+		found = idx_find(&sh->index, ci->keyhash[0], ci->key.ptr, ci->key.len, c->conf.key_icase);
 		if (found == NULL) {
-			c->stat.misses++;
+			if (!(flags & FFCACHE_PEEK))
+				sh->stat.misses++;
 			er = FFCACHE_ENOTFOUND;
 			goto fail;
 		}
 
-		cit = FF_GETPTR(item, rbtnod, found);
-		if (!key_equal(cit->ckey, ci->key.ptr, ci->key.len, c->conf.key_icase)) {
-			c->stat.misses++;
-			er = FFCACHE_ECOLL;
-			goto fail;
-		}
-
-		c->stat.hits++;
+		cit = *found;
+		if (!(flags & FFCACHE_PEEK))
+			sh->stat.hits++;
 	}
 
 	if (flags & FFCACHE_ACQUIRE) {
@@ -233,7 +429,7 @@ int ffcache_fetch(ffcache *c, ffcache_item *ci, uint flags)
 		}
 
 		cit->usage++;
-		item_rlz(c, cit);
+		item_rlz(sh, cit);
 
 	} else {
 
@@ -244,13 +440,16 @@ int ffcache_fetch(ffcache *c, ffcache_item *ci, uint flags)
 		}
 
 		cit->usage += ci->refs;
-		fflist_moveback(&c->lastused, &cit->lastused_li);
+		if (!(flags & FFCACHE_PEEK))
+			policy_onhit(sh, cit);
 	}
 
 	item_fill(ci, cit);
+	shard_unlock(sh);
 	return FFCACHE_OK;
 
 fail:
+	shard_unlock(sh);
 	return er;
 }
 
@@ -258,99 +457,117 @@ int ffcache_store(ffcache *c, ffcache_item *ci, uint flags)
 {
 	int er;
 	item *cit = NULL;
-	ffrbt_node *found, *parent;
+	cach_shard *sh;
+	item **found;
+	size_t memneeded;
 
 	if (ci->key.len > MAX_KEYLEN) {
-		er = FFCACHE_ESZLIMIT;
-		goto fail;
+		return FFCACHE_ESZLIMIT;
 	}
 
 	if (ci->data.len > c->conf.max_data) {
-		er = FFCACHE_ESZLIMIT;
-		goto fail;
+		return FFCACHE_ESZLIMIT;
+	}
+
+	if (KEYHASH_EMPTY(ci->keyhash))
+		KEYHASH_SET(ci->keyhash, ci->key.ptr, ci->key.len, c->conf.key_icase);
+
+	sh = SHARD_BYHASH(c, ci->keyhash);
+	shard_lock(sh);
+
+	/* Note: we should not count the key if an item with the same key already exists,
+	 but that would require us to perform an index lookup first. */
+	memneeded = item_memsize(sh, ci->key.len, ci->data.len);
+
+	if (c->conf.tinylfu) {
+		sketch_add(&sh->sketch, ci->keyhash[0]);
+
+		if (sh->nitems == sh->max_items
+			|| sh->memsize + memneeded > sh->mem_limit) {
+			item *victim = evict_peek(sh);
+			if (victim != NULL
+				&& sketch_estimate(&sh->sketch, ci->keyhash[0]) <= sketch_estimate(&sh->sketch, victim->keyhash)) {
+				sh->stat.rejected++;
+				er = FFCACHE_EREJECTED;
+				goto fail;
+			}
+		}
 	}
 
-	if (c->items.len == c->conf.max_items) {
-		if (0 != rm_unused_one(c)) {
+	if (sh->nitems == sh->max_items) {
+		if (0 != rm_unused_one(sh)) {
 			er = FFCACHE_ENUMLIMIT;
 			goto fail;
 		}
 	}
 
-	/* Note: we should not add 'ci->key.len' if an item with the same key already exists,
-	 but that would require us to perform a tree lookup first. */
-	if (c->memsize + ci->key.len + ci->data.len > c->conf.mem_limit) {
-		if (0 != rm_unused_mem(c, ci->key.len + ci->data.len)) {
+	if (sh->memsize + memneeded > sh->mem_limit) {
+		if (0 != rm_unused_mem(sh, memneeded)) {
 			er = FFCACHE_EMEMLIMIT;
 			goto fail;
 		}
 	}
 
-	if (KEYHASH_EMPTY(ci->keyhash))
-		KEYHASH_SET(ci->keyhash, ci->key.ptr, ci->key.len, c->conf.key_icase);
+	found = idx_find(&sh->index, ci->keyhash[0], ci->key.ptr, ci->key.len, c->conf.key_icase);
+	if (found != NULL && !c->conf.multi) {
+		er = FFCACHE_EEXISTS;
+		goto fail;
+	}
 
-	cit = ffmem_new(item);
+	cit = item_alloc(sh, (!c->conf.multi) ? &ci->key : NULL, ci->data.len);
 	if (cit == NULL) {
 		er = FFCACHE_ESYS;
 		goto fail;
 	}
-	cit->c = c;
-
-	if (0 != item_copydata(cit, ci)) {
+	cit->keyhash = ci->keyhash[0];
+	ffchain_init(&cit->sib);
+	if (0 != item_copydata(sh, cit, &ci->data)) {
 		er = FFCACHE_ESYS;
 		goto fail;
 	}
 
-	cit->usage = ci->refs;
-
-	found = ffrbt_find(&c->items, ci->keyhash[0], &parent);
 	if (found == NULL) {
 
-		cit->ckey = key_alloc(ci->key.ptr, ci->key.len, c->conf.key_icase);
-		if (cit->ckey == NULL) {
-			er = FFCACHE_ESYS;
-			goto fail;
+		if (c->conf.multi) {
+			cit->ckey = key_alloc(sh, ci->key.ptr, ci->key.len);
+			if (cit->ckey == NULL) {
+				er = FFCACHE_ESYS;
+				goto fail;
+			}
 		}
-		c->memsize += ci->key.len;
-
-		cit->rbtnod.key = ci->keyhash[0];
-		ffrbtl_insert3(&c->items, &cit->rbtnod, parent);
-
-	} else {
+		key_init(cit->ckey, ci->key.ptr, ci->key.len, c->conf.key_icase);
 
-		item *fcit = FF_GETPTR(item, rbtnod, found);
-		if (!key_equal(fcit->ckey, ci->key.ptr, ci->key.len, c->conf.key_icase)) {
-			er = FFCACHE_ECOLL;
+		if (0 != idx_insert(&sh->index, cit)) {
+			er = FFCACHE_ESYS;
 			goto fail;
 		}
 
-		if (!c->conf.multi) {
-			er = FFCACHE_EEXISTS;
-			goto fail;
-		}
+	} else {
 
+		item *fcit = *found;
 		key_ref(fcit->ckey);
 		cit->ckey = fcit->ckey;
 
-		ffchain_append(&cit->rbtnod.sib, fcit->rbtnod.sib.prev); //'prev' points to the last item in chain
-		c->items.len++;
+		ffchain_append(&cit->sib, fcit->sib.prev); //'prev' points to the last item in chain
 	}
+	sh->nitems++;
 
-	c->memsize += cit->data.len;
+	cit->usage = ci->refs;
 	ci->expire = item_tmrreset(cit, ci->expire);
-	fflist_ins(&c->lastused, &cit->lastused_li);
+	policy_add(sh, cit);
 
 	if (ci->refs != 0)
 		item_fill(ci, cit);
 	else
 		ci->id = cit;
 	ci->refs = cit->usage;
+	shard_unlock(sh);
 	return FFCACHE_OK;
 
 fail:
 	if (cit != NULL)
-		item_free(cit);
-
+		item_free(sh, cit);
+	shard_unlock(sh);
 	return er;
 }
 
@@ -358,20 +575,22 @@ int ffcache_update(ffcache *c, ffcache_item *ci, uint flags)
 {
 	int er;
 	item *cit;
+	cach_shard *sh;
 	ssize_t memsize_delta;
 
 	if (ci->id == NULL) {
 		fferr_set(EINVAL);
-		er = FFCACHE_ESYS; //item id must be set
-		goto fail;
+		return FFCACHE_ESYS; //item id must be set
 	}
 	cit = (item*)ci->id;
 
 	if (ci->data.len > c->conf.max_data) {
-		er = FFCACHE_ESZLIMIT;
-		goto fail;
+		return FFCACHE_ESZLIMIT;
 	}
 
+	sh = cit->sh;
+	shard_lock(sh);
+
 	if (cit->unlinked) {
 		er = FFCACHE_ENOTFOUND; //the item was expired
 		goto fail;
@@ -382,52 +601,59 @@ int ffcache_update(ffcache *c, ffcache_item *ci, uint flags)
 		goto fail;
 	}
 
-	memsize_delta = (ssize_t)ci->data.len - cit->data.len;
-	if (c->memsize + memsize_delta > c->conf.mem_limit) {
-		if (0 != rm_unused_mem(c, memsize_delta)) {
+	// only the data stored on heap may change its size
+	memsize_delta = ((ci->data.len > cit->data_cap) ? (ssize_t)ci->data.len : 0)
+		- ((cit->data_heap) ? (ssize_t)cit->data.len : 0);
+	if (memsize_delta > 0
+		&& sh->memsize + memsize_delta > sh->mem_limit) {
+		if (0 != rm_unused_mem(sh, memsize_delta)) {
 			er = FFCACHE_EMEMLIMIT;
 			goto fail;
 		}
 	}
 
 	//replace data
-	if (0 != item_copydata(cit, ci)) {
+	if (0 != item_copydata(sh, cit, &ci->data)) {
 		er = FFCACHE_ESYS;
 		goto fail;
 	}
 
-	c->memsize += memsize_delta;
-	fflist_moveback(&c->lastused, &cit->lastused_li);
+	policy_onhit(sh, cit);
 	ci->expire = item_tmrreset(cit, ci->expire);
 
 	item_fill(ci, cit);
+	shard_unlock(sh);
 	return FFCACHE_OK;
 
 fail:
+	shard_unlock(sh);
 	return er;
 }
 
 int ffcache_unref(ffcache *c, void *cid, uint flags)
 {
 	item *cit;
+	cach_shard *sh;
 
 	if (cid == NULL) {
 		fferr_set(EINVAL);
 		return FFCACHE_ESYS; //item id must be set
 	}
 	cit = (item*)cid;
+	sh = cit->sh;
+	shard_lock(sh);
 
 	FF_ASSERT(cit->usage != 0);
 	cit->usage--;
 
 	if ((flags & FFCACHE_REMOVE) && !cit->unlinked) {
-		item_rlz(c, cit);
-		return FFCACHE_OK;
-	}
+		item_rlz(sh, cit);
 
-	if (cit->unlinked && cit->usage == 0)
-		item_fin(c, cit);
+	} else if (cit->unlinked && cit->usage == 0) {
+		item_fin(sh, cit);
+	}
 
+	shard_unlock(sh);
 	return FFCACHE_OK;
 }
 
@@ -436,16 +662,20 @@ int ffcache_unref(ffcache *c, void *cid, uint flags)
 static void item_onexpire(void *param)
 {
 	item *cit = param;
-	item_rlz(cit->c, cit);
+	cach_shard *sh = cit->sh;
+	shard_lock(sh);
+	item_rlz(sh, cit);
+	shard_unlock(sh);
 }
 
 /** @expire: in sec. */
 static uint item_tmrreset(item *cit, uint expire)
 {
-	expire = (expire == 0) ? cit->c->conf.def_expire : (uint)ffmin(expire, cit->c->conf.max_expire);
+	const ffcache_conf *conf = &cit->sh->c->conf;
+	expire = (expire == 0) ? conf->def_expire : (uint)ffmin(expire, conf->max_expire);
 	cit->tmr.handler = &item_onexpire;
 	cit->tmr.param = cit;
-	cit->c->conf.timer(&cit->tmr, (int64)expire * 1000);
+	conf->timer(&cit->tmr, (int64)expire * 1000);
 	return expire;
 }
 
@@ -457,110 +687,305 @@ static void item_fill(ffcache_item *ci, const item *cit)
 	ci->refs = cit->usage;
 }
 
-static int item_copydata(item *cit, const ffcache_item *ci)
+/** Get the size of memory chunk for item, key and data.
+Small data is stored inside the chunk. */
+static size_t item_chunk(const cach_shard *sh, size_t keylen, size_t datalen, size_t *data_off)
+{
+	size_t n = sizeof(item);
+	if (!sh->c->conf.multi)
+		n += ff_align_ceil2(sizeof(cach_key) + keylen, 8);
+	*data_off = n;
+	if (n + datalen <= SLAB_CHUNK_MAX)
+		n += datalen;
+	return n;
+}
+
+/** Get the amount of memory needed to store a new item. */
+static size_t item_memsize(const cach_shard *sh, size_t keylen, size_t datalen)
+{
+	size_t off, n = item_chunk(sh, keylen, datalen, &off);
+	size_t mem = slab_chunksize(n);
+	if (off + datalen > n)
+		mem += datalen;
+	if (sh->c->conf.multi)
+		mem += slab_chunksize(sizeof(cach_key) + keylen);
+	return mem;
+}
+
+/** Allocate a new item.
+key: store the key in the same memory chunk */
+static item* item_alloc(cach_shard *sh, const ffstr *key, size_t datalen)
+{
+	size_t off, n = item_chunk(sh, (key != NULL) ? key->len : 0, datalen, &off);
+	size_t chunk = slab_chunksize(n);
+	item *cit;
+	if (NULL == (cit = slab_alloc(&sh->slab, n)))
+		return NULL;
+	ffmem_zero(cit, sizeof(item));
+	cit->sh = sh;
+	cit->chunk_size = chunk;
+	cit->data_cap = chunk - off;
+	if (key != NULL) {
+		cit->ckey = (void*)(cit + 1);
+		cit->ckey->usage = 1;
+		cit->ckey->chunk_size = 0;
+	}
+	sh->memsize += chunk;
+	return cit;
+}
+
+static FFINL char* item_data_inline(item *cit)
+{
+	return (char*)cit + cit->chunk_size - cit->data_cap;
+}
+
+/** Replace item data.
+Data is stored inside item's memory chunk if there's enough space, otherwise it's allocated on heap.
+New memory is allocated before the old data is released: on failure the item keeps its data.
+Return 0 on success. */
+static int item_copydata(cach_shard *sh, item *cit, const ffstr *data)
 {
 	void *p;
 
-	if (ci->data.len <= DATA_S_SIZE) {
-		p = cit->data_s;
+	if (data->len <= cit->data_cap) {
+		p = item_data_inline(cit);
 
-		if (cit->data.len > DATA_S_SIZE)
+		if (cit->data_heap) {
+			sh->memsize -= cit->data.len;
 			ffstr_free(&cit->data);
+			cit->data_heap = 0;
+		}
 
 	} else {
 
-		if (cit->data.len > DATA_S_SIZE)
-			p = ffmem_realloc(cit->data.ptr, ci->data.len);
+		if (cit->data_heap)
+			p = ffmem_realloc(cit->data.ptr, data->len);
 		else
-			p = ffmem_alloc(ci->data.len);
+			p = ffmem_alloc(data->len);
+
 		if (p == NULL)
-			return 1;
+			return -1;
+
+		if (cit->data_heap)
+			sh->memsize -= cit->data.len;
+		cit->data_heap = 1;
+		sh->memsize += data->len;
 	}
 
-	ffmemcpy(p, ci->data.ptr, ci->data.len);
-	ffstr_set(&cit->data, p, ci->data.len);
+	ffmemcpy(p, data->ptr, data->len);
+	ffstr_set(&cit->data, p, data->len);
 	return 0;
 }
 
 /** Delete 1 unused item. */
-static int rm_unused_one(ffcache *c)
+static int rm_unused_one(cach_shard *sh)
 {
 	item *cit;
 
-	_FFLIST_WALK(&c->lastused, cit, lastused_li) {
+	if (NULL == (cit = evict_candidate(sh)))
+		return 1;
 
-		if (cit->usage == 0) {
-			item_rlz(c, cit);
-			return 0;
-		}
+	sh->stat.evictions++;
+	item_rlz(sh, cit);
+	return 0;
+}
+
+/** Delete unused items until there is enough free memory. */
+static int rm_unused_mem(cach_shard *sh, size_t memneeded)
+{
+	item *cit;
+
+	while (sh->memsize + memneeded > sh->mem_limit) {
+
+		if (NULL == (cit = evict_candidate(sh)))
+			return 1;
+
+		sh->stat.evictions++;
+		item_rlz(sh, cit);
 	}
 
-	return 1;
+	return 0;
 }
 
-/** Delete unused items until there is enough free memory. */
-static int rm_unused_mem(ffcache *c, size_t memneeded)
+static item* lru_first_unused(fflist *lst)
 {
 	item *cit;
+	_FFLIST_WALK(lst, cit, lastused_li) {
+		if (cit->usage == 0)
+			return cit;
+	}
+	return NULL;
+}
 
-	_FFLIST_WALK(&c->lastused, cit, lastused_li) {
+/** Get the item to be evicted next.
+Return NULL if all items are in use. */
+static item* evict_candidate(cach_shard *sh)
+{
+	item *cit;
 
-		if (cit->usage == 0) {
-			item_rlz(c, cit);
+	switch (sh->c->conf.policy) {
+	case FFCACHE_POLICY_LRU:
+		return lru_first_unused(&sh->lastused);
+
+	case FFCACHE_POLICY_SLRU:
+		if (NULL != (cit = lru_first_unused(&sh->lastused)))
+			return cit;
+		return lru_first_unused(&sh->prot);
+
+	case FFCACHE_POLICY_CLOCK:
+		// the list head is the clock hand:
+		//  give a second chance to a referenced item by clearing its flag and moving it to the tail
+		for (size_t n = sh->lastused.len * 2;  n != 0;  n--) {
+			cit = FF_GETPTR(item, lastused_li, fflist_first(&sh->lastused));
+			if (cit->usage == 0 && !cit->referenced)
+				return cit;
+			cit->referenced = 0;
+			fflist_moveback(&sh->lastused, &cit->lastused_li);
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+/** Get the item that evict_candidate() would return without changing the eviction order.
+CLOCK: the sweep clears the reference bits on its first pass,
+ so if there's no unreferenced item, the first unused one is chosen. */
+static item* evict_peek(cach_shard *sh)
+{
+	item *cit, *unused = NULL;
+
+	if (sh->c->conf.policy != FFCACHE_POLICY_CLOCK)
+		return evict_candidate(sh);
+
+	_FFLIST_WALK(&sh->lastused, cit, lastused_li) {
+		if (cit->usage != 0)
+			continue;
+		if (!cit->referenced)
+			return cit;
+		if (unused == NULL)
+			unused = cit;
+	}
+	return unused;
+}
+
+/** Add new item to the eviction order. */
+static void policy_add(cach_shard *sh, item *cit)
+{
+	fflist_ins(&sh->lastused, &cit->lastused_li);
+}
+
+/** Update the eviction order after the item is accessed. */
+static void policy_onhit(cach_shard *sh, item *cit)
+{
+	switch (sh->c->conf.policy) {
+	case FFCACHE_POLICY_LRU:
+		fflist_moveback(&sh->lastused, &cit->lastused_li);
+		break;
+
+	case FFCACHE_POLICY_SLRU:
+		if (cit->prot) {
+			fflist_moveback(&sh->prot, &cit->lastused_li);
+			break;
+		}
 
-			if (c->memsize + memneeded <= c->conf.mem_limit)
-				return 0;
+		// promote to protected segment
+		fflist_rm(&sh->lastused, &cit->lastused_li);
+		fflist_ins(&sh->prot, &cit->lastused_li);
+		cit->prot = 1;
+
+		if (sh->prot.len > sh->prot_max) {
+			// demote the least recently used protected item back to probation
+			item *old = FF_GETPTR(item, lastused_li, fflist_first(&sh->prot));
+			fflist_rm(&sh->prot, &old->lastused_li);
+			fflist_ins(&sh->lastused, &old->lastused_li);
+			old->prot = 0;
 		}
+		break;
+
+	case FFCACHE_POLICY_CLOCK:
+		cit->referenced = 1;
+		break;
 	}
+}
 
-	return 1;
+static void policy_rm(cach_shard *sh, item *cit)
+{
+	if (cit->prot)
+		fflist_rm(&sh->prot, &cit->lastused_li);
+	else
+		fflist_rm(&sh->lastused, &cit->lastused_li);
 }
 
 /** Unlink the item from the cache. */
-static void item_rlz(ffcache *c, item *cit)
+static void item_rlz(cach_shard *sh, item *cit)
 {
 	FF_ASSERT(!cit->unlinked);
 
-	c->conf.timer(&cit->tmr, 0);
-	ffrbtl_rm(&c->items, &cit->rbtnod);
-	fflist_rm(&c->lastused, &cit->lastused_li);
+	sh->c->conf.timer(&cit->tmr, 0);
+
+	if (cit->sib.next == &cit->sib) {
+		idx_rm(&sh->index, cit);
+	} else {
+		// the index must point to the next item with the same key
+		item **slot = idx_find(&sh->index, cit->keyhash, cit->ckey->d, cit->ckey->len, sh->c->conf.key_icase);
+		if (*slot == cit)
+			*slot = FF_GETPTR(item, sib, cit->sib.next);
+		ffchain_unlink(&cit->sib);
+		ffchain_init(&cit->sib);
+	}
+	sh->nitems--;
+
+	policy_rm(sh, cit);
 	cit->unlinked = 1;
 
 	if (cit->usage == 0)
-		item_fin(c, cit);
+		item_fin(sh, cit);
 }
 
 /** Delete the item. */
-static void item_fin(ffcache *c, item *cit)
+static void item_fin(cach_shard *sh, item *cit)
 {
+	ffcache *c = sh->c;
 	if (c->conf.onchange != NULL) {
 		ffcache_item ci = {};
 		item_fill(&ci, cit);
 		c->conf.onchange(c, &ci, FFCACHE_ONDELETE);
 	}
 
-	c->memsize -= key_unref(cit->ckey) + cit->data.len;
-
-	item_free(cit);
+	item_free(sh, cit);
 }
 
 /** Free resources owned by the item. */
-static void item_free(item *cit)
+static void item_free(cach_shard *sh, item *cit)
 {
-	if (cit->data.len > DATA_S_SIZE)
+	if (cit->ckey != NULL)
+		key_unref(sh, cit->ckey);
+
+	if (cit->data_heap) {
+		sh->memsize -= cit->data.len;
 		ffstr_free(&cit->data);
+	}
 
-	ffmem_free(cit);
+	sh->memsize -= cit->chunk_size;
+	slab_free(&sh->slab, cit, cit->chunk_size);
 }
 
 
-/** Create a shared key. */
-static cach_key * key_alloc(const char *key, size_t len, int key_icase)
+/** Allocate a shared key.  Must be initialized with key_init(). */
+static cach_key* key_alloc(cach_shard *sh, const char *key, size_t len)
 {
-	cach_key *ckey = ffmem_alloc(sizeof(cach_key) + len);
+	size_t n = sizeof(cach_key) + len;
+	cach_key *ckey = slab_alloc(&sh->slab, n);
 	if (ckey == NULL)
 		return NULL;
+	ckey->chunk_size = slab_chunksize(n);
+	sh->memsize += ckey->chunk_size;
+	return ckey;
+}
 
+static void key_init(cach_key *ckey, const char *key, size_t len, int key_icase)
+{
 	if (!key_icase)
 		ffmemcpy(ckey->d, key, len);
 	else
@@ -568,7 +993,6 @@ static cach_key * key_alloc(const char *key, size_t len, int key_icase)
 
 	ckey->len = len;
 	ckey->usage = 1;
-	return ckey;
 }
 
 static void key_ref(cach_key *ckey)
@@ -576,17 +1000,18 @@ static void key_ref(cach_key *ckey)
 	ckey->usage++;
 }
 
-/** Decrease refcount and return data size if it's the last reference. */
-static size_t key_unref(cach_key *ckey)
+/** Decrease refcount and free the key if it's the last reference.
+Return the size of freed memory. */
+static size_t key_unref(cach_shard *sh, cach_key *ckey)
 {
-	if (--ckey->usage == 0) {
-		size_t n = ckey->len;
-		ffmem_free(ckey);
+	if (--ckey->usage == 0 && ckey->chunk_size != 0) {
+		size_t n = ckey->chunk_size;
+		sh->memsize -= n;
+		slab_free(&sh->slab, ckey, n);
 		return n;
 	}
 	return 0;
 }
-
 /** Return TRUE if keys are equal. */
 static ffbool key_equal(const cach_key *ckey, const char *key, size_t len, int key_icase)
 {
@@ -597,3 +1022,280 @@ static ffbool key_equal(const cach_key *ckey, const char *key, size_t len, int k
 		return !ffs_cmp(ckey->d, key, len);
 	return !ffs_icmp(ckey->d, key, len);
 }
+
+
+static int idx_init(cach_index *ix, size_t nbuckets)
+{
+	size_t n = nbuckets * sizeof(cach_bucket);
+	if (NULL == (ix->buckets = ffmem_align(n, FFCPU_CACHELINE)))
+		return -1;
+	ffmem_zero(ix->buckets, n);
+	ix->mask = nbuckets - 1;
+	ix->len = 0;
+	return 0;
+}
+
+static void idx_free(cach_index *ix)
+{
+	ffmem_alignfree(ix->buckets);
+	ix->buckets = NULL;
+}
+
+/** Find the slot containing the first item with this key.
+Return NULL if not found. */
+static item** idx_find(cach_index *ix, uint64 hash, const char *key, size_t len, int key_icase)
+{
+	uint tag = KEYHASH_TAG(hash);
+	size_t i = hash & ix->mask;
+
+	for (size_t n = 0;  n <= ix->mask;  n++) {
+		cach_bucket *b = &ix->buckets[i];
+
+		for (uint k = 0;  k != IDX_BUCKET_SLOTS;  k++) {
+			if (b->tags[k] == tag) {
+				item *cit = b->items[k];
+				if (cit->keyhash == hash
+					&& key_equal(cit->ckey, key, len, key_icase))
+					return &b->items[k];
+			}
+		}
+
+		if (b->overflow == 0)
+			break;
+		i = (i + 1) & ix->mask;
+	}
+
+	return NULL;
+}
+
+/** Add the item into the first free slot starting at its home bucket. */
+static void idx_add(cach_index *ix, item *cit)
+{
+	uint tag = KEYHASH_TAG(cit->keyhash);
+	size_t i = cit->keyhash & ix->mask;
+
+	for (;;) {
+		cach_bucket *b = &ix->buckets[i];
+
+		for (uint k = 0;  k != IDX_BUCKET_SLOTS;  k++) {
+			if (b->tags[k] == 0) {
+				b->tags[k] = tag;
+				b->items[k] = cit;
+				ix->len++;
+				return;
+			}
+		}
+
+		b->overflow++;
+		i = (i + 1) & ix->mask;
+	}
+}
+
+/** Double the number of buckets and re-insert all items. */
+static int idx_grow(cach_index *ix)
+{
+	cach_index nix;
+	if (0 != idx_init(&nix, (ix->mask + 1) * 2))
+		return -1;
+
+	for (size_t i = 0;  i <= ix->mask;  i++) {
+		cach_bucket *b = &ix->buckets[i];
+		for (uint k = 0;  k != IDX_BUCKET_SLOTS;  k++) {
+			if (b->tags[k] != 0)
+				idx_add(&nix, b->items[k]);
+		}
+	}
+
+	idx_free(ix);
+	*ix = nix;
+	return 0;
+}
+
+/** Add a new key.
+Grow the index when it's 3/4 full. */
+static int idx_insert(cach_index *ix, item *cit)
+{
+	if (ix->len + 1 > (ix->mask + 1) * IDX_BUCKET_SLOTS * 3 / 4) {
+		if (0 != idx_grow(ix))
+			return -1;
+	}
+
+	idx_add(ix, cit);
+	return 0;
+}
+
+/** Remove the item from its slot and update overflow counters of the buckets it has passed. */
+static void idx_rm(cach_index *ix, item *cit)
+{
+	size_t i = cit->keyhash & ix->mask;
+
+	for (;;) {
+		cach_bucket *b = &ix->buckets[i];
+
+		for (uint k = 0;  k != IDX_BUCKET_SLOTS;  k++) {
+			if (b->items[k] == cit) {
+				b->tags[k] = 0;
+				b->items[k] = NULL;
+				ix->len--;
+				return;
+			}
+		}
+
+		FF_ASSERT(b->overflow != 0);
+		b->overflow--;
+		i = (i + 1) & ix->mask;
+	}
+}
+
+
+/** Allocate counters for the expected number of items. */
+static int sketch_init(cach_sketch *sk, size_t items)
+{
+	size_t width = ffmax(ff_align_power2(items), SKETCH_WIDTH_MIN);
+	if (NULL == (sk->rows = ffmem_calloc(SKETCH_ROWS, width)))
+		return -1;
+	sk->mask = width - 1;
+	sk->additions = 0;
+	sk->sample_size = width * SKETCH_SAMPLE_MUL;
+	return 0;
+}
+
+static void sketch_free(cach_sketch *sk)
+{
+	ffmem_free(sk->rows);
+	sk->rows = NULL;
+}
+
+/** Get counter index within a row. */
+#define SKETCH_INDEX(sk, hash, row) \
+	(((hash) + (row) * (((hash) >> 32) | 1)) & (sk)->mask)
+
+/** Increment the key's counters.
+Halve all counters periodically so that the old popularity fades away. */
+static void sketch_add(cach_sketch *sk, uint64 hash)
+{
+	size_t width = sk->mask + 1;
+	for (uint i = 0;  i != SKETCH_ROWS;  i++) {
+		byte *c = &sk->rows[i * width + SKETCH_INDEX(sk, hash, i)];
+		if (*c != 0xff)
+			(*c)++;
+	}
+
+	if (++sk->additions == sk->sample_size) {
+		for (size_t i = 0;  i != SKETCH_ROWS * width;  i++) {
+			sk->rows[i] >>= 1;
+		}
+		sk->additions /= 2;
+	}
+}
+
+/** Get the estimated access frequency of the key. */
+static uint sketch_estimate(const cach_sketch *sk, uint64 hash)
+{
+	size_t width = sk->mask + 1;
+	uint n = 0xff;
+	for (uint i = 0;  i != SKETCH_ROWS;  i++) {
+		n = ffmin(n, sk->rows[i * width + SKETCH_INDEX(sk, hash, i)]);
+	}
+	return n;
+}
+
+
+/** Get the index of the smallest size class fitting 'size'. */
+static uint slab_class(size_t size)
+{
+	uint i;
+	for (i = 0;  slab_sizes[i] < size;  i++) {
+	}
+	return i;
+}
+
+/** Get the real amount of memory allocated by slab_alloc(). */
+static size_t slab_chunksize(size_t size)
+{
+	if (size > SLAB_CHUNK_MAX)
+		return size;
+	return slab_sizes[slab_class(size)];
+}
+
+static cach_slab* slab_new(cach_slaballoc *sa, uint cls)
+{
+	cach_slab *s;
+	FF_ASSERT(sizeof(cach_slab) <= SLAB_HDR_SIZE);
+	if (NULL == (s = ffmem_align(SLAB_SIZE, SLAB_SIZE)))
+		return NULL;
+	s->used = 0;
+	s->cls = cls;
+	s->free.first = NULL;
+
+	// chunks are allocated in the order of their addresses
+	size_t size = slab_sizes[cls];
+	char *chunks = (char*)s + SLAB_HDR_SIZE;
+	for (size_t i = (SLAB_SIZE - SLAB_HDR_SIZE) / size;  i != 0;  i--) {
+		fflist1_push(&s->free, (fflist1_item*)(chunks + (i - 1) * size));
+	}
+
+	fflist_ins(&sa->partial[cls], &s->sib);
+	sa->total += SLAB_SIZE;
+	return s;
+}
+
+/** Allocate memory chunk.
+Objects larger than SLAB_CHUNK_MAX are allocated on heap. */
+static void* slab_alloc(cach_slaballoc *sa, size_t size)
+{
+	cach_slab *s;
+
+	if (size > SLAB_CHUNK_MAX)
+		return ffmem_alloc(size);
+
+	uint cls = slab_class(size);
+	if (fflist_empty(&sa->partial[cls])) {
+		if (NULL == (s = slab_new(sa, cls)))
+			return NULL;
+	} else {
+		s = FF_GETPTR(cach_slab, sib, fflist_first(&sa->partial[cls]));
+	}
+
+	void *p = fflist1_pop(&s->free);
+	s->used++;
+	if (s->free.first == NULL)
+		fflist_rm(&sa->partial[cls], &s->sib);
+	sa->used += slab_sizes[cls];
+	return p;
+}
+
+/** Free memory chunk.
+Return an empty slab to the system. */
+static void slab_free(cach_slaballoc *sa, void *p, size_t size)
+{
+	if (size > SLAB_CHUNK_MAX) {
+		ffmem_free(p);
+		return;
+	}
+
+	cach_slab *s = (void*)((size_t)p & ~(size_t)(SLAB_SIZE - 1));
+	if (s->free.first == NULL)
+		fflist_ins(&sa->partial[s->cls], &s->sib);
+	fflist1_push(&s->free, p);
+	s->used--;
+	sa->used -= slab_sizes[s->cls];
+
+	if (s->used == 0) {
+		fflist_rm(&sa->partial[s->cls], &s->sib);
+		ffmem_alignfree(s);
+		sa->total -= SLAB_SIZE;
+	}
+}
+
+static void slab_destroy(cach_slaballoc *sa)
+{
+	cach_slab *s;
+	fflist_item *next;
+
+	for (uint i = 0;  i != FFCNT(slab_sizes);  i++) {
+		FFLIST_WALKSAFE(&sa->partial[i], s, sib, next) {
+			ffmem_alignfree(s);
+		}
+	}
+}
@@ -25,21 +25,64 @@ void ffmem_xor(byte *dst, const byte *src, size_t len, const byte *key, size_t n
 	}
 }
 
-void ffmem_xor4(void *dst, const void *src, size_t len, uint key)
-{
-	byte *key1 = (byte*)&key, *dst1 = dst;
-	const byte *src1 = src;
-	uint *dst4 = dst;
-	const uint *src4 = src;
-	size_t i;
+uint ffmem_xor4_off(void *dst, const void *src, size_t len, uint key, uint off)
+{
+	byte *d = dst;
+	const byte *s = src;
+	uint kr;
+	byte *k = (byte*)&kr;
+	size_t i = 0;
+
+	// rotate the key so that its first byte matches the current stream position
+	for (uint j = 0;  j != 4;  j++) {
+		k[j] = ((byte*)&key)[(off + j) % 4];
+	}
+	key = kr;
+
+#ifdef FF_AMD64
+	__m128i k16 = _mm_set1_epi32(key);
+	for (;  i + 64 <= len;  i += 64) {
+		__m128i a = _mm_loadu_si128((const void*)(s + i));
+		__m128i b = _mm_loadu_si128((const void*)(s + i + 16));
+		__m128i c = _mm_loadu_si128((const void*)(s + i + 32));
+		__m128i e = _mm_loadu_si128((const void*)(s + i + 48));
+		_mm_storeu_si128((void*)(d + i), _mm_xor_si128(a, k16));
+		_mm_storeu_si128((void*)(d + i + 16), _mm_xor_si128(b, k16));
+		_mm_storeu_si128((void*)(d + i + 32), _mm_xor_si128(c, k16));
+		_mm_storeu_si128((void*)(d + i + 48), _mm_xor_si128(e, k16));
+	}
+	for (;  i + 16 <= len;  i += 16) {
+		__m128i a = _mm_loadu_si128((const void*)(s + i));
+		_mm_storeu_si128((void*)(d + i), _mm_xor_si128(a, k16));
+	}
+#endif
+
+	// unaligned loads and stores via memcpy():  compilers turn them into plain moves
+	uint64 key8 = ((uint64)key << 32) | key;
+	for (;  i + 8 <= len;  i += 8) {
+		uint64 w;
+		memcpy(&w, s + i, 8);
+		w ^= key8;
+		memcpy(d + i, &w, 8);
+	}
 
-	for (i = 0;  i != len / 4;  i++) {
-		dst4[i] = src4[i] ^ key;
+	for (;  i + 4 <= len;  i += 4) {
+		uint w;
+		memcpy(&w, s + i, 4);
+		w ^= key;
+		memcpy(d + i, &w, 4);
 	}
 
-	for (i = i * 4;  i != len;  i++) {
-		dst1[i] = src1[i] ^ key1[i % 4];
+	for (;  i != len;  i++) {
+		d[i] = s[i] ^ k[i % 4];
 	}
+
+	return (off + len) % 4;
+}
+
+void ffmem_xor4(void *dst, const void *src, size_t len, uint key)
+{
+	ffmem_xor4_off(dst, src, len, key, 0);
 }
 
 ssize_t ffs_cmpn(const char *s1, const char *s2, size_t len)
@@ -0,0 +1,131 @@
+/** Fast non-cryptographic hash functions.
+Copyright (c) 2020 Simon Zolin
+*/
+
+#pragma once
+
+#include <FF/number.h>
+#include <FF/string.h>
+
+
+/*
+64-bit hash based on XXH64 algorithm.
+Input is processed 32 bytes per iteration in 4 independent lanes,
+ which lets the compiler vectorize and pipeline the multiplications.
+Case-insensitive variant lowers 8 ASCII characters at once (SWAR)
+ and produces the same value as the case-sensitive hash of a lower-case string.
+*/
+
+#define _FFHASH_P1  0x9e3779b185ebca87ULL
+#define _FFHASH_P2  0xc2b2ae3d27d4eb4fULL
+#define _FFHASH_P3  0x165667b19e3779f9ULL
+#define _FFHASH_P4  0x85ebca77c2b2ae63ULL
+#define _FFHASH_P5  0x27d4eb2f165667c5ULL
+
+#define _ffhash_rotl64(x, r)  (((x) << (r)) | ((x) >> (64 - (r))))
+
+/** Convert upper-case ASCII letters to lower case in 8 bytes at once. */
+static FFINL uint64 _ffhash_lower8(uint64 v)
+{
+	uint64 h = v & 0x7f7f7f7f7f7f7f7fULL;
+	uint64 ge_A = h + 0x3f3f3f3f3f3f3f3fULL; // 0x80 - 'A'
+	uint64 gt_Z = h + 0x2525252525252525ULL; // 0x80 - 'Z' - 1
+	uint64 upper = (ge_A ^ gt_Z) & ~v & 0x8080808080808080ULL;
+	return v | (upper >> 2);
+}
+
+static FFINL uint64 _ffhash_load64(const byte *p, int icase)
+{
+	uint64 v = ffint_ltoh64(p);
+	return (icase) ? _ffhash_lower8(v) : v;
+}
+
+static FFINL uint64 _ffhash_load32(const byte *p, int icase)
+{
+	uint64 v = ffint_ltoh32(p);
+	return (icase) ? (_ffhash_lower8(v) & 0xffffffff) : v;
+}
+
+static FFINL uint64 _ffhash_round(uint64 acc, uint64 in)
+{
+	acc += in * _FFHASH_P2;
+	acc = _ffhash_rotl64(acc, 31);
+	return acc * _FFHASH_P1;
+}
+
+static FFINL uint64 _ffhash_merge(uint64 h, uint64 v)
+{
+	h ^= _ffhash_round(0, v);
+	return h * _FFHASH_P1 + _FFHASH_P4;
+}
+
+static FFINL uint64 _ffhash64(const void *data, size_t len, uint64 seed, int icase)
+{
+	const byte *p = (byte*)data, *end = p + len;
+	uint64 h;
+
+	if (len >= 32) {
+		uint64 v1 = seed + _FFHASH_P1 + _FFHASH_P2
+			, v2 = seed + _FFHASH_P2
+			, v3 = seed
+			, v4 = seed - _FFHASH_P1;
+		const byte *lim = end - 32;
+		do {
+			v1 = _ffhash_round(v1, _ffhash_load64(p, icase));
+			v2 = _ffhash_round(v2, _ffhash_load64(p + 8, icase));
+			v3 = _ffhash_round(v3, _ffhash_load64(p + 16, icase));
+			v4 = _ffhash_round(v4, _ffhash_load64(p + 24, icase));
+			p += 32;
+		} while (p <= lim);
+
+		h = _ffhash_rotl64(v1, 1) + _ffhash_rotl64(v2, 7) + _ffhash_rotl64(v3, 12) + _ffhash_rotl64(v4, 18);
+		h = _ffhash_merge(h, v1);
+		h = _ffhash_merge(h, v2);
+		h = _ffhash_merge(h, v3);
+		h = _ffhash_merge(h, v4);
+
+	} else {
+		h = seed + _FFHASH_P5;
+	}
+
+	h += len;
+
+	for (;  p + 8 <= end;  p += 8) {
+		h ^= _ffhash_round(0, _ffhash_load64(p, icase));
+		h = _ffhash_rotl64(h, 27) * _FFHASH_P1 + _FFHASH_P4;
+	}
+
+	if (p + 4 <= end) {
+		h ^= _ffhash_load32(p, icase) * _FFHASH_P1;
+		h = _ffhash_rotl64(h, 23) * _FFHASH_P2 + _FFHASH_P3;
+		p += 4;
+	}
+
+	for (;  p != end;  p++) {
+		uint b = *p;
+		if (icase && ffchar_isup(b))
+			b = ffchar_lower(b);
+		h ^= b * _FFHASH_P5;
+		h = _ffhash_rotl64(h, 11) * _FFHASH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= _FFHASH_P2;
+	h ^= h >> 29;
+	h *= _FFHASH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+/** Get 64-bit hash of data. */
+static FFINL uint64 ffhash64(const void *data, size_t len, uint64 seed)
+{
+	return _ffhash64(data, len, seed, 0);
+}
+
+/** Get 64-bit hash of data treating ASCII letters case-insensitively.
+ffhash64_i("ABC") == ffhash64("abc") */
+static FFINL uint64 ffhash64_i(const void *data, size_t len, uint64 seed)
+{
+	return _ffhash64(data, len, seed, 1);
+}
@@ -34,6 +34,17 @@ typedef void (*ffdnscl_log)(uint level, const char *fmt, ...);
 typedef void (*ffdnscl_timer)(fftmrq_entry *tmr, uint value_ms);
 typedef fftime (*ffdnscl_time)(void);
 
+/** Answer cache statistics. */
+struct ffdnscl_cachestat {
+	uint items;
+	uint64 hits;
+	uint64 neg_hits; // requests completed from negative items
+	uint64 misses;
+	uint64 prefetches; // background queries for items which are about to expire
+	uint64 stale; // expired items served because DNS servers didn't respond
+	uint64 evictions; // items deleted to free space for the new ones
+};
+
 struct ffdnsclient {
 	fffd kq; // required
 	ffdnscl_oncomplete oncomplete;
@@ -48,10 +59,37 @@ struct ffdnsclient {
 	uint edns :1; // default:1
 	uint debug_log :1;
 
+	/** Send query to the server with the best score (smoothed RTT and failure rate) rather than round-robin.
+	If there's no response within the adaptive delay (server's RTT + 4 * RTT variation),
+	 send the same query to the next best server;  the first answer wins.
+	Requires 'time'. */
+	uint hedge :1;
+	uint demote_time; // a server that has failed 3 times in a row is not used for this time (msec).  default:10000
+
+	/** Answer cache.  Requires 'time'.
+	A request for a cached name is completed synchronously inside ffdnscl_resolve(). */
+	struct {
+		uint max_items; // max. number of cached names.  0: disable cache
+		uint min_ttl; // lower limit for TTL from DNS records (sec).  default:0
+		uint max_ttl; // upper limit for TTL from DNS records (sec).  default:1 day
+		uint neg_ttl; // TTL for negative answers: no such name or no records (sec).  0: don't cache.  default:60
+		/** Refresh the item in background
+		 when it's requested after this percentage of its TTL has passed.
+		0: disabled.  default:90 */
+		uint prefetch;
+		/** Serve the expired item for this time if DNS servers don't respond (sec).
+		0: disabled */
+		uint stale_ttl;
+	} cache;
+
 	fflist servs; //ffdnscl_serv[]
 	ffdnscl_serv *curserv;
 
 	ffrbtree queries; //active queries by hostname.  dns_query[]
+
+	ffrbtree cached; //cached answers by hostname.  dns_centry[]
+	fflist cached_lru; //dns_centry[]: the least recently used first
+	struct ffdnscl_cachestat cstat;
 };
 
 enum FFDNSCL_LOG {
@@ -68,6 +106,25 @@ FF_EXTN void ffdnscl_conf_init(ffdnscl_conf *conf);
 FF_EXTN ffdnsclient* ffdnscl_new(ffdnscl_conf *conf);
 FF_EXTN void ffdnscl_free(ffdnsclient *r);
 
+FF_EXTN void ffdnscl_cachestat(ffdnsclient *r, struct ffdnscl_cachestat *st);
+
+/** Server statistics. */
+struct ffdnscl_servstat {
+	ffstr addr;
+	uint rtt; // smoothed RTT (usec)
+	uint rttvar; // RTT variation (usec)
+	uint fail_rate; // smoothed failure rate (per mille)
+	uint demoted :1;
+	uint64 queries; // requests sent
+	uint64 answers;
+	uint64 fails; // timeouts and server failures
+	uint64 hedged; // queries sent because the first server didn't respond in time
+};
+
+/** Get statistics of i-th server.
+Return 0 on success;  -1 if there's no such server. */
+FF_EXTN int ffdnscl_servstat(ffdnsclient *r, uint i, struct ffdnscl_servstat *st);
+
 /** Add DNS server.
 addr: "IP[:PORT]" */
 FF_EXTN int ffdnscl_serv_add(ffdnsclient *r, const ffstr *addr);
@@ -21,9 +21,25 @@ struct ffdnscl_serv {
 	char saddr_s[FF_MAXIP4];
 	ffstr saddr;
 	char *ansbuf;
-	unsigned connected :1;
+	unsigned connected :1
+		, measured :1; //srtt is set
 
 	uint nqueries;
+
+	// health:
+	uint srtt; //smoothed RTT (usec)
+	uint rttvar; //RTT variation (usec)
+	uint fail_rate; //smoothed failure rate (per mille)
+	uint nfail_seq; //failures in a row
+	uint64 demote_until; //msec
+	uint64 nanswers;
+	uint64 nfails;
+	uint64 nhedged;
+};
+
+enum {
+	SERV_MAX_FAILS = 3, //failures in a row before the server is demoted
+	HEDGE_MIN_DELAY = 5, //msec
 };
 
 typedef struct dns_quser {
@@ -47,8 +63,17 @@ typedef struct dns_query {
 	ushort txid4;
 	ushort txid6;
 	unsigned need4 :1
-		, need6 :1;
+		, need6 :1
+		, hedge_pending :1; //the timer is set for sending the query to the second server
+	uint hedge_delay; //msec
+	struct {
+		ffdnscl_serv *serv;
+		uint64 time; //msec
+		uint answered :1;
+	} sent[2]; //servers the current try is sent to
+	byte nsent; //number of elements in sent[2]
 	byte nres; //number of elements in res[2]
+	byte nneg; //number of negative responses: NXDOMAIN or no records
 	ushort ques_len4;
 	ushort ques_len6;
 	char question[0];
@@ -63,16 +88,37 @@ struct ffdnscl_res {
 	};
 };
 
+/** Cached answer. */
+typedef struct dns_centry {
+	ffrbt_node rbtnod;
+	fflist_item lru_li;
+	ffstr name;
+	int status; //FFDNS_NOERROR;  otherwise it's a negative item
+	uint ttl; //sec
+	uint64 expire; //sec
+	uint nip; //0: negative item (NXDOMAIN or no records)
+	ffip6 ip[0]; //[IPv4-mapped..., IPv6...]
+} dns_centry;
+
+#define centry_negative(ce)  ((ce)->status != FFDNS_NOERROR || (ce)->nip == 0)
+
 
 #define syserrlog_x(r, ...) \
 	(r)->log(FFDNSCL_LOG_ERR | FFDNSCL_LOG_SYS, NULL, __VA_ARGS__)
 #define errlog_x(r, ...) \
 	(r)->log(FFDNSCL_LOG_ERR, NULL, __VA_ARGS__)
+#define dbglog_x(r, fmt, ...) \
+do { \
+	if ((r)->debug_log) \
+		(r)->log(FFDNSCL_LOG_DBG, fmt, __VA_ARGS__); \
+} while (0)
 
 #define syserrlog_srv(serv, fmt, ...) \
 	(serv)->r->log(FFDNSCL_LOG_ERR | FFDNSCL_LOG_SYS, "%S: " fmt, &(serv)->saddr, __VA_ARGS__)
 #define errlog_srv(serv, fmt, ...) \
 	(serv)->r->log(FFDNSCL_LOG_ERR, "%S: " fmt, &(serv)->saddr, __VA_ARGS__)
+#define warnlog_srv(serv, fmt, ...) \
+	(serv)->r->log(FFDNSCL_LOG_WARN, "%S: " fmt, &(serv)->saddr, __VA_ARGS__)
 #define dbglog_srv(serv, lev, fmt, ...) \
 do { \
 	if ((serv)->r->debug_log) \
@@ -92,10 +138,16 @@ do { \
 // SERVER
 static int serv_init(ffdnscl_serv *serv);
 static ffdnscl_serv * serv_next(ffdnsclient *r);
+static ffdnscl_serv* serv_best(ffdnsclient *r, ffdnscl_serv *exclude);
+static uint serv_hedge_delay(ffdnscl_serv *serv);
+static void serv_rtt(ffdnscl_serv *serv, uint rtt);
+static void serv_ok(ffdnscl_serv *serv, uint rtt);
+static void serv_fail(ffdnscl_serv *serv);
 static void serv_fin(ffdnscl_serv *serv);
 
 // QUERY
 #define query_sib(pnod)  FF_GETPTR(dns_query, rbtnod, pnod)
+static int query_new(ffdnsclient *r, const ffstr *host, uint namecrc, ffrbt_node *parent, ffdnscl_onresolve ondone, void *udata);
 static int query_addusr(dns_query *q, ffdnscl_onresolve ondone, void *udata);
 static int query_rmuser(ffdnsclient *r, const ffstr *host, ffdnscl_onresolve ondone, void *udata);
 static size_t query_prep(ffdnsclient *r, char *buf, size_t cap, uint txid, const ffstr *nm, int type);
@@ -104,6 +156,10 @@ static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend);
 static void query_onexpire(void *param);
 static void query_fin(dns_query *q, int status, ffdnscl_serv *serv);
 static void query_free(void *param);
+static uint query_ttl(dns_query *q);
+static void query_sent(dns_query *q, ffdnscl_serv *serv);
+static void query_answered(dns_query *q, ffdnscl_serv *serv, int ok);
+static void query_tryfail(dns_query *q);
 
 // ANSWER
 static void ans_read(void *udata);
@@ -113,6 +169,17 @@ static uint ans_nrecs(dns_query *q, ffdns_header *h, const ffstr *resp, const ch
 static ffdnscl_res* ans_proc_resp(dns_query *q, ffdns_header *h, const ffstr *resp, int is4);
 static void res_free(ffdnscl_res *dr);
 
+// CACHE
+#define centry_sib(pnod)  FF_GETPTR(dns_centry, rbtnod, pnod)
+static dns_centry* cache_find(ffdnsclient *r, const ffstr *name, uint namecrc);
+static int cache_hit(ffdnsclient *r, dns_centry *ce, ffdnscl_onresolve ondone, void *udata);
+static void cache_prefetch(ffdnsclient *r, dns_centry *ce);
+static void cache_add(ffdnsclient *r, dns_query *q, const ffdnscl_result *res);
+static dns_centry* cache_stale(ffdnsclient *r, dns_query *q);
+static void cache_rm(ffdnsclient *r, dns_centry *ce);
+static void centry_result(const dns_centry *ce, ffdnscl_result *res);
+static void centry_free(void *param);
+
 // DUMMY CALLBACKS
 static int oncomplete_dummy(ffdnsclient *r, ffdnscl_res *res, const ffstr *name, uint refcount, uint ttl)
 {
@@ -137,6 +204,11 @@ void ffdnscl_conf_init(ffdnscl_conf *c)
 	c->edns = 1;
 	c->max_tries = 1;
 	c->buf_size = 4*1024;
+	c->demote_time = 10000;
+
+	c->cache.max_ttl = 24*60*60;
+	c->cache.neg_ttl = 60;
+	c->cache.prefetch = 90;
 
 	c->log = &log_dummy;
 	c->time = &time_dummy;
@@ -153,52 +225,85 @@ ffdnsclient* ffdnscl_new(ffdnscl_conf *conf)
 	fflist_init(&r->servs);
 	r->curserv = NULL;
 	ffrbt_init(&r->queries);
+	ffrbt_init(&r->cached);
+	fflist_init(&r->cached_lru);
+	ffmem_tzero(&r->cstat);
 	return r;
 }
 
 int ffdnscl_resolve(ffdnsclient *r, ffstr name, ffdnscl_onresolve ondone, void *udata, uint flags)
 {
 	uint namecrc;
-	char buf4[FFDNS_MAXMSG], buf6[FFDNS_MAXMSG];
-	size_t ibuf4, ibuf6 = 0;
 	ffrbt_node *found_query, *parent;
-	dns_query *q = NULL;
+	dns_query *q;
 	ffstr host = name;
-	ushort txid4, txid6 = 0;
+	ffdnscl_result res;
 
 	if (flags & FFDNSCL_CANCEL)
 		return query_rmuser(r, &host, ondone, udata);
 
 	namecrc = ffcrc32_iget(name.ptr, name.len);
 
+	if (r->cache.max_items != 0) {
+		dns_centry *ce = cache_find(r, &host, namecrc);
+		if (ce != NULL
+			&& 0 == cache_hit(r, ce, ondone, udata))
+			return 0;
+		r->cstat.misses++;
+	}
+
 	// determine whether the needed query is already pending and if so, attach to it
 	found_query = ffrbt_find(&r->queries, namecrc, &parent);
 	if (found_query != NULL) {
 		q = query_sib(found_query);
 
-		if (!ffstr_eq2(&q->name, &host)) {
+		if (!ffstr_ieq2(&q->name, &host)) {
 			errlog_x(r, "%S: CRC collision with %S", &host, &q->name);
 			goto fail;
 		}
 
 		dbglog_q(q, LOG_DBGFLOW, "query hit", 0);
-		if (0 != query_addusr(q, ondone, udata))
-			goto nomem;
+		if (0 != query_addusr(q, ondone, udata)) {
+			syserrlog_x(r, "ffmem_alloc", 0);
+			goto fail;
+		}
 
 		return 0;
 	}
 
+	if (0 != query_new(r, &host, namecrc, parent, ondone, udata))
+		goto fail;
+	return 0;
+
+fail:
+	ffmem_tzero(&res);
+	res.name = host;
+	res.status = -1;
+	ondone(udata, &res);
+	return 0;
+}
+
+/** Create query object and send it.
+ondone: NULL for a background query
+Return 0 on success. */
+static int query_new(ffdnsclient *r, const ffstr *host, uint namecrc, ffrbt_node *parent, ffdnscl_onresolve ondone, void *udata)
+{
+	char buf4[FFDNS_MAXMSG], buf6[FFDNS_MAXMSG];
+	size_t ibuf4, ibuf6 = 0;
+	dns_query *q = NULL;
+	ushort txid4, txid6 = 0;
+
 	// prepare DNS queries: A and AAAA
 	txid4 = ffrnd_get() & 0xffff;
-	ibuf4 = query_prep(r, buf4, FFCNT(buf4), txid4, &host, FFDNS_A);
+	ibuf4 = query_prep(r, buf4, FFCNT(buf4), txid4, host, FFDNS_A);
 	if (ibuf4 == 0) {
-		errlog_x(r, "invalid hostname: %S", &host);
+		errlog_x(r, "invalid hostname: %S", host);
 		goto fail;
 	}
 
 	if (r->enable_ipv6) {
 		txid6 = ffrnd_get() & 0xffff;
-		ibuf6 = query_prep(r, buf6, FFCNT(buf6), txid6, &host, FFDNS_AAAA);
+		ibuf6 = query_prep(r, buf6, FFCNT(buf6), txid6, host, FFDNS_AAAA);
 	}
 
 	// initialize DNS query object
@@ -208,10 +313,11 @@ int ffdnscl_resolve(ffdnsclient *r, ffstr name, ffdnscl_onresolve ondone, void *
 	ffmem_zero(q, sizeof(dns_query));
 	q->r = r;
 
-	if (0 != query_addusr(q, ondone, udata))
+	if (ondone != NULL
+		&& 0 != query_addusr(q, ondone, udata))
 		goto nomem;
 
-	if (NULL == ffstr_dupstr(&q->name, &name))
+	if (NULL == ffstr_dupstr(&q->name, host))
 		goto nomem;
 
 	q->need4 = 1;
@@ -240,12 +346,7 @@ nomem:
 fail:
 	if (q != NULL)
 		query_free(q);
-
-	ffdnscl_result res = {};
-	res.name = host;
-	res.status = -1;
-	ondone(udata, &res);
-	return 0;
+	return -1;
 }
 
 void ffdnscl_free(ffdnsclient *r)
@@ -254,10 +355,17 @@ void ffdnscl_free(ffdnsclient *r)
 		return;
 
 	ffrbt_freeall(&r->queries, &query_free, FFOFF(dns_query, rbtnod));
+	ffrbt_freeall(&r->cached, &centry_free, FFOFF(dns_centry, rbtnod));
 	FFLIST_ENUMSAFE(&r->servs, serv_fin, ffdnscl_serv, sib);
 	ffmem_free(r);
 }
 
+void ffdnscl_cachestat(ffdnsclient *r, struct ffdnscl_cachestat *st)
+{
+	*st = r->cstat;
+	st->items = r->cached.len;
+}
+
 static void query_free(void *param)
 {
 	dns_query *q = param;
@@ -271,9 +379,29 @@ static void query_free(void *param)
 static void query_onexpire(void *param)
 {
 	dns_query *q = param;
+	ffdnsclient *r = q->r;
+
+	if (q->hedge_pending) {
+		q->hedge_pending = 0;
+		ffdnscl_serv *serv;
+		if (!q->sent[0].answered
+			&& NULL != (serv = serv_best(r, q->sent[0].serv))) {
+			if (0 != query_send1(q, serv, 1)) {
+				serv_fail(serv);
+			} else {
+				serv->nhedged++;
+				query_sent(q, serv);
+				dbglog_q(q, LOG_DBGNET, "%S: no response in %ums, sent hedged query"
+					, &q->sent[0].serv->saddr, q->hedge_delay);
+			}
+		}
+		r->timer(&q->tmr, ffmax(r->retry_timeout - q->hedge_delay, 1));
+		return;
+	}
 
 	if (q->tries_left == 0) {
 		errlog_q(q, "reached max_tries limit", 0);
+		query_tryfail(q);
 		query_fin(q, -1, NULL);
 		return;
 	}
@@ -331,8 +459,11 @@ static int query_rmuser(ffdnsclient *r, const ffstr *host, ffdnscl_onresolve ond
 
 static void query_send(dns_query *q, int resend)
 {
+	ffdnsclient *r = q->r;
 	ffdnscl_serv *serv;
 
+	query_tryfail(q);
+
 	for (;;) {
 
 		if (q->tries_left == 0) {
@@ -342,10 +473,66 @@ static void query_send(dns_query *q, int resend)
 		}
 
 		q->tries_left--;
-		serv = serv_next(q->r);
+		serv = (r->hedge) ? serv_best(r, NULL) : serv_next(r);
 		if (0 == query_send1(q, serv, resend))
-			return;
+			break;
+		serv_fail(serv);
+	}
+
+	query_sent(q, serv);
+
+	uint t = r->retry_timeout;
+	if (r->hedge && r->servs.len > 1) {
+		q->hedge_delay = serv_hedge_delay(serv);
+		q->hedge_pending = 1;
+		t = q->hedge_delay;
 	}
+	q->tmr.handler = &query_onexpire;
+	q->tmr.param = q;
+	r->timer(&q->tmr, t);
+}
+
+static uint64 time_ms(ffdnsclient *r)
+{
+	fftime t = r->time();
+	return fftime_ms(&t);
+}
+
+/** Remember when the query is sent to the server. */
+static void query_sent(dns_query *q, ffdnscl_serv *serv)
+{
+	uint i = q->nsent++;
+	q->sent[i].serv = serv;
+	q->sent[i].time = time_ms(q->r);
+	q->sent[i].answered = 0;
+}
+
+/** Update health of the server on its first response to the current try.
+ok: 0 if the server has failed to process the query */
+static void query_answered(dns_query *q, ffdnscl_serv *serv, int ok)
+{
+	for (uint i = 0;  i != q->nsent;  i++) {
+		if (q->sent[i].serv != serv || q->sent[i].answered)
+			continue;
+
+		q->sent[i].answered = 1;
+		if (ok)
+			serv_ok(serv, (time_ms(q->r) - q->sent[i].time) * 1000);
+		else
+			serv_fail(serv);
+		break;
+	}
+}
+
+/** The current try is over:  the servers which haven't responded have failed. */
+static void query_tryfail(dns_query *q)
+{
+	for (uint i = 0;  i != q->nsent;  i++) {
+		if (!q->sent[i].answered)
+			serv_fail(q->sent[i].serv);
+	}
+	q->nsent = 0;
+	q->hedge_pending = 0;
 }
 
 /** Send query to server. */
@@ -395,9 +582,6 @@ static int query_send1(dns_query *q, ffdnscl_serv *serv, int resend)
 			, (resend ? "re" : ""), "A", (int)q->txid4, serv->nqueries, (size_t)r->queries.len);
 	}
 
-	q->tmr.handler = &query_onexpire;
-	q->tmr.param = q;
-	r->timer(&q->tmr, r->retry_timeout);
 	return 0;
 
 fail:
@@ -487,14 +671,24 @@ static void ans_proc(ffdnscl_serv *serv, const ffstr *resp)
 		q->need6 = 0;
 		is4 = 0;
 
+	} else if (h.id == q->txid4 || h.id == q->txid6) {
+		// the same question has been sent to several servers and one of them has already answered it
+		dbglog_q(q, LOG_DBGNET, "%S: late response #%u: already answered"
+			, &serv->saddr, h.id);
+		return;
+
 	} else {
 		errlog_q(q, "request/response IDs don't match.  Response ID: #%u", h.id);
 		return;
 	}
 
+	query_answered(q, serv, (h.rcode != FFDNS_SERVFAIL && h.rcode != FFDNS_REFUSED));
+
 	if (h.rcode != FFDNS_NOERROR) {
 		errlog_q(q, "#%u: DNS response: (%u) %s"
 			, h.id, h.rcode, ffdns_rcode_str(h.rcode));
+		if (h.rcode == FFDNS_NXDOMAIN)
+			q->nneg++;
 		if (q->nres == 0)
 			q->status = h.rcode; //set error only from the first response
 
@@ -515,7 +709,7 @@ static void ans_proc(ffdnscl_serv *serv, const ffstr *resp)
 
 	q->r->timer(&q->tmr, 0);
 
-	uint ttl = (uint)ffmin(q->ttl[0], q->ttl[q->nres - 1]);
+	uint ttl = query_ttl(q);
 	for (uint i = 0;  i < q->nres;  i++) {
 		q->r->oncomplete(q->r, q->res[i], &q->name, q->users.len, ttl);
 	}
@@ -574,10 +768,15 @@ static dns_query * ans_find_query(ffdnscl_serv *serv, ffdns_header *h, const ffs
 		goto fail;
 	}
 
-	namecrc = ffcrc32_get(name.ptr, name.len);
+	namecrc = ffcrc32_iget(name.ptr, name.len);
 
 	found_query = ffrbt_find(&serv->r->queries, namecrc, NULL);
 	if (found_query == NULL) {
+		if (serv->r->hedge) {
+			// the query is already answered by another server
+			dbglog_srv(serv, LOG_DBGNET, "late response #%u for %S", resp_id, &name);
+			goto fail;
+		}
 		errmsg = "unexpected DNS response";
 		goto fail;
 	}
@@ -716,6 +915,7 @@ static ffdnscl_res* ans_proc_resp(dns_query *q, ffdns_header *h, const ffstr *re
 
 	if (nrecs == 0) {
 		dbglog_q(q, LOG_DBGFLOW, "#%u: no useful records in response", h->id);
+		q->nneg++;
 		return NULL;
 	}
 
@@ -778,9 +978,17 @@ static void query_fin(dns_query *q, int status, ffdnscl_serv *serv)
 	dns_quser *quser;
 	uint i, i4 = 0, total = 0;
 
-	ffrbt_rm(&q->r->queries, &q->rbtnod);
+	if (serv != NULL) {
+		// the servers that have lost the race:  their RTT is at least the time passed
+		uint64 now = time_ms(q->r);
+		for (i = 0;  i != q->nsent;  i++) {
+			if (!q->sent[i].answered)
+				serv_rtt(q->sent[i].serv, (now - q->sent[i].time) * 1000);
+		}
+	}
 
-	ffdnscl_result res = {};
+	ffdnscl_result res = {}, sres;
+	const ffdnscl_result *ures = &res;
 	res.name = q->name;
 	res.status = status;
 	for (i = 0;  i != q->nres;  i++) {
@@ -816,10 +1024,23 @@ static void query_fin(dns_query *q, int status, ffdnscl_serv *serv)
 		res.server_addr = serv->saddr;
 
 done:
+	if (q->r->cache.max_items != 0) {
+		dns_centry *ce;
+		if (serv != NULL)
+			cache_add(q->r, q, &res);
+		else if (q->users.len != 0
+			&& NULL != (ce = cache_stale(q->r, q))) {
+			centry_result(ce, &sres);
+			ures = &sres;
+		}
+	}
+
+	ffrbt_rm(&q->r->queries, &q->rbtnod); // after the cache is updated:  it resets the key
+
 	FFARR_WALK(&q->users, quser) {
 		dbglog_q(q, LOG_DBGFLOW, "calling user function %p, udata:%p"
 			, quser->ondone, quser->udata);
-		quser->ondone(quser->udata, &res);
+		quser->ondone(quser->udata, ures);
 	}
 	ffarr2_free(&res.ip);
 	for (i = 0;  i != q->nres;  i++) {
@@ -832,6 +1053,174 @@ done:
 }
 
 
+/** Get the minimum TTL of the received records. */
+static uint query_ttl(dns_query *q)
+{
+	uint ttl = (uint)-1;
+	for (uint i = 0;  i != q->nres;  i++) {
+		ttl = ffmin(ttl, q->ttl[i]);
+	}
+	return ttl;
+}
+
+
+static uint64 cache_now(ffdnsclient *r)
+{
+	fftime t = r->time();
+	return fftime_sec(&t);
+}
+
+static dns_centry* cache_find(ffdnsclient *r, const ffstr *name, uint namecrc)
+{
+	ffrbt_node *found = ffrbt_find(&r->cached, namecrc, NULL);
+	if (found == NULL)
+		return NULL;
+	dns_centry *ce = centry_sib(found);
+	if (!ffstr_ieq2(&ce->name, name))
+		return NULL;
+	return ce;
+}
+
+static void centry_result(const dns_centry *ce, ffdnscl_result *res)
+{
+	ffmem_tzero(res);
+	res->name = ce->name;
+	res->status = ce->status;
+	res->ip.ptr = (void*)ce->ip;
+	res->ip.len = ce->nip;
+}
+
+/** Complete the request with the cached answer.
+Return 0 on success;  1 if the item has expired. */
+static int cache_hit(ffdnsclient *r, dns_centry *ce, ffdnscl_onresolve ondone, void *udata)
+{
+	uint64 now = cache_now(r);
+	if (now >= ce->expire) {
+		if (centry_negative(ce)
+			|| now >= ce->expire + r->cache.stale_ttl)
+			cache_rm(r, ce);
+		// otherwise keep the item until we know whether the servers respond
+		return 1;
+	}
+
+	if (!centry_negative(ce)) {
+		r->cstat.hits++;
+		if (r->cache.prefetch != 0
+			&& (ce->expire - now) * 100 <= (uint64)ce->ttl * (100 - ffmin(r->cache.prefetch, 100)))
+			cache_prefetch(r, ce);
+	} else {
+		r->cstat.neg_hits++;
+	}
+
+	fflist_moveback(&r->cached_lru, &ce->lru_li);
+	dbglog_x(r, "%S: cache hit.  status:%d  TTL:%U"
+		, &ce->name, ce->status, ce->expire - now);
+
+	ffdnscl_result res;
+	centry_result(ce, &res);
+	ondone(udata, &res);
+	return 0;
+}
+
+/** Refresh the item in background before it expires. */
+static void cache_prefetch(ffdnsclient *r, dns_centry *ce)
+{
+	ffrbt_node *parent;
+	if (NULL != ffrbt_find(&r->queries, ce->rbtnod.key, &parent))
+		return; // the query is already pending
+
+	dbglog_x(r, "%S: prefetching", &ce->name);
+	r->cstat.prefetches++;
+	query_new(r, &ce->name, ce->rbtnod.key, parent, NULL, NULL);
+}
+
+/** Store the answer from server:
+ a positive item with the records' TTL, or a negative item if all responses are NXDOMAIN or have no records. */
+static void cache_add(ffdnsclient *r, dns_query *q, const ffdnscl_result *res)
+{
+	uint ttl;
+	if (res->status == FFDNS_NOERROR && res->ip.len != 0) {
+		ttl = query_ttl(q);
+		ttl = ffmax(ttl, r->cache.min_ttl);
+		ttl = ffmin(ttl, r->cache.max_ttl);
+	} else if (q->nneg == 1 + (q->ques_len6 != 0)
+		&& r->cache.neg_ttl != 0) {
+		ttl = r->cache.neg_ttl;
+	} else {
+		return;
+	}
+	if (ttl == 0)
+		return;
+
+	dns_centry *ce = cache_find(r, &q->name, q->rbtnod.key);
+	if (ce == NULL) {
+		ffrbt_node *found = ffrbt_find(&r->cached, q->rbtnod.key, NULL);
+		if (found != NULL)
+			cache_rm(r, centry_sib(found)); // CRC collision:  replace the old item
+	} else {
+		cache_rm(r, ce);
+	}
+
+	if (r->cached.len >= r->cache.max_items) {
+		ce = FF_GETPTR(dns_centry, lru_li, fflist_first(&r->cached_lru));
+		dbglog_x(r, "%S: evicting from cache", &ce->name);
+		cache_rm(r, ce);
+		r->cstat.evictions++;
+	}
+
+	size_t ipsize = res->ip.len * sizeof(ffip6);
+	if (NULL == (ce = ffmem_alloc(sizeof(dns_centry) + ipsize + q->name.len))) {
+		syserrlog_x(r, "ffmem_alloc", 0);
+		return;
+	}
+	ffmem_zero(ce, sizeof(dns_centry));
+	ce->status = res->status;
+	ce->ttl = ttl;
+	ce->expire = cache_now(r) + ttl;
+	ce->nip = res->ip.len;
+	ffmemcpy(ce->ip, res->ip.ptr, ipsize);
+	ce->name.ptr = (char*)ce->ip + ipsize;
+	ce->name.len = q->name.len;
+	ffmemcpy(ce->name.ptr, q->name.ptr, q->name.len);
+
+	ffrbt_node *parent;
+	ffrbt_find(&r->cached, q->rbtnod.key, &parent);
+	ce->rbtnod.key = q->rbtnod.key;
+	ffrbt_insert(&r->cached, &ce->rbtnod, parent);
+	fflist_ins(&r->cached_lru, &ce->lru_li);
+	dbglog_x(r, "%S: cached.  status:%d  TTL:%u  items:%L"
+		, &ce->name, ce->status, ttl, r->cached.len);
+}
+
+/** Get the expired item to serve when DNS servers don't respond. */
+static dns_centry* cache_stale(ffdnsclient *r, dns_query *q)
+{
+	if (r->cache.stale_ttl == 0)
+		return NULL;
+	dns_centry *ce = cache_find(r, &q->name, q->rbtnod.key);
+	if (ce == NULL
+		|| centry_negative(ce)
+		|| cache_now(r) >= ce->expire + r->cache.stale_ttl)
+		return NULL;
+
+	warnlog_q(q, "serving stale answer from cache", 0);
+	r->cstat.stale++;
+	return ce;
+}
+
+static void cache_rm(ffdnsclient *r, dns_centry *ce)
+{
+	ffrbt_rm(&r->cached, &ce->rbtnod);
+	fflist_rm(&r->cached_lru, &ce->lru_li);
+	centry_free(ce);
+}
+
+static void centry_free(void *param)
+{
+	ffmem_free(param);
+}
+
+
 int ffdnscl_serv_add(ffdnsclient *r, const ffstr *saddr)
 {
 	ffdnscl_serv *serv = ffmem_new(ffdnscl_serv);
@@ -920,6 +1309,113 @@ static void serv_fin(ffdnscl_serv *serv)
 	ffmem_free(serv);
 }
 
+int ffdnscl_servstat(ffdnsclient *r, uint i, struct ffdnscl_servstat *st)
+{
+	ffdnscl_serv *serv;
+	_FFLIST_WALK(&r->servs, serv, sib) {
+		if (i-- != 0)
+			continue;
+
+		ffmem_tzero(st);
+		st->addr = serv->saddr;
+		st->rtt = serv->srtt;
+		st->rttvar = serv->rttvar;
+		st->fail_rate = serv->fail_rate;
+		st->demoted = (time_ms(r) < serv->demote_until);
+		st->queries = serv->nqueries;
+		st->answers = serv->nanswers;
+		st->fails = serv->nfails;
+		st->hedged = serv->nhedged;
+		return 0;
+	}
+	return -1;
+}
+
+/** Update RTT estimation as in RFC 6298.
+rtt: usec */
+static void serv_rtt(ffdnscl_serv *serv, uint rtt)
+{
+	if (!serv->measured) {
+		serv->measured = 1;
+		serv->srtt = rtt;
+		serv->rttvar = rtt / 2;
+		return;
+	}
+	uint err = (rtt > serv->srtt) ? rtt - serv->srtt : serv->srtt - rtt;
+	serv->rttvar = (3 * (uint64)serv->rttvar + err) / 4;
+	serv->srtt = (7 * (uint64)serv->srtt + rtt) / 8;
+}
+
+/** Server has responded. */
+static void serv_ok(ffdnscl_serv *serv, uint rtt)
+{
+	serv->nanswers++;
+	serv->nfail_seq = 0;
+	serv->fail_rate -= serv->fail_rate / 8;
+	serv_rtt(serv, rtt);
+}
+
+/** Server hasn't responded in time or has returned an error.
+Demote the server after several failures in a row. */
+static void serv_fail(ffdnscl_serv *serv)
+{
+	ffdnsclient *r = serv->r;
+	serv->nfails++;
+	serv->fail_rate += (1000 - serv->fail_rate) / 8;
+	if (++serv->nfail_seq != SERV_MAX_FAILS)
+		return;
+
+	serv->nfail_seq = 0;
+	serv->demote_until = time_ms(r) + r->demote_time;
+	warnlog_srv(serv, "server is demoted for %ums after %u failures.  Failure rate:%u%%"
+		, r->demote_time, SERV_MAX_FAILS, serv->fail_rate / 10);
+}
+
+/** Time to wait for the server's response before sending the query to another server (msec).
+Never exceeds retry_timeout. */
+static uint serv_hedge_delay(ffdnscl_serv *serv)
+{
+	uint max = serv->r->retry_timeout / 2;
+	uint d = max / 2;
+	if (serv->measured)
+		d = ((uint64)serv->srtt + 4 * (uint64)serv->rttvar) / 1000;
+	d = ffmax(ffmin(d, max), HEDGE_MIN_DELAY);
+	return ffmin(d, serv->r->retry_timeout);
+}
+
+/** Get the server with the best score.
+Score is the smoothed RTT weighted by failure rate.
+Servers that haven't been used yet are tried first.
+Demoted servers are used only if there's no other choice.
+exclude: server to skip */
+static ffdnscl_serv* serv_best(ffdnsclient *r, ffdnscl_serv *exclude)
+{
+	ffdnscl_serv *serv, *best = NULL, *demoted = NULL;
+	uint64 now = time_ms(r), score, best_score = (uint64)-1;
+
+	_FFLIST_WALK(&r->servs, serv, sib) {
+		if (serv == exclude)
+			continue;
+
+		if (now < serv->demote_until) {
+			if (demoted == NULL || serv->demote_until < demoted->demote_until)
+				demoted = serv;
+			continue;
+		}
+
+		uint rtt = serv->srtt;
+		if (!serv->measured && serv->nfails != 0)
+			rtt = r->retry_timeout * 1000;
+		score = (uint64)rtt * (1000 + 4 * serv->fail_rate);
+		if (score < best_score) {
+			best = serv;
+			best_score = score;
+		}
+	}
+
+	return (best != NULL) ? best : demoted;
+}
+
 /** Round-robin balancer. */
 static ffdnscl_serv * serv_next(ffdnsclient *r)
 {
@@ -3,18 +3,60 @@ Copyright (c) 2019 Simon Zolin
 */
 
 #include <FF/net/http-client.h>
+#include <FF/sys/sendfile.h>
 #include <FF/list.h>
 #include <FFOS/asyncio.h>
+#include <FFOS/atomic.h>
 
 
 static fflist1 recycled_cons;
+static fflock recycle_lk; // for recycled_cons and recycled_conns:  requests may be processed by different threads
+
+typedef struct http http;
+
+/** TCP connection.
+It's put into the pool after the request is complete, and then used by the next request to the same server.
+With pipelining, several requests share one connection:
+ they wait for their responses in the order the requests were sent. */
+typedef struct conn {
+	ffskt sk;
+	ffaio_task aio;
+	fflist1_item recycled;
+	fflist pipe; // requests waiting for response;  the first one receives data
+	http *wr; // request which is being sent
+	uint busy :1 // the connection is in 'busy' list
+		, broken :1 // a pipelined request is cancelled:  don't use the connection after the current response
+		;
+
+	// pooled or busy connection:
+	ffchain_item sib;
+	ffhttpcl_pool *pool;
+	ffstr key; // server: "[proxy ]host:port"
+	uint64 expire; // msec
+	fftmrq_entry tmr;
+	ffhttpcl_timer timer;
+} conn;
+
+static fflist1 recycled_conns;
+
+struct ffhttpcl_pool {
+	fflist idle; // idle connections, the most recently used first
+	fflist busy; // connections accepting pipelined requests
+	struct ffhttpcl_poolstat stat;
+};
 
 struct filter {
 	const struct ffhttp_filter *iface;
 	void *p;
 };
 
-typedef struct http {
+enum REQBODY {
+	REQBODY_NONE,
+	REQBODY_CONTLEN,
+	REQBODY_CHUNKED,
+};
+
+struct http {
 	uint state;
 
 	char *method;
@@ -28,10 +70,12 @@ typedef struct http {
 	ffip6 ip;
 	ffaddrinfo *addr;
 	ffip_iter curaddr;
-	ffskt sk;
-	ffaio_task aio;
+	conn *conn;
+	ffchain_item pipe_sib;
+	ffstr poolkey;
 	uint reconnects;
 	fftmrq_entry tmr;
+	fftmrq_entry restart_tmr; // restart after the connection with pipelined requests is dropped
 	ffhttp_cook hdrs;
 
 	ffstr *bufs;
@@ -42,6 +86,14 @@ typedef struct http {
 	ffstr data, outdata;
 
 	ffstr hbuf;
+
+	// request body:
+	uint reqbody; //enum REQBODY
+	uint64 body_left; // bytes left to send, for REQBODY_CONTLEN
+	ffsf sf;
+	ffiovec iov[4];
+	char chunkhdr[FFINT_MAXCHARS + 2];
+
 	ffhttp_response resp;
 	uint nredirect;
 	struct ffhttpcl_conf conf;
@@ -51,13 +103,18 @@ typedef struct http {
 		, iowait :1 //waiting for I/O, all input data is consumed
 		, async :1
 		, preload :1 //fill all buffers
+		, body_started :1 //request body is passed by user
+		, body_fin :1 //the last part of request body is prepared
+		, pipewait :1 //waiting for the previous response on the connection
+		, pipe_data :1 //bufs[0] contains data received after the previous response
+		, nopipe :1 //don't pipeline after the pipelined request has failed
 		;
 
 	ffhttpcl_handler handler;
 	void *udata;
 	uint status;
 	struct filter f;
-} http;
+};
 
 
 #define dbglog(...) \
@@ -91,13 +148,25 @@ static int tcp_recv(http *c);
 static void tcp_ontmr(void *param);
 static int tcp_recvhdrs(http *c);
 static int tcp_send(http *c);
+static int tcp_sendv(http *c);
 static int tcp_ioerr(http *c);
 
+static conn* conn_new();
+static void conn_close(conn *cn);
+static void conn_attach(http *c, conn *cn);
+static void conn_drop(http *c);
+static void conn_leave(http *c);
+static http* conn_done(http *c);
+static void pipe_ready(http *c);
+static int pool_get(http *c);
+static void pool_put(http *c);
+
 
 static const struct ffhttp_filter*const http_filters[] = {
 	&ffhttp_chunked_filter, &ffhttp_contlen_filter, &ffhttp_connclose_filter
 };
 static int http_prepreq(http *c, ffstr *dst);
+static int http_prepbody(http *c, const ffstr *data);
 static int http_parse(http *c);
 static int http_recvbody(http *c, uint tcpfin);
 
@@ -105,10 +174,51 @@ static int http_recvbody(http *c, uint tcpfin);
 void ffhttpcl_deinit()
 {
 	http *c;
+	conn *cn;
+	fflk_lock(&recycle_lk);
+
 	while (NULL != (c = (void*)fflist1_pop(&recycled_cons))) {
 		c = FF_GETPTR(http, recycled, c);
 		ffmem_free(c);
 	}
+
+	while (NULL != (cn = (void*)fflist1_pop(&recycled_conns))) {
+		cn = FF_GETPTR(conn, recycled, cn);
+		ffmem_free(cn);
+	}
+
+	fflk_unlock(&recycle_lk);
+}
+
+ffhttpcl_pool* ffhttpcl_pool_create(void)
+{
+	ffhttpcl_pool *p;
+	if (NULL == (p = ffmem_new(ffhttpcl_pool)))
+		return NULL;
+	fflist_init(&p->idle);
+	fflist_init(&p->busy);
+	return p;
+}
+
+void ffhttpcl_pool_free(ffhttpcl_pool *p)
+{
+	if (p == NULL)
+		return;
+
+	conn *cn;
+	ffchain_item *next;
+	FFLIST_WALKSAFE(&p->idle, cn, sib, next) {
+		fflist_rm(&p->idle, &cn->sib);
+		conn_close(cn);
+	}
+	FF_ASSERT(p->busy.len == 0);
+	ffmem_free(p);
+}
+
+void ffhttpcl_poolstat(ffhttpcl_pool *p, struct ffhttpcl_poolstat *st)
+{
+	*st = p->stat;
+	st->idle = p->idle.len;
 }
 
 
@@ -154,11 +264,13 @@ static void timer_empty(fftmrq_entry *tmr, uint value_ms)
 void* ffhttpcl_request(const char *method, const char *url, uint flags)
 {
 	http *c;
-	if (NULL != (c = (void*)fflist1_pop(&recycled_cons)))
+	fflk_lock(&recycle_lk);
+	c = (void*)fflist1_pop(&recycled_cons);
+	fflk_unlock(&recycle_lk);
+	if (c != NULL)
 		c = FF_GETPTR(http, recycled, c);
 	else if (NULL == (c = ffmem_new(http)))
 		return NULL;
-	c->sk = FF_BADSKT;
 	ffhttp_respinit(&c->resp);
 	ffhttp_cookinit(&c->hdrs, NULL, 0);
 	c->conf.log = &log_empty;
@@ -186,6 +298,7 @@ void* ffhttpcl_request(const char *method, const char *url, uint flags)
 	c->conf.timeout = 5000;
 	c->conf.max_redirect = 10;
 	c->conf.max_reconnect = 3;
+	c->conf.pool.max_per_host = 4;
 
 	return c;
 
@@ -201,20 +314,17 @@ void ffhttpcl_close(void *con)
 
 	http *c = con;
 	c->conf.timer(&c->tmr, 0);
+	c->conf.timer(&c->restart_tmr, 0);
 
 	if (c->f.p != NULL)
 		c->f.iface->close(c->f.p);
 
 	FF_SAFECLOSE(c->addr, NULL, ffaddr_free);
-	if (c->sk != FF_BADSKT) {
-		ffskt_fin(c->sk);
-		ffskt_close(c->sk);
-		c->sk = FF_BADSKT;
-	}
+	conn_leave(c);
+	ffstr_free(&c->poolkey);
 	ffarr_free(&c->target_url);
 	ffstr_free(&c->orig_target_url);
 	ffmem_free(c->method);
-	ffaio_fin(&c->aio);
 	ffhttp_respfree(&c->resp);
 	ffhttp_cookdestroy(&c->hdrs);
 
@@ -228,10 +338,10 @@ void ffhttpcl_close(void *con)
 
 	ffstr_free(&c->hbuf);
 
-	uint inst = c->aio.instance;
 	ffmem_tzero(c);
-	c->aio.instance = inst;
+	fflk_lock(&recycle_lk);
 	fflist1_push(&recycled_cons, &c->recycled);
+	fflk_unlock(&recycle_lk);
 }
 
 void ffhttpcl_conf(void *con, struct ffhttpcl_conf *conf, uint flags)
@@ -252,7 +362,8 @@ void ffhttpcl_sethandler(void *con, ffhttpcl_handler func, void *udata)
 
 enum {
 	I_START, I_ADDR, I_NEXTADDR, I_CONN,
-	I_HTTP_REQ, I_HTTP_REQ_SEND, I_HTTP_RESP, I_HTTP_RESP_PARSE, I_HTTP_RECVBODY, I_HTTP_RESPBODY,
+	I_HTTP_REQ, I_HTTP_REQ_SEND, I_HTTP_REQBODY, I_HTTP_REQBODY_SEND, I_HTTP_REQ_DONE,
+	I_HTTP_RESP, I_HTTP_RESP_PARSE, I_HTTP_RECVBODY, I_HTTP_RESPBODY,
 	I_DONE, I_ERR, I_ERR2, I_NOOP,
 };
 
@@ -285,9 +396,14 @@ static void httpcl_process(http *c)
 		return;
 
 	case I_ADDR:
-		if (0 != ip_resolve(c)) {
+		r = ip_resolve(c);
+		if (r < 0) {
 			c->state = I_ERR;
 			continue;
+		} else if (r == 1) {
+			c->state = I_HTTP_REQ; // using pooled connection
+			call_handler(c, FFHTTPCL_REQ_WAIT);
+			return;
 		}
 		c->state = I_NEXTADDR;
 		call_handler(c, FFHTTPCL_IP_WAIT);
@@ -315,6 +431,12 @@ static void httpcl_process(http *c)
 
 	case I_HTTP_REQ:
 		http_prepreq(c, &c->data);
+		if (c->reqbody != REQBODY_NONE) {
+			// headers are sent together with the first part of body
+			c->state = I_HTTP_REQBODY;
+			call_handler(c, FFHTTPCL_REQ_BODY);
+			return;
+		}
 		c->state = I_HTTP_REQ_SEND;
 		//fallthrough
 
@@ -326,7 +448,30 @@ static void httpcl_process(http *c)
 			tcp_ioerr(c);
 			continue;
 		}
+		c->state = I_HTTP_REQ_DONE;
+		continue;
+
+	case I_HTTP_REQBODY:
+		return; // waiting for user data in send()
 
+	case I_HTTP_REQBODY_SEND:
+		r = tcp_sendv(c);
+		if (r == R_ASYNC)
+			return;
+		else if (r == R_ERR) {
+			tcp_ioerr(c);
+			continue;
+		}
+		if (!c->body_fin) {
+			c->state = I_HTTP_REQBODY;
+			call_handler(c, FFHTTPCL_REQ_BODY);
+			return;
+		}
+		c->state = I_HTTP_REQ_DONE;
+		//fallthrough
+
+	case I_HTTP_REQ_DONE:
+		pipe_ready(c);
 		dbglog("receiving response...");
 		ffstr_set(&c->data, c->bufs[0].ptr, c->conf.buffer_size);
 		c->state = I_HTTP_RESP;
@@ -334,6 +479,17 @@ static void httpcl_process(http *c)
 		return;
 
 	case I_HTTP_RESP:
+		if (c->conn->pipe.root.next != &c->pipe_sib) {
+			dbglog("waiting for the previous response on this connection...");
+			c->pipewait = 1;
+			return;
+		}
+		if (c->pipe_data) {
+			// the response was received together with the previous one
+			c->pipe_data = 0;
+			c->state = I_HTTP_RESP_PARSE;
+			continue;
+		}
 		r = tcp_recvhdrs(c);
 		if (r == R_ASYNC)
 			return;
@@ -440,8 +596,15 @@ static void httpcl_process(http *c)
 	case I_ERR:
 	case I_DONE: {
 		uint r = (c->state == I_ERR) ? FFHTTPCL_ERR : FFHTTPCL_DONE;
+		http *next = NULL;
+		if (c->state == I_DONE)
+			next = conn_done(c);
+		else
+			conn_drop(c);
 		c->state = I_NOOP;
 		call_handler(c, r);
+		if (next != NULL)
+			httpcl_process(next);
 		return;
 	}
 	case I_ERR2:
@@ -457,8 +620,16 @@ static void httpcl_process(http *c)
 
 void ffhttpcl_send(void *con, const ffstr *data)
 {
-	FF_ASSERT(data == NULL);
-	httpcl_process(con);
+	http *c = con;
+	if (c->state == I_HTTP_REQBODY) {
+		if (0 != http_prepbody(c, data))
+			c->state = I_ERR;
+		else
+			c->state = I_HTTP_REQBODY_SEND;
+	} else {
+		FF_ASSERT(data == NULL);
+	}
+	httpcl_process(c);
 }
 
 int ffhttpcl_recv(void *con, ffhttp_response **resp, ffstr *data)
@@ -473,6 +644,17 @@ int ffhttpcl_recv(void *con, ffhttp_response **resp, ffstr *data)
 void ffhttpcl_header(void *con, const ffstr *name, const ffstr *val, uint flags)
 {
 	http *c = con;
+
+	if (ffstr_ieqcz(name, "Content-Length")) {
+		uint64 n;
+		if (val->len == ffs_toint(val->ptr, val->len, &n, FFS_INT64) && n != 0) {
+			c->reqbody = REQBODY_CONTLEN;
+			c->body_left = n;
+		}
+	} else if (ffstr_ieqcz(name, "Transfer-Encoding") && ffstr_ieqcz(val, "chunked")) {
+		c->reqbody = REQBODY_CHUNKED;
+	}
+
 	ffhttp_addhdr_str(&c->hdrs, name, val);
 }
 
@@ -503,6 +685,9 @@ static int ip_resolve(http *c)
 		c->flags |= FFHTTPCL_NOREDIRECT;
 	}
 
+	if (0 == pool_get(c))
+		return 1;
+
 	if (r < 0) {
 		errlog("bad IP address: %S", &c->hostname);
 		goto done;
@@ -571,20 +756,28 @@ static int tcp_prepare(http *c, ffaddr *a)
 		size_t n = ffaddr_tostr(a, saddr, sizeof(saddr), FFADDR_USEPORT);
 		infolog("connecting to %S (%*s)...", &c->hostname, n, saddr);
 
-		if (FF_BADSKT == (c->sk = ffskt_create(family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP))) {
+		if (c->conn == NULL) {
+			conn *cn = conn_new();
+			if (cn == NULL) {
+				syserrlog("%s", ffmem_alloc_S);
+				return FFHTTPCL_ERR;
+			}
+			conn_attach(c, cn);
+		}
+		conn *cn = c->conn;
+
+		if (FF_BADSKT == (cn->sk = ffskt_create(family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP))) {
 			syswarnlog("%s", ffskt_create_S);
-			ffskt_close(c->sk);
-			c->sk = FF_BADSKT;
 			continue;
 		}
 
-		if (0 != ffskt_setopt(c->sk, IPPROTO_TCP, TCP_NODELAY, 1))
+		if (0 != ffskt_setopt(cn->sk, IPPROTO_TCP, TCP_NODELAY, 1))
 			syswarnlog("%s", ffskt_setopt_S);
 
-		ffaio_init(&c->aio);
-		c->aio.sk = c->sk;
-		c->aio.udata = c;
-		if (0 != ffaio_attach(&c->aio, c->conf.kq, FFKQU_READ | FFKQU_WRITE)) {
+		ffaio_init(&cn->aio);
+		cn->aio.sk = cn->sk;
+		cn->aio.udata = cn;
+		if (0 != ffaio_attach(&cn->aio, c->conf.kq, FFKQU_READ | FFKQU_WRITE)) {
 			syserrlog("%s", ffkqu_attach_S);
 			return FFHTTPCL_ERR;
 		}
@@ -595,23 +788,41 @@ static int tcp_prepare(http *c, ffaddr *a)
 	return FFHTTPCL_ENOADDR;
 }
 
-static void tcp_aio(void *udata)
+static void tcp_aio(http *c)
 {
-	http *c = udata;
 	c->async = 0;
 	c->conf.timer(&c->tmr, 0);
 	httpcl_process(c);
 }
 
+/** Socket is readable:  pass the event to the request that receives response. */
+static void tcp_onread(void *udata)
+{
+	conn *cn = udata;
+	if (cn->pipe.len == 0)
+		return;
+	tcp_aio(FF_GETPTR(http, pipe_sib, cn->pipe.root.next));
+}
+
+/** Socket is writable:  pass the event to the request that is being sent. */
+static void tcp_onwrite(void *udata)
+{
+	conn *cn = udata;
+	if (cn->wr == NULL)
+		return;
+	tcp_aio(cn->wr);
+}
+
 static int tcp_connect(http *c, const struct sockaddr *addr, socklen_t addr_size)
 {
 	int r;
-	r = ffaio_connect(&c->aio, &tcp_aio, addr, addr_size);
+	conn *cn = c->conn;
+	r = ffaio_connect(&cn->aio, &tcp_onwrite, addr, addr_size);
 	if (r == FFAIO_ERROR) {
 		syswarnlog("%s", ffskt_connect_S);
-		ffskt_close(c->sk);
-		c->sk = FF_BADSKT;
-		ffaio_fin(&c->aio);
+		ffskt_close(cn->sk);
+		cn->sk = FF_BADSKT;
+		ffaio_fin(&cn->aio);
 		return R_MORE;
 
 	} else if (r == FFAIO_ASYNC) {
@@ -645,7 +856,7 @@ static int tcp_recvhdrs(http *c)
 		return R_MORE;
 	}
 
-	r = ffaio_recv(&c->aio, &tcp_aio, ffarr_end(&c->bufs[0]), c->conf.buffer_size - c->bufs[0].len);
+	r = ffaio_recv(&c->conn->aio, &tcp_onread, ffarr_end(&c->bufs[0]), c->conf.buffer_size - c->bufs[0].len);
 	if (r == FFAIO_ASYNC) {
 		dbglog("async recv...");
 		c->async = 1;
@@ -668,16 +879,21 @@ static int tcp_recvhdrs(http *c)
 
 static int tcp_ioerr(http *c)
 {
+	if (c->body_started) {
+		errlog("can't resend request body", 0);
+		c->state = I_ERR;
+		return 1;
+	}
+
 	if (c->reconnects++ == c->conf.max_reconnect) {
 		errlog("reached max number of reconnections", 0);
 		c->state = I_ERR;
 		return 1;
 	}
 
-	ffskt_fin(c->sk);
-	ffskt_close(c->sk);
-	c->sk = FF_BADSKT;
-	ffaio_fin(&c->aio);
+	conn_drop(c);
+	c->pipewait = 0;
+	c->pipe_data = 0;
 
 	ffarr_free(&c->target_url);
 	ffstr_set2(&c->target_url, &c->orig_target_url);
@@ -711,9 +927,9 @@ static int tcp_recv(http *c)
 	for (;;) {
 
 		dbglog("buf #%u recv...  rpending:%u  size:%u"
-			, c->wbuf, c->aio.rpending
+			, c->wbuf, c->conn->aio.rpending
 			, (int)c->conf.buffer_size - (int)c->curtcp_len);
-		r = ffaio_recv(&c->aio, &tcp_aio, c->bufs[c->wbuf].ptr + c->curtcp_len, c->conf.buffer_size - c->curtcp_len);
+		r = ffaio_recv(&c->conn->aio, &tcp_onread, c->bufs[c->wbuf].ptr + c->curtcp_len, c->conf.buffer_size - c->curtcp_len);
 		if (r == FFAIO_ASYNC) {
 			dbglog("buf #%u async recv...", c->wbuf);
 			c->async = 1;
@@ -753,7 +969,7 @@ static int tcp_send(http *c)
 	int r;
 
 	for (;;) {
-		r = ffaio_send(&c->aio, &tcp_aio, c->data.ptr, c->data.len);
+		r = ffaio_send(&c->conn->aio, &tcp_onwrite, c->data.ptr, c->data.len);
 		if (r == FFAIO_ERROR) {
 			syserrlog("%s", ffskt_send_S);
 			return R_ERR;
@@ -771,6 +987,391 @@ static int tcp_send(http *c)
 	}
 }
 
+static int tcp_sendv(http *c)
+{
+	int64 r;
+
+	for (;;) {
+		r = ffsf_sendasync(&c->sf, &c->conn->aio, &tcp_onwrite);
+		if (r == FFAIO_ERROR) {
+			syserrlog("%s", ffskt_send_S);
+			return R_ERR;
+
+		} else if (r == FFAIO_ASYNC) {
+			c->async = 1;
+			c->conf.timer(&c->tmr, c->conf.timeout);
+			return R_ASYNC;
+		}
+
+		dbglog("send: +%U", r);
+		if (0 == ffsf_shift(&c->sf, r))
+			return 0;
+	}
+}
+
+
+static conn* conn_new()
+{
+	conn *cn;
+	fflk_lock(&recycle_lk);
+	cn = (void*)fflist1_pop(&recycled_conns);
+	fflk_unlock(&recycle_lk);
+	if (cn != NULL)
+		cn = FF_GETPTR(conn, recycled, cn);
+	else if (NULL == (cn = ffmem_new(conn)))
+		return NULL;
+	cn->sk = FF_BADSKT;
+	fflist_init(&cn->pipe);
+	return cn;
+}
+
+/** Close socket and recycle the object:
+ its memory stays valid for the pending kernel events which are filtered by 'aio.instance'. */
+static void conn_close(conn *cn)
+{
+	if (cn->timer != NULL)
+		cn->timer(&cn->tmr, 0);
+	if (cn->sk != FF_BADSKT) {
+		ffskt_fin(cn->sk);
+		ffskt_close(cn->sk);
+	}
+	ffaio_fin(&cn->aio);
+	ffstr_free(&cn->key);
+
+	uint inst = cn->aio.instance;
+	ffmem_tzero(cn);
+	cn->aio.instance = inst;
+	fflk_lock(&recycle_lk);
+	fflist1_push(&recycled_conns, &cn->recycled);
+	fflk_unlock(&recycle_lk);
+}
+
+/** Use the connection for sending the request. */
+static void conn_attach(http *c, conn *cn)
+{
+	c->conn = cn;
+	fflist_ins(&cn->pipe, &c->pipe_sib);
+	cn->wr = c;
+}
+
+static void busy_rm(conn *cn)
+{
+	if (!cn->busy)
+		return;
+	fflist_rm(&cn->pool->busy, &cn->sib);
+	cn->busy = 0;
+}
+
+static void pipe_onrestart(void *param)
+{
+	http *c = param;
+	httpcl_process(c);
+}
+
+/** Close the connection and restart the other requests pipelined over it.
+The restarted requests are resumed from the timer queue, not from here:
+ the caller is in the middle of processing its own request,
+ and a resumed request might complete and be closed by user. */
+static void conn_drop(http *c)
+{
+	conn *cn = c->conn;
+	if (cn == NULL)
+		return;
+
+	http *o;
+	ffchain_item *next;
+	FFLIST_WALKSAFE(&cn->pipe, o, pipe_sib, next) {
+		fflist_rm(&cn->pipe, &o->pipe_sib);
+		o->conn = NULL;
+		if (o == c)
+			continue;
+
+		// resume the request if it's waiting for an event from this connection;
+		//  otherwise it's resumed by the user's send()
+		uint resume = o->async || o->pipewait;
+		o->conf.timer(&o->tmr, 0);
+		o->async = 0;
+		o->nopipe = 1;
+		tcp_ioerr(o);
+		if (resume) {
+			o->restart_tmr.handler = &pipe_onrestart;
+			o->restart_tmr.param = o;
+			o->conf.timer(&o->restart_tmr, 1);
+		}
+	}
+	busy_rm(cn);
+	conn_close(cn);
+}
+
+/** Release the connection on closing the request. */
+static void conn_leave(http *c)
+{
+	conn *cn = c->conn;
+	if (cn == NULL)
+		return;
+
+	if (cn->pipe.root.next != &c->pipe_sib) {
+		// the response to this request will be received after the current response:
+		//  don't disturb the request that is receiving data, but close the connection after it
+		fflist_rm(&cn->pipe, &c->pipe_sib);
+		c->conn = NULL;
+		if (cn->wr == c)
+			cn->wr = NULL;
+		cn->broken = 1;
+		busy_rm(cn);
+		return;
+	}
+
+	conn_drop(c);
+}
+
+/** Return TRUE if the server will keep the connection alive and there's no unprocessed data. */
+static int conn_reusable(http *c)
+{
+	if ((c->flags & FFHTTPCL_HTTP10)
+		|| !c->resp.h.http11
+		|| c->resp.h.conn_close
+		|| c->f.iface == &ffhttp_connclose_filter
+		|| c->conn->broken
+		|| c->curtcp_len != 0)
+		return 0;
+	for (uint i = 0;  i != c->conf.nbuffers;  i++) {
+		if (c->bufs[i].len != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/** The response is received completely:
+ pass the connection to the next pipelined request or put it into the pool.
+Return the next request if it must be resumed. */
+static http* conn_done(http *c)
+{
+	conn *cn = c->conn;
+	if (cn == NULL)
+		return NULL;
+
+	if (cn->pipe.len == 1) {
+		busy_rm(cn);
+		pool_put(c);
+		return NULL;
+	}
+
+	http *next = FF_GETPTR(http, pipe_sib, c->pipe_sib.next);
+	if (!conn_reusable(c)
+		|| c->data.len > next->conf.buffer_size) {
+		conn_drop(c);
+		return NULL;
+	}
+
+	fflist_rm(&cn->pipe, &c->pipe_sib);
+	c->conn = NULL;
+
+	if (c->data.len != 0) {
+		// the beginning of the next response
+		ffmemcpy(next->bufs[0].ptr, c->data.ptr, c->data.len);
+		next->bufs[0].len = c->data.len;
+		next->pipe_data = 1;
+		c->data.len = 0;
+	}
+
+	dbglog("connection is passed to the next pipelined request");
+	if (!next->pipewait)
+		return NULL;
+	next->pipewait = 0;
+	return next;
+}
+
+static const char *const idempotent_methods[] = {
+	"DELETE", "GET", "HEAD", "OPTIONS", "PUT",
+};
+
+/** Return TRUE if the request may be sent without waiting for the previous response. */
+static int pipe_allowed(http *c)
+{
+	return c->conf.pool.pipeline > 1
+		&& c->conf.pool.conns != NULL
+		&& !c->nopipe
+		&& !(c->flags & FFHTTPCL_HTTP10)
+		&& c->reqbody == REQBODY_NONE
+		&& 0 <= ffs_findarrz(idempotent_methods, FFCNT(idempotent_methods), c->method, ffsz_len(c->method));
+}
+
+/** The request is sent:  allow the next requests to the same server to be pipelined over this connection. */
+static void pipe_ready(http *c)
+{
+	conn *cn = c->conn;
+	cn->wr = NULL;
+	if (cn->busy || cn->broken || !pipe_allowed(c))
+		return;
+
+	if (cn->key.len == 0
+		&& NULL == ffstr_alcopystr(&cn->key, &c->poolkey))
+		return;
+	cn->pool = c->conf.pool.conns;
+	fflist_ins(&cn->pool->busy, &cn->sib);
+	cn->busy = 1;
+}
+
+/** Get busy connection to the server which accepts pipelined requests.
+Return 0 if found. */
+static int pipe_join(http *c)
+{
+	if (!pipe_allowed(c))
+		return -1;
+
+	ffhttpcl_pool *p = c->conf.pool.conns;
+	uint max = c->conf.pool.pipeline;
+	conn *cn;
+	_FFLIST_WALK(&p->busy, cn, sib) {
+		if (!ffstr_eq2(&cn->key, &c->poolkey)
+			|| cn->wr != NULL || cn->pipe.len >= max)
+			continue;
+
+		conn_attach(c, cn);
+		p->stat.pipelined++;
+		infolog("pipelining request over connection to %S", &c->poolkey);
+		return 0;
+	}
+
+	return -1;
+}
+
+static uint64 time_ms()
+{
+	fftime t;
+	ffclk_gettime(&t);
+	return fftime_ms(&t);
+}
+
+/** Idle timer has expired for the pooled connection. */
+static void pool_ontmr(void *param)
+{
+	conn *cn = param;
+	fflist_rm(&cn->pool->idle, &cn->sib);
+	cn->pool->stat.expired++;
+	conn_close(cn);
+}
+
+/** Check if the server hasn't closed the idle connection. */
+static int conn_alive(conn *cn)
+{
+	char b;
+	ssize_t r = ffskt_recv(cn->sk, &b, 1, MSG_PEEK);
+	return (r < 0 && fferr_again(fferr_last()));
+}
+
+/** Set key of the server:  "[proxy ]host:port". */
+static int pool_key(http *c)
+{
+	ffarr a = {};
+	if (0 == ffstr_fmt(&a, "%s%S:%u"
+		, (c->conf.proxy.host != NULL) ? "proxy " : "", &c->hostname, c->hostport)) {
+		syserrlog("%s", ffmem_alloc_S);
+		return -1;
+	}
+	ffstr_free(&c->poolkey);
+	ffstr_acqstr3(&c->poolkey, &a);
+	return 0;
+}
+
+/** Get idle connection to the server from the pool, or a busy connection for pipelining.
+Return 0 if found. */
+static int pool_get(http *c)
+{
+	ffhttpcl_pool *p = c->conf.pool.conns;
+	if (p == NULL
+		|| (c->conf.pool.idle_timeout == 0 && c->conf.pool.pipeline <= 1))
+		return -1;
+
+	if (0 != pool_key(c))
+		return -1;
+
+	if (c->conf.pool.idle_timeout == 0)
+		return pipe_join(c);
+
+	uint64 now = time_ms();
+	conn *cn;
+	ffchain_item *next;
+	FFLIST_WALKSAFE(&p->idle, cn, sib, next) {
+		if (!ffstr_eq2(&cn->key, &c->poolkey))
+			continue;
+
+		fflist_rm(&p->idle, &cn->sib);
+		cn->timer(&cn->tmr, 0);
+		cn->timer = NULL;
+
+		if (now >= cn->expire) {
+			p->stat.expired++;
+			conn_close(cn);
+			continue;
+		} else if (!conn_alive(cn)) {
+			dbglog("pooled connection is closed by server");
+			p->stat.broken++;
+			conn_close(cn);
+			continue;
+		}
+
+		conn_attach(c, cn);
+		p->stat.reused++;
+		infolog("using pooled connection to %S", &c->poolkey);
+		return 0;
+	}
+
+	return pipe_join(c);
+}
+
+/** Put connection into the pool if the next request may use it. */
+static void pool_put(http *c)
+{
+	conn *cn = c->conn;
+	ffhttpcl_pool *p = c->conf.pool.conns;
+	if (p == NULL || c->conf.pool.idle_timeout == 0 || cn == NULL)
+		return;
+
+	if (!conn_reusable(c)
+		|| c->data.len != 0
+		|| cn->aio.rpending || cn->aio.wpending)
+		return; // the server will close connection or the response isn't read completely
+
+	if (c->poolkey.len == 0
+		&& 0 != pool_key(c))
+		return;
+
+	// close expired connections;  count connections to this server
+	uint64 now = time_ms();
+	uint n = 0;
+	conn *it;
+	ffchain_item *next;
+	FFLIST_WALKSAFE(&p->idle, it, sib, next) {
+		if (now >= it->expire) {
+			pool_ontmr(it);
+			continue;
+		}
+		if (ffstr_eq2(&it->key, &c->poolkey))
+			n++;
+	}
+	if (n >= c->conf.pool.max_per_host) {
+		p->stat.overflow++;
+		return;
+	}
+
+	fflist_rm(&cn->pipe, &c->pipe_sib);
+	c->conn = NULL;
+	cn->wr = NULL;
+	ffstr_free(&cn->key);
+	cn->key = c->poolkey;
+	ffstr_null(&c->poolkey);
+	cn->pool = p;
+	cn->expire = now + c->conf.pool.idle_timeout;
+	cn->tmr.handler = &pool_ontmr;
+	cn->tmr.param = cn;
+	cn->timer = c->conf.timer;
+	cn->timer(&cn->tmr, c->conf.pool.idle_timeout);
+	fflist_prepend(&p->idle, &cn->sib);
+	p->stat.pooled++;
+	dbglog("connection is put into the pool");
+}
 
 static int http_prepreq(http *c, ffstr *dst)
 {
@@ -794,6 +1395,7 @@ static int http_prepreq(http *c, ffstr *dst)
 	ffarr_append(&ck.buf, c->hdrs.buf.ptr, c->hdrs.buf.len);
 
 	ffhttp_cookfin(&ck);
+	ffstr_free(&c->hbuf); // the request is prepared again after reconnection
 	ffstr_acqstr3(&c->hbuf, &ck.buf);
 	ffstr_set2(dst, &c->hbuf);
 	ffhttp_cookdestroy(&ck);
@@ -801,6 +1403,55 @@ static int http_prepreq(http *c, ffstr *dst)
 	return 0;
 }
 
+/** Prepare the next part of request body for sending, together with HTTP headers if they aren't sent yet.
+data: NULL or empty: no more data
+Return 0 on success. */
+static int http_prepbody(http *c, const ffstr *data)
+{
+	ffstr d = {};
+	uint n = 0;
+	if (data != NULL)
+		d = *data;
+	c->body_started = 1;
+
+	if (c->data.len != 0) {
+		ffiov_set(&c->iov[n++], c->data.ptr, c->data.len);
+		c->data.len = 0;
+	}
+
+	switch (c->reqbody) {
+	case REQBODY_CONTLEN:
+		if (d.len > c->body_left) {
+			errlog("request body is larger than Content-Length", 0);
+			return -1;
+		} else if (d.len == 0) {
+			errlog("request body is smaller than Content-Length by %U bytes", c->body_left);
+			return -1;
+		}
+		ffiov_set(&c->iov[n++], d.ptr, d.len);
+		c->body_left -= d.len;
+		c->body_fin = (c->body_left == 0);
+		break;
+
+	case REQBODY_CHUNKED:
+		if (d.len != 0) {
+			uint r = ffs_fmt(c->chunkhdr, c->chunkhdr + sizeof(c->chunkhdr), "%xL" FFCRLF, d.len);
+			ffiov_set(&c->iov[n++], c->chunkhdr, r);
+			ffiov_set(&c->iov[n++], d.ptr, d.len);
+			ffiov_set(&c->iov[n++], FFCRLF, FFSLEN(FFCRLF));
+		} else {
+			ffiov_set(&c->iov[n++], "0" FFCRLF FFCRLF, FFSLEN("0" FFCRLF FFCRLF));
+			c->body_fin = 1;
+		}
+		break;
+	}
+
+	dbglog("request body: +%L  last:%u", d.len, (int)c->body_fin);
+	ffsf_init(&c->sf);
+	ffsf_sethdtr(&c->sf.ht, c->iov, n, NULL, 0);
+	return 0;
+}
+
 /**
 Return 0 on success;  1 - need more data;  2 - redirect;  -1 on error. */
 static int http_parse(http *c)
@@ -820,16 +1471,12 @@ static int http_parse(http *c)
 	dbglog("HTTP response: %*s", c->resp.h.len, c->bufs[0].ptr);
 
 	if ((c->resp.code == 301 || c->resp.code == 302)
+		&& c->reqbody == REQBODY_NONE
 		&& c->nredirect++ != c->conf.max_redirect
 		&& 0 != ffhttp_findihdr(&c->resp.h, FFHTTP_LOCATION, &s)) {
 
 		infolog("HTTP redirect: %S", &s);
-		if (c->sk != FF_BADSKT) {
-			ffskt_fin(c->sk);
-			ffskt_close(c->sk);
-			c->sk = FF_BADSKT;
-		}
-		ffaio_fin(&c->aio);
+		conn_drop(c);
 		ffarr_free(&c->target_url);
 		if (0 == ffstr_fmt(&c->target_url, "%S", &s)) {
 			syserrlog("%s", ffmem_alloc_S);
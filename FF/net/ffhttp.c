@@ -23,15 +23,6 @@ static int http_connclose_process(void *p, ffstr *in, ffstr *out);
 const struct ffhttp_filter ffhttp_connclose_filter = { &http_connclose_open, &http_connclose_close, &http_connclose_process };
 
 
-struct _ffhttp_headr {
-	uint hash;
-	ffrange key;
-	ffrange val;
-};
-
-static int ht_headr_fill(ffhttp_headers *h);
-static int ht_headr_cmpkey(void *val, const void *key, void *param);
-
 static int ht_knhdr_cmpkey(void *val, const void *key, void *param);
 
 
@@ -271,6 +262,103 @@ const char *ffhttp_errstr(int code)
 
 enum { CR = '\r', LF = '\n' };
 
+#ifdef FF_AMD64
+
+/** Get mask of the bytes within [lo..hi]. */
+#define sse_within(v, lo, hi) \
+	_mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8((lo) - 1)), _mm_cmplt_epi8(v, _mm_set1_epi8((hi) + 1)))
+
+/** Find the first byte that isn't a header name character: [a-zA-Z0-9_-].
+Return offset;  'end - p' if not found. */
+static size_t hdr_name_end(const char *p, const char *end)
+{
+	const char *s = p;
+	const __m128i lower = _mm_set1_epi8(0x20), under = _mm_set1_epi8('_'), dash = _mm_set1_epi8('-');
+
+	for (;  p + 16 <= end;  p += 16) {
+		__m128i v = _mm_loadu_si128((void*)p);
+		__m128i m = _mm_or_si128(sse_within(v, '0', '9')
+			, sse_within(_mm_or_si128(v, lower), 'a', 'z'));
+		m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, under), _mm_cmpeq_epi8(v, dash)));
+		uint bits = ~_mm_movemask_epi8(m) & 0xffff;
+		if (bits != 0)
+			return p - s + ffbit_ffs32(bits) - 1;
+	}
+
+	for (;  p != end;  p++) {
+		if (!(ffchar_isname(*p) || *p == '-'))
+			break;
+	}
+	return p - s;
+}
+
+/** Find CR or LF.
+Return offset;  'end - p' if not found. */
+static size_t hdr_eol(const char *p, const char *end)
+{
+	const char *s = p;
+	const __m128i cr = _mm_set1_epi8(CR), lf = _mm_set1_epi8(LF);
+
+	for (;  p + 16 <= end;  p += 16) {
+		__m128i v = _mm_loadu_si128((void*)p);
+		uint bits = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+		if (bits != 0)
+			return p - s + ffbit_ffs32(bits) - 1;
+	}
+
+	for (;  p != end;  p++) {
+		if (*p == CR || *p == LF)
+			break;
+	}
+	return p - s;
+}
+
+/** Parse the complete header line 16 bytes at a time.
+The result is the same as of the byte-by-byte parser in ffhttp_nexthdr().
+Return 0 if the header is parsed;
+ -1 if the line is incomplete, empty or invalid:  the caller must use the byte-by-byte parser. */
+static int hdr_parse_sse(ffhttp_hdr *h, const char *d, size_t len)
+{
+	const char *p = d + h->len, *end = d + len;
+	const char *key = p, *val, *eol, *next;
+
+	if (p == end || !ffchar_isname(*p))
+		return -1;
+	p += 1 + hdr_name_end(p + 1, end);
+	if (p == end || *p != ':')
+		return -1;
+	size_t nkey = p - key;
+
+	for (p++;  p != end && *p == ' ';  p++) {
+	}
+	val = p;
+	eol = p + hdr_eol(p, end);
+	if (eol == end)
+		return -1;
+	next = eol + 1;
+	if (*eol == CR) {
+		if (next == end || *next != LF)
+			return -1;
+		next++;
+	}
+
+	while (eol != val && eol[-1] == ' ') {
+		eol--;
+	}
+
+	h->key.off = key - d;
+	h->key.len = nkey;
+	h->val.off = val - d;
+	h->val.len = eol - val;
+	h->crc = ffcrc32_iget4(key, nkey); // hash the whole name at once, after its bounds are known
+	h->len = next - d;
+	return 0;
+}
+
+#undef sse_within
+
+#endif //FF_AMD64
+
 int ffhttp_nexthdr(ffhttp_hdr *h, const char *d, size_t len)
 {
 	enum { iKey = 0, iKeyData, iSpaceBeforeVal, iVal, iSpaceAfterVal, iLastLf };
@@ -280,14 +368,24 @@ int ffhttp_nexthdr(ffhttp_hdr *h, const char *d, size_t len)
 	ffrange *val = &h->val;
 	uint er = FFHTTP_OK;
 
-	len = ffmin(len, (size_t)0xffff);
+	uint lim = (h->max_len != 0) ? h->max_len : 0xffff;
+	len = ffmin(len, (size_t)lim);
+
+#ifdef FF_AMD64
+	if (idx == iKey && 0 == hdr_parse_sse(h, d, len)) {
+		ffstr sname = ffrang_get(name, d);
+		h->ihdr = (int)(size_t)ffhst_find(&ht_known_hdrs, h->crc, &sname, NULL);
+		return FFHTTP_OK;
+	}
+#endif
+
 	for (; i != len; ++i) {
 		int ch = d[i];
 
 		switch (idx) {
 		case iKey:
 			h->crc = ffcrc32_start();
-			name->off = (ushort)i; //save hdr start pos
+			name->off = i; //save hdr start pos
 
 			switch (ch) {
 			case CR:
@@ -336,7 +434,7 @@ int ffhttp_nexthdr(ffhttp_hdr *h, const char *d, size_t len)
 		case iSpaceBeforeVal:
 			if (ch == ' ')
 				break;
-			val->off = (ushort)i; //save val start pos
+			val->off = i; //save val start pos
 			idx = iVal;
 			//break;
 
@@ -388,25 +486,25 @@ int ffhttp_nexthdr(ffhttp_hdr *h, const char *d, size_t len)
 		}
 	}
 
-	if (i == 0xffff) {
+	if (i == lim) {
 		er = FFHTTP_ETOOLARGE;
 		goto fail;
 	}
 
 	h->idx = idx;
-	h->len = (ushort)i;
+	h->len = i;
 	return FFHTTP_MORE;
 
 fail:
 	h->idx = idx;
-	h->len = (ushort)i;
+	h->len = i;
 	return er;
 
 done:
 	ffcrc32_finish(&h->crc);
 	idx = iKey;
 	h->idx = idx;
-	h->len = (ushort)i + 1;
+	h->len = i + 1;
 	if (name->len == 0)
 		return FFHTTP_DONE;
 
@@ -418,6 +516,78 @@ done:
 	return FFHTTP_OK;
 }
 
+/** Parse the header line which is complete in 'd'. */
+static int hdrstream_parse(ffhttp_hdrstream *s, const char *d, size_t len, uint max_len)
+{
+	ffhttp_inithdr(&s->hdr);
+	s->hdr.max_len = max_len;
+	int r = ffhttp_nexthdr(&s->hdr, d, len);
+	if (r == FFHTTP_OK) {
+		s->key = ffrang_get(&s->hdr.key, d);
+		s->val = ffrang_get(&s->hdr.val, d);
+	}
+	return r;
+}
+
+int ffhttp_hdrstream_next(ffhttp_hdrstream *s, ffstr *data)
+{
+	int r;
+	uint lim = (s->max_len != 0) ? s->max_len : 0xffff;
+
+	if (s->line_parsed) {
+		s->line_parsed = 0;
+		s->line.len = 0;
+	}
+
+	if (data->len == 0)
+		return FFHTTP_MORE;
+
+	if (s->line.len == 0) {
+		if (s->total == lim)
+			return FFHTTP_ETOOLARGE;
+
+		r = hdrstream_parse(s, data->ptr, data->len, lim - s->total);
+		switch (r) {
+		case FFHTTP_OK:
+		case FFHTTP_DONE:
+			s->total += s->hdr.len;
+			ffstr_shift(data, s->hdr.len);
+			return r;
+
+		case FFHTTP_MORE:
+			break;
+
+		default:
+			return r;
+		}
+
+		// the line continues in the next buffer
+		if (NULL == ffarr_append(&s->line, data->ptr, data->len))
+			return FFHTTP_ESYS;
+		s->total += data->len;
+		ffstr_shift(data, data->len);
+		return FFHTTP_MORE;
+	}
+
+	// append data up to LF to the line from the previous buffers
+	const char *lf = ffs_findc(data->ptr, data->len, LF);
+	size_t n = (lf != NULL) ? (size_t)(lf - data->ptr) + 1 : data->len;
+	if (n > lim - s->total)
+		return FFHTTP_ETOOLARGE;
+	if (NULL == ffarr_append(&s->line, data->ptr, n))
+		return FFHTTP_ESYS;
+	s->total += n;
+	ffstr_shift(data, n);
+	if (lf == NULL)
+		return FFHTTP_MORE;
+
+	s->line_parsed = 1;
+	r = hdrstream_parse(s, s->line.ptr, s->line.len, (uint)-1);
+	if (r == FFHTTP_MORE)
+		r = FFHTTP_EEOL; // can't happen: the line ends with LF
+	return r;
+}
+
 void ffhttp_init(ffhttp_headers *h)
 {
 	memset(h, 0, sizeof(ffhttp_headers));
@@ -425,7 +595,31 @@ void ffhttp_init(ffhttp_headers *h)
 	h->cont_len = -1;
 	h->ce_identity = 1;
 	h->index_headers = 1;
-	h->htheaders.cmpkey = &ht_headr_cmpkey;
+}
+
+#define hidx_ptr(h)  (((h)->hidx.ptr != NULL) ? (h)->hidx.ptr : (_ffhttp_headr*)(h)->hidx_inline)
+
+/** Add an entry to headers index.
+The inline array is used first;  only a request with many headers needs a heap buffer. */
+static _ffhttp_headr* hidx_add(ffhttp_headers *h)
+{
+	if (h->hidx.len == FFHTTP_HIDX_INLINE && h->hidx.ptr == NULL) {
+		_ffhttp_headr *ar;
+		if (NULL == (ar = ffmem_allocT(FFHTTP_HIDX_INLINE * 2, _ffhttp_headr)))
+			return NULL;
+		ffmemcpy(ar, h->hidx_inline, sizeof(h->hidx_inline));
+		h->hidx.ptr = ar;
+		h->hidx.cap = FFHTTP_HIDX_INLINE * 2;
+
+	} else if (h->hidx.ptr != NULL && h->hidx.len == h->hidx.cap) {
+		_ffhttp_headr *ar;
+		if (NULL == (ar = ffmem_realloc(h->hidx.ptr, h->hidx.cap * 2 * sizeof(_ffhttp_headr))))
+			return NULL;
+		h->hidx.ptr = ar;
+		h->hidx.cap *= 2;
+	}
+
+	return &hidx_ptr(h)[h->hidx.len++];
 }
 
 int ffhttp_parsehdr(ffhttp_headers *h, const char *data, size_t len)
@@ -438,32 +632,26 @@ int ffhttp_parsehdr(ffhttp_headers *h, const char *data, size_t len)
 	e = ffhttp_nexthdr(&h->hdr, data, len);
 	h->len = h->hdr.len;
 
-	if (e == FFHTTP_DONE) {
-
-		if (h->hidx.len != 0 && 0 != ht_headr_fill(h))
-			return FFHTTP_ESYS;
-
+	if (e == FFHTTP_DONE)
 		return FFHTTP_DONE;
-	}
 
 	if (e != FFHTTP_OK)
 		return e;
 
 	if (h->index_headers) {
 		// add this header to index
-		_ffhttp_headr *ar;
 		_ffhttp_headr *hh;
-		ar = ffmem_realloc(h->hidx.ptr, (h->hidx.len + 1) * sizeof(_ffhttp_headr));
-		if (ar == NULL)
+		if (NULL == (hh = hidx_add(h)))
 			return FFHTTP_ESYS;
-
-		hh = &ar[h->hidx.len];
 		hh->hash = h->hdr.crc;
+		hh->ihdr = h->hdr.ihdr;
 		hh->key = h->hdr.key;
 		hh->val = h->hdr.val;
 
-		h->hidx.ptr = ar;
-		h->hidx.len++;
+		if (hh->ihdr != FFHTTP_HUKN
+			&& h->hidx_known[hh->ihdr] == 0
+			&& h->hidx.len <= 0xff)
+			h->hidx_known[hh->ihdr] = h->hidx.len;
 	}
 
 	val = ffrang_get(&h->hdr.val, data);
@@ -519,61 +707,53 @@ int ffhttp_parsehdr(ffhttp_headers *h, const char *data, size_t len)
 	return FFHTTP_OK;
 }
 
-// build hash table for headers
-static int ht_headr_fill(ffhttp_headers *h)
+int ffhttp_findihdr(const ffhttp_headers *h, uint ihdr, ffstr *dst)
 {
-	_ffhttp_headr *hh
-		, *end = h->hidx.ptr + h->hidx.len;
-
-	if (0 != ffhst_init(&h->htheaders, h->hidx.len))
-		return -1;
-
-	for (hh = h->hidx.ptr;  hh != end;  hh++) {
-		if (ffhst_ins(&h->htheaders, hh->hash, hh) < 0)
-			return -1;
+	if (ihdr >= FFHTTP_HLAST)
+		return 0;
+	uint i = h->hidx_known[ihdr];
+	if (i == 0) {
+		if (ihdr == FFHTTP_HUKN
+			|| (h->hidx.len <= 0xff && ht_known_hdrs.nslots != 0))
+			return 0; // all known headers are in 'hidx_known'
+		return ffhttp_findhdr(h, ffhttp_shdr[ihdr].ptr, ffhttp_shdr[ihdr].len, dst);
 	}
-
-	return 0;
-}
-
-static int ht_headr_cmpkey(void *val, const void *key, void *param)
-{
-	const ffhttp_headers *h = param;
-	const _ffhttp_headr *hh = val;
-	ffstr name = ffrang_get(&hh->key, h->base);
-	const ffstr *k = key;
-	return ffstr_ieq2(&name, k) ? 0 : -1;
+	if (dst != NULL)
+		*dst = ffrang_get(&hidx_ptr(h)[i - 1].val, h->base);
+	return 1;
 }
 
 int ffhttp_findhdr(const ffhttp_headers *h, const char *name, size_t namelen, ffstr *dst)
 {
-	uint hash = ffcrc32_iget(name, namelen);
-	ffstr sname;
-	ffstr_set(&sname, name, namelen);
-	const _ffhttp_headr *hh = ffhst_find(&h->htheaders, hash, &sname, (void*)h);
-	if (hh == NULL)
-		return 0;
-	if (dst != NULL)
-		*dst = ffrang_get(&hh->val, h->base);
-	return 1;
+	uint hash = ffcrc32_iget4(name, namelen);
+	const _ffhttp_headr *hh = hidx_ptr(h), *end = hh + h->hidx.len;
+
+	for (;  hh != end;  hh++) {
+		if (hh->hash != hash)
+			continue;
+		ffstr key = ffrang_get(&hh->key, h->base);
+		if (ffstr_ieq(&key, name, namelen)) {
+			if (dst != NULL)
+				*dst = ffrang_get(&hh->val, h->base);
+			return 1;
+		}
+	}
+	return 0;
 }
 
 int ffhttp_gethdr(const ffhttp_headers *h, uint idx, ffstr *key, ffstr *val)
 {
-	_ffhttp_headr *hh;
-	int i;
+	const _ffhttp_headr *hh;
 
 	if (idx >= h->hidx.len)
 		return FFHTTP_DONE;
 
-	hh = &h->hidx.ptr[idx];
+	hh = &hidx_ptr(h)[idx];
 	if (key != NULL)
 		*key = ffrang_get(&hh->key, h->base);
 	if (val != NULL)
 		*val = ffrang_get(&hh->val, h->base);
-
-	i = (int)(size_t)ffhst_find(&ht_known_hdrs, hh->hash, key, NULL);
-	return i;
+	return hh->ihdr;
 }
 
 
@@ -669,7 +849,8 @@ int ffhttp_req_line(ffhttp_request *r, const char *d, size_t len)
 	uint i = r->h.hdr.len;
 	uint idx = r->h.hdr.idx;
 	ffbool again = 0;
-	len = ffmin(len, (size_t)0xffff);
+	uint lim = (r->h.hdr.max_len != 0) ? r->h.hdr.max_len : 0xffff;
+	len = ffmin(len, (size_t)lim);
 
 	if (r->h.base != d)
 		r->h.base = d;
@@ -694,11 +875,11 @@ int ffhttp_req_line(ffhttp_request *r, const char *d, size_t len)
 			if (ch == ' ')
 			{}
 			else if (r->method > _FFHTTP_MLASTURI) {
-				r->url.offpath = (ushort)i;
+				r->url.offpath = i;
 				idx = iNonStdUri;
 			}
 			else {
-				r->offurl = (ushort)i;
+				r->offurl = i;
 				idx = iURL;
 				again = 1;
 			}
@@ -707,7 +888,7 @@ int ffhttp_req_line(ffhttp_request *r, const char *d, size_t len)
 		case iURL:
 			er = ffurl_parse(&r->url, d + r->offurl, len - r->offurl);
 			if (er == FFURL_EOK || er == FFURL_EMORE) {
-				i = (ushort)len - 1;
+				i = (uint)len - 1;
 				goto more; //url is not parsed completely yet
 			}
 
@@ -766,7 +947,7 @@ int ffhttp_req_line(ffhttp_request *r, const char *d, size_t len)
 
 		case iNonStdUri:
 			if (ch == ' ') {
-				r->url.pathlen = (ushort)(i - r->url.offpath);
+				r->url.pathlen = i - r->url.offpath;
 				idx = iAfterUri;
 			}
 			break;
@@ -838,27 +1019,27 @@ int ffhttp_req_line(ffhttp_request *r, const char *d, size_t len)
 		}
 	}
 
-	if (i == 0xffff) {
+	if (i == lim) {
 		er = FFHTTP_ETOOLARGE;
 		goto fail;
 	}
 
 more:
 	r->h.hdr.idx = idx;
-	r->h.len = r->h.hdr.len = (ushort)i;
+	r->h.len = r->h.hdr.len = i;
 	return FFHTTP_MORE;
 
 done:
 	++i;
-	r->h.len = r->h.hdr.len = (ushort)i;
-	r->h.firstline_len = (ushort)i;
+	r->h.len = r->h.hdr.len = i;
+	r->h.firstline_len = i;
 	r->h.base = d;
 	r->h.hdr.idx = 0; //iKey
 	return FFHTTP_OK;
 
 fail:
-	r->h.len = r->h.hdr.len = (ushort)i;
-	r->h.firstline_len = (ushort)(ffs_findof(d + i, len - i, FFSTR("\r\n")) - d);
+	r->h.len = r->h.hdr.len = i;
+	r->h.firstline_len = (uint)(ffs_findof(d + i, len - i, FFSTR("\r\n")) - d);
 	return er;
 }
 
@@ -954,8 +1135,9 @@ int ffhttp_resp_line(ffhttp_response *r, const char *d, size_t len, int flags)
 	int er = 0;
 	uint i = r->h.hdr.len;
 	uint idx = r->h.hdr.idx;
+	uint lim = (r->h.hdr.max_len != 0) ? r->h.hdr.max_len : 0xffff;
 
-	len = ffmin(len, (size_t)0xffff);
+	len = ffmin(len, (size_t)lim);
 	if (r->h.base != d)
 		r->h.base = d;
 
@@ -987,7 +1169,7 @@ int ffhttp_resp_line(ffhttp_response *r, const char *d, size_t len, int flags)
 			if (ch == ' ')
 				break;
 			idx = iCode;
-			r->status.off = (ushort)i;
+			r->status.off = i;
 			//break;
 
 		case iCode:
@@ -1017,12 +1199,12 @@ int ffhttp_resp_line(ffhttp_response *r, const char *d, size_t len, int flags)
 
 		case iStatusStr:
 			if (ch == CR) {
-				r->status.len = (ushort)(i - r->status.off);
+				r->status.len = i - r->status.off;
 				r->h.firstcrlf = 2;
 				idx = iLastLf;
 			}
 			else if (ch == LF) {
-				r->status.len = (ushort)(i - r->status.off);
+				r->status.len = i - r->status.off;
 				r->h.firstcrlf = 1;
 				goto done;
 			}
@@ -1071,26 +1253,26 @@ int ffhttp_resp_line(ffhttp_response *r, const char *d, size_t len, int flags)
 		}
 	}
 
-	if (i == 0xffff) {
+	if (i == lim) {
 		er = FFHTTP_ETOOLARGE;
 		goto fail;
 	}
 
 	r->h.hdr.idx = idx;
-	r->h.len = r->h.hdr.len = (ushort)i;
+	r->h.len = r->h.hdr.len = i;
 	return FFHTTP_MORE;
 
 done:
 	++i;
-	r->h.len = r->h.hdr.len = (ushort)i;
-	r->h.firstline_len = (ushort)i;
+	r->h.len = r->h.hdr.len = i;
+	r->h.firstline_len = i;
 	r->h.hdr.idx = 0; //iKey
 	r->h.base = d;
 	return FFHTTP_OK;
 
 fail:
-	r->h.len = r->h.hdr.len = (ushort)i;
-	r->h.firstline_len = (ushort)(ffs_findof(d + i, len - i, FFSTR("\r\n")) - d);
+	r->h.len = r->h.hdr.len = i;
+	r->h.firstline_len = (uint)(ffs_findof(d + i, len - i, FFSTR("\r\n")) - d);
 	return er;
 }
 
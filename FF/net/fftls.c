@@ -18,6 +18,10 @@ rec
       list16
        alpn_proto[]
       suppvers
+      list16
+       group[]
+      list8
+       ec_point_format[]
   server_hello
    list16
     ext[]
@@ -36,6 +40,7 @@ rec
 
 
 static int tls_rec_read(fftls *t, ffstr *data, uint *version, ffstr *body);
+static int tls_hshake_join(fftls *t, ffstr *rec, ffstr *in);
 static int tls_hshake_read(fftls *t, ffstr *data, ffstr *body);
 static int tls_clihello_read(fftls *t, ffstr *data);
 static int tls_srvhello_read(fftls *t, ffstr *data);
@@ -127,6 +132,56 @@ static int tls_rec_read(fftls *t, ffstr *data, uint *version, ffstr *body)
 	return rec->type;
 }
 
+/** Join the handshake message fragmented across several records.
+The bodies of the next records are moved in place over their headers so that the message becomes contiguous.
+Input data isn't modified until all fragments are available.
+Return 1 if all messages in 'rec' are complete;  0 if more data is needed;  <0 on error. */
+static int tls_hshake_join(fftls *t, ffstr *rec, ffstr *in)
+{
+	for (;;) {
+		// skip complete messages
+		ffstr d = *rec;
+		while (d.len >= 4) {
+			size_t n = 4 + ffint_ntoh24(d.ptr + 1);
+			if (n > d.len)
+				break;
+			ffstr_shift(&d, n);
+		}
+		if (d.len == 0)
+			return 1;
+
+		size_t need = (d.len >= 4) ? 4 + ffint_ntoh24(d.ptr + 1) - d.len : 4 - d.len;
+
+		// check that the next records contain enough data
+		size_t off = 0, avail = 0;
+		uint nrecs = 0;
+		while (avail < need) {
+			if (off + sizeof(struct rec) > in->len)
+				return 0;
+			const struct rec *r = (void*)(in->ptr + off);
+			if (r->type != RT_HANDSHAKE)
+				return -FFTLS_EDATA; //a handshake message can't be interleaved with other records
+			uint n = ffint_ntoh16(r->len);
+			if (off + sizeof(struct rec) + n > in->len)
+				return 0;
+			avail += n;
+			off += sizeof(struct rec) + n;
+			nrecs++;
+		}
+
+		// join the whole records: the data after the message is processed as usual
+		char *dst = rec->ptr + rec->len;
+		for (uint i = 0;  i != nrecs;  i++) {
+			const struct rec *r = (void*)in->ptr;
+			uint n = ffint_ntoh16(r->len);
+			memmove(dst, r->data, n);
+			dst += n;
+			ffstr_shift(in, sizeof(struct rec) + n);
+		}
+		rec->len = dst - rec->ptr;
+	}
+}
+
 
 enum hshake_type {
 	HS_CLIENT_HELLO = 1,
@@ -192,6 +247,10 @@ static int tls_clihello_read(fftls *t, ffstr *data)
 	if (ver < t->version || (ver & 0xff00) != 0x0300)
 		return -FFTLS_EVERSION;
 	t->version = ver;
+	t->hello_version = ver;
+	t->exts.len = 0;
+	t->groups.len = 0;
+	t->ec_formats.len = 0;
 
 	if (h->session_id.len > data->len)
 		return 0;
@@ -257,6 +316,8 @@ static int tls_srvhello_read(fftls *t, ffstr *data)
 
 enum ext_type {
 	EXT_SERVER_NAME = 0,
+	EXT_SUPP_GROUPS = 10,
+	EXT_EC_POINT_FORMATS = 11,
 	EXT_ALPN = 16,
 	EXT_SUPP_VERS = 43,
 };
@@ -379,6 +440,23 @@ static int tlsext_read(fftls *t, ffstr *data)
 	ffstr_set(&extdata, ext->data, n);
 
 	type = ffint_ntoh16(ext->type);
+	if (t->hshake_type == HS_CLIENT_HELLO) {
+		int k;
+		switch (type) {
+		case EXT_SUPP_GROUPS:
+			if ((k = datalen16(&extdata)) < 0)
+				return 0;
+			ffstr_set(&t->groups, extdata.ptr, k & ~1);
+			return FFTLS_RDONE;
+
+		case EXT_EC_POINT_FORMATS:
+			if ((k = datalen8(&extdata)) < 0)
+				return 0;
+			ffstr_set(&t->ec_formats, extdata.ptr, k);
+			return FFTLS_RDONE;
+		}
+	}
+
 	switch (type) {
 	case EXT_SERVER_NAME:
 		r = tlsext_servname_read(t, &extdata, &t->hostname);
@@ -449,8 +527,9 @@ int fftls_read(fftls *t)
 	for (;;) {
 	switch (t->state) {
 
-	case R_REC:
-		r = tls_rec_read(t, &t->in, &t->version, &t->rec);
+	case R_REC: {
+		ffstr in = t->in;
+		r = tls_rec_read(t, &in, &t->version, &t->rec);
 		if (r == 0)
 			return FFTLS_RMORE;
 		else if (r < 0)
@@ -458,12 +537,19 @@ int fftls_read(fftls *t)
 
 		switch (r) {
 		case RT_HANDSHAKE:
+			r = tls_hshake_join(t, &t->rec, &in);
+			if (r == 0)
+				return FFTLS_RMORE;
+			else if (r < 0)
+				return ERR(t, -r);
 			t->state = R_HSHAKE;
 			break;
 		default:
 			return ERR(t, FFTLS_ENOTSUPP);
 		}
+		t->in = in;
 		break;
+	}
 
 	case R_HSHAKE:
 		if (t->rec.len == 0) {
@@ -522,6 +608,8 @@ int fftls_read(fftls *t)
 		if (r <= 0)
 			return ERR(t, -r);
 		t->buf = exts;
+		if (t->hshake_type == HS_CLIENT_HELLO)
+			t->exts = exts;
 		t->state = R_HEL_EXT;
 		break;
 	}
@@ -563,6 +651,96 @@ const char* fftls_verstr(uint ver)
 }
 
 
+/** GREASE values (RFC 8701): 0x0a0a, 0x1a1a, ... 0xfafa */
+#define tls_grease(v)  (((v) & 0x0f0f) == 0x0a0a && ((v) >> 8) == ((v) & 0xff))
+
+/** Write the next value of the list "1-2-3".
+Return the number of bytes written;  -1 if the buffer is too small. */
+static int ja3_val(char *p, char *end, uint v, uint sep)
+{
+	char *start = p;
+	if (sep) {
+		if (p == end)
+			return -1;
+		*p++ = '-';
+	}
+
+	size_t r = ffs_fromint(v, p, end - p, 0);
+	if (r == 0)
+		return -1;
+	return p + r - start;
+}
+
+/** Write the list of values as "1-2-3".
+Return the number of bytes written;  -1 if the buffer is too small. */
+static int ja3_list(char *buf, char *end, const void *data, uint n, uint elsize)
+{
+	char *p = buf;
+	const byte *d = data;
+	int r;
+
+	for (uint i = 0;  i != n;  i++) {
+		uint v = (elsize == 2) ? ffint_ntoh16(d + i * 2) : d[i];
+		if (elsize == 2 && tls_grease(v))
+			continue;
+
+		if (0 > (r = ja3_val(p, end, v, (p != buf))))
+			return -1;
+		p += r;
+	}
+	return p - buf;
+}
+
+/** Write the types of extensions as "1-2-3".
+Return the number of bytes written;  -1 if the buffer is too small. */
+static int ja3_exts(char *buf, char *end, ffstr exts)
+{
+	char *p = buf;
+	int r;
+
+	while (exts.len >= sizeof(struct ext)) {
+		const struct ext *ext = (void*)exts.ptr;
+		uint v = ffint_ntoh16(ext->type);
+		ffstr_shift(&exts, ffmin(sizeof(struct ext) + ffint_ntoh16(ext->len), exts.len));
+		if (tls_grease(v))
+			continue;
+
+		if (0 > (r = ja3_val(p, end, v, (p != buf))))
+			return -1;
+		p += r;
+	}
+	return p - buf;
+}
+
+size_t fftls_ja3(const fftls *t, char *buf, size_t cap)
+{
+	char *p = buf, *end = buf + cap;
+	int r;
+
+	const void *lists[] = { t->ciphers.ptr, NULL, t->groups.ptr, t->ec_formats.ptr };
+	const uint nlists[] = { t->ciphers.len / 2, 0, t->groups.len / 2, t->ec_formats.len };
+
+	if (0 == (r = ffs_fromint(t->hello_version, p, end - p, 0)))
+		return 0;
+	p += r;
+
+	for (uint i = 0;  i != FFCNT(lists);  i++) {
+		if (p == end)
+			return 0;
+		*p++ = ',';
+		if (i == 1)
+			r = ja3_exts(p, end, t->exts);
+		else
+			r = ja3_list(p, end, lists[i], nlists[i], (i != 3) ? 2 : 1);
+		if (r < 0)
+			return 0;
+		p += r;
+	}
+
+	return p - buf;
+}
+
+
 int fftls_alpn_next(ffstr *buf, ffstr *proto)
 {
 	int len;
@@ -713,3 +891,153 @@ const char* fftls_cipher_name(ushort ciph)
 	}
 	return NULL;
 }
+
+
+struct sni_item {
+	uint off, len; //name in fftls_sni.names
+	uint id;
+	uint wild;
+};
+
+struct sni_key {
+	const char *s;
+	size_t len;
+	uint wild;
+};
+
+enum {
+	SNI_HASH_INIT = 0x811c9dc5,
+	SNI_HASH_PRIME = 0x01000193,
+};
+
+/* Hostname hash is computed from right to left (FNV-1a on lower-cased characters),
+ so the hashes of all suffixes are obtained in a single pass */
+static FFINL uint sni_hash_step(uint h, int c)
+{
+	if (ffchar_isup(c))
+		c = ffchar_lower(c);
+	return (h ^ (byte)c) * SNI_HASH_PRIME;
+}
+
+static uint sni_hash(const char *s, size_t len)
+{
+	uint h = SNI_HASH_INIT;
+	for (size_t i = len;  i != 0;  i--) {
+		h = sni_hash_step(h, s[i - 1]);
+	}
+	return h;
+}
+
+static int sni_cmpkey(void *val, const void *key, void *param)
+{
+	const fftls_sni *s = param;
+	const struct sni_key *k = key;
+	const struct sni_item *it = ffarr_itemT(&s->items, (size_t)val - 1, struct sni_item);
+	if (it->wild != k->wild || it->len != k->len)
+		return -1;
+	return ffs_icmp(s->names.ptr + it->off, k->s, k->len);
+}
+
+void fftls_sni_init(fftls_sni *s)
+{
+	ffmem_tzero(s);
+	s->def_id = -1;
+}
+
+void fftls_sni_free(fftls_sni *s)
+{
+	ffhst_free(&s->ht);
+	ffarr_free(&s->items);
+	ffarr_free(&s->names);
+}
+
+int fftls_sni_add(fftls_sni *s, const ffstr *pattern, uint id)
+{
+	ffstr name = *pattern;
+	uint wild = 0;
+
+	if (ffstr_eqcz(&name, "*")) {
+		s->def_id = id;
+		return 0;
+	}
+
+	if (name.len > 2 && name.ptr[0] == '*' && name.ptr[1] == '.') {
+		ffstr_shift(&name, 2);
+		wild = 1;
+	}
+	if (name.len != 0 && name.ptr[name.len - 1] == '.')
+		name.len--;
+	if (name.len == 0 || NULL != ffs_findc(name.ptr, name.len, '*'))
+		return -1;
+
+	if (NULL == ffarr_grow(&s->names, name.len, 256 | FFARR_GROWQUARTER))
+		return -1;
+	struct sni_item *it = ffarr_pushgrowT(&s->items, 16 | FFARR_GROWQUARTER, struct sni_item);
+	if (it == NULL)
+		return -1;
+	it->off = s->names.len;
+	it->len = name.len;
+	it->id = id;
+	it->wild = wild;
+	ffs_lower(ffarr_end(&s->names), name.len, name.ptr, name.len);
+	s->names.len += name.len;
+	return 0;
+}
+
+int fftls_sni_compile(fftls_sni *s)
+{
+	ffhst_free(&s->ht);
+	if (s->items.len == 0)
+		return 0;
+	if (0 != ffhst_init(&s->ht, s->items.len))
+		return -1;
+	s->ht.cmpkey = &sni_cmpkey;
+
+	const struct sni_item *it = (void*)s->items.ptr;
+	for (size_t i = 0;  i != s->items.len;  i++) {
+		struct sni_key k = { s->names.ptr + it[i].off, it[i].len, it[i].wild };
+		uint h = sni_hash(k.s, k.len);
+		if (NULL != ffhst_find(&s->ht, h, &k, s)
+			|| 0 > ffhst_ins(&s->ht, h, (void*)(i + 1))) {
+			ffhst_free(&s->ht);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+. Walk hostname from right to left updating the hash
+. At each label boundary look up "*.suffix": the longest matching suffix is the last one found
+. Look up the exact name
+*/
+int fftls_sni_find(const fftls_sni *s, const char *host, size_t len)
+{
+	int id = s->def_id;
+	struct sni_key k;
+	size_t n;
+	uint h = SNI_HASH_INIT;
+
+	if (s->ht.len == 0)
+		return id;
+	if (len != 0 && host[len - 1] == '.')
+		len--;
+
+	k.wild = 1;
+	for (size_t i = len;  i != 0;  i--) {
+		h = sni_hash_step(h, host[i - 1]);
+		if (i >= 2 && host[i - 2] == '.') {
+			k.s = host + i - 1;
+			k.len = len - (i - 1);
+			if (0 != (n = (size_t)ffhst_find(&s->ht, h, &k, (void*)s)))
+				id = ffarr_itemT(&s->items, n - 1, struct sni_item)->id;
+		}
+	}
+
+	k.s = host;
+	k.len = len;
+	k.wild = 0;
+	if (0 != (n = (size_t)ffhst_find(&s->ht, h, &k, (void*)s)))
+		id = ffarr_itemT(&s->items, n - 1, struct sni_item)->id;
+	return id;
+}
@@ -43,7 +43,7 @@ int ffurl_parse(ffurl *url, const char *s, size_t len)
 			// http://
 			url->hostlen = 0;
 			idx = iHostStart;
-			url->offhost = (ushort)i + 1;
+			url->offhost = (uint)i + 1;
 			break;
 
 		case iIp6:
@@ -140,7 +140,7 @@ int ffurl_parse(ffurl *url, const char *s, size_t len)
 				er = FFURL_ESTOP;
 				break;
 			}
-			url->offpath = (ushort)i;
+			url->offpath = (uint)i;
 			idx = iPath;
 			//break;
 
@@ -206,7 +206,7 @@ int ffurl_parse(ffurl *url, const char *s, size_t len)
 
 fin:
 	url->idx = (byte)idx;
-	url->len = (ushort)i;
+	url->len = (uint)i;
 
 	if (er != FFURL_EMORE && !(idx == iPath || idx == iQs))
 		url->offpath = url->len;
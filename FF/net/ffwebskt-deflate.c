@@ -0,0 +1,272 @@
+/**
+Copyright (c) 2020 Simon Zolin
+*/
+
+#include <FF/net/webskt-deflate.h>
+#include <FF/number.h>
+
+
+/* Compressed message body doesn't contain the trailing empty stored block produced by Z_SYNC_FLUSH */
+static const char pmd_tail[] = "\x00\x00\xff\xff";
+
+enum {
+	Z_DEFLATE_MINBITS = 9,
+	Z_DEFLATE_MINBUF = 64, //output buffer must be larger than the held back tail
+};
+
+void ffwebskt_zconf_init(ffwebskt_zconf *conf)
+{
+	ffmem_tzero(conf);
+	conf->window_bits = 15;
+	conf->level = 6;
+	conf->mem_level = 8;
+	conf->max_msg = 16 * 1024 * 1024;
+	conf->bufsize = 16 * 1024;
+}
+
+
+ffwebskt_inflate* ffwebskt_inflate_create(const ffwebskt_zconf *conf)
+{
+	ffwebskt_inflate *z;
+	if (NULL == (z = ffmem_new(ffwebskt_inflate)))
+		return NULL;
+	z->conf = *conf;
+	if (z->conf.window_bits == 0)
+		z->conf.window_bits = 15;
+
+	// negative value: raw deflate data without zlib header
+	if (Z_OK != inflateInit2(&z->z, -(int)z->conf.window_bits)) {
+		ffmem_free(z);
+		return NULL;
+	}
+
+	if (NULL == ffarr_alloc(&z->buf, z->conf.bufsize)) {
+		inflateEnd(&z->z);
+		ffmem_free(z);
+		return NULL;
+	}
+	return z;
+}
+
+void ffwebskt_inflate_free(ffwebskt_inflate *z)
+{
+	if (z == NULL)
+		return;
+	inflateEnd(&z->z);
+	ffarr_free(&z->buf);
+	ffmem_free(z);
+}
+
+/** Decompress the next chunk.
+Return enum FFWEBSKT_R;  FFWEBSKT_RMORE: input data is processed and there's no output. */
+static int zinflate(ffwebskt *w, ffwebskt_inflate *z)
+{
+	z->z.next_in = (void*)z->in.ptr;
+	z->z.avail_in = ffmin(z->in.len, (uint)-1);
+	z->z.next_out = (void*)z->buf.ptr;
+	z->z.avail_out = z->buf.cap;
+
+	int r = inflate(&z->z, Z_SYNC_FLUSH);
+	if (!(r == Z_OK || r == Z_BUF_ERROR || r == Z_STREAM_END))
+		return FFWEBSKT_RERR;
+
+	size_t rd = (char*)z->z.next_in - z->in.ptr;
+	size_t n = z->buf.cap - z->z.avail_out;
+	ffstr_shift(&z->in, rd);
+	z->more = (z->z.avail_out == 0);
+
+	if (r == Z_STREAM_END) {
+		// the last block with BFINAL bit: the data after it is ignored
+		inflateReset(&z->z);
+		z->in.len = 0;
+	} else if (rd == 0 && n == 0 && z->in.len != 0)
+		return FFWEBSKT_RERR;
+
+	z->total += n;
+	if (z->total > z->conf.max_msg)
+		return FFWEBSKT_RERR;
+
+	if (n == 0)
+		return FFWEBSKT_RMORE;
+
+	ffstr_set(&w->out, z->buf.ptr, n);
+	return FFWEBSKT_RDATA;
+}
+
+/*
+. Pass uncompressed messages through as is
+. Decompress each chunk of message body from ffwebskt_parse()
+. After the last chunk decompress the trailing empty block, then return FFWEBSKT_RDATA_FIN
+*/
+int ffwebskt_parse_z(ffwebskt *w, ffwebskt_inflate *z)
+{
+	int r;
+
+	for (;;) {
+
+		if (z->in.len != 0 || z->more) {
+			r = zinflate(w, z);
+			if (r != FFWEBSKT_RMORE)
+				return r;
+			continue;
+		}
+
+		if (z->tail) {
+			z->tail = 0;
+			if (z->conf.no_context_takeover)
+				inflateReset(&z->z);
+			return FFWEBSKT_RDATA_FIN;
+		}
+
+		r = ffwebskt_parse(w);
+		if (!w->compressed)
+			return r;
+
+		switch (r) {
+		case FFWEBSKT_RMSG:
+			z->total = 0;
+			return r;
+
+		case FFWEBSKT_RDATA:
+			z->in = w->out;
+			break;
+
+		case FFWEBSKT_RDATA_FIN:
+			if (w->cont)
+				return r; //wait for continuation frames
+			ffstr_set(&z->in, (char*)pmd_tail, 4);
+			z->tail = 1;
+			break;
+
+		default:
+			return r;
+		}
+	}
+}
+
+
+ffwebskt_deflate* ffwebskt_deflate_create(const ffwebskt_zconf *conf)
+{
+	ffwebskt_deflate *z;
+	if (NULL == (z = ffmem_new(ffwebskt_deflate)))
+		return NULL;
+	z->conf = *conf;
+	if (z->conf.window_bits == 0)
+		z->conf.window_bits = 15;
+	// the negotiation never selects 8 for our side
+	int bits = ffmax(z->conf.window_bits, Z_DEFLATE_MINBITS);
+
+	if (Z_OK != deflateInit2(&z->z, z->conf.level, Z_DEFLATED, -bits, z->conf.mem_level, Z_DEFAULT_STRATEGY)) {
+		ffmem_free(z);
+		return NULL;
+	}
+
+	if (NULL == ffarr_alloc(&z->buf, ffmax(z->conf.bufsize, Z_DEFLATE_MINBUF))) {
+		deflateEnd(&z->z);
+		ffmem_free(z);
+		return NULL;
+	}
+	return z;
+}
+
+void ffwebskt_deflate_free(ffwebskt_deflate *z)
+{
+	if (z == NULL)
+		return;
+	deflateEnd(&z->z);
+	ffarr_free(&z->buf);
+	ffmem_free(z);
+}
+
+/*
+. Move the bytes held back by the previous call to the beginning of the buffer
+. Compress input data with Z_SYNC_FLUSH until the buffer is full or the flush is complete
+. Buffer is full: return its data as a fragment, but hold back the last 4 bytes
+. Flush is complete: cut the trailing empty block "00 00 ff ff" and return the last fragment
+*/
+int ffwebskt_deflate_data(ffwebskt_deflate *z, ffstr *in, ffstr *out)
+{
+	if (!z->more && in->len == 0) {
+		// an empty message is a single empty block
+		z->buf.ptr[0] = 0x00;
+		z->buf.len = 0;
+		ffstr_set(out, z->buf.ptr, 1);
+		return 1;
+	}
+
+	memmove(z->buf.ptr, ffarr_end(&z->buf) - z->hold, z->hold);
+	z->buf.len = z->hold;
+
+	for (;;) {
+		z->z.next_in = (void*)in->ptr;
+		z->z.avail_in = ffmin(in->len, (uint)-1);
+		z->z.next_out = (void*)ffarr_end(&z->buf);
+		z->z.avail_out = ffarr_unused(&z->buf);
+		int r = deflate(&z->z, Z_SYNC_FLUSH);
+		if (!(r == Z_OK || r == Z_BUF_ERROR))
+			goto err;
+		size_t rd = (char*)z->z.next_in - in->ptr;
+		ffstr_shift(in, rd);
+		z->buf.len = z->buf.cap - z->z.avail_out;
+
+		if (z->z.avail_out == 0)
+			break; // the buffer is full
+		if (in->len == 0) {
+			// the flush is complete
+			if (!(z->buf.len >= 4 && !ffmemcmp(ffarr_end(&z->buf) - 4, pmd_tail, 4)))
+				goto err;
+			z->buf.len -= 4;
+			z->total += z->buf.len;
+			if (z->total > z->conf.max_msg)
+				goto err;
+
+			ffstr_set(out, z->buf.ptr, z->buf.len);
+			z->buf.len = 0;
+			z->hold = 0;
+			z->total = 0;
+			z->more = 0;
+			if (z->conf.no_context_takeover)
+				deflateReset(&z->z);
+			return 1;
+		}
+	}
+
+	z->hold = 4;
+	size_t n = z->buf.len - z->hold;
+	z->total += n;
+	if (z->total > z->conf.max_msg)
+		goto err;
+	ffstr_set(out, z->buf.ptr, n);
+	z->more = 1;
+	return 0;
+
+err:
+	deflateReset(&z->z);
+	z->buf.len = 0;
+	z->hold = 0;
+	z->total = 0;
+	z->more = 0;
+	return -1;
+}
+
+int ffwebskt_cookv_z(ffwebskt_cook *w, ffwebskt_deflate *z, uint mask_key, uint op, ffiovec iov[2])
+{
+	ffstr d;
+	uint first = !z->more;
+	int r = ffwebskt_deflate_data(z, &w->in, &d);
+	if (r < 0)
+		return -1;
+
+	if (!first)
+		op = FFWEBSKT_OP_CONT;
+	else
+		op |= FFWEBSKT_F_COMPRESSED;
+	if (r == 0)
+		op |= FFWEBSKT_F_MORE;
+
+	ffstr body = w->in;
+	ffwebskt_input(w, d.ptr, d.len);
+	int n = ffwebskt_cookv(w, mask_key, op, iov);
+	w->in = body;
+	return n;
+}
@@ -12,6 +12,7 @@ Copyright (c) 2018 Simon Zolin
 enum B1 {
 	WS_F_FIN = 0x80,
 	WS_F_RES = 0x70, //must be 0
+	WS_F_RSV1 = 0x40, //"compressed" flag for permessage-deflate
 	WS_F_OPCODE = 0x0f, //enum FFWEBSKT_OP
 };
 enum B2 {
@@ -61,6 +62,195 @@ int ffwebskt_accept_ver(ffwebskt *w, const ffstr *ver)
 	return -1;
 }
 
+/* permessage-deflate negotiation (RFC 7692):
+Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits; server_max_window_bits=10, permessage-deflate
+*/
+
+#define PMD_NAME  "permessage-deflate"
+
+enum {
+	PMD_MINBITS = 8,
+	PMD_MAXBITS = 15,
+};
+
+struct pmd_offer {
+	int smwb, cmwb; //-1: not set;  0: set without value (client_max_window_bits only)
+	uint snct :1;
+	uint cnct :1;
+};
+
+/** Parse one extension from the list.
+Return 0 if it's a valid permessage-deflate;  1: another extension;  -1: invalid parameters. */
+static int pmd_parse(ffstr ext, struct pmd_offer *o)
+{
+	ffstr name, param, key, val;
+	int *pbits;
+
+	ffstr_nextval3(&ext, &name, ';');
+	if (!ffstr_ieqcz(&name, PMD_NAME))
+		return 1;
+
+	o->smwb = o->cmwb = -1;
+	o->snct = o->cnct = 0;
+
+	while (ext.len != 0) {
+		ffstr_nextval3(&ext, &param, ';');
+		ffstr_nextval3(&param, &key, '=');
+		ffstr_nextval3(&param, &val, '=');
+		if (val.len >= 2 && val.ptr[0] == '"' && val.ptr[val.len - 1] == '"')
+			ffstr_set(&val, val.ptr + 1, val.len - 2);
+
+		if (ffstr_ieqcz(&key, "server_no_context_takeover")) {
+			if (o->snct || val.len != 0)
+				return -1;
+			o->snct = 1;
+			continue;
+
+		} else if (ffstr_ieqcz(&key, "client_no_context_takeover")) {
+			if (o->cnct || val.len != 0)
+				return -1;
+			o->cnct = 1;
+			continue;
+
+		} else if (ffstr_ieqcz(&key, "server_max_window_bits")) {
+			pbits = &o->smwb;
+			if (val.len == 0)
+				return -1;
+
+		} else if (ffstr_ieqcz(&key, "client_max_window_bits")) {
+			pbits = &o->cmwb;
+
+		} else
+			return -1;
+
+		if (*pbits != -1)
+			return -1;
+		*pbits = 0;
+		if (val.len != 0) {
+			uint n;
+			if (val.len != ffs_toint(val.ptr, val.len, &n, FFS_INT32)
+				|| !(n >= PMD_MINBITS && n <= PMD_MAXBITS))
+				return -1;
+			*pbits = n;
+		}
+	}
+
+	return 0;
+}
+
+int ffwebskt_deflate_accept(ffwebskt_deflate_conf *conf, const ffstr *exts)
+{
+	ffstr s = *exts, ext;
+	struct pmd_offer o;
+
+	while (s.len != 0) {
+		ffstr_nextval3(&s, &ext, ',');
+		if (0 != pmd_parse(ext, &o))
+			continue;
+
+		/* zlib doesn't support deflate with 256-byte window:
+		 the offer with server_max_window_bits=8 is declined,
+		 because the response must not have a larger value (RFC 7692 7.1.2.1);
+		 our own limit of 8 is raised to 9. */
+		if (o.smwb == PMD_MINBITS)
+			continue;
+		uint smwb = (conf->server_max_window_bits != 0)
+			? ffmax(conf->server_max_window_bits, PMD_MINBITS + 1) : PMD_MAXBITS;
+		if (o.smwb > 0)
+			smwb = ffmin(smwb, (uint)o.smwb);
+		if (smwb == PMD_MAXBITS && o.smwb == -1)
+			smwb = 0;
+
+		uint cmwb = 0;
+		if (o.cmwb != -1) {
+			cmwb = (o.cmwb > 0) ? (uint)o.cmwb : PMD_MAXBITS;
+			if (conf->client_max_window_bits != 0)
+				cmwb = ffmin(cmwb, conf->client_max_window_bits);
+			if (o.cmwb == 0 && cmwb == PMD_MAXBITS)
+				cmwb = 0;
+		}
+
+		conf->server_max_window_bits = smwb;
+		conf->client_max_window_bits = cmwb;
+		conf->server_no_context_takeover |= o.snct;
+		conf->client_no_context_takeover |= o.cnct;
+		return 0;
+	}
+
+	return 1;
+}
+
+int ffwebskt_deflate_check(ffwebskt_deflate_conf *conf, const ffstr *exts)
+{
+	ffstr s = *exts, ext;
+	struct pmd_offer o;
+	int r, found = 0;
+
+	while (s.len != 0) {
+		ffstr_nextval3(&s, &ext, ',');
+		r = pmd_parse(ext, &o);
+		if (r == 1)
+			continue;
+		if (r < 0 || found)
+			return -1;
+		found = 1;
+
+		if (o.cmwb == 0
+			|| (o.cmwb > 0 && conf->client_max_window_bits == 0))
+			return -1; //server must not set client_max_window_bits if it wasn't offered
+		if (o.cmwb == PMD_MINBITS)
+			return -1; //zlib doesn't support deflate with 256-byte window
+		if (o.smwb > 0 && conf->server_max_window_bits != 0
+			&& (uint)o.smwb > conf->server_max_window_bits)
+			return -1;
+		if (conf->server_no_context_takeover && !o.snct)
+			return -1;
+
+		conf->server_max_window_bits = (o.smwb > 0) ? (uint)o.smwb : 0;
+		conf->client_max_window_bits = (o.cmwb > 0) ? (uint)o.cmwb : 0;
+		conf->server_no_context_takeover = o.snct;
+		conf->client_no_context_takeover = o.cnct;
+	}
+
+	return (found) ? 0 : 1;
+}
+
+size_t ffwebskt_deflate_hdr(const ffwebskt_deflate_conf *conf, char *buf, size_t cap)
+{
+	char *p = buf, *end = buf + cap;
+	size_t n;
+
+	if (0 == (n = ffs_fmt(p, end, "%s", PMD_NAME)))
+		return 0;
+	p += n;
+
+	if (conf->server_no_context_takeover) {
+		if (0 == (n = ffs_fmt(p, end, "; server_no_context_takeover")))
+			return 0;
+		p += n;
+	}
+
+	if (conf->client_no_context_takeover) {
+		if (0 == (n = ffs_fmt(p, end, "; client_no_context_takeover")))
+			return 0;
+		p += n;
+	}
+
+	if (conf->server_max_window_bits != 0) {
+		if (0 == (n = ffs_fmt(p, end, "; server_max_window_bits=%u", conf->server_max_window_bits)))
+			return 0;
+		p += n;
+	}
+
+	if (conf->client_max_window_bits != 0) {
+		if (0 == (n = ffs_fmt(p, end, "; client_max_window_bits=%u", conf->client_max_window_bits)))
+			return 0;
+		p += n;
+	}
+
+	return p - buf;
+}
+
 #define GATHER(w, st, n) \
 	(w)->state = R_GATHER,  (w)->nxstate = st,  (w)->gathlen = n
 
@@ -102,14 +292,21 @@ int ffwebskt_parse(ffwebskt *w)
 	case R_HDR:
 		w->op = w->buf[0] & WS_F_OPCODE;
 
-		if ((w->buf[0] & WS_F_RES) != 0)
-			return FFWEBSKT_RERR;
+		n = w->buf[0] & WS_F_RES;
+		if (n != 0) {
+			if (n != WS_F_RSV1 || !w->deflate)
+				return FFWEBSKT_RERR;
+			if (w->op == FFWEBSKT_OP_CONT || w->op >= FFWEBSKT_OP_CLOSE)
+				return FFWEBSKT_RERR; //RSV1 is allowed only in the first frame of a data message
+		}
 
 		if (!w->cont && w->op == FFWEBSKT_OP_CONT)
 			return FFWEBSKT_RERR; //unexpected "continuation" frame
 		else if (w->cont && w->op != FFWEBSKT_OP_CONT)
 			return FFWEBSKT_RERR; //expected "continuation" frame
 		w->cont = !(w->buf[0] & WS_F_FIN);
+		if (w->op != FFWEBSKT_OP_CONT)
+			w->compressed = !!(w->buf[0] & WS_F_RSV1);
 
 		w->mask_off = 0;
 
@@ -159,6 +356,7 @@ int ffwebskt_parse(ffwebskt *w)
 	case R_HOK:
 		if (w->mask_off != 0)
 			w->mask = *(int*)(w->buf + w->mask_off);
+		w->mask_pos = 0;
 		w->state = R_BODY;
 		if (w->op == FFWEBSKT_OP_CONT)
 			continue;
@@ -175,9 +373,12 @@ int ffwebskt_parse(ffwebskt *w)
 			return FFWEBSKT_RMORE;
 
 		size_t nn = ffmin64(w->datalen, w->in.len);
-		if (w->mask_off != 0) {
+		if (w->mask_off != 0 && w->inplace) {
+			w->mask_pos = ffmem_xor4_off(w->in.ptr, w->in.ptr, nn, w->mask, w->mask_pos);
+			ffstr_set(&w->out, w->in.ptr, nn);
+		} else if (w->mask_off != 0) {
 			nn = ffmin64(nn, sizeof(w->buf));
-			ffmem_xor4(w->buf, w->in.ptr, nn, w->mask);
+			w->mask_pos = ffmem_xor4_off(w->buf, w->in.ptr, nn, w->mask, w->mask_pos);
 			ffstr_set(&w->out, w->buf, nn);
 		} else {
 			ffstr_set(&w->out, w->in.ptr, nn);
@@ -193,38 +394,50 @@ int ffwebskt_parse(ffwebskt *w)
 }
 
 
-int ffwebskt_newmsg(ffwebskt_cook *w, uint mask_key, uint op)
+/** Write message header.
+Return header size;  0 on error. */
+static uint ws_hdr(char *buf, size_t datalen, uint mask_key, uint op)
 {
-	FF_ASSERT(0 == (op & ~WS_F_OPCODE));
+	FF_ASSERT(0 == (op & ~(WS_F_OPCODE | WS_F_RSV1 | FFWEBSKT_F_MORE)));
 
 	char *p;
-	w->buf[0] = 0;
-	w->buf[0] |= WS_F_FIN;
-	w->buf[0] |= op;
-	w->buf[1] = 0;
-
-	if (w->in.len < WS_MAXMSG1) {
-		w->buf[1] |= w->in.len;
-		p = w->buf + 2;
-	} else if (w->in.len <= WS_MAXMSG2) {
-		ffint_hton16(w->buf + 2, w->in.len);
-		p = w->buf + 2 + 2;
+	buf[0] = 0;
+	if (!(op & FFWEBSKT_F_MORE))
+		buf[0] |= WS_F_FIN;
+	buf[0] |= op & (WS_F_OPCODE | WS_F_RSV1);
+	buf[1] = 0;
+
+	if (datalen < WS_MAXMSG1) {
+		buf[1] |= datalen;
+		p = buf + 2;
+	} else if (datalen <= WS_MAXMSG2) {
+		ffint_hton16(buf + 2, datalen);
+		p = buf + 2 + 2;
 #ifdef FF_64
-	} else if (w->in.len <= WS_MAXMSG) {
-		ffint_hton64(w->buf + 2, w->in.len);
-		p = w->buf + 2 + 8;
+	} else if (datalen <= WS_MAXMSG) {
+		ffint_hton64(buf + 2, datalen);
+		p = buf + 2 + 8;
 #endif
 	} else
-		return FFWEBSKT_RERR;
+		return 0;
 
 	if (mask_key != 0) {
-		w->buf[1] |= WS_F_MASK;
+		buf[1] |= WS_F_MASK;
 		ffmemcpy(p, &mask_key, 4);
 		p += 4;
 	}
 
+	return p - buf;
+}
+
+int ffwebskt_newmsg(ffwebskt_cook *w, uint mask_key, uint op)
+{
+	uint n = ws_hdr(w->buf, w->in.len, mask_key, op);
+	if (n == 0)
+		return FFWEBSKT_RERR;
+
 	w->mask = mask_key;
-	w->out.ptr = w->buf,  w->out.len = p - w->buf;
+	w->out.ptr = w->buf,  w->out.len = n;
 	return FFWEBSKT_RDATA;
 }
 
@@ -245,3 +458,19 @@ int ffwebskt_writenext(ffwebskt_cook *w)
 	w->in.len = 0;
 	return FFWEBSKT_RDATA;
 }
+
+int ffwebskt_cookv(ffwebskt_cook *w, uint mask_key, uint op, ffiovec iov[2])
+{
+	uint n = ws_hdr(w->buf, w->in.len, mask_key, op);
+	if (n == 0)
+		return -1;
+	ffiov_set(&iov[0], w->buf, n);
+	if (w->in.len == 0)
+		return 1;
+
+	if (mask_key != 0)
+		ffmem_xor4(w->in.ptr, w->in.ptr, w->in.len, mask_key);
+	ffiov_set(&iov[1], w->in.ptr, w->in.len);
+	w->in.len = 0;
+	return 2;
+}
@@ -9,9 +9,34 @@ Copyright (c) 2019 Simon Zolin
 #include <FF/sys/timer-queue.h>
 
 
-/** Deinitialize recycled connection objects (on kqueue close). */
+/** Deinitialize recycled request and connection objects (on kqueue close). */
 FF_EXTN void ffhttpcl_deinit();
 
+/** Pool of idle and pipelining connections.
+It isn't thread-safe:  all requests using one pool must be processed in the same thread.
+Create one pool per kqueue. */
+typedef struct ffhttpcl_pool ffhttpcl_pool;
+
+FF_EXTN ffhttpcl_pool* ffhttpcl_pool_create(void);
+
+/** Close pooled connections and free the pool.
+All requests using the pool must be closed before. */
+FF_EXTN void ffhttpcl_pool_free(ffhttpcl_pool *p);
+
+/** Connection pool statistics. */
+struct ffhttpcl_poolstat {
+	uint idle; /** N of connections in the pool */
+	uint64 pooled; /** N of connections put into the pool */
+	uint64 reused; /** N of requests sent over a pooled connection */
+	uint64 expired; /** N of connections closed after idle timeout */
+	uint64 broken; /** N of pooled connections closed by server */
+	uint64 overflow; /** N of connections not pooled because of 'max_per_host' limit */
+	uint64 pipelined; /** N of requests sent over a connection that is waiting for the previous response */
+};
+
+/** Get connection pool statistics. */
+FF_EXTN void ffhttpcl_poolstat(ffhttpcl_pool *p, struct ffhttpcl_poolstat *st);
+
 
 enum FFHTTPCL_F {
 	FFHTTPCL_HTTP10 = 1, /** Use HTTP ver 1.0. */
@@ -56,6 +81,21 @@ struct ffhttpcl_conf {
 		const char *host;
 		uint port; /** Proxy port */
 	} proxy;
+	/** Keep the connection open after the request is complete,
+	 so the next request to the same server (host, port, proxy) with the same 'pool.conns' doesn't need to connect.
+	 A pooled connection is checked on reuse:  it's closed if the server has closed it. */
+	struct {
+		ffhttpcl_pool *conns; /** Connection pool used with 'kq'.  NULL: don't pool connections */
+		uint idle_timeout; /** msec.  0: don't put connections into the pool */
+		uint max_per_host; /** Max. number of idle connections to one server */
+
+		/** HTTP/1.1 pipelining: max. number of requests waiting for responses on one connection.
+		A request without body with an idempotent method (GET, HEAD, OPTIONS, PUT, DELETE)
+		 is sent over a busy connection to the same server without waiting for the previous response.
+		If the server closes the connection, the pipelined requests are restarted without pipelining.
+		0 or 1: disabled */
+		uint pipeline;
+	} pool;
 	uint debug_log :1; /** Log messages with FFHTTPCL_LOG_DEBUG. */
 };
 
@@ -73,6 +113,7 @@ enum FFHTTPCL_ST {
 	FFHTTPCL_DNS_WAIT, /** resolving hostname via DNS */
 	FFHTTPCL_IP_WAIT, /** connecting to host */
 	FFHTTPCL_REQ_WAIT, /** sending request */
+	FFHTTPCL_REQ_BODY, /** ready to send the next part of request body */
 	FFHTTPCL_RESP_WAIT, /** receiving response (HTTP headers) */
 	FFHTTPCL_RESP, /** received response headers */
 	FFHTTPCL_RESP_RECV, /** receiving data */
@@ -92,7 +133,13 @@ Processing is suspended until user calls send(). */
 FF_EXTN void ffhttpcl_sethandler(void *con, ffhttpcl_handler func, void *udata);
 
 /** Connect, send request, receive response.
-Note: data must be NULL - sending request body isn't supported. */
+Request body is sent when "Content-Length" or "Transfer-Encoding: chunked" header is added by ffhttpcl_header():
+ user handler is called with FFHTTPCL_REQ_BODY status, then user calls send() with the next part of body.
+ The data must stay valid until the handler is called again.
+ Chunked encoding is applied automatically.
+ The body ends when "Content-Length" bytes are sent, or when data is NULL or empty.
+ The request with body isn't resent after I/O failure and doesn't follow redirections.
+data: request body;  must be NULL if status isn't FFHTTPCL_REQ_BODY */
 FF_EXTN void ffhttpcl_send(void *con, const ffstr *data);
 
 /** Get response data.
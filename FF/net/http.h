@@ -181,10 +181,11 @@ FF_EXTN const char *ffhttp_errstr(int code);
 
 /** Header information. */
 typedef struct ffhttp_hdr {
-	ushort len;
+	uint len;
 	byte idx;
 	byte ihdr; //enum FFHTTP_HDR
 	uint crc;
+	uint max_len; // max. size of the first line and headers.  0: 64k.  Set after ffhttp_inithdr().
 	ffrange key
 		, val;
 } ffhttp_hdr;
@@ -195,42 +196,82 @@ static FFINL void ffhttp_inithdr(ffhttp_hdr *h) {
 }
 
 /** Get name and value of the next HTTP header.
-Headers must be within 64k boundary.
+Headers must be within 'hdr.max_len' boundary.
 Return enum FFHTTP_E. */
 FF_EXTN int ffhttp_nexthdr(ffhttp_hdr *hdr, const char *d, size_t len);
 
+
+/** Parser of headers received in several non-contiguous buffers.
+A header line is returned from the user's buffer if it's complete there;
+ only a line split between buffers is copied to the internal buffer. */
+typedef struct ffhttp_hdrstream {
+	ffhttp_hdr hdr; // hdr.ihdr: enum FFHTTP_HDR of the last parsed header
+	ffstr key, val; // the last parsed header;  valid until the next call
+	uint max_len; // max. size of all headers.  0: 64k
+	uint total; // N of bytes processed
+	uint line_parsed :1;
+	ffarr line; // the beginning of a header line from the previous buffers
+} ffhttp_hdrstream;
+
+static FFINL void ffhttp_hdrstream_init(ffhttp_hdrstream *s) {
+	ffmem_tzero(s);
+}
+
+static FFINL void ffhttp_hdrstream_free(ffhttp_hdrstream *s) {
+	ffarr_free(&s->line);
+}
+
+/** Get name and value of the next HTTP header from a stream of data.
+data: input data;  shifted by the number of bytes processed
+Return FFHTTP_OK: 'key', 'val' and 'hdr.ihdr' are set;
+ FFHTTP_MORE: all input data is processed, need more;
+ FFHTTP_DONE: the end of headers, 'data' points to body;
+ enum FFHTTP_E on error. */
+FF_EXTN int ffhttp_hdrstream_next(ffhttp_hdrstream *s, ffstr *data);
+
 /** Return FFHTTP_METH. */
 static FFINL int ffhttp_findmethod(const char *data, size_t len) {
 	int r = ffs_findarr3(ffhttp_smeth, data, len);
 	return (r != -1) ? (uint)r : FFCNT(ffhttp_smeth);
 }
 
-typedef struct _ffhttp_headr _ffhttp_headr;
+typedef struct _ffhttp_headr {
+	uint hash;
+	byte ihdr; //enum FFHTTP_HDR
+	ffrange key;
+	ffrange val;
+} _ffhttp_headr;
+
+enum {
+	FFHTTP_HIDX_INLINE = 24, // headers indexed without memory allocation
+};
 
 /** Parsed headers information. */
 typedef struct ffhttp_headers {
 	const char *base;
-	ushort len;
+	uint len;
 	ushort ver; ///< HTTP version, e.g. 0x0100 = http/1.0
-	ushort firstline_len;
+	uint firstline_len;
 	byte http11 : 1
 		, firstcrlf : 2
 		, conn_close : 1
 		, has_body : 1
 		, chunked : 1 ///< Transfer-Encoding: chunked
 		, body_conn_close : 1 // for response
-		, index_headers :1 //if set, collect headers in hidx and then build htheaders
+		, index_headers :1 //if set, collect headers in hidx for ffhttp_findhdr(), ffhttp_gethdr()
 		;
 	byte ce_gzip : 1 ///< Content-Encoding: gzip
 		, ce_identity : 1 ///< no Content-Encoding or Content-Encoding: identity
 		;
 	int64 cont_len; ///< Content-Length value or -1
 
-	ffhstab htheaders;
 	struct {
 		uint len;
-		_ffhttp_headr *ptr;
+		uint cap;
+		_ffhttp_headr *ptr; // NULL: headers are in 'hidx_inline'
 	} hidx;
+	_ffhttp_headr hidx_inline[FFHTTP_HIDX_INLINE];
+	byte hidx_known[FFHTTP_HLAST]; // enum FFHTTP_HDR -> index in hidx + 1 of its first occurrence;  0: not found
 
 	ffhttp_hdr hdr; ///< The header being parsed currently
 } ffhttp_headers;
@@ -238,7 +279,6 @@ typedef struct ffhttp_headers {
 FF_EXTN void ffhttp_init(ffhttp_headers *h);
 
 static FFINL void ffhttp_fin(ffhttp_headers *h) {
-	ffhst_free(&h->htheaders);
 	FF_SAFECLOSE(h->hidx.ptr, NULL, ffmem_free);
 }
 
@@ -250,8 +290,10 @@ FF_EXTN int ffhttp_parsehdr(ffhttp_headers *h, const char *data, size_t len);
 Return 0 if header is not found. */
 FF_EXTN int ffhttp_findhdr(const ffhttp_headers *h, const char *name, size_t namelen, ffstr *dst);
 
-#define ffhttp_findihdr(h, ihdr, dst) \
-	ffhttp_findhdr(h, ffhttp_shdr[ihdr].ptr, ffhttp_shdr[ihdr].len, dst)
+/** Get value of a known header.
+ihdr: enum FFHTTP_HDR
+Return 0 if header is not found. */
+FF_EXTN int ffhttp_findihdr(const ffhttp_headers *h, uint ihdr, ffstr *dst);
 
 /** Get header by index.
 Return enum FFHTTP_HDR.
@@ -279,7 +321,7 @@ typedef struct ffhttp_request {
 
 	ffurl url;
 	ffstr decoded_url;
-	ushort offurl;
+	uint offurl;
 	ffrange sver;
 	byte methodlen;
 	byte method; //FFHTTP_METH
@@ -380,7 +422,7 @@ typedef struct ffhttp_response {
 
 	byte ver_len;
 	ushort code;
-	ushort status_text_off;
+	uint status_text_off;
 	ffrange status;
 } ffhttp_response;
 
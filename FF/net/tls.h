@@ -5,6 +5,7 @@ Copyright (c) 2018 Simon Zolin
 #pragma once
 
 #include <FF/string.h>
+#include <FF/hashtab.h>
 
 
 enum FFTLS_E {
@@ -46,6 +47,12 @@ typedef struct fftls {
 	ffstr alpn_protos; //ALPN protocols from C/S Hello (struct alpn_proto[]) (available after FFTLS_RHELLO_ALPN)
 
 	ffstr cert; //certficate data from Server Certificate (available after FFTLS_RCERT)
+
+	// Client Hello fingerprint data (available after FFTLS_RDONE for the record with Client Hello)
+	uint hello_version; //version from Client Hello body
+	ffstr groups; //supported groups (ushort[], network byte order)
+	ffstr ec_formats; //EC point formats (byte[])
+	ffstr exts; //extensions (struct ext[])
 } fftls;
 
 /** Set input data. */
@@ -53,6 +60,10 @@ typedef struct fftls {
 	ffstr_set(&(t)->in, d, n)
 
 /** Parse TLS record.
+A handshake message fragmented across several records is joined in the input buffer:
+ record bodies are moved over the headers of the next records,
+ so the message data is parsed in place without a separate reassembly buffer.
+ FFTLS_RMORE is returned until all fragments are available.
 Return enum FFTLS_R. */
 FF_EXTN int fftls_read(fftls *t);
 
@@ -73,3 +84,40 @@ FF_EXTN int fftls_alpn_next(ffstr *buf, ffstr *proto);
 /** Write a TLS alert record.
 Return the number of bytes written;  -1 if not enough space. */
 FF_EXTN int fftls_alert(void *buffer, size_t cap, const void *data, size_t len);
+
+/** Get JA3 fingerprint string of Client Hello:
+ "VERSION,CIPHERS,EXTENSIONS,GROUPS,EC_FORMATS" - decimal values separated by '-', GREASE values are skipped.
+Use MD5 of this string for JA3 compatibility or ffhash64() for a compact routing key.
+Note: JA4 isn't supported.
+Return the number of bytes written;  0 if the buffer is too small. */
+FF_EXTN size_t fftls_ja3(const fftls *t, char *buf, size_t cap);
+
+
+/** SNI router: find backend ID by server name.
+Patterns:
+ "host.example.com": exact match
+ "*.example.com": any subdomain of example.com (not example.com itself);  the longest suffix wins
+ "*": default
+Names are case-insensitive;  a trailing dot is ignored.
+Lookup time is linear in the hostname length. */
+typedef struct fftls_sni {
+	ffarr items; //struct sni_item[]
+	ffarr names; //lower-case names of all patterns
+	ffhstab ht;
+	int def_id; //-1: not set
+} fftls_sni;
+
+FF_EXTN void fftls_sni_init(fftls_sni *s);
+FF_EXTN void fftls_sni_free(fftls_sni *s);
+
+/** Add pattern.
+Return 0 on success. */
+FF_EXTN int fftls_sni_add(fftls_sni *s, const ffstr *pattern, uint id);
+
+/** Build lookup table after all patterns are added.
+Return 0 on success;  -1: duplicate pattern or no memory. */
+FF_EXTN int fftls_sni_compile(fftls_sni *s);
+
+/** Get backend ID by server name.
+Return -1 if not found. */
+FF_EXTN int fftls_sni_find(const fftls_sni *s, const char *host, size_t len);
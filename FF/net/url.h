@@ -12,15 +12,15 @@ Copyright (c) 2013 Simon Zolin
 
 /** URL structure. */
 typedef struct ffurl {
-	ushort offhost;
+	uint offhost;
 	ushort port; //number
 	byte hostlen;
 	byte portlen;
 
-	ushort len;
-	ushort offpath;
-	ushort pathlen;
-	ushort decoded_pathlen; //length of decoded filename
+	uint len;
+	uint offpath;
+	uint pathlen;
+	uint decoded_pathlen; //length of decoded filename
 
 	unsigned idx : 4
 		, ipv4 : 1
@@ -53,9 +53,9 @@ FF_EXTN int ffurl_parse(ffurl *url, const char *s, size_t len);
 static FFINL void ffurl_rebase(ffurl *url, const char *oldbase, const char *newbase) {
 	ssize_t off = oldbase - newbase;
 	if (url->hostlen != 0)
-		url->offhost += (short)off;
-	url->offpath += (short)off;
-	url->len += (short)off;
+		url->offhost += (uint)off;
+	url->offpath += (uint)off;
+	url->len += (uint)off;
 }
 
 /** Get error message. */
@@ -0,0 +1,111 @@
+/** WebSocket permessage-deflate compression (RFC 7692).
+Copyright (c) 2020 Simon Zolin
+*/
+
+/*
+Reader:
+	ffwebskt_inflate_create()
+	... ffwebskt_parse_z()
+	ffwebskt_inflate_free()
+
+Writer:
+	ffwebskt_deflate_create()
+	ffwebskt_input()
+	ffwebskt_cookv_z()  (while ffwebskt_deflate_more())
+	ffwebskt_deflate_free()
+*/
+
+#pragma once
+
+#include <FF/net/websocket.h>
+#include <FF/array.h>
+
+#include <zlib.h>
+
+
+typedef struct ffwebskt_zconf {
+	/** Sliding window size (8..15).
+	Deflate: the negotiated *_max_window_bits of our side;  Inflate: of the peer's side.
+	0: default (15).
+	Deflate: 8 is raised to 9 (zlib doesn't support 256-byte window),
+	 so the negotiation never selects 8 for our side:
+	 ffwebskt_deflate_accept() declines such offers, ffwebskt_deflate_check() rejects such response. */
+	uint window_bits;
+
+	uint level; //compression level (1..9).  default:6
+	uint mem_level; //deflate internal state memory (1..9).  default:8
+
+	/** Inflate: max. size of a decompressed message.  default:16MB
+	Deflate: max. size of a compressed message. */
+	size_t max_msg;
+
+	/** Inflate: size of output buffer.
+	Deflate: max. size of compressed data in a frame.  default:16k */
+	uint bufsize;
+
+	/** Reset the compression context after each message:
+	 *_no_context_takeover is negotiated for our (deflate) or the peer's (inflate) side.
+	Deflate: a message doesn't depend on the previous ones,
+	 so one compressor and its output may be shared between many connections. */
+	uint no_context_takeover :1;
+} ffwebskt_zconf;
+
+FF_EXTN void ffwebskt_zconf_init(ffwebskt_zconf *conf);
+
+
+typedef struct ffwebskt_inflate {
+	z_stream z;
+	ffwebskt_zconf conf;
+	ffstr in;
+	ffarr buf;
+	uint64 total;
+	uint more :1; //inflate() may have more output
+	uint tail :1; //the message is complete;  processing the trailing empty block
+} ffwebskt_inflate;
+
+/** Return NULL on error. */
+FF_EXTN ffwebskt_inflate* ffwebskt_inflate_create(const ffwebskt_zconf *conf);
+FF_EXTN void ffwebskt_inflate_free(ffwebskt_inflate *z);
+
+/** Parse data and decompress message body.
+Same as ffwebskt_parse(), but for compressed messages
+ ffwebskt_body() returns decompressed data which is valid until the next call.
+'w.deflate' must be set.
+Return enum FFWEBSKT_R. */
+FF_EXTN int ffwebskt_parse_z(ffwebskt *w, ffwebskt_inflate *z);
+
+
+typedef struct ffwebskt_deflate {
+	z_stream z;
+	ffwebskt_zconf conf;
+	ffarr buf;
+	uint64 total; //compressed size of the current message
+	uint hold; //number of bytes at the end of 'buf' not returned yet:  they may be a part of the trailing empty block
+	uint more :1; //the current message isn't complete
+} ffwebskt_deflate;
+
+/** Return NULL on error. */
+FF_EXTN ffwebskt_deflate* ffwebskt_deflate_create(const ffwebskt_zconf *conf);
+FF_EXTN void ffwebskt_deflate_free(ffwebskt_deflate *z);
+
+/** Compress the next part of message body.
+Data is compressed into the buffer of 'z' ('bufsize' bytes):
+ when the buffer is full, its contents are returned as a fragment of the message.
+@in: the whole message body;  shifted by the number of processed bytes
+@out: receives compressed data which is valid until the next call
+Return 0: 'out' is a fragment and the message continues;
+ 1: 'out' is the last fragment of the message;
+ <0 on error. */
+FF_EXTN int ffwebskt_deflate_data(ffwebskt_deflate *z, ffstr *in, ffstr *out);
+
+/** Return TRUE if the message isn't complete:  ffwebskt_cookv_z() must be called again. */
+#define ffwebskt_deflate_more(z)  ((z)->more)
+
+/** Compress message body and get the next frame as header and body buffers.
+Call ffwebskt_input() to set input data.
+Same as ffwebskt_cookv(), but the body is compressed into the buffer of 'z' which is valid until the next call.
+A large message is sent as several frames of up to 'bufsize' bytes:
+ the first one has opcode 'op' and RSV1 bit, the next ones are continuation frames.
+Note: a masked body can't be shared between connections.
+Return the number of elements in 'iov';  <0 on error. */
+FF_EXTN int ffwebskt_cookv_z(ffwebskt_cook *w, ffwebskt_deflate *z, uint mask_key, uint op, ffiovec iov[2]);
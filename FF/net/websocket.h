@@ -48,6 +48,15 @@ enum FFWEBSKT_OP {
 	FFWEBSKT_OP_CLOSE = 8,
 	FFWEBSKT_OP_PING,
 	FFWEBSKT_OP_PONG,
+
+	/** Flag for ffwebskt_newmsg(), ffwebskt_cookv():
+	 message body is compressed by permessage-deflate (RSV1 bit). */
+	FFWEBSKT_F_COMPRESSED = 0x40,
+
+	/** Flag for ffwebskt_newmsg(), ffwebskt_cookv():
+	 the frame isn't the last fragment of the message (FIN bit isn't set);
+	 the next fragments are sent with FFWEBSKT_OP_CONT. */
+	FFWEBSKT_F_MORE = 0x100,
 };
 
 typedef struct ffwebskt {
@@ -58,9 +67,20 @@ typedef struct ffwebskt {
 	uint64 datalen;
 	uint mask_off;
 	uint mask;
+	uint mask_pos; //position within the mask key for the next body chunk
 	uint op; //enum FFWEBSKT_OP
 	uint cont :1;
 	uint server :1;
+	uint compressed :1; //the current message is compressed
+
+	/** permessage-deflate is negotiated:  RSV1 bit marks compressed messages.
+	 Use ffwebskt_parse_z() to get decompressed data. */
+	uint deflate :1;
+
+	/** Unmask message body in the input buffer and return it via 'out' directly:
+	 no copying to 'buf' and no 4k limit per FFWEBSKT_RDATA.
+	 The buffer passed to ffwebskt_input() must be writable. */
+	uint inplace :1;
 
 	ffstr in;
 	ffstr out;
@@ -73,6 +93,7 @@ typedef struct ffwebskt {
 #define FFWEBSKT_HDR_ACCEPT  "Sec-WebSocket-Accept"
 #define FFWEBSKT_HDR_VER  "Sec-WebSocket-Version"
 #define FFWEBSKT_HDR_PROTO  "Sec-WebSocket-Protocol"
+#define FFWEBSKT_HDR_EXT  "Sec-WebSocket-Extensions"
 
 /** Get server security key.
 @clientkey: value of HTTP header Sec-WebSocket-Key
@@ -83,6 +104,36 @@ FF_EXTN void ffwebskt_accept(struct ffwebskt *w, const ffstr *clientkey);
 Return 0 on success. */
 FF_EXTN int ffwebskt_accept_ver(struct ffwebskt *w, const ffstr *ver);
 
+/** permessage-deflate extension parameters (RFC 7692).
+Window bits: 8..15;  0: parameter isn't used (15). */
+typedef struct ffwebskt_deflate_conf {
+	uint server_max_window_bits;
+	uint client_max_window_bits;
+	uint server_no_context_takeover :1;
+	uint client_no_context_takeover :1;
+} ffwebskt_deflate_conf;
+
+/** Server: choose permessage-deflate parameters from client's offers.
+Deflate with 256-byte window isn't supported:
+ an offer with server_max_window_bits=8 is declined (the response can't have a larger value);
+ server_max_window_bits=8 in 'conf' is treated as 9.
+@conf: [in] server limits and preferences;  [out] the negotiated parameters
+@exts: value of HTTP header Sec-WebSocket-Extensions
+Return 0 if the extension is accepted;  1: not offered or no offer is acceptable. */
+FF_EXTN int ffwebskt_deflate_accept(ffwebskt_deflate_conf *conf, const ffstr *exts);
+
+/** Client: check server's response to permessage-deflate offer.
+The response with client_max_window_bits=8 is invalid for us:  deflate with 256-byte window isn't supported.
+@conf: [in] parameters sent in the offer;  [out] the negotiated parameters
+@exts: value of HTTP header Sec-WebSocket-Extensions
+Return 0 if the extension is enabled;  1: not enabled;  -1: invalid response. */
+FF_EXTN int ffwebskt_deflate_check(ffwebskt_deflate_conf *conf, const ffstr *exts);
+
+/** Write Sec-WebSocket-Extensions header value for permessage-deflate:
+ client's offer or server's response.
+Return the number of bytes written;  0 if the buffer is too small. */
+FF_EXTN size_t ffwebskt_deflate_hdr(const ffwebskt_deflate_conf *conf, char *buf, size_t cap);
+
 /** Set input data. */
 #define ffwebskt_input(w, d, n)  ffstr_set(&(w)->in, d, n)
 
@@ -92,6 +143,9 @@ FF_EXTN int ffwebskt_accept_ver(struct ffwebskt *w, const ffstr *ver);
 /** Get message body length after FFWEBSKT_RMSG is returned. */
 #define ffwebskt_datalen(w)  ((w)->datalen)
 
+/** Return TRUE if the message is compressed by permessage-deflate. */
+#define ffwebskt_compressed(w)  ((w)->compressed)
+
 /** Get message body after FFWEBSKT_RDATA is returned. */
 #define ffwebskt_body(w)  ((w)->out)
 
@@ -111,10 +165,19 @@ typedef struct ffwebskt_cook {
 /** Get message header.
 Call ffwebskt_input() to set input data.
  Data must be valid until ffwebskt_writenext() returns FFWEBSKT_RDATA_FIN.
-@op: enum FFWEBSKT_OP
+@op: enum FFWEBSKT_OP;  may be OR-ed with FFWEBSKT_F_COMPRESSED
 Return enum FFWEBSKT_R. */
 FF_EXTN int ffwebskt_newmsg(ffwebskt_cook *w, uint mask_key, uint op);
 
 /** Get message body.
 Return enum FFWEBSKT_R. */
 FF_EXTN int ffwebskt_writenext(ffwebskt_cook *w);
+
+/** Get the complete message as header and body buffers, without copying the body.
+Call ffwebskt_input() to set input data.
+@mask_key: if not 0, the body is masked in place:
+ the input buffer must be writable and stay valid until the data is sent.
+@op: enum FFWEBSKT_OP;  may be OR-ed with FFWEBSKT_F_COMPRESSED
+@iov: receives header and body (if not empty)
+Return the number of elements in 'iov';  <0 on error. */
+FF_EXTN int ffwebskt_cookv(ffwebskt_cook *w, uint mask_key, uint op, ffiovec iov[2]);
@@ -190,6 +190,11 @@ FF_EXTN void ffmem_xor(byte *dst, const byte *src, size_t len, const byte *key,
 /** Apply XOR on a data with 4-byte key. */
 FF_EXTN void ffmem_xor4(void *dst, const void *src, size_t len, uint key);
 
+/** Apply XOR on a data with 4-byte key starting at key byte 'off'.
+'dst' may be equal to 'src'.
+Return key offset for the next chunk of the same stream:  (off + len) % 4. */
+FF_EXTN uint ffmem_xor4_off(void *dst, const void *src, size_t len, uint key, uint off);
+
 
 // FIND - get position of a byte or a substring
 
@@ -10,14 +10,25 @@ Copyright (c) 2019 Simon Zolin
 #include <ffbase/slice.h>
 
 
+struct buf;
 static int fr_read_off(fffileread *f, uint64 off);
 static int fr_read(fffileread *f);
+static void fr_readahead(fffileread *f);
+static int fr_uring_read(fffileread *f, uint64 off, uint flags);
+static uint fr_uring_readahead(fffileread *f, uint64 off, uint back);
+static int fr_uring_submit(fffileread *f);
+static void fr_uring_complete(ffuring_op *op, int result);
 
 
 struct buf {
 	size_t len;
 	char *ptr;
 	uint64 offset;
+
+	ffuring_op uop;
+	int ubuf; // index in io_uring buffers table
+	uint pending :1; // io_uring request is in progress
+	uint ra :1; // the block was read ahead and hasn't been requested by user yet
 };
 
 struct fffileread {
@@ -34,6 +45,19 @@ struct fffileread {
 	uint wbuf;
 	uint locked;
 
+	int ufile; // index in io_uring files table
+	uint upending; // number of io_uring requests in progress
+
+	// read-ahead:
+	uint64 ra_prev; // offset of the block returned to user last time
+	uint ra_win; // window size, in blocks
+	int ra_dir; // access direction:  1:forward  -1:backward  0:unknown
+	uint64 ra_next; // the last block scheduled for read-ahead
+	uint ra_left; // blocks left to read ahead with a single AIO object
+	uint ra_back :1;
+
+	uint64 ckey[3]; // shared cache key: offset, file ID, device ID
+	void *cached_id; // shared cache item returned to user
 	fffileread_conf conf;
 	struct fffileread_stat stat;
 };
@@ -77,6 +101,7 @@ static int bufs_create(fffileread *f, const fffileread_conf *conf)
 		if (NULL == (b->ptr = ffmem_align(conf->bufsize, conf->bufalign)))
 			goto err;
 		b->offset = (uint64)-1;
+		b->ubuf = -1;
 	}
 	return 0;
 
@@ -85,10 +110,12 @@ err:
 	return -1;
 }
 
-static void bufs_free(ffslice *bufs)
+static void bufs_free(ffslice *bufs, ffuring *u)
 {
 	struct buf *b;
 	FFSLICE_WALK_T(bufs, b, struct buf) {
+		if (b->ubuf != -1)
+			ffuring_buf_unreg(u, b->ubuf);
 		ffmem_alignfree(b->ptr);
 	}
 	ffslice_free(bufs);
@@ -105,11 +132,142 @@ static struct buf* bufs_find(fffileread *f, uint64 offset)
 	return NULL;
 }
 
+/** Find buffer with io_uring request pending at the aligned file offset. */
+static struct buf* bufs_find_pending(fffileread *f, uint64 offset)
+{
+	struct buf *b;
+	FFSLICE_WALK_T(&f->bufs, b, struct buf) {
+		if (b->pending && b->offset == offset)
+			return b;
+	}
+	return NULL;
+}
+
+/** Find buffer that may be reused for a new request, starting from 'wbuf'.
+Buffers that are locked, pending or contain data within [lo..hi) are skipped. */
+static struct buf* bufs_find_free(fffileread *f, uint64 lo, uint64 hi)
+{
+	for (uint i = 0;  i != f->conf.nbufs;  i++) {
+		uint ib = ffint_cycleinc(f->wbuf + i - 1, f->conf.nbufs);
+		struct buf *b = ffslice_itemT(&f->bufs, ib, struct buf);
+		if (ib == f->locked
+			|| b->pending
+			|| (b->offset != (uint64)-1 && ffint_within(b->offset, lo, hi)))
+			continue;
+		f->wbuf = ffint_cycleinc(ib, f->conf.nbufs);
+		return b;
+	}
+	return NULL;
+}
+
 /** Prepare buffer for reading. */
 static void buf_prepread(struct buf *b, uint64 off)
 {
 	b->len = 0;
 	b->offset = off;
+	b->ra = 0;
+}
+
+/** Set file identity for the shared cache key.
+Blocks are shared by all paths to the same file, and a new file under the same name doesn't get the old data. */
+static int shared_init(fffileread *f)
+{
+	fffileinfo fi;
+	if (0 != fffile_info(f->fd, &fi)) {
+		syserrlog(f, "%s", fffile_info_S);
+		return -1;
+	}
+	f->ckey[1] = fffile_infoid(&fi);
+#ifdef FF_UNIX
+	f->ckey[2] = fi.st_dev;
+#endif
+	return 0;
+}
+
+/** Get the shared cache key for the block at aligned file offset. */
+static ffstr shared_key(fffileread *f, uint64 off)
+{
+	ffstr k;
+	f->ckey[0] = off;
+	ffstr_set(&k, f->ckey, sizeof(f->ckey));
+	return k;
+}
+
+/** Get block from the shared cache.
+User holds a reference to the item until the next call to fffileread_getdata(). */
+static int shared_fetch(fffileread *f, uint64 off, ffstr *data)
+{
+	ffcache_item ci = {};
+	ci.key = shared_key(f, off);
+	ci.refs = 1;
+	if (FFCACHE_OK != ffcache_fetch(f->conf.cache, &ci, 0)) {
+		f->stat.nshared_miss++;
+		return -1;
+	}
+	f->cached_id = ci.id;
+	*data = ci.data;
+	f->stat.nshared_hit++;
+	return 0;
+}
+
+/** Return TRUE if the shared cache contains the block.
+The cache statistics and eviction order aren't affected.
+The last (short) block sets EOF position. */
+static ffbool shared_has(fffileread *f, uint64 off)
+{
+	if (f->conf.cache == NULL)
+		return 0;
+	ffcache_item ci = {};
+	ci.key = shared_key(f, off);
+	ci.refs = 1;
+	if (FFCACHE_OK != ffcache_fetch(f->conf.cache, &ci, FFCACHE_PEEK))
+		return 0;
+	if (ci.data.len != f->conf.bufsize)
+		f->eof = ffmin(f->eof, off + ci.data.len);
+	ffcache_unref(f->conf.cache, ci.id, 0);
+	return 1;
+}
+
+/** Copy the block that has just been read into the shared cache.
+An empty block is stored too:  it marks the end of file for other readers. */
+static void shared_store(fffileread *f, const struct buf *b)
+{
+	if (f->conf.cache == NULL)
+		return;
+	ffcache_item ci = {};
+	ci.key = shared_key(f, b->offset);
+	ffstr_set(&ci.data, b->ptr, b->len);
+	ffcache_store(f->conf.cache, &ci, 0); // FFCACHE_EEXISTS: stored by another reader
+}
+
+/** Release the block returned to user from the shared cache. */
+static void shared_unref(fffileread *f)
+{
+	if (f->cached_id == NULL)
+		return;
+	ffcache_unref(f->conf.cache, f->cached_id, 0);
+	f->cached_id = NULL;
+}
+
+/** Update read-ahead window after user has requested the block at 'off'.
+The window is doubled on each sequential (forward or backward) block request;  it's reset on random access. */
+static void ra_track(fffileread *f, uint64 off)
+{
+	if (off == f->ra_prev)
+		return;
+
+	int dir = 0;
+	if (off == f->ra_prev + f->conf.bufsize)
+		dir = 1;
+	else if (off + f->conf.bufsize == f->ra_prev)
+		dir = -1;
+
+	uint win = 1;
+	if (dir != 0 && dir == f->ra_dir)
+		win = ffmin(f->ra_win * 2, f->conf.ra_max);
+	f->ra_win = win;
+	f->ra_dir = dir;
+	f->ra_prev = off;
 }
 
 
@@ -136,6 +294,7 @@ void fffileread_setconf(fffileread_conf *conf)
 	conf->bufsize = 64 * 1024;
 	conf->nbufs = 1;
 	conf->bufalign = 4 * 1024;
+	conf->ra_max = 8;
 }
 
 fffileread* fffileread_create(const char *fn, fffileread_conf *conf)
@@ -145,7 +304,8 @@ fffileread* fffileread_create(const char *fn, fffileread_conf *conf)
 		|| conf->bufsize == 0
 		|| conf->bufalign != ff_align_power2(conf->bufalign)
 		|| conf->bufsize != ff_align_floor2(conf->bufsize, conf->bufalign)
-		|| (conf->directio && conf->onread == NULL))
+		|| (conf->directio && conf->onread == NULL)
+		|| (conf->uring != NULL && conf->onread == NULL))
 		return NULL;
 
 	fffileread *f;
@@ -154,15 +314,19 @@ fffileread* fffileread_create(const char *fn, fffileread_conf *conf)
 	f->fd = FF_BADFD;
 	f->async_off = (uint64)-1;
 	f->eof = (uint64)-1;
+	f->ufile = -1;
+	f->ra_prev = (uint64)-1;
 	f->conf.udata = conf->udata;
 	f->conf.log = conf->log;
+	f->conf.uring = conf->uring;
+	f->conf.cache = conf->cache;
 
 	if (0 != bufs_create(f, conf))
 		goto err;
 
 	uint flags = conf->oflags;
 
-	if (conf->kq != FF_BADFD)
+	if (conf->kq != FF_BADFD || conf->uring != NULL)
 		flags |= (conf->directio) ? FFO_DIRECT : 0;
 
 	while (FF_BADFD == (f->fd = fffile_open(fn, flags))) {
@@ -178,12 +342,29 @@ fffileread* fffileread_create(const char *fn, fffileread_conf *conf)
 		goto err;
 	}
 
-	ffaio_finit(&f->aio, f->fd, f);
-	if (0 != ffaio_fattach(&f->aio, conf->kq, !!(flags & FFO_DIRECT))) {
-		syserrlog(f, "%s: %s", ffkqu_attach_S, fn);
+	if (conf->cache != NULL
+		&& 0 != shared_init(f))
 		goto err;
+
+	if (conf->uring != NULL) {
+		// fixed file and buffers save the kernel from looking up the descriptor and pinning the pages on each request
+		f->ufile = ffuring_file_reg(conf->uring, f->fd);
+		struct buf *b;
+		FFSLICE_WALK_T(&f->bufs, b, struct buf) {
+			b->ubuf = ffuring_buf_reg(conf->uring, b->ptr, conf->bufsize);
+			b->uop.handler = &fr_uring_complete;
+			b->uop.param = f;
+		}
+
+	} else {
+		ffaio_finit(&f->aio, f->fd, f);
+		if (0 != ffaio_fattach(&f->aio, conf->kq, !!(flags & FFO_DIRECT))) {
+			syserrlog(f, "%s: %s", ffkqu_attach_S, fn);
+			goto err;
+		}
 	}
 	f->conf = *conf;
+	f->conf.ra_max = ffmax(conf->ra_max, 1);
 
 	conf->directio = !!(flags & FFO_DIRECT);
 	return f;
@@ -195,7 +376,17 @@ err:
 
 void fffileread_free(fffileread *f)
 {
+	if (f->ufile != -1) {
+		ffuring_file_unreg(f->conf.uring, f->ufile);
+		f->ufile = -1;
+	}
 	FF_SAFECLOSE(f->fd, FF_BADFD, fffile_close);
+	shared_unref(f);
+
+	if (f->upending != 0) {
+		f->state = FI_CLOSED;
+		return; //wait until all io_uring requests are completed
+	}
 
 	ffbool ret = 0;
 	fflk_lock(&f->lk);
@@ -207,7 +398,7 @@ void fffileread_free(fffileread *f)
 	if (ret)
 		return; //wait until AIO is completed
 
-	bufs_free(&f->bufs);
+	bufs_free(&f->bufs, f->conf.uring);
 	ffthpool_task_free(f->iotask);
 	ffmem_free(f);
 }
@@ -299,6 +490,7 @@ static int fr_thpool_read(fffileread *f, ffstr *dst, uint64 off)
 
 	t->handler = &fr_aio;
 	t->udata = f;
+	t->affinity = (uint)((size_t)f / sizeof(void*)) | 1; // keep the file on the same thread
 	f->state = FI_ASYNC;
 	FF_ASSERT(f->iotask == NULL);
 	f->iotask = t;
@@ -334,6 +526,7 @@ static int fr_thpool_result(fffileread *f)
 	b->len = ext->result;
 	f->wbuf = ffint_cycleinc(f->wbuf, f->conf.nbufs);
 	f->stat.nread++;
+	shared_store(f, b);
 
 	if ((uint)ext->result != f->conf.bufsize) {
 		dbglog(f, "read the last block", 0);
@@ -352,11 +545,13 @@ int fffileread_getdata(fffileread *f, ffstr *dst, uint64 off, uint flags)
 	int r, cachehit = 0;
 	uint ibuf;
 	struct buf *b;
-	uint64 next;
+	uint64 boff;
 
-	if (f->conf.thpool != NULL)
+	if (f->conf.thpool != NULL && f->conf.uring == NULL)
 		flags &= ~(FFFILEREAD_FREADAHEAD | FFFILEREAD_FBACKWARD);
 
+	shared_unref(f);
+
 	if (f->iotask != NULL) {
 		FF_ASSERT(f->state == FI_OK);
 		if (0 != (r = fr_thpool_result(f)))
@@ -379,6 +574,28 @@ int fffileread_getdata(fffileread *f, ffstr *dst, uint64 off, uint flags)
 		goto done;
 	}
 
+	boff = ff_align_floor2(off, f->conf.bufalign);
+	if (f->conf.cache != NULL) {
+		if (off < f->eof
+			&& 0 == shared_fetch(f, boff, dst)) {
+
+			if (dst->len != f->conf.bufsize)
+				f->eof = ffmin(f->eof, boff + dst->len);
+			if (off >= boff + dst->len) {
+				shared_unref(f);
+				return FFFILEREAD_REOF;
+			}
+			dbglog(f, "returning block from shared cache  offset:%xU", boff);
+			goto readahead;
+		}
+
+		if (off == f->eof)
+			return FFFILEREAD_REOF; // EOF position is known from the shared cache
+	}
+
+	if (f->conf.uring != NULL)
+		return fr_uring_read(f, off, flags);
+
 	if (f->conf.thpool != NULL && !(flags & FFFILEREAD_FALLOWBLOCK))
 		return fr_thpool_read(f, dst, off);
 
@@ -394,7 +611,8 @@ int fffileread_getdata(fffileread *f, ffstr *dst, uint64 off, uint flags)
 		f->state = FI_OK;
 	}
 
-	r = fr_read_off(f, ff_align_floor2(off, f->conf.bufalign));
+	f->ra_left = 0;
+	r = fr_read_off(f, boff);
 	if (r == R_ASYNC) {
 		f->async_off = off;
 		f->nfy_user = 1;
@@ -411,27 +629,36 @@ int fffileread_getdata(fffileread *f, ffstr *dst, uint64 off, uint flags)
 done:
 	ibuf = b - (struct buf*)f->bufs.ptr;
 	f->locked = ibuf;
-
-	next = b->offset + b->len;
-	if (flags & FFFILEREAD_FBACKWARD)
-		next = b->offset - f->conf.bufsize;
-	if ((flags & FFFILEREAD_FREADAHEAD)
-		&& (int64)next >= 0 && next != f->eof // don't read past eof
-		&& f->conf.directio && f->conf.nbufs != 1) {
-
-		if (NULL == bufs_find(f, next)
-			&& f->state != FI_ASYNC) {
-			if (f->wbuf == f->locked)
-				f->wbuf = ffint_cycleinc(f->wbuf, f->conf.nbufs);
-			fr_read_off(f, next);
-		}
+	if (b->ra) {
+		b->ra = 0;
+		f->stat.nra_hit++;
 	}
 
 	dbglog(f, "returning buf#%u  offset:%xU  cache-hit:%u"
 		, ibuf, b->offset, cachehit);
 
+	boff = b->offset;
 	ffstr_set(dst, b->ptr, b->len);
-	ffstr_shift(dst, off - b->offset);
+
+readahead:
+	ra_track(f, boff);
+	if (flags & FFFILEREAD_FREADAHEAD) {
+		uint back = ((flags & FFFILEREAD_FBACKWARD) || f->ra_dir < 0);
+
+		if (f->conf.uring != NULL) {
+			if (0 != fr_uring_readahead(f, boff, back))
+				fr_uring_submit(f);
+
+		} else if (f->conf.directio && f->conf.nbufs != 1) {
+			f->ra_next = boff;
+			f->ra_left = ffmin(f->ra_win, f->conf.nbufs - 1);
+			f->ra_back = back;
+			if (f->state != FI_ASYNC)
+				fr_readahead(f);
+		}
+	}
+
+	ffstr_shift(dst, off - boff);
 	return FFFILEREAD_RREAD;
 }
 
@@ -456,7 +683,41 @@ static void fr_read_a(void *param)
 	if (f->nfy_user) {
 		f->nfy_user = 0;
 		f->conf.onread(f->conf.udata);
+	} else if (r == R_DATA)
+		fr_readahead(f);
+}
+
+/** Read ahead the blocks within the window one by one:
+ the next read is started after the previous one is complete. */
+static void fr_readahead(fffileread *f)
+{
+	uint64 bs = f->conf.bufsize;
+	while (f->ra_left != 0) {
+		f->ra_left--;
+		if (f->ra_back) {
+			if (f->ra_next < bs)
+				break;
+			f->ra_next -= bs;
+		} else {
+			f->ra_next += bs;
+			if (f->ra_next >= f->eof)
+				break; // don't read past eof
+		}
+
+		if (NULL != bufs_find(f, f->ra_next)
+			|| shared_has(f, f->ra_next))
+			continue;
+
+		if (f->wbuf == f->locked)
+			f->wbuf = ffint_cycleinc(f->wbuf, f->conf.nbufs);
+		struct buf *b = ffslice_itemT(&f->bufs, f->wbuf, struct buf);
+		f->stat.nra++;
+		int r = fr_read_off(f, f->ra_next);
+		b->ra = 1;
+		if (r != R_DATA)
+			return; // R_ASYNC: continue after the current request is complete
 	}
+	f->ra_left = 0;
 }
 
 /** Start reading at the specified aligned offset. */
@@ -494,6 +755,7 @@ static int fr_read(fffileread *f)
 	f->stat.nread++;
 	dbglog(f, "buf#%u: read:%L  offset:%Uk"
 		, f->wbuf, b->len, b->offset / 1024);
+	shared_store(f, b);
 
 	f->wbuf = ffint_cycleinc(f->wbuf, f->conf.nbufs);
 
@@ -506,6 +768,161 @@ static int fr_read(fffileread *f)
 	return R_DATA;
 }
 
+/** Queue io_uring read request for the aligned file offset. */
+static int fr_uring_queue(fffileread *f, struct buf *b, uint64 off)
+{
+	buf_prepread(b, off);
+	if (0 != ffuring_read(f->conf.uring, &b->uop, f->fd, f->ufile, b->ptr, f->conf.bufsize, b->ubuf, off)) {
+		b->offset = (uint64)-1;
+		syserrlog(f, "%s: offset:%Uk", "ffuring_read", off / 1024);
+		return -1;
+	}
+	b->pending = 1;
+	f->upending++;
+	f->stat.nsubmit++;
+	dbglog(f, "buf#%u: io_uring read, offset:%Uk"
+		, (uint)(b - (struct buf*)f->bufs.ptr), off / 1024);
+	return 0;
+}
+
+/** Queue requests for the blocks within read-ahead window after (or before) the block at 'off'.
+Return the number of requests queued. */
+static uint fr_uring_readahead(fffileread *f, uint64 off, uint back)
+{
+	uint n = 0;
+	uint64 bs = f->conf.bufsize;
+	uint win = ffmin(f->ra_win, f->conf.nbufs - 1);
+	uint64 lo = off, hi = off + (win + 1) * bs;
+	if (back) {
+		lo = (off > win * bs) ? off - win * bs : 0;
+		hi = off + bs;
+	}
+
+	uint64 next = off;
+	for (uint i = 0;  i != win;  i++) {
+		if (back) {
+			if (next == 0)
+				break;
+			next -= bs;
+		} else {
+			next += bs;
+			if (next >= f->eof)
+				break;
+		}
+
+		if (NULL != bufs_find(f, next)
+			|| NULL != bufs_find_pending(f, next)
+			|| shared_has(f, next))
+			continue;
+
+		struct buf *nb;
+		if (NULL == (nb = bufs_find_free(f, lo, hi))
+			|| 0 != fr_uring_queue(f, nb, next))
+			break;
+		nb->ra = 1;
+		f->stat.nra++;
+		n++;
+	}
+	return n;
+}
+
+/** Pass all queued requests to kernel. */
+static int fr_uring_submit(fffileread *f)
+{
+	if (0 > ffuring_submit(f->conf.uring)) {
+		syserrlog(f, "%s", "ffuring_submit");
+		return -1;
+	}
+	return 0;
+}
+
+/** Begin reading the block containing 'off' via io_uring. */
+static int fr_uring_read(fffileread *f, uint64 off, uint flags)
+{
+	if (f->state == FI_ERR) {
+		f->state = FI_OK;
+		return FFFILEREAD_RERR;
+	}
+
+	if (off > f->eof) {
+		errlog(f, "seek offset %U is bigger than file size %U", off, f->eof);
+		return FFFILEREAD_RERR;
+	} else if (off == f->eof)
+		return FFFILEREAD_REOF;
+
+	uint64 boff = ff_align_floor2(off, f->conf.bufalign);
+	struct buf *b;
+	if (NULL == (b = bufs_find_pending(f, boff))) {
+		if (NULL == (b = bufs_find_free(f, 0, 0))) {
+			// all buffers are busy: wait until any request is completed
+			FF_ASSERT(f->upending != 0);
+			f->async_off = off;
+			f->nfy_user = 1;
+			return FFFILEREAD_RASYNC;
+		}
+
+		if (0 != fr_uring_queue(f, b, boff))
+			return FFFILEREAD_RERR;
+
+		if (flags & FFFILEREAD_FREADAHEAD)
+			fr_uring_readahead(f, boff, ((flags & FFFILEREAD_FBACKWARD) || f->ra_dir < 0));
+
+		if (0 != fr_uring_submit(f))
+			return FFFILEREAD_RERR;
+	}
+
+	f->async_off = off;
+	f->nfy_user = 1;
+	f->stat.nasync++;
+	return FFFILEREAD_RASYNC;
+}
+
+/** io_uring request is complete. */
+static void fr_uring_complete(ffuring_op *op, int result)
+{
+	fffileread *f = op->param;
+	struct buf *b = FF_GETPTR(struct buf, uop, op);
+	b->pending = 0;
+	f->upending--;
+	f->stat.ncomplete++;
+
+	if (f->state == FI_CLOSED) {
+		// object was closed while requests are pending
+		if (f->upending == 0)
+			fffileread_free(f);
+		return;
+	}
+
+	uint64 off = b->offset;
+	ffbool user_block = ffint_within(f->async_off, off, off + f->conf.bufsize);
+
+	if (result < 0) {
+		b->offset = (uint64)-1;
+		fferr_set(-result);
+		syserrlog(f, "%s: offset:%Uk", fffile_read_S, off / 1024);
+		if (!user_block)
+			return; // read-ahead failed: the block will be requested again
+		f->state = FI_ERR;
+
+	} else {
+		b->len = result;
+		f->stat.nread++;
+		shared_store(f, b);
+		dbglog(f, "buf#%u: read:%L  offset:%Uk"
+			, (uint)(b - (struct buf*)f->bufs.ptr), b->len, off / 1024);
+		if ((uint)result != f->conf.bufsize) {
+			dbglog(f, "read the last block", 0);
+			f->eof = ffmin(f->eof, off + result);
+		}
+	}
+
+	if (f->nfy_user
+		&& (user_block || f->state == FI_ERR || f->upending == 0)) {
+		f->nfy_user = 0;
+		f->conf.onread(f->conf.udata);
+	}
+}
+
 fffd fffileread_fd(fffileread *f)
 {
 	return f->fd;
@@ -8,12 +8,29 @@ Copyright (c) 2020 Simon Zolin
 #include <FF/number.h>
 #include <FFOS/dir.h>
 #include <FFOS/timer.h>
+#ifdef FF_UNIX
+#include <sys/uio.h>
+#endif
 
 
+#ifdef FF_WIN
+	#define iov_ptr(iov)  ((iov)->buf)
+	#define iov_len(iov)  ((iov)->len)
+#else
+	#define iov_ptr(iov)  ((iov)->iov_base)
+	#define iov_len(iov)  ((iov)->iov_len)
+#endif
+
 #define dbglog(f, fmt, ...)  fw_log(f, FFFILEWRITE_LOG_DBG, fmt, __VA_ARGS__)
 #define syserrlog(f, fmt, ...)  fw_log(f, _FFFILEWRITE_LOG_SYSERR, "%s: " fmt, (f)->name, __VA_ARGS__)
 
 static void fw_writedone(fffilewrite *f, uint64 off, size_t written);
+static void fw_uring_complete(ffuring_op *op, int result);
+static void fw_prelease(fffilewrite *f);
+
+enum {
+	IOV_MAX_PASSTHRU = 16, // max. array size for fffilewrite_writev()
+};
 
 struct buf_s {
 	size_t len;
@@ -40,6 +57,21 @@ struct fffilewrite {
 	struct buf_s bufs[2]; // bufferred data
 	uint64 cur_off; // current file offset
 	uint cur_len; // current buffer length
+	size_t lwritten; // N of bytes of the locked buffer written to disk
+
+	// io_uring:
+	ffuring_op uop;
+	int ufile; // index in io_uring files table
+	int ubufs[2]; // indexes in io_uring buffers table
+	int uresult; // result of the completed request
+
+	// data written directly from user buffers:
+	ffiovec piov[IOV_MAX_PASSTHRU];
+	uint piov_n;
+	size_t plen; // !=0: the pending request writes user buffers;  N of bytes left to write
+	uint64 poff;
+	void *pparam;
+	uint prelease :1; // all user data is accepted: call release(pparam) after it's written
 
 	// preallocation:
 	uint64 prealloc_size; // preallocated size
@@ -91,13 +123,18 @@ static void fw_log(fffilewrite *f, uint level, const char *fmt, ...)
 
 fffilewrite* fffilewrite_create(const char *fn, fffilewrite_conf *conf)
 {
-	if (conf->nbufs == 0 || conf->nbufs > FFCNT(((fffilewrite*)NULL)->bufs))
+	if (conf->nbufs == 0 || conf->nbufs > FFCNT(((fffilewrite*)NULL)->bufs)
+		|| (conf->uring != NULL && conf->onwrite == NULL))
 		return NULL;
 
 	fffilewrite *f = ffmem_new(fffilewrite);
 	if (f == NULL)
 		return NULL;
 	f->conf = *conf;
+	if (f->conf.passthru_min == 0)
+		f->conf.passthru_min = f->conf.bufsize;
+	f->ufile = -1;
+	f->ubufs[0] = f->ubufs[1] = -1;
 	if (NULL == (f->name = ffsz_alcopyz(fn))) {
 		syserrlog(f, "mem alloc", 0);
 		goto end;
@@ -110,7 +147,11 @@ fffilewrite* fffilewrite_create(const char *fn, fffilewrite_conf *conf)
 			goto end;
 		}
 		f->bufs[i].ptr = b;
+		if (f->conf.uring != NULL)
+			f->ubufs[i] = ffuring_buf_reg(f->conf.uring, b, f->conf.bufsize);
 	}
+	f->uop.handler = &fw_uring_complete;
+	f->uop.param = f;
 
 	f->locked = -1;
 	f->fd = FF_BADFD;
@@ -126,6 +167,11 @@ void fffilewrite_free(fffilewrite *f)
 	if (f == NULL)
 		return;
 
+	if (f->ufile != -1) {
+		ffuring_file_unreg(f->conf.uring, f->ufile);
+		f->ufile = -1;
+	}
+
 	if (f->fd != FF_BADFD) {
 		if (0 != fffile_trunc(f->fd, f->size))
 			syserrlog(f, "fffile_trunc", 0);
@@ -152,8 +198,11 @@ void fffilewrite_free(fffilewrite *f)
 	if (ret)
 		return; //wait until AIO is completed
 
+	fw_prelease(f); // the write of user buffers has failed or is incomplete
 	ffmem_free(f->name);
 	for (uint i = 0;  i != f->conf.nbufs;  i++) {
+		if (f->ubufs[i] != -1)
+			ffuring_buf_unreg(f->conf.uring, f->ubufs[i]);
 		ffmem_alignfree(f->bufs[i].ptr);
 	}
 	ffthpool_task_free(f->iotask);
@@ -185,6 +234,8 @@ static int fw_open(fffilewrite *f)
 		}
 	}
 
+	if (f->conf.uring != NULL)
+		f->ufile = ffuring_file_reg(f->conf.uring, f->fd);
 	return 0;
 
 err:
@@ -232,6 +283,7 @@ static size_t fw_buf_add(fffilewrite *f, ffstr data, int64 off, uint flags)
 	size_t n = ffstr_add2(&tmp, f->conf.bufsize, &data);
 	f->cur_len = tmp.len;
 	f->cur_off += n;
+	f->stat.ncopied += n;
 	if (!(f->cur_len == f->conf.bufsize
 		|| (flags & FFFILEWRITE_FFLUSH))) {
 		f->stat.nmwrite++;
@@ -246,6 +298,8 @@ static size_t fw_buf_add(fffilewrite *f, ffstr data, int64 off, uint flags)
 
 static int fw_buf_lock_get(fffilewrite *f, struct buf_s *dst)
 {
+	if (f->plen != 0)
+		return FFFILEWRITE_RASYNC; // user buffers are being written
 	if (buf_empty(f))
 		return FFFILEWRITE_RERR;
 	if (f->locked != -1)
@@ -264,6 +318,25 @@ static void fw_buf_unlock(fffilewrite *f)
 	buf->off = 0;
 	f->buf_r = ffint_cycleinc(f->buf_r, f->conf.nbufs);
 	f->locked = -1;
+	f->lwritten = 0;
+}
+
+/** Account for the data of the locked buffer written to disk.
+Return 1 if the rest of the buffer must be written (short write). */
+static int fw_buf_written(fffilewrite *f, size_t n, struct buf_s *rest)
+{
+	struct buf_s *buf = &f->bufs[f->locked];
+	fw_writedone(f, buf->off + f->lwritten, n);
+	f->lwritten += n;
+	if (f->lwritten == buf->len) {
+		fw_buf_unlock(f);
+		return 0;
+	}
+
+	rest->ptr = (char*)buf->ptr + f->lwritten;
+	rest->len = buf->len - f->lwritten;
+	rest->off = buf->off + f->lwritten;
+	return 1;
 }
 
 /** Preallocate disk space. */
@@ -289,24 +362,29 @@ static void fw_prealloc(fffilewrite *f, struct buf_s data)
 static int fw_write(fffilewrite *f, struct buf_s d)
 {
 	fftime t1, t2;
-	if (f->conf.log_debug)
-		ffclk_gettime(&t1);
 
-	ssize_t n = fffile_pwrite(f->fd, d.ptr, d.len, d.off);
+	while (d.len != 0) {
+		if (f->conf.log_debug)
+			ffclk_gettime(&t1);
 
-	if (f->conf.log_debug) {
-		ffclk_gettime(&t2);
-		fftime_sub(&t2, &t1);
-		dbglog(f, "write result:%D  offset:%xU  (%uus)"
-			, (int64)n, d.off, fftime_mcs(&t2));
-	}
+		ssize_t n = fffile_pwrite(f->fd, d.ptr, d.len, d.off);
 
-	if (n < 0) {
-		syserrlog(f, "%s", fffile_write_S);
-		return FFFILEWRITE_RERR;
+		if (f->conf.log_debug) {
+			ffclk_gettime(&t2);
+			fftime_sub(&t2, &t1);
+			dbglog(f, "write result:%D  offset:%xU  (%uus)"
+				, (int64)n, d.off, fftime_mcs(&t2));
+		}
+
+		if (n <= 0) {
+			syserrlog(f, "%s", fffile_write_S);
+			return FFFILEWRITE_RERR;
+		}
+		fw_writedone(f, d.off, n);
+		d.ptr = (char*)d.ptr + n;
+		d.len -= n;
+		d.off += n;
 	}
-	FF_ASSERT((size_t)n == d.len);
-	fw_writedone(f, d.off, n);
 	return 0;
 }
 
@@ -320,12 +398,71 @@ static void fw_writedone(fffilewrite *f, uint64 off, size_t written)
 
 struct fw_task {
 	ffstr buf;
+	const ffiovec *iov; // write user buffers instead of 'buf'
+	uint niov;
 	uint64 off;
 	fffd fd;
 	int error;
 	ssize_t result;
 };
 
+/** Write data from several buffers at the file offset. */
+static ssize_t fw_pwritev(fffd fd, const ffiovec *iov, uint n, uint64 off)
+{
+#ifdef FF_UNIX
+	return pwritev(fd, iov, n, off);
+#else
+	size_t all = 0;
+	for (uint i = 0;  i != n;  i++) {
+		ssize_t r = fffile_pwrite(fd, iov_ptr(&iov[i]), iov_len(&iov[i]), off + all);
+		if (r < 0)
+			return (all != 0) ? (ssize_t)all : -1;
+		all += r;
+		if ((size_t)r != iov_len(&iov[i]))
+			break;
+	}
+	return all;
+#endif
+}
+
+/** User buffers aren't needed anymore. */
+static void fw_release(fffilewrite *f, void *param)
+{
+	if (f->conf.release != NULL)
+		f->conf.release(f->conf.udata, param);
+}
+
+/** The last request for the user buffers is complete. */
+static void fw_prelease(fffilewrite *f)
+{
+	if (f->prelease) {
+		f->prelease = 0;
+		fw_release(f, f->pparam);
+	}
+}
+
+/** Account for the data written from user buffers.
+Return 1 if the rest of the data must be written (short write). */
+static int fw_pwritten(fffilewrite *f, size_t n)
+{
+	fw_writedone(f, f->poff, n);
+	f->poff += n;
+	f->plen -= n;
+	if (f->plen == 0)
+		return 0;
+
+	// skip the written data in the array
+	uint i = 0;
+	while (n >= iov_len(&f->piov[i])) {
+		n -= iov_len(&f->piov[i]);
+		i++;
+	}
+	f->piov_n -= i;
+	memmove(f->piov, &f->piov[i], f->piov_n * sizeof(ffiovec));
+	ffiov_set(&f->piov[0], (char*)iov_ptr(&f->piov[0]) + n, iov_len(&f->piov[0]) - n);
+	return 1;
+}
+
 /** Called within thread pool's worker. */
 static void fw_aio(ffthpool_task *t)
 {
@@ -336,7 +473,10 @@ static void fw_aio(ffthpool_task *t)
 	if (f->conf.log_debug)
 		ffclk_gettime(&t1);
 
-	ext->result = fffile_pwrite(ext->fd, ext->buf.ptr, ext->buf.len, ext->off);
+	if (ext->niov != 0)
+		ext->result = fw_pwritev(ext->fd, ext->iov, ext->niov, ext->off);
+	else
+		ext->result = fffile_pwrite(ext->fd, ext->buf.ptr, ext->buf.len, ext->off);
 	ext->error = fferr_last();
 
 	if (f->conf.log_debug) {
@@ -346,6 +486,8 @@ static void fw_aio(ffthpool_task *t)
 			, (int64)ext->result, ext->off, ext->error, fftime_mcs(&t2));
 	}
 
+	if (ext->niov != 0 && ext->result > 0 && (size_t)ext->result == ext->buf.len)
+		fw_prelease(f); // errors and short writes are handled in the user's thread
 	f->aio_done = 1;
 
 	/* Handling a close event from user while AIO is pending:
@@ -374,7 +516,8 @@ static void fw_aio(ffthpool_task *t)
 	fflk_unlock(&f->lk);
 }
 
-/** Add buffer write task to a thread pool. */
+/** Add buffer write task to a thread pool.
+chunk.ptr: NULL: write user buffers 'piov' */
 static int fw_thpool_write(fffilewrite *f, struct buf_s chunk)
 {
 	ffthpool_task *t;
@@ -384,10 +527,15 @@ static int fw_thpool_write(fffilewrite *f, struct buf_s chunk)
 	struct fw_task *ext = (void*)t->ext;
 	ext->fd = f->fd;
 	ffstr_set2(&ext->buf, &chunk);
+	if (chunk.ptr == NULL) {
+		ext->iov = f->piov;
+		ext->niov = f->piov_n;
+	}
 	ext->off = chunk.off;
 
 	t->handler = &fw_aio;
 	t->udata = f;
+	t->affinity = (uint)((size_t)f / sizeof(void*)) | 1; // keep the file on the same thread
 	FF_ASSERT(f->iotask == NULL);
 	f->iotask = t;
 	f->state = FW_ASYNC;
@@ -403,28 +551,170 @@ static int fw_thpool_write(fffilewrite *f, struct buf_s chunk)
 	return 0;
 }
 
+static int fw_chunk_write(fffilewrite *f, struct buf_s chunk);
+
 static int fw_thpool_result(fffilewrite *f)
 {
-	int r = FFFILEWRITE_RERR;
-	ffthpool_task *t = f->iotask;
-	struct fw_task *ext = (void*)t->ext;
+	int r;
+	struct buf_s rest;
+	struct fw_task *ext = (void*)f->iotask->ext;
+	ssize_t n = ext->result;
+	int e = ext->error;
+	ffthpool_task_free(f->iotask);
+	f->iotask = NULL;
 
-	fw_buf_unlock(f);
+	if (n <= 0) {
+		fw_buf_unlock(f);
+		fferr_set(e);
+		syserrlog(f, "%s", fffile_write_S);
+		return FFFILEWRITE_RERR;
+	}
+
+	if (fw_buf_written(f, n, &rest)
+		&& 0 != (r = fw_chunk_write(f, rest))) {
+		fw_buf_unlock(f);
+		return r;
+	}
+	return 0;
+}
+
+/** io_uring request is complete. */
+static void fw_uring_complete(ffuring_op *op, int result)
+{
+	fffilewrite *f = op->param;
+	f->uresult = result;
+	if (f->plen != 0 && result > 0 && (size_t)result == f->plen)
+		fw_prelease(f); // errors and short writes are handled in the user's thread
+	f->aio_done = 1;
 
-	if (ext->result < 0) {
-		fferr_set(ext->error);
+	if (f->state == FW_CLOSED) {
+		// user has closed the object
+		fffilewrite_free(f);
+		return;
+	}
+	FF_ASSERT(f->state == FW_ASYNC);
+	f->state = FW_OK;
+	if (f->nfy_user) {
+		f->nfy_user = 0;
+		f->conf.onwrite(f->conf.udata);
+	}
+}
+
+/** Begin writing the locked buffer via io_uring.
+chunk.ptr: NULL: write user buffers 'piov' */
+static int fw_uring_write(fffilewrite *f, struct buf_s chunk)
+{
+	dbglog(f, "io_uring write: offset:%xU", chunk.off);
+	int r = (chunk.ptr != NULL)
+		? ffuring_write(f->conf.uring, &f->uop, f->fd, f->ufile, chunk.ptr, chunk.len, f->ubufs[f->locked], chunk.off)
+		: ffuring_writev(f->conf.uring, &f->uop, f->fd, f->ufile, f->piov, f->piov_n, chunk.off);
+	if (r != 0
+		|| 0 > ffuring_submit(f->conf.uring)) {
+		syserrlog(f, "%s", "ffuring_write");
+		return FFFILEWRITE_RERR;
+	}
+	f->state = FW_ASYNC;
+	f->stat.nasync++;
+	return 0;
+}
+
+static int fw_uring_result(fffilewrite *f)
+{
+	int r;
+	struct buf_s rest;
+
+	if (f->uresult <= 0) {
+		fw_buf_unlock(f);
+		fferr_set(-f->uresult);
 		syserrlog(f, "%s", fffile_write_S);
-		goto end;
+		return FFFILEWRITE_RERR;
 	}
 
-	FF_ASSERT((size_t)ext->result == ext->buf.len);
-	fw_writedone(f, ext->off, ext->result);
-	r = 0;
+	if (fw_buf_written(f, f->uresult, &rest)
+		&& 0 != (r = fw_chunk_write(f, rest))) {
+		fw_buf_unlock(f);
+		return r;
+	}
+	return 0;
+}
 
-end:
-	ffthpool_task_free(f->iotask);
-	f->iotask = NULL;
-	return r;
+/** Process the result of the write of user buffers. */
+static int fw_passthru_result(fffilewrite *f)
+{
+	ssize_t n;
+	int r, e = 0;
+	if (f->conf.uring != NULL) {
+		n = f->uresult;
+		if (n < 0)
+			e = -n;
+	} else {
+		struct fw_task *ext = (void*)f->iotask->ext;
+		n = ext->result;
+		e = ext->error;
+		ffthpool_task_free(f->iotask);
+		f->iotask = NULL;
+	}
+
+	if (n <= 0) {
+		f->plen = 0;
+		fw_prelease(f);
+		fferr_set(e);
+		syserrlog(f, "%s", fffile_write_S);
+		return FFFILEWRITE_RERR;
+	}
+
+	if (fw_pwritten(f, n)) {
+		struct buf_s chunk = {};
+		chunk.len = f->plen;
+		chunk.off = f->poff;
+		if (0 != (r = fw_chunk_write(f, chunk))) {
+			f->plen = 0;
+			fw_prelease(f);
+			return r;
+		}
+	}
+	return 0;
+}
+
+/** Process the result of the completed asynchronous request. */
+static int fw_aio_result(fffilewrite *f)
+{
+	f->aio_done = 0;
+	if (f->plen != 0)
+		return fw_passthru_result(f);
+	return (f->conf.uring != NULL) ? fw_uring_result(f) : fw_thpool_result(f);
+}
+
+/** Write the locked buffer (or user buffers, if chunk.ptr == NULL). */
+static int fw_chunk_write(fffilewrite *f, struct buf_s chunk)
+{
+	int r;
+	fw_prealloc(f, chunk);
+
+	if (f->conf.uring != NULL)
+		return fw_uring_write(f, chunk);
+	else if (f->conf.thpool != NULL)
+		return fw_thpool_write(f, chunk);
+
+	if (chunk.ptr == NULL) {
+		for (;;) {
+			ssize_t n = fw_pwritev(f->fd, f->piov, f->piov_n, f->poff);
+			if (n <= 0) {
+				syserrlog(f, "%s", fffile_write_S);
+				return FFFILEWRITE_RERR;
+			}
+			if (!fw_pwritten(f, n))
+				break;
+		}
+		fw_prelease(f);
+		return 0;
+	}
+
+	r = fw_write(f, chunk);
+	if (r != 0)
+		return r;
+	fw_buf_unlock(f);
+	return 0;
 }
 
 ssize_t fffilewrite_write(fffilewrite *f, ffstr data, int64 off, uint flags)
@@ -440,8 +730,7 @@ ssize_t fffilewrite_write(fffilewrite *f, ffstr data, int64 off, uint flags)
 	for (;;) {
 
 		if (f->aio_done) {
-			f->aio_done = 0;
-			if (0 != (r = fw_thpool_result(f)))
+			if (0 != (r = fw_aio_result(f)))
 				return r;
 		}
 
@@ -472,22 +761,103 @@ ssize_t fffilewrite_write(fffilewrite *f, ffstr data, int64 off, uint flags)
 			return allwr;
 		}
 
-		fw_prealloc(f, chunk);
+		if (0 != (r = fw_chunk_write(f, chunk)))
+			return r;
 
-		if (f->conf.thpool != NULL) {
-			r = fw_thpool_write(f, chunk);
-			if (r != 0)
-				return r;
-		} else {
-			r = fw_write(f, chunk);
-			if (r != 0)
+		ffstr_shift(&data, wr);
+		off = -1;
+	}
+}
+
+/** Write all bufferred data.
+Return 0 when there's no more bufferred data and no pending request. */
+static int fw_flush(fffilewrite *f)
+{
+	int r;
+	struct buf_s chunk;
+	ffstr empty = {};
+
+	for (;;) {
+		if (f->aio_done) {
+			if (0 != (r = fw_aio_result(f)))
 				return r;
-			fw_buf_unlock(f);
 		}
 
-		ffstr_shift(&data, wr);
-		off = -1;
+		fflk_lock(&f->lk);
+		if (f->state == FW_ASYNC) {
+			f->nfy_user = 1;
+			fflk_unlock(&f->lk);
+			return FFFILEWRITE_RASYNC;
+		}
+		fflk_unlock(&f->lk);
+		if (f->aio_done)
+			continue; // the request has just been completed
+
+		fw_buf_add(f, empty, -1, FFFILEWRITE_FFLUSH);
+		if (0 != fw_buf_lock_get(f, &chunk))
+			return 0;
+		if (0 != (r = fw_chunk_write(f, chunk)))
+			return r;
+	}
+}
+
+ssize_t fffilewrite_writev(fffilewrite *f, const ffiovec *iov, uint n, int64 off, uint flags, void *param)
+{
+	int r;
+	size_t total = ffiov_size(iov, n);
+
+	if (total < f->conf.passthru_min) {
+		// copy small data to the internal buffer
+		size_t all = 0;
+		for (uint i = 0;  i != n;  i++) {
+			ffstr d;
+			ffstr_set(&d, iov_ptr(&iov[i]), iov_len(&iov[i]));
+			int64 o = (off == -1) ? -1 : off + (int64)all;
+			ssize_t w = fffilewrite_write(f, d, o, (i + 1 == n) ? flags : 0);
+			if (w < 0)
+				return (all != 0) ? (ssize_t)all : w;
+			all += w;
+			if ((size_t)w != d.len)
+				return all;
+		}
+		fw_release(f, param);
+		return all;
 	}
+
+	if (f->fd == FF_BADFD && 0 != (r = fw_open(f)))
+		return r;
+
+	if (0 != (r = fw_flush(f)))
+		return r;
+
+	if (off == -1)
+		off = f->cur_off;
+	// release() is called only after the request which contains the last buffer of the array
+	f->prelease = (n <= IOV_MAX_PASSTHRU);
+	n = ffmin(n, IOV_MAX_PASSTHRU);
+	total = ffiov_size(iov, n);
+	ffmemcpy(f->piov, iov, n * sizeof(ffiovec));
+	f->piov_n = n;
+	f->plen = total;
+	f->poff = off;
+	f->pparam = param;
+	f->cur_off = off + total;
+	f->stat.npassthru += total;
+	dbglog(f, "writing %L bytes from %u user buffers at offset %xU"
+		, total, n, off);
+
+	struct buf_s chunk = {};
+	chunk.len = total;
+	chunk.off = off;
+	if (0 != (r = fw_chunk_write(f, chunk))) {
+		f->plen = 0;
+		f->prelease = 0; // the data isn't accepted
+		return r;
+	}
+
+	if ((flags & FFFILEWRITE_FFLUSH) && f->plen == 0)
+		f->completed = 1;
+	return total;
 }
 
 fffd fffilewrite_fd(fffilewrite *f)
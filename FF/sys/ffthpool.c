@@ -10,15 +10,57 @@ Copyright (c) 2020 Simon Zolin
 #include <ffbase/slice.h>
 
 
+enum {
+	SPIN_DEFAULT = 200,
+	NPRIO = 3,
+};
+
+/** Queue index by task priority:  the tasks in queue #0 are executed first. */
+static const byte prio_queue[] = {
+	1, // FFTHPOOL_PRIO_NORMAL
+	0, // FFTHPOOL_PRIO_HIGH
+	2, // FFTHPOOL_PRIO_LOW
+};
+
+#define TASK_QUEUE(t)  prio_queue[ffmin((t)->prio, NPRIO - 1)]
+
+typedef struct tp_queue {
+	ffthpool_task **d; // circular buffer
+	uint head, n;
+} tp_queue;
+
+/** Per-thread task queues (FFTHPOOL_WORKSTEAL). */
+typedef struct tp_worker {
+	fflock lk;
+	uint cap; // capacity of each queue;  power of 2
+	uint n; // tasks in all queues
+	uint nshared; // tasks in 'shared' queues
+	tp_queue shared[NPRIO]; // tasks that may be stolen by other threads
+	tp_queue pinned[NPRIO]; // tasks with affinity key
+
+	ffthpool *p;
+	ffatomic sleeping; // the thread is waiting on 'sem'
+	ffsem sem;
+	size_t steals; // modified by the owner thread only
+} tp_worker;
+
 struct ffthpool {
 	ffthpoolconf conf;
 	ffslice threads; // ffthd[]
-	ffring queue; // ffthpool_task*[]
+	ffring queue[NPRIO]; // ffthpool_task*[]
 	fflock lk;
 	uint stop;
 	ffsem sem;
+
+	tp_worker **workers; // tp_worker*[maxthreads]
+	ffatomic next; // round-robin index of the worker for the next task
+	ffatomic nsleeping; // number of sleeping workers
+	ffatomic wakeups;
 };
 
+static int ws_create(ffthpool *p);
+static void ws_free(ffthpool *p);
+
 ffthpool* ffthpool_create(ffthpoolconf *conf)
 {
 	if (conf->maxthreads == 0
@@ -31,16 +73,27 @@ ffthpool* ffthpool_create(ffthpoolconf *conf)
 	if (NULL == (p = ffmem_new(ffthpool)))
 		return NULL;
 	p->conf = *conf;
-
-	if (FFSEM_INV == (p->sem = ffsem_open(NULL, 0, 0)))
-		goto end;
+	if (p->conf.spin == 0)
+		p->conf.spin = SPIN_DEFAULT;
+	p->sem = FFSEM_INV;
 
 	if (NULL == ffslice_allocT(&p->threads, p->conf.maxthreads, ffthd))
 		goto end;
 
-	if (0 != ffring_create(&p->queue, p->conf.maxqueue, FFCPU_CACHELINE))
+	if (p->conf.flags & FFTHPOOL_WORKSTEAL) {
+		if (0 != ws_create(p))
+			goto end;
+		return p;
+	}
+
+	if (FFSEM_INV == (p->sem = ffsem_open(NULL, 0, 0)))
 		goto end;
 
+	for (uint i = 0;  i != NPRIO;  i++) {
+		if (0 != ffring_create(&p->queue[i], p->conf.maxqueue, FFCPU_CACHELINE))
+			goto end;
+	}
+
 	return p;
 
 end:
@@ -57,8 +110,14 @@ int ffthpool_free(ffthpool *p)
 	FF_WRITEONCE(p->stop, 1);
 
 	ffthd *th;
-	FFSLICE_WALK_T(&p->threads, th, ffthd) {
-		ffsem_post(p->sem);
+	if (p->workers != NULL) {
+		for (uint i = 0;  i != p->threads.len;  i++) {
+			ffsem_post(p->workers[i]->sem);
+		}
+	} else {
+		FFSLICE_WALK_T(&p->threads, th, ffthd) {
+			ffsem_post(p->sem);
+		}
 	}
 	FFSLICE_WALK_T(&p->threads, th, ffthd) {
 		if (*th != FFTHD_INV && 0 != ffthd_join(*th, 5000, NULL))
@@ -68,13 +127,28 @@ int ffthpool_free(ffthpool *p)
 	}
 	if (rc == 0) {
 		ffslice_free(&p->threads);
-		ffring_destroy(&p->queue);
-		ffsem_close(p->sem);
+		ws_free(p);
+		for (uint i = 0;  i != NPRIO;  i++) {
+			if (p->queue[i].d != NULL)
+				ffring_destroy(&p->queue[i]);
+		}
+		if (p->sem != FFSEM_INV)
+			ffsem_close(p->sem);
 		ffmem_free(p);
 	}
 	return rc;
 }
 
+/** Get a task from the queue with the highest priority. */
+static int ring_read(ffthpool *p, void **ptr)
+{
+	for (uint i = 0;  i != NPRIO;  i++) {
+		if (0 == ffring_read(&p->queue[i], ptr))
+			return 0;
+	}
+	return -1;
+}
+
 static int FFTHDCALL ffthpool_loop(void *udata)
 {
 	ffthpool *p = udata;
@@ -82,7 +156,7 @@ static int FFTHDCALL ffthpool_loop(void *udata)
 	while (!FF_READONCE(p->stop)) {
 
 		void *ptr;
-		if (0 != ffring_read(&p->queue, &ptr)) {
+		if (0 != ring_read(p, &ptr)) {
 			ffsem_wait(p->sem, -1);
 			continue;
 		}
@@ -94,6 +168,8 @@ static int FFTHDCALL ffthpool_loop(void *udata)
 	return 0;
 }
 
+static int FFTHDCALL ws_loop(void *udata);
+
 /** Add a new thread. */
 static int tp_newthread(ffthpool *p)
 {
@@ -105,7 +181,11 @@ static int tp_newthread(ffthpool *p)
 	}
 
 	ffthd th;
-	if (FFTHD_INV == (th = ffthd_create(&ffthpool_loop, p, 0)))
+	if (p->workers != NULL)
+		th = ffthd_create(&ws_loop, p->workers[p->threads.len], 0);
+	else
+		th = ffthd_create(&ffthpool_loop, p, 0);
+	if (th == FFTHD_INV)
 		goto end;
 	*ffslice_pushT(&p->threads, p->conf.maxthreads, ffthd) = th;
 	r = 0;
@@ -115,12 +195,295 @@ end:
 	return r;
 }
 
+
+/*
+Work-stealing mode:
+. A producer puts tasks into the queues of the running threads in round-robin order.
+  If all threads are busy, a new thread is started.
+  A task with affinity key always goes to the same thread's 'pinned' queue.
+. A thread takes a task from its own queues (higher priority first)
+  or steals one from the 'shared' queues of another thread.
+. When there's nothing to do, a thread spins for a while, then announces that it's going to sleep,
+  checks the queues once again and waits on its semaphore.
+. A producer signals the semaphore only when the thread is asleep.
+  If the thread that got the task is busy, but another one is asleep, the latter is woken up to steal the task.
+*/
+
+static int ws_create(ffthpool *p)
+{
+	if (NULL == (p->workers = ffmem_callocT(p->conf.maxthreads, tp_worker*)))
+		return -1;
+
+	uint cap = ff_align_power2(p->conf.maxqueue);
+	for (uint i = 0;  i != p->conf.maxthreads;  i++) {
+		tp_worker *w;
+		if (NULL == (w = ffmem_align(ff_align_ceil2(sizeof(tp_worker), FFCPU_CACHELINE), FFCPU_CACHELINE)))
+			return -1;
+		ffmem_tzero(w);
+		p->workers[i] = w;
+		w->p = p;
+		fflk_init(&w->lk);
+		w->sem = FFSEM_INV;
+		w->cap = cap;
+		for (uint k = 0;  k != NPRIO;  k++) {
+			if (NULL == (w->shared[k].d = ffmem_allocT(cap, ffthpool_task*))
+				|| NULL == (w->pinned[k].d = ffmem_allocT(cap, ffthpool_task*)))
+				return -1;
+		}
+		if (FFSEM_INV == (w->sem = ffsem_open(NULL, 0, 0)))
+			return -1;
+	}
+	return 0;
+}
+
+static void ws_free(ffthpool *p)
+{
+	if (p->workers == NULL)
+		return;
+	for (uint i = 0;  i != p->conf.maxthreads;  i++) {
+		tp_worker *w = p->workers[i];
+		if (w == NULL)
+			break;
+		for (uint k = 0;  k != NPRIO;  k++) {
+			ffmem_free(w->shared[k].d);
+			ffmem_free(w->pinned[k].d);
+		}
+		if (w->sem != FFSEM_INV)
+			ffsem_close(w->sem);
+		ffmem_alignfree(w);
+	}
+	ffmem_free(p->workers);
+	p->workers = NULL;
+}
+
+/** Add tasks to the thread's queues.
+Return the number of tasks added. */
+static uint ws_push(tp_worker *w, ffthpool_task **tasks, uint n)
+{
+	uint i, nshared = 0;
+	fflk_lock(&w->lk);
+	for (i = 0;  i != n;  i++) {
+		ffthpool_task *t = tasks[i];
+		tp_queue *q = (t->affinity != 0) ? &w->pinned[TASK_QUEUE(t)] : &w->shared[TASK_QUEUE(t)];
+		if (q->n == w->cap)
+			break;
+		q->d[(q->head + q->n++) & (w->cap - 1)] = t;
+		nshared += (t->affinity == 0);
+	}
+	FF_WRITEONCE(w->nshared, w->nshared + nshared);
+	FF_WRITEONCE(w->n, w->n + i);
+	fflk_unlock(&w->lk);
+	return i;
+}
+
+static ffthpool_task* ws_qpop(tp_worker *w, tp_queue *q)
+{
+	ffthpool_task *t = q->d[q->head];
+	q->head = (q->head + 1) & (w->cap - 1);
+	q->n--;
+	FF_WRITEONCE(w->n, w->n - 1);
+	return t;
+}
+
+/** Get the oldest task with the highest priority from the thread's queues.
+steal: take only the tasks without affinity */
+static ffthpool_task* ws_pop(tp_worker *w, uint steal)
+{
+	if (FF_READONCE(w->n) == 0
+		|| (steal && FF_READONCE(w->nshared) == 0))
+		return NULL;
+
+	ffthpool_task *t = NULL;
+	fflk_lock(&w->lk);
+	for (uint i = 0;  i != NPRIO;  i++) {
+		if (!steal && w->pinned[i].n != 0) {
+			t = ws_qpop(w, &w->pinned[i]);
+			break;
+		}
+		if (w->shared[i].n != 0) {
+			t = ws_qpop(w, &w->shared[i]);
+			FF_WRITEONCE(w->nshared, w->nshared - 1);
+			break;
+		}
+	}
+	fflk_unlock(&w->lk);
+	return t;
+}
+
+/** Get a task from the thread's own queues or from another thread's queue. */
+static ffthpool_task* ws_take(ffthpool *p, tp_worker *w)
+{
+	ffthpool_task *t;
+	if (NULL != (t = ws_pop(w, 0)))
+		return t;
+
+	uint n = FF_READONCE(p->threads.len);
+	for (uint i = 0;  i != n;  i++) {
+		tp_worker *victim = p->workers[i];
+		if (victim == w)
+			continue;
+		if (NULL != (t = ws_pop(victim, 1))) {
+			w->steals++;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/** Wake up the thread if it's asleep. */
+static int ws_wake(ffthpool *p, tp_worker *w)
+{
+	if (!ffatom_cmpset(&w->sleeping, 1, 0))
+		return 0;
+	ffatom_dec(&p->nsleeping);
+	ffatom_inc(&p->wakeups);
+	ffsem_post(w->sem);
+	return 1;
+}
+
+/** Wake up any sleeping thread. */
+static void ws_wake_any(ffthpool *p)
+{
+	if (ffatom_get(&p->nsleeping) == 0)
+		return;
+	uint n = FF_READONCE(p->threads.len);
+	for (uint i = 0;  i != n;  i++) {
+		if (ws_wake(p, p->workers[i]))
+			break;
+	}
+}
+
+static void ws_sleep(ffthpool *p, tp_worker *w)
+{
+	ffatom_inc(&p->nsleeping);
+	ffatom_swap(&w->sleeping, 1); // full barrier: a producer either sees the flag or we see its task
+
+	uint n = FF_READONCE(p->threads.len);
+	for (uint i = 0;  i != n;  i++) {
+		tp_worker *wi = p->workers[i];
+		if ((wi == w) ? FF_READONCE(wi->n) != 0 : FF_READONCE(wi->nshared) != 0) {
+			if (ffatom_cmpset(&w->sleeping, 1, 0)) {
+				ffatom_dec(&p->nsleeping);
+				return;
+			}
+			break; // a producer has signalled the semaphore already
+		}
+	}
+
+	ffsem_wait(w->sem, -1);
+}
+
+static int FFTHDCALL ws_loop(void *udata)
+{
+	tp_worker *w = udata;
+	ffthpool *p = w->p;
+	uint spins = 0;
+
+	while (!FF_READONCE(p->stop)) {
+
+		ffthpool_task *t;
+		if (NULL == (t = ws_take(p, w))) {
+			if (++spins != p->conf.spin) {
+				ffcpu_pause();
+				continue;
+			}
+			spins = 0;
+			ws_sleep(p, w);
+			continue;
+		}
+		spins = 0;
+
+		t->handler(t);
+		ffthpool_task_free(t);
+	}
+	return 0;
+}
+
+/** Add a task with affinity key to its thread.
+The thread is started if necessary. */
+static int ws_add_pinned(ffthpool *p, ffthpool_task *t)
+{
+	uint i = t->affinity % p->conf.maxthreads;
+	while (FF_READONCE(p->threads.len) <= i) {
+		if (0 != tp_newthread(p))
+			return -1;
+	}
+
+	tp_worker *w = p->workers[i];
+	if (0 == ws_push(w, &t, 1))
+		return 0;
+	ws_wake(p, w);
+	return 1;
+}
+
+static int ws_add(ffthpool *p, ffthpool_task **tasks, uint n)
+{
+	uint nthd = FF_READONCE(p->threads.len);
+	if ((nthd == 0 || ffatom_get(&p->nsleeping) == 0)
+		&& nthd < p->conf.maxthreads) {
+		if (0 != tp_newthread(p) && nthd == 0)
+			return -1;
+		nthd = FF_READONCE(p->threads.len);
+	}
+
+	for (uint i = 0;  i != n;  i++) {
+		ffatom32_inc(&tasks[i]->ref);
+	}
+
+	// spread the tasks evenly;  if some queues are full, try to put the rest into the others
+	uint added = 0, chunk = (n + nthd - 1) / nthd, tries = 0;
+	int r = 0;
+	while (added != n && tries != nthd * 2) {
+
+		if (tasks[added]->affinity != 0) {
+			if (1 != (r = ws_add_pinned(p, tasks[added])))
+				break; // the thread's queue is full
+			added++;
+			continue;
+		}
+
+		uint k;
+		for (k = 0;  added + k != n && k != chunk;  k++) {
+			if (tasks[added + k]->affinity != 0)
+				break;
+		}
+
+		tp_worker *w = p->workers[ffatom_incret(&p->next) % nthd];
+		if (0 == (k = ws_push(w, tasks + added, k))) {
+			tries++; // only the failed attempts in a row are counted
+			chunk = n;
+			continue;
+		}
+		tries = 0;
+		added += k;
+		if (!ws_wake(p, w))
+			ws_wake_any(p);
+	}
+
+	for (uint i = added;  i != n;  i++) {
+		ffatom32_dec(&tasks[i]->ref);
+	}
+	if (r < 0)
+		return (added != 0) ? (int)added : -1;
+	if (added != n)
+		fferr_set(EOVERFLOW);
+	return added;
+}
+
 int ffthpool_add(ffthpool *p, ffthpool_task *task)
 {
-	ffbool empty = ffring_empty(&p->queue);
+	if (p->workers != NULL) {
+		int r = ws_add(p, &task, 1);
+		if (r == 0)
+			fferr_set(EOVERFLOW);
+		return (r == 1) ? 0 : -1;
+	}
+
+	ffring *q = &p->queue[TASK_QUEUE(task)];
+	ffbool empty = ffring_empty(q);
 
 	ffatom32_inc(&task->ref);
-	if (0 != ffring_write(&p->queue, task)) {
+	if (0 != ffring_write(q, task)) {
 		ffatom32_dec(&task->ref);
 		fferr_set(EOVERFLOW);
 		return -1;
@@ -132,10 +495,68 @@ int ffthpool_add(ffthpool *p, ffthpool_task *task)
 			return -1;
 	}
 
+	ffatom_inc(&p->wakeups);
 	ffsem_post(p->sem);
 	return 0;
 }
 
+int ffthpool_add_batch(ffthpool *p, ffthpool_task **tasks, uint n)
+{
+	if (p->workers != NULL)
+		return ws_add(p, tasks, n);
+
+	ffbool empty = 1;
+
+	uint i;
+	for (i = 0;  i != n;  i++) {
+		ffring *q = &p->queue[TASK_QUEUE(tasks[i])];
+		empty &= ffring_empty(q);
+		ffatom32_inc(&tasks[i]->ref);
+		if (0 != ffring_write(q, tasks[i])) {
+			ffatom32_dec(&tasks[i]->ref);
+			fferr_set(EOVERFLOW);
+			break;
+		}
+	}
+	if (i == 0)
+		return 0;
+
+	if ((!empty || p->threads.len == 0)
+		&& p->threads.len < p->conf.maxthreads) {
+		if (0 != tp_newthread(p))
+			return -1;
+	}
+
+	// a thread processes the tasks until the queue is empty:
+	//  there's no need to signal more threads than there are tasks
+	uint nwake = ffmin(i, p->threads.len);
+	ffatom_add(&p->wakeups, nwake);
+	for (uint k = 0;  k != nwake;  k++) {
+		ffsem_post(p->sem);
+	}
+	return i;
+}
+
+void ffthpool_stat(ffthpool *p, struct ffthpool_stat *st)
+{
+	ffmem_tzero(st);
+	st->wakeups = ffatom_get(&p->wakeups);
+
+	if (p->workers == NULL) {
+		for (uint i = 0;  i != NPRIO;  i++) {
+			st->queued += ffring_unread(&p->queue[i]);
+		}
+		return;
+	}
+
+	uint n = FF_READONCE(p->threads.len);
+	for (uint i = 0;  i != n;  i++) {
+		tp_worker *w = p->workers[i];
+		st->queued += FF_READONCE(w->n);
+		st->steals += FF_READONCE(w->steals);
+	}
+}
+
 ffthpool_task* ffthpool_task_new(uint addsize)
 {
 	ffthpool_task *t;
@@ -144,6 +565,8 @@ ffthpool_task* ffthpool_task_new(uint addsize)
 	ffatom_set(&t->ref, 1);
 	t->handler = NULL;
 	t->udata = NULL;
+	t->affinity = 0;
+	t->prio = FFTHPOOL_PRIO_NORMAL;
 	return t;
 }
 
@@ -3,6 +3,8 @@ Copyright (c) 2017 Simon Zolin
 */
 
 #include <FF/sys/timer-queue.h>
+#include <FF/bitops.h>
+#include <FFOS/mem.h>
 
 
 static void tmrq_onfire(void *t);
@@ -46,17 +48,142 @@ static void tmrq_update(fftimer_queue *tq)
 	tq->msec_time = fftime_ms(&now);
 }
 
-void fftmrq_init(fftimer_queue *tq)
+/*
+Timing wheel:
+ 5 levels of 64 slots, level N slot covers 64^N ticks.
+ A timer is placed in the slot of the lowest level its expiration tick fits into.
+ When the current tick crosses the boundary of a level N slot, its timers are moved (cascaded) to the lower levels.
+ Timers which expire later than the whole wheel covers are put into the last slot and re-placed when cascaded.
+Timer entry uses 'tnode.left/right' as a list item and 'tnode.reserved' for its slot number.
+*/
+
+enum {
+	WHL_LEVELS = 5,
+	WHL_BITS = 6,
+	WHL_SLOTS = 1 << WHL_BITS,
+	WHL_MASK = WHL_SLOTS - 1,
+	WHL_COARSE_SHIFT = 6, //tick = 64ms
+};
+
+struct fftmrq_wheel {
+	uint64 tick; //the current tick: all timers before it are fired
+	uint shift; //tick = msec >> shift
+	uint64 occupied[WHL_LEVELS]; //bit mask of non-empty slots
+	ffchain_item slots[WHL_LEVELS][WHL_SLOTS];
+};
+
+#define ENT_SIB(t)  ((ffchain_item*)&(t)->tnode)
+#define ENT_BYSIB(it)  FF_GETPTR(fftmrq_entry, tnode, it)
+
+/** Put timer into the slot corresponding to its expiration time.
+min_tick: the earliest tick the timer may be fired at */
+static void wheel_place(fftmrq_wheel *w, fftmrq_entry *t, uint64 min_tick)
 {
+	uint64 exp = (t->tnode.key + (1 << w->shift) - 1) >> w->shift;
+	if ((int64)(exp - min_tick) < 0)
+		exp = min_tick;
+
+	uint64 delta = exp - w->tick;
+	uint lev = 0;
+	while (delta >> (WHL_BITS * (lev + 1)) != 0) {
+		if (++lev == WHL_LEVELS - 1) {
+			if (delta >> (WHL_BITS * WHL_LEVELS) != 0)
+				exp = w->tick + (1ULL << (WHL_BITS * WHL_LEVELS)) - 1;
+			break;
+		}
+	}
+
+	uint slot = (exp >> (WHL_BITS * lev)) & WHL_MASK;
+	ffchain_add(&w->slots[lev][slot], ENT_SIB(t));
+	w->occupied[lev] |= FF_BIT64(slot);
+	t->tnode.reserved = lev * WHL_SLOTS + slot;
+}
+
+void _fftmrq_wheel_add(fftimer_queue *tq, fftmrq_entry *t)
+{
+	fftmrq_wheel *w = tq->wheel;
+	wheel_place(w, t, w->tick + 1);
+	tq->items.len++;
+}
+
+void _fftmrq_wheel_rm(fftimer_queue *tq, fftmrq_entry *t)
+{
+	fftmrq_wheel *w = tq->wheel;
+	uint n = t->tnode.reserved;
+	ffchain_unlink(ENT_SIB(t));
+	// note: the timer may be in the list of expired timers already, its slot is empty then
+	if (ffchain_empty(&w->slots[n / WHL_SLOTS][n % WHL_SLOTS]))
+		w->occupied[n / WHL_SLOTS] &= ~FF_BIT64(n % WHL_SLOTS);
+	tq->items.len--;
+}
+
+/** Move all timers from the slot to 'dst' list. */
+static void wheel_takeslot(fftmrq_wheel *w, uint lev, uint slot, ffchain_item *dst)
+{
+	ffchain_item *sl = &w->slots[lev][slot];
+	w->occupied[lev] &= ~FF_BIT64(slot);
+	if (ffchain_empty(sl)) {
+		ffchain_init(dst);
+		return;
+	}
+	dst->next = sl->next;
+	dst->prev = sl->prev;
+	dst->next->prev = dst;
+	dst->prev->next = dst;
+	ffchain_init(sl);
+}
+
+/** Re-distribute timers from the current slot of an upper level. */
+static void wheel_cascade(fftmrq_wheel *w, uint lev)
+{
+	ffchain_item lst, *it;
+	wheel_takeslot(w, lev, (w->tick >> (WHL_BITS * lev)) & WHL_MASK, &lst);
+	while (!ffchain_empty(&lst)) {
+		it = ffchain_first(&lst);
+		ffchain_unlink(it);
+		wheel_place(w, ENT_BYSIB(it), w->tick);
+	}
+}
+
+static void wheel_free(fftimer_queue *tq)
+{
+	ffmem_free(tq->wheel);
+	tq->wheel = NULL;
+}
+
+int fftmrq_init2(fftimer_queue *tq, uint flags)
+{
+	fftmrq_wheel *w = NULL;
+
+	if (flags & FFTMRQ_WHEEL) {
+		if (NULL == (w = ffmem_new(fftmrq_wheel)))
+			return 1;
+		for (uint i = 0;  i != WHL_LEVELS;  i++) {
+			for (uint k = 0;  k != WHL_SLOTS;  k++) {
+				ffchain_init(&w->slots[i][k]);
+			}
+		}
+		w->shift = (flags & FFTMRQ_COARSE) ? WHL_COARSE_SHIFT : 0;
+	}
+
 	tq->tmr = FF_BADTMR;
 	ffrbt_init(&tq->items);
 	tq->items.insnode = &tree_instimer;
+	tq->wheel = w;
 	ffkev_init(&tq->kev);
 	tq->kev.oneshot = 0;
 	tq->kev.handler = &tmrq_onfire;
 	tq->kev.udata = tq;
 
 	tmrq_update(tq);
+	if (w != NULL)
+		w->tick = tq->msec_time >> w->shift;
+	return 0;
+}
+
+void fftmrq_init(fftimer_queue *tq)
+{
+	fftmrq_init2(tq, 0);
 }
 
 int fftmrq_start(fftimer_queue *tq, fffd kq, uint interval_ms)
@@ -84,6 +211,7 @@ void fftmrq_stop(fftimer_queue *tq, fffd kq)
 void fftmrq_destroy(fftimer_queue *tq, fffd kq)
 {
 	ffrbt_init(&tq->items);
+	wheel_free(tq);
 	if (tq->tmr != FF_BADTMR) {
 		fftmr_close(tq->tmr, kq);
 		tq->tmr = FF_BADTMR;
@@ -92,39 +220,87 @@ void fftmrq_destroy(fftimer_queue *tq, fffd kq)
 	tq->started = 0;
 }
 
+/** Remove (or re-arm a periodic) timer and call its handler. */
+static void tmrq_fire(fftimer_queue *tq, fftmrq_entry *ent)
+{
+	uint64 key = ent->tnode.key, next;
+
+	fftmrq_rm(tq, ent);
+	if (ent->interval > 0) {
+		ent->tnode.key = ffmax(key + ffabs(ent->interval), tq->msec_time + 1);
+		if (tq->wheel != NULL)
+			_fftmrq_wheel_add(tq, ent);
+		else
+			ffrbt_insert(&tq->items, (ffrbt_node*)&ent->tnode, NULL);
+	}
+	next = ent->tnode.key;
+	(void)next;
+
+	FFDBG_PRINTLN(FFDBG_TIMER | 5, "%U: %p, interval:%D  key:%U  next:%U [%L]"
+		, tq->msec_time, ent, ent->interval, key, next, tq->items.len);
+
+	ent->handler(ent->param);
+}
+
+/** Advance the wheel up to the current time and fire expired timers. */
+static void wheel_expire(fftimer_queue *tq)
+{
+	fftmrq_wheel *w = tq->wheel;
+	uint64 now = tq->msec_time >> w->shift;
+	ffchain_item expired;
+
+	while ((int64)(now - w->tick) > 0) {
+
+		if (tq->items.len == 0) {
+			w->tick = now;
+			break;
+		}
+
+		// skip empty slots up to the next non-empty one or to the next cascade point
+		uint pos = w->tick & WHL_MASK;
+		uint64 bits = w->occupied[0] & ~((2ULL << pos) - 1);
+		uint64 next = w->tick - pos + ((bits != 0) ? ffbit_ffs64(bits) - 1 : WHL_SLOTS);
+		if ((int64)(now - next) < 0) {
+			w->tick = now;
+			break;
+		}
+		w->tick = next;
+
+		for (uint lev = 1;  lev != WHL_LEVELS;  lev++) {
+			if ((w->tick & ((1ULL << (WHL_BITS * lev)) - 1)) != 0)
+				break;
+			wheel_cascade(w, lev);
+		}
+
+		// handlers may add or remove any timers while the expired ones are processed
+		wheel_takeslot(w, 0, w->tick & WHL_MASK, &expired);
+		for (ffchain_item *it = ffchain_first(&expired);  it != &expired;  it = ffchain_first(&expired)) {
+			tmrq_fire(tq, ENT_BYSIB(it));
+		}
+	}
+}
+
 static void tmrq_onfire(void *t)
 {
 	fftimer_queue *tq = t;
 	fftree_node *nod;
 	fftmrq_entry *ent;
-	fftime now;
-	uint64 next;
 
-	ffclk_gettime(&now);
-	tq->msec_time = fftime_ms(&now);
+	tmrq_update(tq);
+
+	if (tq->wheel != NULL) {
+		wheel_expire(tq);
+		fftmr_read(tq->tmr);
+		return;
+	}
 
 	while (!ffrbt_empty(&tq->items)) {
 		nod = fftree_min((fftree_node*)tq->items.root, &tq->items.sentl);
 		ent = FF_GETPTR(fftmrq_entry, tnode, nod);
-		uint64 key = ((fftree_node8*)nod)->key;
-		if ((int64)tq->msec_time < (int64)key)
+		if ((int64)tq->msec_time < (int64)ent->tnode.key)
 			break;
 
-		if (ent->interval <= 0)
-			fftmrq_rm(tq, ent);
-		else {
-			fftmrq_rm(tq, ent);
-			ent->tnode.key = ffmax(key + ffabs(ent->interval), tq->msec_time + 1);
-			ffrbt_insert(&tq->items, (ffrbt_node*)&ent->tnode, NULL);
-		}
-		next = ent->tnode.key;
-		(void)next;
-
-		FFDBG_PRINTLN(FFDBG_TIMER | 5, "%U.%06u: %p, interval:%D  key:%U  next:%U [%L]"
-			, (int64)fftime_sec(&now), (int)fftime_usec(&now)
-			, ent, ent->interval, key, next, tq->items.len);
-
-		ent->handler(ent->param);
+		tmrq_fire(tq, ent);
 	}
 
 	fftmr_read(tq->tmr);
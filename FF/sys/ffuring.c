@@ -0,0 +1,456 @@
+/**
+Copyright (c) 2020 Simon Zolin
+*/
+
+#include <FF/sys/uring.h>
+#include <FFOS/atomic.h>
+#include <FFOS/error.h>
+#include <FFOS/mem.h>
+
+
+void ffuring_conf_init(ffuring_conf *conf)
+{
+	ffmem_tzero(conf);
+	conf->entries = 128;
+	conf->max_files = 64;
+	conf->max_bufs = 64;
+	conf->kq = FF_BADFD;
+}
+
+#ifdef FF_LINUX
+
+#include <linux/io_uring.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+
+struct ffuring {
+	int fd;
+
+	// submission queue:
+	void *sq_ring;
+	size_t sq_ring_size;
+	uint *sq_head, *sq_tail, *sq_array;
+	uint sq_mask, sq_entries;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	uint sq_local_tail; // tail including the entries not yet published to kernel
+	uint queued; // published entries not yet submitted
+
+	// completion queue:
+	void *cq_ring;
+	size_t cq_ring_size;
+	uint *cq_head, *cq_tail;
+	uint cq_mask;
+	struct io_uring_cqe *cqes;
+
+	fffd *files; // registered files table;  -1: free slot
+	uint nfiles;
+	byte *bufs; // registered buffers table;  0: free slot
+	uint nbufs;
+
+	fffd evfd; // eventfd signalled on each completion
+	fffd kq;
+	ffkevent kev;
+};
+
+static int _ffuring_setup(uint entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int _ffuring_enter(int fd, uint to_submit, uint min_complete, uint flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int _ffuring_register(int fd, uint opcode, const void *arg, uint n)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, n);
+}
+
+static void* uring_mmap(int fd, size_t size, uint64 off)
+{
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, off);
+	return (p != MAP_FAILED) ? p : NULL;
+}
+
+static int uring_map(ffuring *u, const struct io_uring_params *p)
+{
+	u->sq_ring_size = p->sq_off.array + p->sq_entries * sizeof(uint);
+	u->cq_ring_size = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+	u->sqes_size = p->sq_entries * sizeof(struct io_uring_sqe);
+
+	if (NULL == (u->sq_ring = uring_mmap(u->fd, u->sq_ring_size, IORING_OFF_SQ_RING))
+		|| NULL == (u->cq_ring = uring_mmap(u->fd, u->cq_ring_size, IORING_OFF_CQ_RING))
+		|| NULL == (u->sqes = uring_mmap(u->fd, u->sqes_size, IORING_OFF_SQES)))
+		return -1;
+
+	byte *sq = u->sq_ring;
+	u->sq_head = (void*)(sq + p->sq_off.head);
+	u->sq_tail = (void*)(sq + p->sq_off.tail);
+	u->sq_array = (void*)(sq + p->sq_off.array);
+	u->sq_mask = *(uint*)(sq + p->sq_off.ring_mask);
+	u->sq_entries = *(uint*)(sq + p->sq_off.ring_entries);
+	u->sq_local_tail = *u->sq_tail;
+
+	byte *cq = u->cq_ring;
+	u->cq_head = (void*)(cq + p->cq_off.head);
+	u->cq_tail = (void*)(cq + p->cq_off.tail);
+	u->cq_mask = *(uint*)(cq + p->cq_off.ring_mask);
+	u->cqes = (void*)(cq + p->cq_off.cqes);
+	return 0;
+}
+
+/** Register sparse files table. */
+static void uring_files_init(ffuring *u, uint n)
+{
+	if (n == 0
+		|| NULL == (u->files = ffmem_allocT(n, fffd)))
+		return;
+	for (uint i = 0;  i != n;  i++) {
+		u->files[i] = -1;
+	}
+	if (0 != _ffuring_register(u->fd, IORING_REGISTER_FILES, u->files, n)) {
+		ffmem_free0(u->files);
+		return;
+	}
+	u->nfiles = n;
+}
+
+/** Register sparse buffers table. */
+static void uring_bufs_init(ffuring *u, uint n)
+{
+#ifdef IORING_RSRC_REGISTER_SPARSE
+	if (n == 0
+		|| NULL == (u->bufs = ffmem_calloc(n, 1)))
+		return;
+	struct io_uring_rsrc_register rr = {};
+	rr.nr = n;
+	rr.flags = IORING_RSRC_REGISTER_SPARSE;
+	if (0 != _ffuring_register(u->fd, IORING_REGISTER_BUFFERS2, &rr, sizeof(rr))) {
+		ffmem_free0(u->bufs);
+		return;
+	}
+	u->nbufs = n;
+#endif
+}
+
+/** eventfd has signalled. */
+static void uring_onsignal(void *param)
+{
+	ffuring *u = param;
+	uint64 val;
+	ssize_t r = read(u->evfd, &val, sizeof(val));
+	(void)r;
+	ffuring_process(u);
+}
+
+ffuring* ffuring_create(const ffuring_conf *conf)
+{
+	ffuring *u;
+	if (NULL == (u = ffmem_new(ffuring)))
+		return NULL;
+	u->fd = -1;
+	u->evfd = -1;
+	u->kq = FF_BADFD;
+
+	struct io_uring_params p = {};
+	if (-1 == (u->fd = _ffuring_setup(conf->entries, &p)))
+		goto err;
+	if (0 != uring_map(u, &p))
+		goto err;
+
+	uring_files_init(u, conf->max_files);
+	uring_bufs_init(u, conf->max_bufs);
+
+	if (conf->kq != FF_BADFD) {
+		if (-1 == (u->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)))
+			goto err;
+		if (0 != _ffuring_register(u->fd, IORING_REGISTER_EVENTFD, &u->evfd, 1))
+			goto err;
+		ffkev_init(&u->kev);
+		u->kev.oneshot = 0;
+		u->kev.handler = &uring_onsignal;
+		u->kev.udata = u;
+		if (0 != ffkqu_attach(conf->kq, u->evfd, ffkev_ptr(&u->kev), FFKQU_READ))
+			goto err;
+		u->kq = conf->kq;
+	}
+	return u;
+
+err:
+	ffuring_free(u);
+	return NULL;
+}
+
+void ffuring_free(ffuring *u)
+{
+	if (u == NULL)
+		return;
+	if (u->evfd != -1) {
+		close(u->evfd);
+		ffkev_fin(&u->kev);
+	}
+	if (u->sqes != NULL)
+		munmap(u->sqes, u->sqes_size);
+	if (u->cq_ring != NULL)
+		munmap(u->cq_ring, u->cq_ring_size);
+	if (u->sq_ring != NULL)
+		munmap(u->sq_ring, u->sq_ring_size);
+	if (u->fd != -1)
+		close(u->fd); // kernel releases registered files and buffers
+	ffmem_free(u->files);
+	ffmem_free(u->bufs);
+	ffmem_free(u);
+}
+
+int ffuring_file_reg(ffuring *u, fffd fd)
+{
+	for (uint i = 0;  i != u->nfiles;  i++) {
+		if (u->files[i] != -1)
+			continue;
+
+		struct io_uring_files_update fu = {};
+		fu.offset = i;
+		fu.fds = (size_t)&fd;
+		if (1 != _ffuring_register(u->fd, IORING_REGISTER_FILES_UPDATE, &fu, 1))
+			return -1;
+		u->files[i] = fd;
+		return i;
+	}
+	return -1;
+}
+
+void ffuring_file_unreg(ffuring *u, int index)
+{
+	if (index < 0 || (uint)index >= u->nfiles)
+		return;
+	fffd fd = -1;
+	struct io_uring_files_update fu = {};
+	fu.offset = index;
+	fu.fds = (size_t)&fd;
+	_ffuring_register(u->fd, IORING_REGISTER_FILES_UPDATE, &fu, 1);
+	u->files[index] = -1;
+}
+
+#ifdef IORING_RSRC_REGISTER_SPARSE
+static int uring_buf_update(ffuring *u, uint index, void *ptr, size_t size)
+{
+	struct iovec iov = { ptr, size };
+	struct io_uring_rsrc_update2 up = {};
+	up.offset = index;
+	up.data = (size_t)&iov;
+	up.nr = 1;
+	return _ffuring_register(u->fd, IORING_REGISTER_BUFFERS_UPDATE, &up, sizeof(up));
+}
+#endif
+
+int ffuring_buf_reg(ffuring *u, void *ptr, size_t size)
+{
+#ifdef IORING_RSRC_REGISTER_SPARSE
+	for (uint i = 0;  i != u->nbufs;  i++) {
+		if (u->bufs[i])
+			continue;
+		if (1 != uring_buf_update(u, i, ptr, size))
+			return -1;
+		u->bufs[i] = 1;
+		return i;
+	}
+#endif
+	return -1;
+}
+
+void ffuring_buf_unreg(ffuring *u, int index)
+{
+#ifdef IORING_RSRC_REGISTER_SPARSE
+	if (index < 0 || (uint)index >= u->nbufs)
+		return;
+	uring_buf_update(u, index, NULL, 0);
+	u->bufs[index] = 0;
+#endif
+}
+
+/** Make all prepared entries visible to kernel. */
+static void sq_publish(ffuring *u)
+{
+	uint n = u->sq_local_tail - *u->sq_tail;
+	if (n == 0)
+		return;
+	ffatom_fence_rel(); // SQEs must be written before the new tail is seen
+	FF_WRITEONCE(*u->sq_tail, u->sq_local_tail);
+	u->queued += n;
+}
+
+/** Get a free SQE;  submit the queued entries if the queue is full. */
+static struct io_uring_sqe* sq_get(ffuring *u)
+{
+	uint head = FF_READONCE(*u->sq_head);
+	ffatom_fence_acq();
+	if (u->sq_local_tail - head == u->sq_entries) {
+		if (ffuring_submit(u) <= 0)
+			return NULL;
+		head = FF_READONCE(*u->sq_head);
+		ffatom_fence_acq();
+		if (u->sq_local_tail - head == u->sq_entries) {
+			fferr_set(EAGAIN);
+			return NULL;
+		}
+	}
+
+	uint i = u->sq_local_tail & u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[i];
+	ffmem_tzero(sqe);
+	u->sq_array[i] = i;
+	u->sq_local_tail++;
+	return sqe;
+}
+
+static int uring_rw(ffuring *u, uint opcode, ffuring_op *op, fffd fd, int file, const void *ptr, size_t len, int buf, uint64 off)
+{
+	struct io_uring_sqe *sqe;
+	if (NULL == (sqe = sq_get(u)))
+		return -1;
+
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	if (file >= 0) {
+		sqe->fd = file;
+		sqe->flags = IOSQE_FIXED_FILE;
+	}
+	sqe->addr = (size_t)ptr;
+	sqe->len = len;
+	sqe->off = off;
+	if (buf >= 0) {
+		sqe->opcode = (opcode == IORING_OP_READ) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+		sqe->buf_index = buf;
+	}
+	sqe->user_data = (size_t)op;
+	return 0;
+}
+
+int ffuring_read(ffuring *u, ffuring_op *op, fffd fd, int file, void *ptr, size_t len, int buf, uint64 off)
+{
+	return uring_rw(u, IORING_OP_READ, op, fd, file, ptr, len, buf, off);
+}
+
+int ffuring_write(ffuring *u, ffuring_op *op, fffd fd, int file, const void *ptr, size_t len, int buf, uint64 off)
+{
+	return uring_rw(u, IORING_OP_WRITE, op, fd, file, ptr, len, buf, off);
+}
+
+int ffuring_writev(ffuring *u, ffuring_op *op, fffd fd, int file, const ffiovec *iov, uint n, uint64 off)
+{
+	return uring_rw(u, IORING_OP_WRITEV, op, fd, file, iov, n, -1, off);
+}
+
+int ffuring_submit(ffuring *u)
+{
+	sq_publish(u);
+	if (u->queued == 0)
+		return 0;
+	int r = _ffuring_enter(u->fd, u->queued, 0, 0);
+	if (r > 0)
+		u->queued -= r;
+	return r;
+}
+
+uint ffuring_process(ffuring *u)
+{
+	uint n = 0;
+	uint head = *u->cq_head;
+	for (;;) {
+		uint tail = FF_READONCE(*u->cq_tail);
+		ffatom_fence_acq(); // read CQEs only after the tail
+		if (head == tail)
+			break;
+
+		const struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+		ffuring_op *op = (void*)(size_t)cqe->user_data;
+		int res = cqe->res;
+
+		// release the entry before calling the handler:  it may queue a new operation
+		head++;
+		ffatom_fence_rel();
+		FF_WRITEONCE(*u->cq_head, head);
+
+		op->handler(op, res);
+		n++;
+	}
+	return n;
+}
+
+int ffuring_wait(ffuring *u)
+{
+	sq_publish(u);
+	int r = _ffuring_enter(u->fd, u->queued, 1, IORING_ENTER_GETEVENTS);
+	if (r < 0)
+		return -1;
+	u->queued -= r;
+	return ffuring_process(u);
+}
+
+#else // !FF_LINUX
+
+ffuring* ffuring_create(const ffuring_conf *conf)
+{
+	fferr_set(ENOSYS);
+	return NULL;
+}
+
+void ffuring_free(ffuring *u)
+{}
+
+int ffuring_file_reg(ffuring *u, fffd fd)
+{
+	return -1;
+}
+
+void ffuring_file_unreg(ffuring *u, int index)
+{}
+
+int ffuring_buf_reg(ffuring *u, void *ptr, size_t size)
+{
+	return -1;
+}
+
+void ffuring_buf_unreg(ffuring *u, int index)
+{}
+
+int ffuring_read(ffuring *u, ffuring_op *op, fffd fd, int file, void *ptr, size_t len, int buf, uint64 off)
+{
+	fferr_set(ENOSYS);
+	return -1;
+}
+
+int ffuring_write(ffuring *u, ffuring_op *op, fffd fd, int file, const void *ptr, size_t len, int buf, uint64 off)
+{
+	fferr_set(ENOSYS);
+	return -1;
+}
+
+int ffuring_writev(ffuring *u, ffuring_op *op, fffd fd, int file, const ffiovec *iov, uint n, uint64 off)
+{
+	fferr_set(ENOSYS);
+	return -1;
+}
+
+int ffuring_submit(ffuring *u)
+{
+	fferr_set(ENOSYS);
+	return -1;
+}
+
+uint ffuring_process(ffuring *u)
+{
+	return 0;
+}
+
+int ffuring_wait(ffuring *u)
+{
+	fferr_set(ENOSYS);
+	return -1;
+}
+
+#endif
@@ -5,6 +5,8 @@ Copyright (c) 2019 Simon Zolin
 #pragma once
 
 #include <FF/sys/thpool.h>
+#include <FF/sys/uring.h>
+#include <FF/cache.h>
 #include <FF/string.h>
 #include <FFOS/file.h>
 #include <FFOS/mem.h>
@@ -25,6 +27,18 @@ typedef struct fffileread_conf {
 	fffileread_onread onread;
 	ffthpool *thpool; // thread pool
 
+	/** io_uring object (Linux).  Has priority over 'thpool'.
+	File and buffers are registered in its tables, if possible.
+	Read-ahead blocks are submitted in one batch.
+	'onread' is called from ffuring_process(). */
+	ffuring *uring;
+
+	/** Process-wide block cache shared between readers (optional).
+	Key: file offset + file ID (device and inode on UNIX);  each block that is read from file is copied to the cache.
+	Must be created with 'shards' != 0 if readers work in different threads.
+	Note: the file must not be modified while its blocks are cached. */
+	ffcache *cache;
+
 	fffd kq; // kqueue descriptor
 	uint oflags; // flags for fffile_open().  default:FFO_RDONLY
 
@@ -32,6 +46,11 @@ typedef struct fffileread_conf {
 	uint nbufs; // number of buffers.  default:1
 	uint bufalign; // buffer & file offset align value.  Power of 2.
 
+	/** Maximum read-ahead window, in blocks.  Also limited by 'nbufs' - 1.  default:8
+	The window grows x2 while the blocks are requested sequentially (forward or backward)
+	 and shrinks to 1 block on random access. */
+	uint ra_max;
+
 	uint directio :1; // use direct I/O if available
 	uint log_debug :1; // enable debug logging.  default:0
 } fffileread_conf;
@@ -50,8 +69,8 @@ FF_EXTN void fffileread_free(fffileread *f);
 FF_EXTN fffd fffileread_fd(fffileread *f);
 
 enum FFFILEREAD_F {
-	FFFILEREAD_FREADAHEAD = 1, // read-ahead: schedule reading of the next block
-	FFFILEREAD_FBACKWARD = 2, // read-ahead: schedule reading of the previous block, not the next
+	FFFILEREAD_FREADAHEAD = 1, // read-ahead: schedule reading of the next blocks;  the direction is detected automatically
+	FFFILEREAD_FBACKWARD = 2, // read-ahead: schedule reading of the previous blocks, not the next
 	FFFILEREAD_FALLOWBLOCK = 4, // file reading is allowed to block this thread (i.e. perform synchronous I/O)
 };
 
@@ -71,6 +90,12 @@ struct fffileread_stat {
 	uint nread; // number of reads made
 	uint nasync; // number of asynchronous requests
 	uint ncached; // number of cache hits
+	uint nsubmit; // number of requests submitted to io_uring
+	uint ncomplete; // number of io_uring requests completed
+	uint nra; // number of blocks scheduled for read-ahead
+	uint nra_hit; // number of read-ahead blocks requested by user afterwards.  Read-ahead efficiency = nra_hit / nra
+	uint nshared_hit; // number of blocks returned from the shared cache
+	uint nshared_miss; // number of blocks not found in the shared cache
 };
 
 FF_EXTN void fffileread_stat(fffileread *f, struct fffileread_stat *st);
@@ -5,6 +5,7 @@ Copyright (c) 2020 Simon Zolin
 #pragma once
 
 #include <FF/sys/thpool.h>
+#include <FF/sys/uring.h>
 #include <FF/string.h>
 #include <FFOS/file.h>
 #include <FFOS/mem.h>
@@ -19,11 +20,17 @@ enum FFFILEWRITE_LOG {
 typedef void (*fffilewrite_log)(void *udata, uint level, ffstr msg);
 typedef void (*fffilewrite_onwrite)(void *udata);
 
+/** The data passed to fffilewrite_writev() isn't used by the writer anymore.
+param: value passed to fffilewrite_writev() */
+typedef void (*fffilewrite_release)(void *udata, void *param);
+
 typedef struct {
 	void *udata;
 	fffilewrite_log log;
 	fffilewrite_onwrite onwrite;
+	fffilewrite_release release; // may be called from thread pool's worker or from ffuring_process()
 	ffthpool *thpool; // thread pool
+	ffuring *uring; // io_uring object (Linux).  Has priority over 'thpool'.  'onwrite' is called from ffuring_process().
 
 	uint oflags; // additional flags for fffile_open()
 	fffd kq;
@@ -31,6 +38,7 @@ typedef struct {
 	uint nbufs; // number of buffers.  default:2
 	uint align; // buffer align.  default:4k
 	uint64 prealloc; // preallocate-by value (or total file size if known in advance).  default:128k
+	uint passthru_min; // fffilewrite_writev(): minimum data size to write without copying.  default:'bufsize'
 	uint prealloc_grow :1; // increase 'prealloc' value x2 on each preallocation.  default:1
 	uint create :1; // create file. default:1
 	uint overwrite :1; // overwrite existing file
@@ -65,6 +73,22 @@ flags: enum FFFILEWRITE_F
 Return N of bytes written or enum FFFILEWRITE_R. */
 FF_EXTN ssize_t fffilewrite_write(fffilewrite *f, ffstr data, int64 off, uint flags);
 
+/** Write data from several buffers.
+Data of size >= 'passthru_min' is written directly from user buffers:
+ bufferred data is written first, then the array (max. 16 buffers) is written with 1 request.
+ A larger array is accepted partially: the caller passes the rest of the buffers again.
+ The user buffers must stay valid until release() is called.
+Smaller data is copied to the internal buffer, as with fffilewrite_write().
+When all data is accepted, release(param) is called once the data isn't needed anymore:
+ before the function returns, or after the asynchronous write is complete.
+ release() isn't called for a partially accepted array, nor if the function returns an error.
+off: file offset
+ -1: write to the current offset
+flags: enum FFFILEWRITE_F
+Return N of bytes accepted (call again with the rest of data if it's less than the total size)
+ or enum FFFILEWRITE_R. */
+FF_EXTN ssize_t fffilewrite_writev(fffilewrite *f, const ffiovec *iov, uint n, int64 off, uint flags, void *param);
+
 /** Get file descriptor. */
 FF_EXTN fffd fffilewrite_fd(fffilewrite *f);
 
@@ -73,6 +97,8 @@ typedef struct {
 	uint nfwrite; // N of file writes
 	uint nprealloc; // N of preallocations made
 	uint nasync; // N of asynchronous requests
+	uint64 ncopied; // N of bytes copied to internal buffer
+	uint64 npassthru; // N of bytes written directly from user buffers
 } fffilewrite_stat;
 
 FF_EXTN void fffilewrite_getstat(fffilewrite *f, fffilewrite_stat *stat);
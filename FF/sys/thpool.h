@@ -7,10 +7,19 @@ Copyright (c) 2020 Simon Zolin
 #include <FFOS/atomic.h>
 
 
+enum FFTHPOOL_F {
+	/** Each thread has its own task queue;  an idle thread steals tasks from the queues of other threads.
+	An idle thread spins for a while before going to sleep,
+	 and a thread is woken up only when it's asleep and there's a task for it. */
+	FFTHPOOL_WORKSTEAL = 1,
+};
+
 /** Configuration. */
 typedef struct ffthpoolconf {
 	uint maxthreads; // max. allowed threads
-	uint maxqueue; // task queue capacity
+	uint maxqueue; // task queue capacity;  per thread with FFTHPOOL_WORKSTEAL
+	uint flags; // enum FFTHPOOL_F
+	uint spin; // FFTHPOOL_WORKSTEAL: attempts to find a task before going to sleep.  0: default
 } ffthpoolconf;
 
 typedef struct ffthpool ffthpool;
@@ -24,6 +33,12 @@ FF_EXTN int ffthpool_free(ffthpool *p);
 typedef struct ffthpool_task ffthpool_task;
 typedef void (*ffthpool_handler)(ffthpool_task *t);
 
+enum FFTHPOOL_PRIO {
+	FFTHPOOL_PRIO_NORMAL,
+	FFTHPOOL_PRIO_HIGH, // latency-critical: executed before any normal or low priority task
+	FFTHPOOL_PRIO_LOW, // background work: executed only when there are no other tasks
+};
+
 /** Shared data for a task object.
 Extended data area contains user-defined data. */
 struct ffthpool_task {
@@ -31,6 +46,12 @@ struct ffthpool_task {
 	ffthpool_handler handler;
 	void *udata;
 
+	/** FFTHPOOL_WORKSTEAL: tasks with the same non-zero key are executed by the same thread
+	 in FIFO order (within the same priority class).
+	Such tasks are never stolen by other threads. */
+	uint affinity;
+	uint prio; // enum FFTHPOOL_PRIO
+
 	byte ext[0];
 };
 
@@ -43,3 +64,17 @@ FF_EXTN void ffthpool_task_free(ffthpool_task *t);
 /** Add task to the queue.  Thread-safe.
 Create additional threads when necessary. */
 FF_EXTN int ffthpool_add(ffthpool *p, ffthpool_task *task);
+
+/** Add several tasks to the queue.  Thread-safe.
+The tasks are spread over the threads and each thread is woken up at most once.
+Return the number of tasks added;  less than 'n' if the queue is full (EOVERFLOW);
+ -1 on error. */
+FF_EXTN int ffthpool_add_batch(ffthpool *p, ffthpool_task **tasks, uint n);
+
+struct ffthpool_stat {
+	size_t queued; // tasks waiting in the queue
+	size_t steals; // tasks taken by a thread from another thread's queue
+	size_t wakeups; // times a sleeping thread was signalled
+};
+
+FF_EXTN void ffthpool_stat(ffthpool *p, struct ffthpool_stat *st);
@@ -17,10 +17,14 @@ typedef struct fftmrq_entry {
 	void *param;
 } fftmrq_entry;
 
+typedef struct fftmrq_wheel fftmrq_wheel;
+
 typedef struct fftimer_queue {
 	fftmr tmr;
 	uint64 msec_time;
 	ffrbtree items; //fftmrq_entry[].  Note: 'items.sentl' is still fftree_node, not fftree_node8.
+		//With FFTMRQ_WHEEL only 'items.len' is used.
+	fftmrq_wheel *wheel;
 	ffkevent kev;
 	uint started :1;
 } fftimer_queue;
@@ -28,6 +32,22 @@ typedef struct fftimer_queue {
 /** Initialize. */
 FF_EXTN void fftmrq_init(fftimer_queue *tq);
 
+enum FFTMRQ_INIT {
+	/** Hierarchical timing wheel instead of a tree:
+	 add, remove and re-arm are O(1), expired timers are processed slot by slot.
+	Timers are never fired earlier than requested. */
+	FFTMRQ_WHEEL = 1,
+
+	/** With FFTMRQ_WHEEL: 64ms resolution.
+	Suitable for timeouts: timers may be fired later by up to 64ms. */
+	FFTMRQ_COARSE = 2,
+};
+
+/** Initialize.
+flags: enum FFTMRQ_INIT
+Return 0 on success. */
+FF_EXTN int fftmrq_init2(fftimer_queue *tq, uint flags);
+
 /** Stop and destroy timer queue. */
 FF_EXTN void fftmrq_stop(fftimer_queue *tq, fffd kq);
 FF_EXTN void fftmrq_destroy(fftimer_queue *tq, fffd kq);
@@ -38,17 +58,27 @@ static FFINL ffbool fftmrq_active(fftimer_queue *tq, fftmrq_entry *t) {
 	return (t->tnode.key != 0);
 }
 
+FF_EXTN void _fftmrq_wheel_add(fftimer_queue *tq, fftmrq_entry *t);
+FF_EXTN void _fftmrq_wheel_rm(fftimer_queue *tq, fftmrq_entry *t);
+
 /** Add item to timer queue.
 @interval: periodic if >0, one-shot if <0.*/
 static FFINL void fftmrq_add(fftimer_queue *tq, fftmrq_entry *t, int64 interval) {
 	t->tnode.key = tq->msec_time + ffabs(interval);
 	t->interval = interval;
+	if (tq->wheel != NULL) {
+		_fftmrq_wheel_add(tq, t);
+		return;
+	}
 	ffrbt_insert(&tq->items, (ffrbt_node*)&t->tnode, NULL);
 }
 
 /** Remove item from timer queue. */
 static FFINL void fftmrq_rm(fftimer_queue *tq, fftmrq_entry *t) {
-	ffrbt_rm(&tq->items, (ffrbt_node*)&t->tnode);
+	if (tq->wheel != NULL)
+		_fftmrq_wheel_rm(tq, t);
+	else
+		ffrbt_rm(&tq->items, (ffrbt_node*)&t->tnode);
 	t->tnode.key = 0;
 }
 
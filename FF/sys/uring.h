@@ -0,0 +1,87 @@
+/** Asynchronous file I/O via Linux io_uring.
+Copyright (c) 2020 Simon Zolin
+*/
+
+/*
+ffuring_create()
+ffuring_file_reg() ffuring_buf_reg()
+ffuring_read() ffuring_write() ffuring_writev()
+ffuring_submit()
+... ffuring_process()
+ffuring_free()
+*/
+
+#pragma once
+
+#include <FFOS/types.h>
+#include <FFOS/queue.h>
+
+
+typedef struct ffuring ffuring;
+typedef struct ffuring_op ffuring_op;
+
+/** Completion handler.
+result: number of bytes transferred;  <0: -errno */
+typedef void (*ffuring_handler)(ffuring_op *op, int result);
+
+/** Asynchronous operation.
+The object must stay valid until its handler is called. */
+struct ffuring_op {
+	ffuring_handler handler;
+	void *param;
+};
+
+typedef struct ffuring_conf {
+	uint entries; // submission queue size.  default:128
+	uint max_files; // size of registered files table.  0: don't use fixed files.  default:64
+	uint max_bufs; // size of registered buffers table.  0: don't use fixed buffers.  default:64
+
+	/** Kernel queue descriptor:  completions are signalled via eventfd attached to it.
+	FF_BADFD: the user calls ffuring_process() or ffuring_wait() himself. */
+	fffd kq;
+} ffuring_conf;
+
+FF_EXTN void ffuring_conf_init(ffuring_conf *conf);
+
+/** Create io_uring object.
+Registered files and buffers tables are disabled if kernel doesn't support them.
+Return NULL on error;  ENOSYS: io_uring isn't supported. */
+FF_EXTN ffuring* ffuring_create(const ffuring_conf *conf);
+
+FF_EXTN void ffuring_free(ffuring *u);
+
+/** Put file descriptor into the registered files table.
+Return index;  -1 if the table is full or disabled. */
+FF_EXTN int ffuring_file_reg(ffuring *u, fffd fd);
+
+FF_EXTN void ffuring_file_unreg(ffuring *u, int index);
+
+/** Put buffer into the registered buffers table:  its pages are pinned in memory once.
+Return index;  -1 if the table is full or disabled. */
+FF_EXTN int ffuring_buf_reg(ffuring *u, void *ptr, size_t size);
+
+FF_EXTN void ffuring_buf_unreg(ffuring *u, int index);
+
+/** Queue read or write operation.
+The request isn't passed to kernel until ffuring_submit(), unless the submission queue is full.
+file: index of the registered file;  -1: use 'fd'
+buf: index of the registered buffer that contains 'ptr';  -1: not registered
+Return 0 on success. */
+FF_EXTN int ffuring_read(ffuring *u, ffuring_op *op, fffd fd, int file, void *ptr, size_t len, int buf, uint64 off);
+FF_EXTN int ffuring_write(ffuring *u, ffuring_op *op, fffd fd, int file, const void *ptr, size_t len, int buf, uint64 off);
+
+/** Queue vectored write operation.
+'iov' array must stay valid until the handler is called. */
+FF_EXTN int ffuring_writev(ffuring *u, ffuring_op *op, fffd fd, int file, const ffiovec *iov, uint n, uint64 off);
+
+/** Pass all queued requests to kernel with one system call.
+Return the number of requests submitted;  <0 on error. */
+FF_EXTN int ffuring_submit(ffuring *u);
+
+/** Call handlers of the completed operations.
+Return the number of completions processed. */
+FF_EXTN uint ffuring_process(ffuring *u);
+
+/** Submit queued requests, wait until at least 1 operation is complete and process completions.
+Return the number of completions processed;  <0 on error. */
+FF_EXTN int ffuring_wait(ffuring *u);
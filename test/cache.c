@@ -208,6 +208,265 @@ static void test_cache_limits()
 	ffcache_free(c);
 }
 
+static void test_cache_shards()
+{
+	ffcache_item ci;
+	ffcache *c;
+	ffcache_conf conf;
+	char key[16];
+	gstate = 4;
+	gstatus = 0;
+
+	ffcache_conf_init(&conf);
+	conf.onchange = &onchange;
+	conf.shards = 4;
+	x(NULL != (c = ffcache_create(&conf)));
+
+	for (uint i = 0;  i != 16;  i++) {
+		ffs_format(key, sizeof(key), "key%u%Z", i);
+		setci(&ci, key, "val");
+		x(0 == ffcache_store(c, &ci, 0));
+		x(0 == ffcache_unref(c, ci.id, 0));
+	}
+
+	for (uint i = 0;  i != 16;  i++) {
+		ffs_format(key, sizeof(key), "key%u%Z", i);
+		setci(&ci, key, "");
+		x(0 == ffcache_fetch(c, &ci, 0));
+		x(ffstr_eqz(&ci.key, key) && ffstr_eqz(&ci.data, "val"));
+		x(0 == ffcache_unref(c, ci.id, 0));
+	}
+
+	setci(&ci, "key16", "");
+	x(FFCACHE_ENOTFOUND == ffcache_fetch(c, &ci, 0));
+
+	struct ffcache_stat stat;
+	ffcache_stat(c, &stat);
+	x(stat.items == 16);
+	x(stat.hits == 16);
+	x(stat.misses == 1);
+
+	ffcache_reset(c);
+	x(gstatus == 16);
+	ffcache_stat(c, &stat);
+	x(stat.items == 0 && stat.memsize == 0);
+
+	ffcache_free(c);
+}
+
+/** Index growth and removal of keys that were moved to the next buckets */
+static void test_cache_index()
+{
+	ffcache_item ci;
+	ffcache *c;
+	ffcache_conf conf;
+	char key[16];
+	void *ids[1000];
+	gstate = 5;
+
+	ffcache_conf_init(&conf);
+	x(NULL != (c = ffcache_create(&conf)));
+
+	for (uint i = 0;  i != FFCNT(ids);  i++) {
+		ffs_format(key, sizeof(key), "key%u%Z", i);
+		setci(&ci, key, "val");
+		ci.refs = 0;
+		x(0 == ffcache_store(c, &ci, 0));
+		ids[i] = ci.id;
+	}
+
+	for (uint i = 0;  i != FFCNT(ids);  i += 2) {
+		x(0 == ffcache_fetch(c, &(ffcache_item){ .id = ids[i], .refs = 1 }, 0));
+		x(0 == ffcache_unref(c, ids[i], FFCACHE_REMOVE));
+	}
+
+	for (uint i = 0;  i != FFCNT(ids);  i++) {
+		ffs_format(key, sizeof(key), "key%u%Z", i);
+		setci(&ci, key, "");
+		if (i % 2 == 0) {
+			x(FFCACHE_ENOTFOUND == ffcache_fetch(c, &ci, 0));
+			continue;
+		}
+		x(0 == ffcache_fetch(c, &ci, 0));
+		x(ci.id == ids[i]);
+		x(0 == ffcache_unref(c, ci.id, 0));
+	}
+
+	struct ffcache_stat stat;
+	ffcache_stat(c, &stat);
+	x(stat.items == FFCNT(ids) / 2);
+
+	ffcache_free(c);
+}
+
+static void store_unref(ffcache *c, const char *key)
+{
+	ffcache_item ci;
+	setci(&ci, key, "val");
+	x(0 == ffcache_store(c, &ci, 0));
+	x(0 == ffcache_unref(c, ci.id, 0));
+}
+
+static int fetch_unref(ffcache *c, const char *key)
+{
+	ffcache_item ci;
+	setci(&ci, key, "");
+	int r = ffcache_fetch(c, &ci, 0);
+	if (r == 0)
+		x(0 == ffcache_unref(c, ci.id, 0));
+	return r;
+}
+
+static void test_cache_policy()
+{
+	ffcache *c;
+	ffcache_conf conf;
+	struct ffcache_stat stat;
+
+	// CLOCK: referenced item gets a second chance
+	ffcache_conf_init(&conf);
+	conf.policy = FFCACHE_POLICY_CLOCK;
+	conf.max_items = 2;
+	x(NULL != (c = ffcache_create(&conf)));
+	store_unref(c, "key1");
+	store_unref(c, "key2");
+	x(0 == fetch_unref(c, "key1"));
+	store_unref(c, "key3"); //"key2" is evicted
+	x(FFCACHE_ENOTFOUND == fetch_unref(c, "key2"));
+	x(0 == fetch_unref(c, "key1"));
+	x(0 == fetch_unref(c, "key3"));
+	ffcache_stat(c, &stat);
+	x(stat.evictions == 1);
+	ffcache_free(c);
+
+	// LRU: peek doesn't update the eviction order and statistics
+	ffcache_conf_init(&conf);
+	conf.max_items = 2;
+	x(NULL != (c = ffcache_create(&conf)));
+	store_unref(c, "key1");
+	store_unref(c, "key2");
+	ffcache_item ci;
+	setci(&ci, "key1", "");
+	x(0 == ffcache_fetch(c, &ci, FFCACHE_PEEK));
+	x(0 == ffcache_unref(c, ci.id, 0));
+	setci(&ci, "key3", "");
+	x(FFCACHE_ENOTFOUND == ffcache_fetch(c, &ci, FFCACHE_PEEK));
+	store_unref(c, "key3"); //"key1" is evicted
+	ffcache_stat(c, &stat);
+	x(stat.hits == 0 && stat.misses == 0);
+	x(FFCACHE_ENOTFOUND == fetch_unref(c, "key1"));
+	ffcache_free(c);
+
+	// SLRU: an item hit twice survives a scan of new keys
+	ffcache_conf_init(&conf);
+	conf.policy = FFCACHE_POLICY_SLRU;
+	conf.max_items = 3;
+	x(NULL != (c = ffcache_create(&conf)));
+	store_unref(c, "key1");
+	x(0 == fetch_unref(c, "key1")); //"key1" -> protected
+	store_unref(c, "key2");
+	store_unref(c, "key3");
+	store_unref(c, "key4"); //"key2" is evicted
+	store_unref(c, "key5"); //"key3" is evicted
+	x(FFCACHE_ENOTFOUND == fetch_unref(c, "key2"));
+	x(FFCACHE_ENOTFOUND == fetch_unref(c, "key3"));
+	x(0 == fetch_unref(c, "key1"));
+	ffcache_stat(c, &stat);
+	x(stat.evictions == 2);
+	ffcache_free(c);
+
+	// TinyLFU: a new key doesn't replace a popular one
+	ffcache_conf_init(&conf);
+	conf.max_items = 1;
+	conf.tinylfu = 1;
+	x(NULL != (c = ffcache_create(&conf)));
+	store_unref(c, "key1");
+	for (uint i = 0;  i != 3;  i++) {
+		x(0 == fetch_unref(c, "key1"));
+	}
+	setci(&ci, "key2", "val");
+	x(FFCACHE_EREJECTED == ffcache_store(c, &ci, 0));
+	x(0 == fetch_unref(c, "key1"));
+	ffcache_stat(c, &stat);
+	x(stat.rejected == 1);
+	x(stat.evictions == 0);
+	ffcache_free(c);
+
+	// TinyLFU+CLOCK: admission check doesn't clear the reference bits
+	ffcache_conf_init(&conf);
+	conf.policy = FFCACHE_POLICY_CLOCK;
+	conf.max_items = 2;
+	conf.tinylfu = 1;
+	x(NULL != (c = ffcache_create(&conf)));
+	store_unref(c, "key1");
+	setci(&ci, "key2", "val");
+	x(0 == ffcache_store(c, &ci, 0)); //"key2" is in use
+	x(0 == fetch_unref(c, "key1"));
+	ffcache_item ci3;
+	setci(&ci3, "key3", "val");
+	x(FFCACHE_EREJECTED == ffcache_store(c, &ci3, 0)); //"key1" is the candidate and it's more popular
+	x(0 == ffcache_unref(c, ci.id, 0));
+	setci(&ci3, "key3", "val");
+	x(0 == ffcache_store(c, &ci3, 0)); //"key1" is still referenced: "key2" is evicted
+	x(0 == ffcache_unref(c, ci3.id, 0));
+	x(FFCACHE_ENOTFOUND == fetch_unref(c, "key2"));
+	x(0 == fetch_unref(c, "key1"));
+	ffcache_stat(c, &stat);
+	x(stat.rejected == 1);
+	x(stat.evictions == 1);
+	ffcache_free(c);
+}
+
+static void test_cache_slab()
+{
+	ffcache_item ci;
+	ffcache *c;
+	ffcache_conf conf;
+	struct ffcache_stat stat;
+	char key[16];
+	void *id;
+	static char big[8*1024];
+
+	ffcache_conf_init(&conf);
+	x(NULL != (c = ffcache_create(&conf)));
+
+	for (uint i = 0;  i != 100;  i++) {
+		ffs_format(key, sizeof(key), "key%u%Z", i);
+		setci(&ci, key, "");
+		ffstr_set(&ci.data, big, i * 50);
+		x(0 == ffcache_store(c, &ci, 0));
+		x(ci.data.len == i * 50);
+		x(0 == ffcache_unref(c, ci.id, 0));
+	}
+
+	ffcache_stat(c, &stat);
+	x(stat.slab_total != 0);
+	x(stat.slab_used != 0 && stat.slab_used <= stat.slab_total);
+	x(stat.memsize >= stat.slab_used);
+
+	// data moves from the item's chunk to heap and back
+	setci(&ci, "key1", "");
+	x(0 == ffcache_fetch(c, &ci, 0));
+	id = ci.id;
+	setci(&ci, "key1", "");
+	ci.id = id;
+	ffstr_set(&ci.data, big, sizeof(big));
+	x(0 == ffcache_update(c, &ci, 0));
+	x(ci.data.len == sizeof(big));
+	setci(&ci, "key1", "val");
+	ci.id = id;
+	x(0 == ffcache_update(c, &ci, 0));
+	x(ffstr_eqz(&ci.data, "val"));
+	x(0 == ffcache_unref(c, id, 0));
+
+	ffcache_reset(c);
+	ffcache_stat(c, &stat);
+	x(stat.memsize == 0);
+	x(stat.slab_total == 0 && stat.slab_used == 0);
+
+	ffcache_free(c);
+}
+
 int test_cache(void)
 {
 	FFTEST_FUNC;
@@ -227,5 +486,9 @@ int test_cache(void)
 
 	test_cache_multi();
 	test_cache_limits();
+	test_cache_shards();
+	test_cache_index();
+	test_cache_policy();
+	test_cache_slab();
 	return 0;
 }
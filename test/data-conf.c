@@ -393,12 +393,117 @@ void test_conf_write(void)
 	ffconf_wdestroy(&cw);
 }
 
+/** In-situ mode: values reference input data, escape sequences are decoded in place */
+static void test_conf_insitu()
+{
+	ffconf conf;
+	ffstr d;
+	FFTEST_FUNC;
+
+	char data[] = "k1 \"a\\\"b\\x41c\"\n\"k\\n2\" plain\n";
+	ffconf_parseinit(&conf);
+	conf.flags |= FFCONF_PINSITU;
+	ffstr_set(&d, data, sizeof(data) - 1);
+	x(FFPARS_KEY == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "k1") && conf.val.ptr == data);
+	x(FFPARS_VAL == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "a\"bAc") && conf.val.ptr == data + 4);
+	x(FFPARS_KEY == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "k\n2") && conf.val.ptr == data + 16);
+	x(FFPARS_VAL == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "plain") && conf.val.ptr == data + 22);
+	x(conf.buf.cap == 0);
+	ffconf_parseclose(&conf);
+
+	// a string which continues in the next chunk is copied
+	char d1[] = "k \"a\\tb", d2[] = "c\" \"\\x", d3[] = "41x\"\n";
+	ffconf_parseinit(&conf);
+	conf.flags |= FFCONF_PINSITU;
+	ffstr_set(&d, d1, sizeof(d1) - 1);
+	x(FFPARS_KEY == ffconf_parsestr(&conf, &d));
+	x(FFPARS_MORE == ffconf_parsestr(&conf, &d) && d.len == 0);
+	ffstr_set(&d, d2, sizeof(d2) - 1);
+	x(FFPARS_VAL == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "a\tbc") && conf.buf.cap != 0);
+	x(FFPARS_MORE == ffconf_parsestr(&conf, &d) && d.len == 0);
+	ffstr_set(&d, d3, sizeof(d3) - 1);
+	x(FFPARS_VAL == ffconf_parsestr(&conf, &d));
+	x(ffstr_eqcz(&conf.val, "Ax") && conf.buf.cap != 0);
+	ffconf_parseclose(&conf);
+}
+
+struct insitu_obj {
+	ffstr s;
+	char *z;
+	ffstr r;
+};
+
+static const ffpars_arg insitu_args[] = {
+	{ "s", FFPARS_TSTR | FFPARS_FCOPY, FFPARS_DSTOFF(struct insitu_obj, s) },
+	{ "z", FFPARS_TCHARPTR | FFPARS_FSTRZ | FFPARS_FCOPY, FFPARS_DSTOFF(struct insitu_obj, z) },
+	{ "r", FFPARS_TSTR | FFPARS_FRECOPY | FFPARS_FMULTI, FFPARS_DSTOFF(struct insitu_obj, r) },
+};
+
+/** FFPARS_FCOPY strings borrow input data;  a value which isn't in-situ is rejected */
+static void test_conf_insitu_schem()
+{
+	ffconf conf;
+	ffparser_schem ps;
+	ffpars_ctx ctx;
+	struct insitu_obj o = {};
+	ffstr d;
+	int r;
+	FFTEST_FUNC;
+
+	char data[] = "s \"a\\\"b\"\nz \"z\\\"\"\nr r1\nr \"r\\x41\"\n";
+	ffpars_setargs(&ctx, &o, insitu_args, FFCNT(insitu_args));
+	x(0 == ffconf_scheminit(&ps, &conf, &ctx));
+	conf.flags |= FFCONF_PINSITU;
+	ps.flags |= FFPARS_INSITU;
+	ffstr_set(&d, data, sizeof(data) - 1);
+	while (d.len != 0) {
+		ffconf_parsestr(&conf, &d);
+		r = ffconf_schemrun(&ps);
+		x(!ffpars_iserr(r));
+	}
+	x(0 == ffconf_schemfin(&ps));
+
+	x(ffstr_eqcz(&o.s, "a\"b") && o.s.ptr == data + 3);
+	x(!ffsz_cmp(o.z, "z\"")
+		&& !(o.z >= data && o.z < data + sizeof(data))); // NULL-terminated string is copied
+	x(ffstr_eqcz(&o.r, "rA")
+		&& !(o.r.ptr >= data && o.r.ptr < data + sizeof(data))); // FFPARS_FRECOPY string is copied
+	ffmem_free(o.z);
+	ffstr_free(&o.r);
+	ffconf_parseclose(&conf);
+	ffpars_schemfree(&ps);
+
+	char d1[] = "s \"ab", d2[] = "c\"\n";
+	ffmem_tzero(&o);
+	ffpars_setargs(&ctx, &o, insitu_args, FFCNT(insitu_args));
+	x(0 == ffconf_scheminit(&ps, &conf, &ctx));
+	conf.flags |= FFCONF_PINSITU;
+	ps.flags |= FFPARS_INSITU;
+	ffstr_set(&d, d1, sizeof(d1) - 1);
+	ffconf_parsestr(&conf, &d);
+	x(FFPARS_KEY == ffconf_schemrun(&ps));
+	x(FFPARS_MORE == ffconf_parsestr(&conf, &d) && d.len == 0);
+	ffstr_set(&d, d2, sizeof(d2) - 1);
+	ffconf_parsestr(&conf, &d);
+	x(FFPARS_EVALUNSUPP == ffconf_schemrun(&ps));
+	x(o.s.ptr == NULL);
+	ffconf_parseclose(&conf);
+	ffpars_schemfree(&ps);
+}
+
 int test_conf()
 {
 	FFTEST_FUNC;
 
 	test_conf_parse(TESTDATADIR "/schem.conf");
 	test_conf_schem(TESTDATADIR "/schem.conf");
+	test_conf_insitu();
+	test_conf_insitu_schem();
 	return 0;
 }
 
@@ -132,8 +132,82 @@ void test_conf2_scheme()
 	ffvec_free(&d);
 }
 
+typedef struct kstruct {
+	ffstr s[8];
+	ffint64 n;
+} kstruct;
+
+#define OFF(m)  FF_OFF(kstruct, m)
+static const ffconf_arg kargs[] = {
+	{ "k0",	FFCONF_TSTR,	OFF(s[0]) },
+	{ "k1",	FFCONF_TSTR,	OFF(s[1]) },
+	{ "k2",	FFCONF_TSTR,	OFF(s[2]) },
+	{ "k3",	FFCONF_TSTR,	OFF(s[3]) },
+	{ "Key4",	FFCONF_TSTR,	OFF(s[4]) },
+	{ "k5",	FFCONF_TSTR,	OFF(s[5]) },
+	{ "k6",	FFCONF_TSTR,	OFF(s[6]) },
+	{ "k7",	FFCONF_TSTR,	OFF(s[7]) },
+	{ "int",	FFCONF_TINT,	OFF(n) },
+	{},
+};
+#undef OFF
+
+static ffkeyidx *kidx;
+
+static int ks_obj(ffconf_scheme *cs, kstruct *o)
+{
+	ffconf_scheme_addctx(cs, kargs, o);
+	ffconf_scheme_setkeyidx(cs, kidx);
+	return 0;
+}
+
+static const ffconf_arg ktop_args[] = {
+	{ "k",	FFCONF_TOBJ,	(ffsize)ks_obj },
+	{},
+};
+
+/** Large table is searched by the key index */
+void test_conf2_scheme_keyidx()
+{
+	ffstr err = {};
+	kstruct o = {};
+	kidx = ffkeyidx_create(kargs, sizeof(ffconf_arg), -1, 0);
+	x(kidx != NULL && kidx->n == 9);
+
+	ffstr s = FFSTR_INIT("k {\nk7 v7\nKey4 v4\nint 1234\nk0 v0\n}\n");
+	xieq(0, ffconf_parse_object(ktop_args, &o, &s, 0, &err));
+	xseq(&o.s[7], "v7");
+	xseq(&o.s[4], "v4");
+	xseq(&o.s[0], "v0");
+	x(o.n == 1234);
+
+	ffstr_setz(&s, "k {\nkey4 v4\n}\n");
+	x(0 > ffconf_parse_object(ktop_args, &o, &s, 0, &err));
+	ffstr_free(&err);
+
+	// case-sensitive index isn't used for case-insensitive search
+	ffstr_setz(&s, "k {\nKEY4 V4\nK1 v1\n}\n");
+	xieq(0, ffconf_parse_object(ktop_args, &o, &s, FFCONF_SCF_ICASE, &err));
+	xseq(&o.s[4], "V4");
+	xseq(&o.s[1], "v1");
+	ffkeyidx_free(kidx);
+
+	kidx = ffkeyidx_create(kargs, sizeof(ffconf_arg), -1, FFKEYIDX_ICASE);
+	ffstr_setz(&s, "k {\nK2 v2\nINT 5\n}\n");
+	xieq(0, ffconf_parse_object(ktop_args, &o, &s, FFCONF_SCF_ICASE, &err));
+	xseq(&o.s[2], "v2");
+	x(o.n == 5);
+	ffkeyidx_free(kidx);
+	kidx = NULL;
+
+	for (ffuint i = 0;  i != 8;  i++) {
+		ffstr_free(&o.s[i]);
+	}
+}
+
 void test_conf2()
 {
 	test_conf2_r();
 	test_conf2_scheme();
+	test_conf2_scheme_keyidx();
 }
@@ -6,6 +6,7 @@ Copyright (c) 2013 Simon Zolin
 #include <FFOS/file.h>
 #include <FFOS/process.h>
 #include <FF/data/json.h>
+#include <FF/data/json-par.h>
 #define TEST_JSON_SCHEME
 #include "data-schem.h"
 #include "all.h"
@@ -222,6 +223,488 @@ int test_json_schem(const char *testJsonFile)
 	return 0;
 }
 
+/** Parse the whole data with bulk parser.
+Return the last event or error code. */
+static int json_bulk_validate(const char *data, size_t len, uint flags, ffjson_bulk *b)
+{
+	int r, last = 0;
+	ffjson_bulk_init(b, flags);
+	ffjson_bulk_input(b, data, len);
+	ffjson_bulk_input(b, NULL, 0);
+	for (;;) {
+		r = ffjson_bulk_parse(b);
+		if (r == FFPARS_MORE)
+			break;
+		last = r;
+		if (ffpars_iserr(r))
+			break;
+	}
+	return last;
+}
+
+static int test_json_bulk_err()
+{
+	ffjson_bulk b;
+	static const struct {
+		const char *data;
+		int r;
+	} tests[] = {
+		{ "{,", FFPARS_EBADCHAR },
+		{ "[123;", FFPARS_EBADCHAR },
+		{ "\"val\n", FFPARS_EBADCHAR },
+		{ "\"val\"1", FFPARS_EBADCHAR },
+		{ "\"val\",", FFPARS_EBADCHAR },
+		{ "\"val\"]", FFPARS_EBADCHAR },
+		{ "123,", FFPARS_EBADCHAR },
+		{ "123]", FFPARS_EBADCHAR },
+		{ "[123],", FFPARS_EBADCHAR },
+		{ "[123]]", FFPARS_EBADCHAR },
+		{ "{\"key\",", FFPARS_EKVSEP },
+		{ "{\"key\":,", FFPARS_ENOVAL },
+		{ "truE", FFPARS_EBADVAL },
+		{ "\"\\1\"", FFPARS_EESC },
+		{ "\"\\uD83D\"", FFPARS_EESC },
+		{ "[123}", FFPARS_EBADBRACE },
+		{ " /z", FFPARS_EBADCMT },
+		{ "[\"val", FFPARS_ENOVAL },
+	};
+
+	FFTEST_FUNC;
+
+	for (uint i = 0;  i != FFCNT(tests);  i++) {
+		x(tests[i].r == json_bulk_validate(tests[i].data, ffsz_len(tests[i].data), 0, &b));
+		ffjson_bulk_close(&b);
+	}
+
+	x(FFPARS_VAL == json_bulk_validate(FFSTR("123456789123456789123456789123456789"), 0, &b)
+		&& b.p.type == FFJSON_TNUM);
+	ffjson_bulk_close(&b);
+
+	x(FFPARS_EBADCHAR == json_bulk_validate(FFSTR("[1,\n2,\n3 x]"), 0, &b));
+	x(b.p.line == 3 && b.p.ch == 3);
+	ffjson_bulk_close(&b);
+
+	x(FFPARS_EBADCHAR == json_bulk_validate(FFSTR("{}\n{}"), 0, &b));
+	ffjson_bulk_close(&b);
+	x(FFPARS_CLOSE == json_bulk_validate(FFSTR("{}\n{}"), FFJSON_BULK_MULTI, &b));
+	ffjson_bulk_close(&b);
+	return 0;
+}
+
+/* Strings cross 64-byte block boundaries, quotes follow backslash sequences of different length */
+static const char json_bulk_data[] =
+	"{\"key\":\"value\",\"esc\\\\\":\"\\\\\\\"\\\\\",\"arr\":[1, -2 ,3.5e2,true,false,null,\"\"],\n"
+	"\"nested\":{\"a\":{\"b\":[[],{}]}},  \"utf\":\"\\u0444\\uD83D\\uDE02\",\"long\":\""
+	"0123456789012345678901234567890123456789012345678901234567890123456789\\\"\\\\\"\n"
+	",\"n\":[123456789123456789,-0.5, 7]}";
+
+static void json_bulk_events(ffjson *p, int r, ffarr *out)
+{
+	char buf[64];
+	ffstr s = {};
+	switch (r) {
+	case FFPARS_VAL:
+		if (p->type == FFJSON_TINT || p->type == FFJSON_TBOOL) {
+			ffstr_set(&s, buf, ffs_fromint(p->intval, buf, sizeof(buf), FFINT_SIGNED));
+			break;
+		}
+		// fallthrough
+	case FFPARS_KEY:
+		s = p->val;
+		break;
+	}
+	ffstr_catfmt(out, "%d %u %S\n", r, p->type, &s);
+}
+
+/** Compare the events from bulk parser with those from ffjson_parse(). */
+static int test_json_bulk_cmp()
+{
+	ffjson js;
+	ffjson_bulk b;
+	ffarr ev = {}, ev2 = {};
+	int r;
+
+	FFTEST_FUNC;
+
+	ffjson_parseinit(&js);
+	ffstr d;
+	ffstr_set(&d, json_bulk_data, FFSLEN(json_bulk_data));
+	while (d.len != 0) {
+		r = ffjson_parsestr(&js, &d);
+		x(!ffpars_iserr(r));
+		if (r != FFPARS_MORE)
+			json_bulk_events(&js, r, &ev);
+	}
+	ffjson_parseclose(&js);
+
+	// the whole data;  chunked input
+	static const uint chunks[] = { FFSLEN(json_bulk_data), 1, 7, 63, 64, 65 };
+	for (uint i = 0;  i != FFCNT(chunks);  i++) {
+		ffjson_bulk_init(&b, 0);
+		ev2.len = 0;
+		ffstr_set(&d, json_bulk_data, FFSLEN(json_bulk_data));
+		for (;;) {
+			r = ffjson_bulk_parse(&b);
+			if (r == FFPARS_MORE) {
+				if (b.fin)
+					break;
+				size_t n = ffmin(d.len, chunks[i]);
+				ffjson_bulk_input(&b, d.ptr, n);
+				ffstr_shift(&d, n);
+				continue;
+			}
+			x(!ffpars_iserr(r));
+			json_bulk_events(&b.p, r, &ev2);
+		}
+		x(ffstr_eq2(&ev, &ev2));
+		x(b.p.ctxs.len == 0);
+		ffjson_bulk_close(&b);
+	}
+
+	ffarr_free(&ev);
+	ffarr_free(&ev2);
+	return 0;
+}
+
+/** Parse JSON with a predefined scheme using bulk parser. */
+static int test_json_bulk_schem(const char *testJsonFile)
+{
+	obj_s o;
+	ffjson_bulk b;
+	ffparser_schem ps;
+	int r;
+	char buf[1024];
+	size_t n;
+
+	FFTEST_FUNC;
+
+	memset(&o, 0, sizeof(obj_s));
+	ffjson_bulk_scheminit(&ps, &b, &glob_ctx, &o);
+
+	n = _test_readfile(testJsonFile, buf, sizeof(buf));
+	x(n != (size_t)-1);
+	ffjson_bulk_input(&b, buf, n);
+	ffjson_bulk_input(&b, NULL, 0);
+
+	for (;;) {
+		r = ffjson_bulk_parse(&b);
+		if (r == FFPARS_MORE)
+			break;
+		r = ffjson_schemrun(&ps);
+		if (ffpars_iserr(r)) {
+			printf("error (%d) %s\n", r, ffpars_errstr(r));
+			x(0);
+			break;
+		}
+	}
+	x(0 == ffjson_schemfin(&ps));
+
+	objChk(&o);
+	x(o.arrCloseOk == 1);
+
+	ffstr_free(&o.s);
+	ffmem_free(o.o[0]);
+	ffmem_free(o.o[1]);
+	ffjson_bulk_close(&b);
+	ffpars_schemfree(&ps);
+	return 0;
+}
+
+static void json_bench_data(ffarr *d)
+{
+	ffstr_catfmt(d, "[\n");
+	for (uint i = 0;  i != 20000;  i++) {
+		ffstr_catfmt(d, "{\"id\":%u,\"name\":\"user %u\",\"score\":%u.%u,\"active\":true"
+			",\"tags\":[\"a\",\"b\\\"c\",\"d\"],\"text\":\"Lorem ipsum dolor sit amet, consectetur adipiscing elit\"},\n"
+			, i, i, i % 100, i % 10);
+	}
+	ffstr_catfmt(d, "{}]");
+}
+
+static uint json_bench_parse(const ffstr *data)
+{
+	ffjson js;
+	ffstr d = *data;
+	uint n = 0;
+	int r;
+	ffjson_parseinit(&js);
+	while (d.len != 0) {
+		r = ffjson_parsestr(&js, &d);
+		x(!ffpars_iserr(r));
+		n += (r != FFPARS_MORE);
+	}
+	ffjson_parseclose(&js);
+	return n;
+}
+
+static uint json_bench_bulk(const ffstr *data)
+{
+	ffjson_bulk b;
+	uint n = 0;
+	int r;
+	ffjson_bulk_init(&b, 0);
+	ffjson_bulk_input(&b, data->ptr, data->len);
+	ffjson_bulk_input(&b, NULL, 0);
+	while (FFPARS_MORE != (r = ffjson_bulk_parse(&b))) {
+		x(!ffpars_iserr(r));
+		n++;
+	}
+	ffjson_bulk_close(&b);
+	return n;
+}
+
+/** Compare the speed of bulk parser and ffjson_parse(). */
+static void test_json_bulk_speed()
+{
+	ffarr d = {};
+	uint n1 = 0, n2 = 0;
+	json_bench_data(&d);
+	ffstr s;
+	ffstr_set2(&s, &d);
+
+	FFTEST_TIMECALL(n1 = json_bench_parse(&s));
+	FFTEST_TIMECALL(n2 = json_bench_bulk(&s));
+	x(n1 == n2);
+	ffarr_free(&d);
+}
+
+/** In-situ mode: values reference input data, escape sequences are decoded in place */
+static void test_json_insitu()
+{
+	ffjson js;
+	ffstr d;
+	FFTEST_FUNC;
+
+	char data[] = "{\"key\":\"a\\\"b\\u00e9c\\ud83d\\ude00\", \"k\\n2\":\"plain\"}";
+	ffjson_parseinit(&js);
+	js.flags |= FFJSON_PINSITU;
+	ffstr_set(&d, data, sizeof(data) - 1);
+	x(FFPARS_OPEN == ffjson_parsestr(&js, &d));
+	x(FFPARS_KEY == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "key") && js.val.ptr == data + 2);
+	x(FFPARS_VAL == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "a\"b\xc3\xa9" "c\xf0\x9f\x98\x80") && js.val.ptr == data + 8);
+	x(FFPARS_KEY == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "k\n2") && js.val.ptr == data + 35);
+	x(FFPARS_VAL == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "plain") && js.val.ptr == data + 42);
+	x(FFPARS_CLOSE == ffjson_parsestr(&js, &d));
+	x(js.buf.cap == 0);
+	ffjson_parseclose(&js);
+
+	// a string which continues in the next chunk is copied
+	char d1[] = "[\"a\\tb", d2[] = "c\",\"\\u00", d3[] = "e9x\"]";
+	ffjson_parseinit(&js);
+	js.flags |= FFJSON_PINSITU;
+	ffstr_set(&d, d1, sizeof(d1) - 1);
+	x(FFPARS_OPEN == ffjson_parsestr(&js, &d));
+	x(FFPARS_MORE == ffjson_parsestr(&js, &d) && d.len == 0);
+	ffstr_set(&d, d2, sizeof(d2) - 1);
+	x(FFPARS_VAL == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "a\tbc") && js.buf.cap != 0);
+	x(FFPARS_MORE == ffjson_parsestr(&js, &d) && d.len == 0);
+	ffstr_set(&d, d3, sizeof(d3) - 1);
+	x(FFPARS_VAL == ffjson_parsestr(&js, &d));
+	x(ffstr_eqcz(&js.val, "\xc3\xa9x") && js.buf.cap != 0);
+	x(FFPARS_CLOSE == ffjson_parsestr(&js, &d));
+	ffjson_parseclose(&js);
+}
+
+struct insitu_obj {
+	ffstr s;
+	char *z;
+};
+
+static const ffpars_arg insitu_args[] = {
+	{ "s", FFPARS_TSTR | FFPARS_FCOPY, FFPARS_DSTOFF(struct insitu_obj, s) },
+	{ "z", FFPARS_TCHARPTR | FFPARS_FSTRZ | FFPARS_FCOPY, FFPARS_DSTOFF(struct insitu_obj, z) },
+};
+
+static int insitu_setctx(ffparser_schem *ps, void *obj, ffpars_ctx *ctx)
+{
+	ffpars_setargs(ctx, obj, insitu_args, FFCNT(insitu_args));
+	return 0;
+}
+
+static const ffpars_arg insitu_top = { NULL, FFPARS_TOBJ, FFPARS_DST(&insitu_setctx) };
+
+/** FFPARS_FCOPY strings borrow input data */
+static void test_json_insitu_schem()
+{
+	ffjson js;
+	ffparser_schem ps;
+	struct insitu_obj o = {};
+	ffstr d;
+	int r;
+	FFTEST_FUNC;
+
+	char data[] = "{\"s\":\"a\\\"b\", \"z\":\"z\\\"\"}";
+	ffjson_scheminit2(&ps, &js, &insitu_top, &o);
+	js.flags |= FFJSON_PINSITU;
+	ps.flags |= FFPARS_INSITU;
+	ffstr_set(&d, data, sizeof(data) - 1);
+	while (d.len != 0) {
+		ffjson_parsestr(&js, &d);
+		r = ffjson_schemrun(&ps);
+		x(!ffpars_iserr(r));
+	}
+	x(0 == ffjson_schemfin(&ps));
+
+	x(ffstr_eqcz(&o.s, "a\"b") && o.s.ptr == data + 6);
+	x(!ffsz_cmp(o.z, "z\"")
+		&& !(o.z >= data && o.z < data + sizeof(data))); // NULL-terminated string is copied
+	ffmem_free(o.z);
+	ffjson_parseclose(&js);
+	ffpars_schemfree(&ps);
+
+	// a value which isn't in-situ is rejected
+	char d1[] = "{\"s\":\"ab", d2[] = "c\"}";
+	ffmem_tzero(&o);
+	ffjson_scheminit2(&ps, &js, &insitu_top, &o);
+	js.flags |= FFJSON_PINSITU;
+	ps.flags |= FFPARS_INSITU;
+	ffstr_set(&d, d1, sizeof(d1) - 1);
+	while (d.len != 0) {
+		ffjson_parsestr(&js, &d);
+		x(!ffpars_iserr(ffjson_schemrun(&ps)));
+	}
+	ffstr_set(&d, d2, sizeof(d2) - 1);
+	ffjson_parsestr(&js, &d);
+	x(FFPARS_EVALUNSUPP == ffjson_schemrun(&ps));
+	x(o.s.ptr == NULL);
+	ffjson_parseclose(&js);
+	ffpars_schemfree(&ps);
+}
+
+static const ffpars_arg keyidx_args[] = {
+	{ "id", FFPARS_TINT, FFPARS_DST(0) },	{ "name", FFPARS_TSTR, FFPARS_DST(0) },
+	{ "", FFPARS_TSTR, FFPARS_DST(0) },	{ "address", FFPARS_TSTR, FFPARS_DST(0) },
+	{ "city", FFPARS_TSTR, FFPARS_DST(0) },	{ "country", FFPARS_TSTR, FFPARS_DST(0) },
+	{ "Zip", FFPARS_TINT, FFPARS_DST(0) },	{ "phone", FFPARS_TSTR, FFPARS_DST(0) },
+	{ "email", FFPARS_TSTR, FFPARS_DST(0) },	{ "name", FFPARS_TINT, FFPARS_DST(0) },
+	{ "created", FFPARS_TINT, FFPARS_DST(0) },	{ "updated", FFPARS_TINT, FFPARS_DST(0) },
+	{ "active", FFPARS_TBOOL, FFPARS_DST(0) },	{ "score", FFPARS_TFLOAT, FFPARS_DST(0) },
+	{ "tags", FFPARS_TSTR | FFPARS_FLIST | FFPARS_FMULTI, FFPARS_DST(0) },
+	{ "*", FFPARS_TSTR, FFPARS_DST(0) },
+	{ NULL, FFPARS_TCLOSE, FFPARS_DST(0) },
+};
+
+/** Key index must find the same arguments as the linear search. */
+static void test_json_keyidx()
+{
+	ffpars_ctx ctx = {};
+	const ffpars_arg *a;
+	FFTEST_FUNC;
+
+	ffkeyidx *ki = ffkeyidx_create(keyidx_args, sizeof(ffpars_arg), FFCNT(keyidx_args) - 1, 0);
+	ffkeyidx *kii = ffkeyidx_create(keyidx_args, sizeof(ffpars_arg), FFCNT(keyidx_args) - 1, FFKEYIDX_ICASE);
+	x(ki != NULL && kii != NULL);
+	x(NULL == ffkeyidx_create(keyidx_args, sizeof(ffpars_arg), FFKEYIDX_MINKEYS - 1, 0));
+
+	ffpars_setargs(&ctx, NULL, keyidx_args, FFCNT(keyidx_args));
+	ffpars_setkeyidx(&ctx, ki);
+	for (uint i = 0;  i != FFCNT(keyidx_args) - 2;  i++) {
+		const char *name = keyidx_args[i].name;
+		x(ffkeyidx_find(ki, name, ffsz_len(name)) == (int)((i == 9) ? 1 : i));
+		a = ffpars_ctx_findarg(&ctx, name, ffsz_len(name), 0);
+		x(a == &keyidx_args[(i == 9) ? 1 : i]); // the first "name" is found
+	}
+
+	x(-1 == ffkeyidx_find(ki, FFSTR("nam")));
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("nam"), 0));
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("names"), 0));
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("NAME"), 0));
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("zip"), 0));
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("*"), 0));
+	x(&keyidx_args[15] == ffpars_ctx_findarg(&ctx, FFSTR("unknown"), FFPARS_CTX_FANY));
+
+	x(&keyidx_args[3] == ffpars_ctx_findarg(&ctx, FFSTR("address"), FFPARS_CTX_FDUP));
+	x((void*)-1 == ffpars_ctx_findarg(&ctx, FFSTR("address"), FFPARS_CTX_FDUP));
+	x(&keyidx_args[14] == ffpars_ctx_findarg(&ctx, FFSTR("tags"), FFPARS_CTX_FDUP));
+	x(&keyidx_args[14] == ffpars_ctx_findarg(&ctx, FFSTR("tags"), FFPARS_CTX_FDUP));
+
+	// case-sensitive index isn't used for case-insensitive search
+	x(&keyidx_args[6] == ffpars_ctx_findarg(&ctx, FFSTR("zIP"), FFPARS_CTX_FKEYICASE));
+
+	ffpars_setargs(&ctx, NULL, keyidx_args, FFCNT(keyidx_args));
+	ffpars_setkeyidx(&ctx, kii);
+	x(-1 == ffkeyidx_find(kii, FFSTR("NAMES")));
+	x(&keyidx_args[6] == ffpars_ctx_findarg(&ctx, FFSTR("zIP"), FFPARS_CTX_FKEYICASE));
+	x(&keyidx_args[1] == ffpars_ctx_findarg(&ctx, FFSTR("NAME"), FFPARS_CTX_FKEYICASE));
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("NAMES"), FFPARS_CTX_FKEYICASE));
+
+	// the index of another table isn't used
+	ffpars_setargs(&ctx, NULL, keyidx_args, 10);
+	ffpars_setkeyidx(&ctx, ki);
+	x(&keyidx_args[8] == ffpars_ctx_findarg(&ctx, FFSTR("email"), 0));
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("created"), 0));
+
+	// a part of the same table has its own index
+	ffkeyidx *ki10 = ffkeyidx_create(keyidx_args, sizeof(ffpars_arg), 10, 0);
+	x(ki10 != NULL && ki10->n == 10);
+	ffpars_setkeyidx(&ctx, ki10);
+	x(&keyidx_args[8] == ffpars_ctx_findarg(&ctx, FFSTR("email"), 0));
+	x(NULL == ffpars_ctx_findarg(&ctx, FFSTR("created"), 0));
+
+	ffkeyidx_free(ki);
+	ffkeyidx_free(kii);
+	ffkeyidx_free(ki10);
+}
+
+static const ffpars_arg* keyidx_linear(const ffpars_arg *args, uint nargs, const ffstr *name)
+{
+	for (uint i = 0;  i != nargs;  i++) {
+		if (0 == ffs_cmpz(name->ptr, name->len, args[i].name))
+			return &args[i];
+	}
+	return NULL;
+}
+
+static uint keyidx_bench_linear(const ffstr *keys, uint n)
+{
+	uint found = 0;
+	for (uint k = 0;  k != 100000;  k++) {
+		for (uint i = 0;  i != n;  i++) {
+			found += (NULL != keyidx_linear(keyidx_args, FFCNT(keyidx_args) - 1, &keys[i]));
+		}
+	}
+	return found;
+}
+
+static uint keyidx_bench_idx(const ffstr *keys, uint n)
+{
+	uint found = 0;
+	ffpars_ctx ctx = {};
+	ffkeyidx *ki = ffkeyidx_create(keyidx_args, sizeof(ffpars_arg), FFCNT(keyidx_args) - 1, 0);
+	ffpars_setargs(&ctx, NULL, keyidx_args, FFCNT(keyidx_args));
+	ffpars_setkeyidx(&ctx, ki);
+	for (uint k = 0;  k != 100000;  k++) {
+		for (uint i = 0;  i != n;  i++) {
+			found += (NULL != ffpars_ctx_findarg(&ctx, keys[i].ptr, keys[i].len, 0));
+		}
+	}
+	ffkeyidx_free(ki);
+	return found;
+}
+
+/** Linear search vs. compiled key index */
+static void test_json_keyidx_speed()
+{
+	uint n1, n2;
+	ffstr keys[FFCNT(keyidx_args)];
+	uint n = FFCNT(keyidx_args) - 2;
+	for (uint i = 0;  i != n;  i++) {
+		ffstr_setz(&keys[i], keyidx_args[i].name);
+	}
+	ffstr_setz(&keys[n], "unknown");
+	n++;
+
+	FFTEST_TIMECALL(n1 = keyidx_bench_linear(keys, n));
+	FFTEST_TIMECALL(n2 = keyidx_bench_idx(keys, n));
+	x(n1 == n2);
+}
+
+
 /** Generate JSON file. */
 int test_json_generat(const char *fn)
 {
@@ -335,6 +818,493 @@ static int test_json_cook()
 	return 0;
 }
 
+/* Compare SIMD escape against the known result for each position of a special character */
+static void test_json_escape()
+{
+	char src[40], buf[256];
+	FFTEST_FUNC;
+
+	for (uint i = 0;  i != sizeof(src);  i++) {
+		ffmem_fill(src, 'a', sizeof(src));
+		src[i] = '\x1f';
+		x(sizeof(src) - 1 + FFSLEN("\\u001F") == ffjson_escape(NULL, 0, src, sizeof(src)));
+		size_t n = ffjson_escape(buf, sizeof(buf), src, sizeof(src));
+		x(n == sizeof(src) - 1 + FFSLEN("\\u001F"));
+		x(!ffmemcmp(buf + i, "\\u001F", 6));
+		x(i == ffjson_escape_skip(src, sizeof(src)));
+
+		src[i] = '"';
+		x(i == ffjson_escape_skip(src, sizeof(src)));
+		src[i] = (char)0xd1; // UTF-8 isn't escaped
+		x(sizeof(src) == ffjson_escape_skip(src, sizeof(src)));
+	}
+
+	x(0 == ffjson_escape(buf, 4, FFSTR("aaa\n")));
+	x(5 == ffjson_escape(buf, 5, FFSTR("aaa\n")));
+	x(!ffmemcmp(buf, "aaa\\n", 5));
+}
+
+static void json_wr_data(ffjson_wr *w, ffarr *out)
+{
+	const ffiovec *iov;
+	size_t n = ffjson_wr_iov(w, &iov);
+	out->len = 0;
+	for (size_t i = 0;  i != n;  i++) {
+		ffarr_append(out, iov[i].iov_base, iov[i].iov_len);
+	}
+	x(out->len == w->total);
+}
+
+static void test_json_wr()
+{
+	ffjson_wr w;
+	ffarr out = {};
+	FFTEST_FUNC;
+
+	ffjson_wr_init(&w, 0, 0);
+	x(FFJSON_OK == ffjson_wr_obj(&w));
+	x(FFJSON_OK == ffjson_wr_key(&w, FFSTR("key")));
+	x(FFJSON_OK == ffjson_wr_str(&w, FFSTR("val\"\n")));
+	x(FFJSON_OK == ffjson_wr_key(&w, FFSTR("arr")));
+	x(FFJSON_OK == ffjson_wr_arr(&w));
+	x(FFJSON_OK == ffjson_wr_int(&w, -1234567890123456789LL));
+	x(FFJSON_OK == ffjson_wr_int(&w, 0));
+	x(FFJSON_OK == ffjson_wr_float(&w, 0.1));
+	x(FFJSON_OK == ffjson_wr_float(&w, -2.5e-300));
+	x(FFJSON_OK == ffjson_wr_float(&w, 1e15));
+	x(FFJSON_OK == ffjson_wr_bool(&w, 1));
+	x(FFJSON_OK == ffjson_wr_null(&w));
+	x(FFJSON_OK == ffjson_wr_obj(&w));
+	x(FFJSON_OK == ffjson_wr_end(&w));
+	x(FFJSON_OK == ffjson_wr_end(&w));
+	x(FFJSON_OK == ffjson_wr_end(&w));
+	x(FFJSON_OK == ffjson_wr_int(&w, 1));
+	json_wr_data(&w, &out);
+	x(ffstr_eqcz(&out, "{\"key\":\"val\\\"\\n\",\"arr\":[-1234567890123456789,0,0.1,-2.5e-300,1000000000000000,true,null,{}]}\n1"));
+
+	// invalid order
+	ffjson_wr_reset(&w);
+	x(FFJSON_OK == ffjson_wr_obj(&w));
+	x(FFJSON_ERR == ffjson_wr_int(&w, 1));
+	x(FFJSON_ERR == ffjson_wr_key(&w, FFSTR("key")));
+	ffjson_wr_reset(&w);
+	x(FFJSON_ERR == ffjson_wr_end(&w));
+	ffjson_wr_reset(&w);
+	x(FFJSON_ERR == ffjson_wr_float(&w, 1.0 / 0.0));
+	ffjson_wr_close(&w);
+
+	// floats survive the round-trip
+	static const double flt[] = { 0.3, 1.0 / 3, 5e-324, 1.7976931348623157e308, 123456.789, -0.0
+		, 9007199254740992.0 /*2^53*/, 1e19, -1e30 };
+	ffjson_wr_init(&w, 0, 0);
+	for (uint i = 0;  i != FFCNT(flt);  i++) {
+		ffjson_wr_reset(&w);
+		x(FFJSON_OK == ffjson_wr_float(&w, flt[i]));
+		json_wr_data(&w, &out);
+		ffarr_append(&out, "", 1);
+		x(strtod(out.ptr, NULL) == flt[i]);
+	}
+
+	// the shortest text
+	static const struct { double val; const char *s; } flt_s[] = {
+		{ 0.3, "0.3" }, { 1.0 / 3, "0.3333333333333333" }, { 123456.789, "123456.789" },
+		{ 5e-324, "5e-324" }, { 1.7976931348623157e308, "1.7976931348623157e+308" },
+		{ 1e19, "10000000000000000000" }, { 1e21, "1e+21" }, { 0.000001, "0.000001" },
+		{ 1.5e-7, "1.5e-7" }, { -0.0, "-0" }, { -1e30, "-1e+30" },
+		{ 5.2829453113566525e+269, "5.282945311356653e+269" }, // not the correctly rounded 16 digits
+	};
+	for (uint i = 0;  i != FFCNT(flt_s);  i++) {
+		ffjson_wr_reset(&w);
+		x(FFJSON_OK == ffjson_wr_float(&w, flt_s[i].val));
+		json_wr_data(&w, &out);
+		x(ffstr_eqz(&out, flt_s[i].s));
+	}
+	ffjson_wr_close(&w);
+
+	// small chunks, large strings are referenced
+	ffarr big = {};
+	for (uint i = 0;  i != 1000;  i++) {
+		ffarr_append(&big, "0123456789", 10);
+	}
+	big.ptr[500] = '\t';
+	ffjson_wr_init(&w, 256, FFJSON_WR_REF);
+	x(FFJSON_OK == ffjson_wr_arr(&w));
+	for (uint i = 0;  i != 100;  i++) {
+		x(FFJSON_OK == ffjson_wr_str(&w, big.ptr, (i % 2) ? big.len : 100));
+	}
+	x(FFJSON_OK == ffjson_wr_end(&w));
+	const ffiovec *iov;
+	size_t niov = ffjson_wr_iov(&w, &iov);
+	uint nref = 0;
+	for (size_t i = 0;  i != niov;  i++) {
+		if ((char*)iov[i].iov_base >= big.ptr && (char*)iov[i].iov_base < big.ptr + big.len)
+			nref++;
+	}
+	x(nref == 50 * 2);
+	json_wr_data(&w, &out);
+	ffjson p;
+	ffjson_parseinit(&p);
+	x(FFPARS_CLOSE == ffjson_validate(&p, out.ptr, out.len));
+	ffjson_parseclose(&p);
+
+	// the same output is written without references
+	ffarr out2 = {};
+	ffjson_wr_close(&w);
+	ffjson_wr_init(&w, 256, 0);
+	x(FFJSON_OK == ffjson_wr_arr(&w));
+	for (uint i = 0;  i != 100;  i++) {
+		x(FFJSON_OK == ffjson_wr_str(&w, big.ptr, (i % 2) ? big.len : 100));
+	}
+	x(FFJSON_OK == ffjson_wr_end(&w));
+	json_wr_data(&w, &out2);
+	x(out.len == out2.len && !ffmemcmp(out.ptr, out2.ptr, out.len));
+	ffjson_wr_close(&w);
+
+	ffarr_free(&out2);
+	ffarr_free(&big);
+	ffarr_free(&out);
+}
+
+static const char json_bench_str[] = "Lorem ipsum dolor sit amet, consectetur adipiscing elit \"quoted\"";
+
+static size_t json_bench_cook()
+{
+	ffjson_cook c;
+	size_t n = 0;
+	int64 i;
+	ffstr s = FFSTR_INIT(json_bench_str);
+	ffjson_cookinit(&c, NULL, 0);
+	for (uint k = 0;  k != 100;  k++) {
+		ffjson_cookreset(&c);
+		ffjson_bufadd(&c, FFJSON_TARR, FFJSON_CTXOPEN);
+		for (i = 0;  i != 10000;  i++) {
+			ffjson_bufadd(&c, FFJSON_TOBJ, FFJSON_CTXOPEN);
+			ffjson_bufadd(&c, FFJSON_FKEYNAME, "id");
+			ffjson_bufadd(&c, FFJSON_TINT, &i);
+			ffjson_bufadd(&c, FFJSON_FKEYNAME, "text");
+			ffjson_bufadd(&c, FFJSON_TSTR, &s);
+			ffjson_bufadd(&c, FFJSON_TOBJ, FFJSON_CTXCLOSE);
+		}
+		ffjson_bufadd(&c, FFJSON_TARR, FFJSON_CTXCLOSE);
+		n += c.buf.len;
+	}
+	ffjson_cookfinbuf(&c);
+	return n;
+}
+
+static size_t json_bench_wr()
+{
+	ffjson_wr w;
+	size_t n = 0;
+	ffjson_wr_init(&w, 0, 0);
+	for (uint k = 0;  k != 100;  k++) {
+		ffjson_wr_reset(&w);
+		ffjson_wr_arr(&w);
+		for (int64 i = 0;  i != 10000;  i++) {
+			ffjson_wr_obj(&w);
+			ffjson_wr_key(&w, FFSTR("id"));
+			ffjson_wr_int(&w, i);
+			ffjson_wr_key(&w, FFSTR("text"));
+			ffjson_wr_str(&w, json_bench_str, FFSLEN(json_bench_str));
+			ffjson_wr_end(&w);
+		}
+		ffjson_wr_end(&w);
+		n += w.total;
+	}
+	ffjson_wr_close(&w);
+	return n;
+}
+
+/* Writer vs. ffjson_bufadd() */
+static void test_json_wr_speed()
+{
+	size_t n1, n2;
+	FFTEST_TIMECALL(n1 = json_bench_cook());
+	FFTEST_TIMECALL(n2 = json_bench_wr());
+	x(n1 == n2);
+}
+
+static size_t json_bench_float_libc(const double *v, uint n)
+{
+	char buf[32];
+	size_t total = 0;
+	for (uint k = 0;  k != 10;  k++) {
+		for (uint i = 0;  i != n;  i++) {
+			total += snprintf(buf, sizeof(buf), "%.17g", v[i]);
+		}
+	}
+	return total;
+}
+
+static size_t json_bench_float_wr(const double *v, uint n)
+{
+	ffjson_wr w;
+	size_t total = 0;
+	ffjson_wr_init(&w, 0, 0);
+	for (uint k = 0;  k != 10;  k++) {
+		ffjson_wr_reset(&w);
+		for (uint i = 0;  i != n;  i++) {
+			ffjson_wr_float(&w, v[i]);
+		}
+		total += w.total;
+	}
+	ffjson_wr_close(&w);
+	return total;
+}
+
+/* Float conversion: writer vs. snprintf("%.17g") */
+static void test_json_wr_float_speed()
+{
+	size_t n1, n2;
+	uint n = 100000;
+	double *v = ffmem_alloc(n * sizeof(double));
+	uint64 r = 1;
+	for (uint i = 0;  i != n;  i++) {
+		r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+		v[i] = (double)(r >> 11) / (1ULL << 53) * 1000; // [0..1000) with up to 17 digits
+	}
+
+	FFTEST_TIMECALL(n1 = json_bench_float_libc(v, n));
+	FFTEST_TIMECALL(n2 = json_bench_float_wr(v, n));
+	x(n2 != 0 && n2 <= n1 + 10 * n); // the shortest text + separators
+	ffmem_free(v);
+}
+
+static void test_json_split()
+{
+	ffjson_split sp;
+	ffstr d, rec;
+	FFTEST_FUNC;
+
+	// NDJSON: newlines within strings and objects aren't delimiters
+	ffjson_split_init(&sp, 0);
+	ffstr_setz(&d, "{\"a\":\"x\\\"\\n{\"}\n\n{\"b\":\n[1,2]}\r\n 3");
+	x(FFPARS_VAL == ffjson_split_next(&sp, &d, &rec, 0));
+	x(ffstr_eqz(&rec, "{\"a\":\"x\\\"\\n{\"}"));
+	x(FFPARS_VAL == ffjson_split_next(&sp, &d, &rec, 0));
+	x(ffstr_eqz(&rec, "{\"b\":\n[1,2]}"));
+	x(FFPARS_MORE == ffjson_split_next(&sp, &d, &rec, 0));
+	x(FFPARS_VAL == ffjson_split_next(&sp, &d, &rec, 1));
+	x(ffstr_eqz(&rec, "3"));
+	x(FFPARS_MORE == ffjson_split_next(&sp, &d, &rec, 1));
+
+	// top-level array
+	ffjson_split_init(&sp, FFJSON_SPLIT_ARRAY);
+	ffstr_setz(&d, " [ {\"a\":[1,\"],\\\\\"]}, 2 ,\"s\" ] ");
+	x(FFPARS_VAL == ffjson_split_next(&sp, &d, &rec, 1));
+	x(ffstr_eqz(&rec, "{\"a\":[1,\"],\\\\\"]}"));
+	x(FFPARS_VAL == ffjson_split_next(&sp, &d, &rec, 1));
+	x(ffstr_eqz(&rec, "2"));
+	x(FFPARS_VAL == ffjson_split_next(&sp, &d, &rec, 1));
+	x(ffstr_eqz(&rec, "\"s\""));
+	x(FFPARS_MORE == ffjson_split_next(&sp, &d, &rec, 1));
+
+	ffjson_split_init(&sp, FFJSON_SPLIT_ARRAY);
+	ffstr_setz(&d, "[]");
+	x(FFPARS_MORE == ffjson_split_next(&sp, &d, &rec, 1));
+	ffjson_split_init(&sp, FFJSON_SPLIT_ARRAY);
+	ffstr_setz(&d, "[1,,2]");
+	x(FFPARS_VAL == ffjson_split_next(&sp, &d, &rec, 1));
+	x(FFPARS_ENOVAL == ffjson_split_next(&sp, &d, &rec, 1));
+	ffjson_split_init(&sp, FFJSON_SPLIT_ARRAY);
+	ffstr_setz(&d, "1 [2]");
+	x(FFPARS_EBADCHAR == ffjson_split_next(&sp, &d, &rec, 1));
+	ffjson_split_init(&sp, FFJSON_SPLIT_ARRAY);
+	ffstr_setz(&d, "[1");
+	x(FFPARS_ENOBRACE == ffjson_split_next(&sp, &d, &rec, 1));
+	ffjson_split_init(&sp, 0);
+	ffstr_setz(&d, "{}}");
+	x(FFPARS_EBADBRACE == ffjson_split_next(&sp, &d, &rec, 1));
+
+	// chunked input: the same data is passed again with the next part appended
+	static const char r1[] = "{\"k\":\"x\\\\\\\"}],\\n{[\",\"n\":[1,{\"a\":\"\\\"\"}],\"long value which spans several blocks\"}";
+	ffarr a = {};
+	for (uint i = 0;  i != 100;  i++) {
+		ffarr_append(&a, r1, FFSLEN(r1));
+		ffarr_append(&a, "\n", 1);
+	}
+	const char *end = a.ptr + a.len;
+	uint n = 0;
+	ffjson_split_init(&sp, 0);
+	ffstr_set(&d, a.ptr, 0);
+	for (;;) {
+		uint fin = (d.ptr + d.len == end);
+		int r = ffjson_split_next(&sp, &d, &rec, fin);
+		if (r == FFPARS_VAL) {
+			x(ffstr_eqz(&rec, r1));
+			n++;
+			continue;
+		}
+		x(r == FFPARS_MORE);
+		if (fin)
+			break;
+		d.len = ffmin(d.len + 7, (size_t)(end - d.ptr));
+	}
+	x(n == 100);
+	ffarr_free(&a);
+}
+
+struct par_obj {
+	uint64 sum;
+	uint n;
+};
+
+struct par_res {
+	uint64 next_chunk;
+	uint64 sum;
+	uint n;
+	ffstr errrec;
+};
+
+static int par_id(ffparser_schem *ps, void *obj, const int64 *val)
+{
+	struct par_obj *o = obj;
+	o->sum += *val;
+	o->n++;
+	return 0;
+}
+
+static int par_str(ffparser_schem *ps, void *obj, const ffstr *val)
+{
+	if (!ffstr_eqz(val, "a\"b,}]\n"))
+		return FFPARS_EBADVAL;
+	return 0;
+}
+
+static const ffpars_arg par_args[] = {
+	{ "id", FFPARS_TINT64, FFPARS_DST(&par_id) },
+	{ "s", FFPARS_TSTR, FFPARS_DST(&par_str) },
+};
+
+static int par_setctx(ffparser_schem *ps, void *obj, ffpars_ctx *ctx)
+{
+	ffpars_setargs(ctx, obj, par_args, FFCNT(par_args));
+	return 0;
+}
+
+static const ffpars_arg par_top = { NULL, FFPARS_TOBJ, FFPARS_DST(&par_setctx) };
+
+static void par_chunk_begin(void *obj)
+{
+	ffmem_zero(obj, sizeof(struct par_obj));
+}
+
+static int par_chunk_done(void *udata, ffjson_pchunk *c)
+{
+	struct par_res *res = udata;
+	struct par_obj *o = c->obj;
+	x(c->index == res->next_chunk++);
+	if (c->err != 0) {
+		res->errrec = c->errrec;
+		return 0;
+	}
+	x(o->n == c->nrecs);
+	res->sum += o->sum;
+	res->n += o->n;
+	return 0;
+}
+
+/** Generate 'n' records: NDJSON or array. */
+static void par_data(ffarr *a, uint n, uint arr)
+{
+	char buf[64];
+	a->len = 0;
+	if (arr)
+		ffarr_append(a, "[\n", 2);
+	for (uint i = 0;  i != n;  i++) {
+		uint r = ffs_fmt(buf, buf + sizeof(buf), "{\"id\":%u,\"s\":\"a\\\"b,}]\\n\"}", i);
+		ffarr_append(a, buf, r);
+		if (arr && i + 1 != n)
+			ffarr_append(a, ",", 1);
+		ffarr_append(a, "\n", 1);
+	}
+	if (arr)
+		ffarr_append(a, "]", 1);
+}
+
+static int par_run(ffthpool *tp, uint nslots, uint flags, uint schem_flags, const ffarr *a, struct par_res *res)
+{
+	struct par_obj objs[8];
+	void *pobjs[8];
+	for (uint i = 0;  i != nslots;  i++) {
+		pobjs[i] = &objs[i];
+	}
+
+	ffjson_pconf conf = {};
+	conf.thpool = tp;
+	conf.flags = flags;
+	conf.nslots = nslots;
+	conf.chunk_size = 4 * 1024;
+	conf.top = &par_top;
+	conf.schem_flags = schem_flags;
+	conf.objs = pobjs;
+	conf.chunk_begin = &par_chunk_begin;
+	conf.chunk_done = &par_chunk_done;
+	conf.udata = res;
+	ffmem_zero(res, sizeof(*res));
+	return ffjson_prun(&conf, a->ptr, a->len);
+}
+
+static void test_json_par()
+{
+	enum { N = 10000 };
+	ffthpoolconf tc = {};
+	ffthpool *tp;
+	ffarr a = {};
+	struct par_res res;
+	FFTEST_FUNC;
+
+	tc.maxthreads = 4;
+	tc.maxqueue = 64;
+	x(NULL != (tp = ffthpool_create(&tc)));
+
+	for (uint arr = 0;  arr != 2;  arr++) {
+		uint flags = (arr) ? FFJSON_SPLIT_ARRAY : 0;
+		par_data(&a, N, arr);
+		x(0 == par_run(tp, 4, flags, 0, &a, &res));
+		x(res.n == N);
+		x(res.sum == (uint64)N * (N - 1) / 2);
+		x(res.next_chunk > 4);
+	}
+
+	// processing stops after the chunk with error
+	par_data(&a, N, 0);
+	char *bad = ffs_finds(a.ptr, a.len, FFSTR("\"id\":5000,"));
+	bad[FFSLEN("\"id\":")] = 'x';
+	x(0 != par_run(tp, 4, 0, 0, &a, &res));
+	x(res.n < 5000);
+	x(res.errrec.ptr == bad - 1);
+
+	// scheme flags
+	par_data(&a, N, 0);
+	for (char *p = a.ptr, *end = ffarr_end(&a);  end != (p = ffs_finds(p, end - p, FFSTR("\"id\"")));  p++) {
+		ffmemcpy(p, "\"ID\"", 4);
+	}
+	x(FFPARS_EUKNKEY == par_run(tp, 4, 0, 0, &a, &res));
+	x(0 == par_run(tp, 4, 0, FFPARS_KEYICASE | FFPARS_INSITU, &a, &res));
+	x(res.n == N);
+
+	// 4 slots, but the queue of thread pool can hold only 1 task
+	ffthpool *tp1;
+	tc.maxthreads = 1;
+	tc.maxqueue = 1;
+	x(NULL != (tp1 = ffthpool_create(&tc)));
+	par_data(&a, N, 0);
+	x(0 == par_run(tp1, 4, 0, 0, &a, &res));
+	x(res.n == N);
+	x(res.sum == (uint64)N * (N - 1) / 2);
+	x(0 == ffthpool_free(tp1));
+
+	// 1 slot vs. 4 slots
+	par_data(&a, 50 * N, 0);
+	FFTEST_TIMECALL(x(0 == par_run(tp, 1, 0, 0, &a, &res)));
+	FFTEST_TIMECALL(x(0 == par_run(tp, 4, 0, 0, &a, &res)));
+	x(res.n == 50 * N);
+
+	ffarr_free(&a);
+	x(0 == ffthpool_free(tp));
+}
+
 int test_json()
 {
 	char buf[16];
@@ -348,8 +1318,22 @@ int test_json()
 	test_json_parse(TESTDATADIR "/test.json");
 	test_json_err();
 	test_json_schem(TESTDATADIR "/schem.json");
+	test_json_bulk_err();
+	test_json_bulk_cmp();
+	test_json_bulk_schem(TESTDATADIR "/schem.json");
+	test_json_bulk_speed();
+	test_json_insitu();
+	test_json_insitu_schem();
+	test_json_keyidx();
+	test_json_keyidx_speed();
 
 	test_json_generat(TESTDIR "/gen.json");
 	test_json_cook();
+	test_json_escape();
+	test_json_wr();
+	test_json_wr_speed();
+	test_json_wr_float_speed();
+	test_json_split();
+	test_json_par();
 	return 0;
 }
@@ -7,6 +7,7 @@ Copyright (c) 2019 Simon Zolin
 #include <FF/array.h>
 #include <FF/net/proto.h>
 #include <FFOS/random.h>
+#include <FFOS/socket.h>
 #include <FFOS/test.h>
 
 
@@ -20,6 +21,10 @@ static void dnslog(uint level, const char *fmt, ...);
 static void dnstimer(fftmrq_entry *tmr, uint value_ms);
 static fftime dnstime(void);
 static void tmr_exit(void *param);
+static void dsrv_init(void);
+static void dsrv_close(void);
+static void test_dns_client_hedge(fffd kq);
+static void test_dns_client_cache(fffd kq);
 
 void test_dns_client(void)
 {
@@ -49,6 +54,8 @@ void test_dns_client(void)
 	conf.enable_ipv6 = 1;
 	conf.edns = 1;
 	conf.debug_log = 1;
+	conf.cache.max_items = 16;
+	conf.cache.max_ttl = 60;
 
 	ctx = ffdnscl_new(&conf);
 	ffstr s;
@@ -75,6 +82,24 @@ void test_dns_client(void)
 
 	x(gflags & 1);
 
+	// the answer is in cache:  the request is completed synchronously
+	ffstr_setz(&s, "google.com");
+	x(0 == ffdnscl_resolve(ctx, s, &onresolve, (void*)3, 0));
+	x(gflags & 4);
+	struct ffdnscl_cachestat st;
+	ffdnscl_cachestat(ctx, &st);
+	x(st.hits == 1 && st.items != 0);
+
+	struct ffdnscl_servstat ss;
+	x(0 == ffdnscl_servstat(ctx, 0, &ss));
+	x(ss.answers != 0 && ss.queries != 0);
+	x(0 != ffdnscl_servstat(ctx, 1, &ss));
+
+	dsrv_init();
+	test_dns_client_hedge(kq);
+	test_dns_client_cache(kq);
+	dsrv_close();
+
 	ffkqu_close(kq);
 	ffdnscl_free(ctx);
 	fftmrq_destroy(&tq, kq);
@@ -97,6 +122,11 @@ static void onresolve(void *udata, const ffdnscl_result *res)
 		fffile_write(ffstdout, data.ptr, data.len);
 		fffile_write(ffstdout, "\r\n", 2);
 
+	} else if (udata == (void*)3) {
+		xieq(FFDNS_NOERROR, res->status);
+		x(res->ip.len != 0);
+		gflags |= 4;
+
 	} else {
 		x(0);
 	}
@@ -139,3 +169,301 @@ static void tmr_exit(void *param)
 {
 	gflags |= 2;
 }
+
+
+/* Local DNS servers:  the first one never responds,
+ the second one answers every A query with 127.0.0.2 unless 'mute' is set. */
+static struct {
+	ffskt sk[2];
+	uint nreq; // queries received by the second server
+	uint ttl; // TTL of the answer record
+	uint rcode; // response code;  no answer record if not FFDNS_NOERROR
+	uint mute :1;
+	uint nodata :1; // respond with FFDNS_NOERROR but without records
+} dsrv;
+
+static void dsrv_init(void)
+{
+	ffaddr a;
+	for (uint i = 0;  i != 2;  i++) {
+		ffaddr_init(&a);
+		x(0 == ffaddr_set(&a, FFSTR("127.0.0.1"), NULL, 0));
+		ffip_setport(&a, 64020 + i);
+		dsrv.sk[i] = ffskt_create(AF_INET, SOCK_DGRAM, 0);
+		x(dsrv.sk[i] != FF_BADSKT);
+		x(0 == ffskt_bind(dsrv.sk[i], &a.a, a.len));
+		x(0 == ffskt_nblock(dsrv.sk[i], 1));
+	}
+	dsrv.ttl = 60;
+}
+
+static void dsrv_close(void)
+{
+	ffskt_close(dsrv.sk[0]);
+	ffskt_close(dsrv.sk[1]);
+}
+
+static void dsrv_process(void)
+{
+	char buf[512];
+	struct sockaddr_in peer;
+	socklen_t peerlen;
+	ssize_t n;
+	// name: pointer to the question;  type: A;  class: IN;  TTL: 60;  data: 127.0.0.2
+	static const char ans[] = "\xc0\x0c" "\x00\x01" "\x00\x01" "\x00\x00\x00\x3c" "\x00\x04" "\x7f\x00\x00\x02";
+
+	for (;;) {
+		peerlen = sizeof(peer);
+		n = recvfrom(dsrv.sk[1], buf, sizeof(buf) - (sizeof(ans) - 1), 0, (struct sockaddr*)&peer, &peerlen);
+		if (n <= 0)
+			break;
+		dsrv.nreq++;
+		if (dsrv.mute)
+			continue;
+		buf[2] |= 0x80; // response
+		buf[3] = 0x80 | dsrv.rcode; // recursion available
+		if (dsrv.rcode != FFDNS_NOERROR || dsrv.nodata)
+			goto send;
+		buf[6] = 0, buf[7] = 1; // 1 answer
+		ffmemcpy(&buf[n], ans, sizeof(ans) - 1);
+		uint ttl = ffint_hton32(dsrv.ttl);
+		ffmemcpy(&buf[n + 6], &ttl, 4);
+		n += sizeof(ans) - 1;
+send:
+		x(n == sendto(dsrv.sk[1], buf, n, 0, (struct sockaddr*)&peer, peerlen));
+	}
+}
+
+static void hedge_onresolve(void *udata, const ffdnscl_result *res)
+{
+	int *status = udata;
+	*status = res->status;
+	if (res->status == FFDNS_NOERROR) {
+		xieq(1, res->ip.len);
+		const ffip4 *ip4 = ffip6_tov4((ffip6*)res->ip.ptr);
+		x(ip4 != NULL && !ffmemcmp(ip4, "\x7f\x00\x00\x02", 4));
+	}
+}
+
+/** Process events until the request is completed.
+Return DNS response status. */
+static int hedge_wait(fffd kq, int *status)
+{
+	ffkqu_time tm;
+	ffkqu_settm(&tm, 10);
+	for (uint i = 0;  *status == 0x7fff && i != 500;  i++) {
+		dsrv_process();
+		ffkqu_entry ev;
+		int n = ffkqu_wait(kq, &ev, 1, &tm);
+		if (n == 1)
+			ffkev_call(&ev);
+	}
+	x(*status != 0x7fff);
+	return *status;
+}
+
+static void test_dns_client_hedge(fffd kq)
+{
+	ffdnscl_conf conf;
+	ffdnscl_conf_init(&conf);
+	conf.kq = kq;
+	conf.log = &dnslog;
+	conf.time = &dnstime;
+	conf.timer = &dnstimer;
+	conf.max_tries = 3;
+	conf.retry_timeout = 300;
+	conf.enable_ipv6 = 0;
+	conf.edns = 0;
+	conf.debug_log = 1;
+	conf.hedge = 1;
+	ffdnsclient *r = ffdnscl_new(&conf);
+
+	ffstr s;
+	ffstr_setz(&s, "127.0.0.1:64020");
+	x(0 == ffdnscl_serv_add(r, &s));
+	ffstr_setz(&s, "127.0.0.1:64021");
+	x(0 == ffdnscl_serv_add(r, &s));
+
+	struct ffdnscl_servstat silent, live;
+	int status;
+
+	// the query is sent to the first server;  it doesn't respond, so the query is hedged to the second server
+	status = 0x7fff;
+	ffstr_setz(&s, "hedge1.test");
+	x(0 == ffdnscl_resolve(r, s, &hedge_onresolve, &status, 0));
+	xieq(FFDNS_NOERROR, hedge_wait(kq, &status));
+	x(0 == ffdnscl_servstat(r, 0, &silent));
+	x(0 == ffdnscl_servstat(r, 1, &live));
+	x(silent.queries == 1 && silent.answers == 0 && silent.rtt != 0);
+	x(live.queries == 1 && live.answers == 1 && live.hedged == 1);
+
+	// the second server has the better score now:  the query is sent to it first
+	status = 0x7fff;
+	ffstr_setz(&s, "hedge2.test");
+	x(0 == ffdnscl_resolve(r, s, &hedge_onresolve, &status, 0));
+	x(0 == ffdnscl_servstat(r, 0, &silent));
+	x(0 == ffdnscl_servstat(r, 1, &live));
+	x(silent.queries == 1 && live.queries == 2);
+	xieq(FFDNS_NOERROR, hedge_wait(kq, &status));
+	x(0 == ffdnscl_servstat(r, 1, &live));
+	x(live.answers == 2 && live.hedged == 1);
+
+	// no server responds:  both fail on every try and get demoted after 3 failures.
+	// Hedge delay must not exceed retry_timeout.
+	dsrv.mute = 1;
+	r->retry_timeout = 4;
+	status = 0x7fff;
+	ffstr_setz(&s, "hedge3.test");
+	x(0 == ffdnscl_resolve(r, s, &hedge_onresolve, &status, 0));
+	xieq(-1, hedge_wait(kq, &status));
+	x(0 == ffdnscl_servstat(r, 0, &silent));
+	x(0 == ffdnscl_servstat(r, 1, &live));
+	x(silent.fails == 3 && silent.demoted);
+	x(live.fails == 3 && live.demoted);
+
+	ffdnscl_free(r);
+}
+
+
+static uint64 cache_sec; // the current time for cache tests
+
+static fftime cache_time(void)
+{
+	fftime t = {};
+	t.sec = cache_sec;
+	return t;
+}
+
+/** Resolve the name and process events until all queries (including background ones) are completed.
+Return DNS response status. */
+static int cache_resolve(fffd kq, ffdnsclient *r, const char *name)
+{
+	ffstr s;
+	ffstr_setz(&s, name);
+	int status = 0x7fff;
+	x(0 == ffdnscl_resolve(r, s, &hedge_onresolve, &status, 0));
+
+	ffkqu_time tm;
+	ffkqu_settm(&tm, 10);
+	for (uint i = 0;  (status == 0x7fff || r->queries.len != 0) && i != 500;  i++) {
+		dsrv_process();
+		ffkqu_entry ev;
+		int n = ffkqu_wait(kq, &ev, 1, &tm);
+		if (n == 1)
+			ffkev_call(&ev);
+	}
+	x(status != 0x7fff && r->queries.len == 0);
+	return status;
+}
+
+static void test_dns_client_cache(fffd kq)
+{
+	ffdnscl_conf conf;
+	ffdnscl_conf_init(&conf);
+	conf.kq = kq;
+	conf.log = &dnslog;
+	conf.time = &cache_time;
+	conf.timer = &dnstimer;
+	conf.retry_timeout = 20;
+	conf.enable_ipv6 = 0;
+	conf.edns = 0;
+	conf.debug_log = 1;
+	conf.cache.max_items = 2;
+	conf.cache.min_ttl = 10;
+	conf.cache.max_ttl = 100;
+	conf.cache.neg_ttl = 30;
+	conf.cache.prefetch = 50;
+	conf.cache.stale_ttl = 20;
+	ffdnsclient *r = ffdnscl_new(&conf);
+
+	ffstr s;
+	ffstr_setz(&s, "127.0.0.1:64021");
+	x(0 == ffdnscl_serv_add(r, &s));
+
+	struct ffdnscl_cachestat st;
+	dsrv.mute = 0;
+	dsrv.nreq = 0;
+	cache_sec = 1000;
+
+	// TTL 5 is raised to min_ttl;  lookup is case-insensitive
+	dsrv.ttl = 5;
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "a.test"));
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "A.Test"));
+	xieq(1, dsrv.nreq);
+	ffdnscl_cachestat(r, &st);
+	x(st.items == 1 && st.hits == 1 && st.misses == 1);
+
+	// 50% of TTL has passed:  the answer is served from cache and refreshed in background
+	cache_sec += 5;
+	dsrv.ttl = 1000;
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "a.test"));
+	xieq(2, dsrv.nreq);
+	ffdnscl_cachestat(r, &st);
+	x(st.hits == 2 && st.prefetches == 1);
+
+	r->cache.prefetch = 0;
+	// TTL 1000 is lowered to max_ttl:  the refreshed item expires in 100 sec
+	cache_sec += 99;
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "a.test"));
+	xieq(2, dsrv.nreq);
+	cache_sec += 1;
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "a.test"));
+	xieq(3, dsrv.nreq);
+	ffdnscl_cachestat(r, &st);
+	x(st.hits == 3 && st.misses == 2 && st.prefetches == 1);
+
+	// the item has expired and the server doesn't respond:  the stale answer is served
+	cache_sec += 100 + 10;
+	dsrv.mute = 1;
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "a.test"));
+	ffdnscl_cachestat(r, &st);
+	x(st.stale == 1 && st.items == 1);
+
+	// stale_ttl has passed:  the item is deleted
+	cache_sec += 10;
+	xieq(-1, cache_resolve(kq, r, "a.test"));
+	ffdnscl_cachestat(r, &st);
+	x(st.stale == 1 && st.items == 0);
+	dsrv.mute = 0;
+
+	// NXDOMAIN and NODATA answers are cached for neg_ttl;  they are neither prefetched nor served stale
+	dsrv.rcode = FFDNS_NXDOMAIN;
+	xieq(FFDNS_NXDOMAIN, cache_resolve(kq, r, "nx.test"));
+	dsrv.rcode = FFDNS_NOERROR;
+	dsrv.nodata = 1;
+	x(FFDNS_NOERROR != cache_resolve(kq, r, "nodata.test"));
+	dsrv.nodata = 0;
+	uint nreq = dsrv.nreq;
+	cache_sec += 29;
+	xieq(FFDNS_NXDOMAIN, cache_resolve(kq, r, "nx.test"));
+	x(FFDNS_NOERROR != cache_resolve(kq, r, "nodata.test"));
+	xieq(nreq, dsrv.nreq);
+	ffdnscl_cachestat(r, &st);
+	x(st.items == 2 && st.neg_hits == 2 && st.hits == 3);
+
+	cache_sec += 1;
+	dsrv.mute = 1;
+	x(FFDNS_NOERROR != cache_resolve(kq, r, "nodata.test"));
+	xieq(nreq + 1, dsrv.nreq);
+	ffdnscl_cachestat(r, &st);
+	x(st.stale == 1 && st.items == 1);
+	dsrv.mute = 0;
+
+	// the cache is full:  the least recently used item is evicted
+	dsrv.ttl = 60;
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "b.test"));
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "c.test"));
+	ffdnscl_cachestat(r, &st);
+	x(st.items == 2 && st.evictions == 1);
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "b.test"));
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "d.test"));
+	nreq = dsrv.nreq;
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "b.test"));
+	xieq(nreq, dsrv.nreq);
+	xieq(FFDNS_NOERROR, cache_resolve(kq, r, "c.test"));
+	xieq(nreq + 1, dsrv.nreq);
+	ffdnscl_cachestat(r, &st);
+	x(st.items == 2 && st.evictions == 3);
+
+	ffdnscl_free(r);
+}
@@ -0,0 +1,562 @@
+/**
+Copyright (c) 2019 Simon Zolin
+*/
+
+#include <FF/net/http-client.h>
+#include <FF/net/url.h>
+#include <FF/array.h>
+#include <FFOS/socket.h>
+#include <FFOS/test.h>
+
+
+/* Loopback HTTP server.
+It's polled by the test loop.  The response body is the request path. */
+
+enum {
+	SRV_PORT = 64010,
+	SRV_PORT2 = 64011,
+	SRV_MAXCONN = 16,
+	SRV_MAXREQ = 32,
+};
+
+struct sconn {
+	ffskt sk;
+	uint lsn; // index of the listening socket
+	ffarr in;
+	size_t off; // offset of the next request in 'in'
+};
+
+struct sreq {
+	uint conn; // index of the connection
+	ffstr path;
+	ffstr body; // raw request body
+	uint answered :1;
+};
+
+static struct {
+	ffskt lsn[2];
+	struct sconn conns[SRV_MAXCONN];
+	uint nconns;
+	struct sreq reqs[SRV_MAXREQ];
+	uint nreqs;
+	uint hold; // wait for N requests on one connection, then respond to all of them at once
+	uint fail; // with 'hold': respond only to the first request, then close the connection
+} srv;
+
+static void srv_init(void)
+{
+	ffaddr a;
+	ffmem_tzero(&srv);
+	for (uint i = 0;  i != 2;  i++) {
+		ffaddr_init(&a);
+		x(0 == ffaddr_set(&a, FFSTR("127.0.0.1"), NULL, 0));
+		ffip_setport(&a, (i == 0) ? SRV_PORT : SRV_PORT2);
+		srv.lsn[i] = ffskt_create(AF_INET, SOCK_STREAM, 0);
+		x(srv.lsn[i] != FF_BADSKT);
+		ffskt_setopt(srv.lsn[i], SOL_SOCKET, SO_REUSEADDR, 1);
+		x(0 == ffskt_bind(srv.lsn[i], &a.a, a.len));
+		x(0 == ffskt_listen(srv.lsn[i], SOMAXCONN));
+		x(0 == ffskt_nblock(srv.lsn[i], 1));
+	}
+}
+
+static void srv_close(uint i)
+{
+	FF_SAFECLOSE(srv.conns[i].sk, FF_BADSKT, ffskt_close);
+}
+
+static void srv_free(void)
+{
+	for (uint i = 0;  i != 2;  i++) {
+		ffskt_close(srv.lsn[i]);
+	}
+	for (uint i = 0;  i != srv.nconns;  i++) {
+		srv_close(i);
+		ffarr_free(&srv.conns[i].in);
+	}
+	for (uint i = 0;  i != srv.nreqs;  i++) {
+		ffstr_free(&srv.reqs[i].path);
+		ffstr_free(&srv.reqs[i].body);
+	}
+}
+
+/** Find the request by its path. */
+static struct sreq* srv_find(const char *path)
+{
+	for (uint i = 0;  i != srv.nreqs;  i++) {
+		if (ffstr_eqz(&srv.reqs[i].path, path))
+			return &srv.reqs[i];
+	}
+	return NULL;
+}
+
+/** Get the next complete request received on the connection.
+Return 0 if more data is needed. */
+static int srv_reqnext(uint i)
+{
+	struct sconn *sc = &srv.conns[i];
+	ffstr in, h, body;
+	char *p;
+	uint64 n;
+
+	ffstr_set(&in, sc->in.ptr + sc->off, sc->in.len - sc->off);
+	p = ffs_finds(in.ptr, in.len, FFSTR("\r\n\r\n"));
+	if (p == ffarr_end(&in))
+		return 0;
+	ffstr_set(&h, in.ptr, p + FFSLEN("\r\n\r\n") - in.ptr);
+	ffstr_set(&body, ffarr_end(&h), 0);
+
+	if (ffarr_end(&h) != (p = ffs_finds(h.ptr, h.len, FFSTR("Content-Length: ")))) {
+		p += FFSLEN("Content-Length: ");
+		x(0 != ffs_toint(p, ffarr_end(&h) - p, &n, FFS_INT64));
+		body.len = n;
+
+	} else if (ffarr_end(&h) != ffs_finds(h.ptr, h.len, FFSTR("Transfer-Encoding: chunked"))) {
+		// the body ends with the last chunk: CRLF "0" CRLF CRLF
+		p = ffs_finds(body.ptr - 2, ffarr_end(&in) - (body.ptr - 2), FFSTR("\r\n0\r\n\r\n"));
+		if (p == ffarr_end(&in))
+			return 0;
+		body.len = p + FFSLEN("\r\n0\r\n\r\n") - body.ptr;
+	}
+
+	if (h.len + body.len > in.len)
+		return 0;
+	sc->off += h.len + body.len;
+
+	x(srv.nreqs != SRV_MAXREQ);
+	struct sreq *rq = &srv.reqs[srv.nreqs++];
+	ffmem_tzero(rq);
+	rq->conn = i;
+	// "METHOD PATH HTTP/1.1"
+	const char *path = ffs_findc(h.ptr, h.len, ' ') + 1;
+	const char *path_end = ffs_findc(path, ffarr_end(&h) - path, ' ');
+	x(NULL != ffstr_dup(&rq->path, path, path_end - path));
+	x(NULL != ffstr_dup(&rq->body, body.ptr, body.len));
+	return 1;
+}
+
+/** Send responses to the requests received on the connection. */
+static void srv_respond(uint i)
+{
+	uint n = 0, max = (uint)-1;
+	for (uint k = 0;  k != srv.nreqs;  k++) {
+		if (srv.reqs[k].conn == i && !srv.reqs[k].answered)
+			n++;
+	}
+	if (srv.hold != 0) {
+		if (n < srv.hold)
+			return;
+		if (srv.fail)
+			max = 1;
+	}
+
+	ffarr out = {};
+	for (uint k = 0;  k != srv.nreqs && max != 0;  k++) {
+		struct sreq *rq = &srv.reqs[k];
+		if (rq->conn != i || rq->answered)
+			continue;
+		rq->answered = 1;
+		max--;
+		ffstr_catfmt(&out, "HTTP/1.1 200 OK\r\nContent-Length: %L\r\n\r\n%S"
+			, rq->path.len, &rq->path);
+	}
+	if (out.len != 0)
+		x(out.len == (size_t)ffskt_send(srv.conns[i].sk, out.ptr, out.len, 0));
+	ffarr_free(&out);
+
+	if (srv.hold != 0) {
+		if (srv.fail)
+			srv_close(i);
+		srv.hold = 0;
+		srv.fail = 0;
+	}
+}
+
+static void srv_process(void)
+{
+	ffskt sk;
+	for (uint l = 0;  l != 2;  l++) {
+		while (FF_BADSKT != (sk = ffskt_accept(srv.lsn[l], NULL, NULL, 0))) {
+			x(srv.nconns != SRV_MAXCONN);
+			x(0 == ffskt_nblock(sk, 1));
+			struct sconn *sc = &srv.conns[srv.nconns++];
+			ffmem_tzero(sc);
+			sc->sk = sk;
+			sc->lsn = l;
+			x(NULL != ffarr_alloc(&sc->in, 64 * 1024));
+		}
+	}
+
+	for (uint i = 0;  i != srv.nconns;  i++) {
+		struct sconn *sc = &srv.conns[i];
+		if (sc->sk == FF_BADSKT)
+			continue;
+
+		ssize_t r;
+		while (0 < (r = ffskt_recv(sc->sk, ffarr_end(&sc->in), ffarr_unused(&sc->in), 0))) {
+			sc->in.len += r;
+		}
+
+		while (srv_reqnext(i)) {
+		}
+		srv_respond(i);
+
+		if (r == 0)
+			srv_close(i); // the client has closed connection
+	}
+}
+
+
+/* Client */
+
+struct req {
+	void *c;
+	uint id;
+	int status; // the last status passed to the handler
+	uint sent; // the request is sent
+	ffarr body; // response body
+	const char *const *parts; // request body parts
+	uint ipart;
+};
+
+static fftimer_queue tq;
+static struct ffhttpcl_conf gconf;
+static uint gdone; // N of completed requests
+static uint gorder[SRV_MAXREQ]; // request IDs in the order of completion
+
+static void cl_handler(void *param)
+{
+	struct req *r = param;
+	ffhttp_response *resp;
+	ffstr data;
+	r->status = ffhttpcl_recv(r->c, &resp, &data);
+	if (r->status <= FFHTTPCL_DONE) {
+		gorder[gdone++] = r->id;
+		return;
+	}
+
+	switch (r->status) {
+	case FFHTTPCL_REQ_BODY: {
+		// the last part is empty
+		ffstr d = {};
+		const char *part = r->parts[r->ipart];
+		if (part != NULL) {
+			ffstr_setz(&d, part);
+			r->ipart++;
+		}
+		ffhttpcl_send(r->c, &d);
+		return;
+	}
+
+	case FFHTTPCL_RESP_WAIT:
+		r->sent = 1;
+		break;
+
+	case FFHTTPCL_RESP:
+		xieq(200, resp->code);
+		break;
+
+	case FFHTTPCL_RESP_RECV:
+		ffarr_append(&r->body, data.ptr, data.len);
+		break;
+	}
+
+	ffhttpcl_send(r->c, NULL);
+}
+
+/** Print errors and warnings only. */
+static void cl_log(void *udata, uint level, const char *fmt, ...)
+{
+	if ((level & ~FFHTTPCL_LOG_SYS) > FFHTTPCL_LOG_WARN)
+		return;
+
+	ffarr a = {};
+	va_list args;
+	va_start(args, fmt);
+	ffstr_catfmtv(&a, fmt, args);
+	va_end(args);
+	fffile_write(ffstdout, a.ptr, a.len);
+	fffile_write(ffstdout, "\r\n", 2);
+	ffarr_free(&a);
+}
+
+static void cl_timer(fftmrq_entry *tmr, uint value_ms)
+{
+	if (value_ms == 0) {
+		if (fftmrq_active(&tq, tmr))
+			fftmrq_rm(&tq, tmr);
+		return;
+	}
+	fftmrq_add(&tq, tmr, -(int)value_ms);
+}
+
+/** Create request object with the test configuration. */
+static void cl_new(struct req *r, uint id, const char *method, const char *url)
+{
+	ffmem_tzero(r);
+	r->id = id;
+	r->c = ffhttpcl_request(method, url, 0);
+	x(r->c != NULL);
+
+	struct ffhttpcl_conf conf;
+	ffhttpcl_conf(r->c, &conf, FFHTTPCL_CONF_GET);
+	conf.kq = gconf.kq;
+	conf.log = gconf.log;
+	conf.timer = gconf.timer;
+	conf.proxy = gconf.proxy;
+	conf.pool.conns = gconf.pool.conns;
+	conf.pool.idle_timeout = gconf.pool.idle_timeout;
+	conf.pool.pipeline = gconf.pool.pipeline;
+	conf.debug_log = 1;
+	ffhttpcl_conf(r->c, &conf, FFHTTPCL_CONF_SET);
+	ffhttpcl_sethandler(r->c, &cl_handler, r);
+}
+
+/** Execute GET request. */
+static void cl_get(struct req *r, uint id, const char *url)
+{
+	cl_new(r, id, "GET", url);
+	ffhttpcl_send(r->c, NULL);
+}
+
+static void cl_free(struct req *r)
+{
+	ffhttpcl_close(r->c);
+	ffarr_free(&r->body);
+}
+
+/** Process client and server events until '*val' reaches 'n'. */
+static void loop(uint *val, uint n)
+{
+	ffkqu_time tm;
+	ffkqu_settm(&tm, 10);
+	for (uint i = 0;  *val < n;  i++) {
+		if (i == 500) {
+			x(0); // timeout
+			break;
+		}
+		srv_process();
+		ffkqu_entry ev;
+		if (1 == ffkqu_wait(gconf.kq, &ev, 1, &tm))
+			ffkev_call(&ev);
+	}
+}
+
+/** Execute GET request and wait until it's complete. */
+static void cl_get_wait(struct req *r, const char *url)
+{
+	gdone = 0;
+	cl_get(r, 0, url);
+	loop(&gdone, 1);
+	xieq(FFHTTPCL_DONE, r->status);
+}
+
+
+static void test_http_client_pool(void)
+{
+	struct req r;
+	struct sreq *rq;
+	struct ffhttpcl_poolstat st, st0;
+	ffhttpcl_poolstat(gconf.pool.conns, &st0);
+	gconf.pool.idle_timeout = 5000;
+
+	// the connection is put into the pool after the response is received
+	cl_get_wait(&r, "http://127.0.0.1:64010/a");
+	x(ffstr_eqcz(&r.body, "/a"));
+	cl_free(&r);
+	ffhttpcl_poolstat(gconf.pool.conns, &st);
+	x(st.pooled == st0.pooled + 1);
+	xieq(1, st.idle);
+	xieq(1, srv.nconns);
+
+	// the pooled connection is reused
+	cl_get_wait(&r, "http://127.0.0.1:64010/b");
+	x(ffstr_eqcz(&r.body, "/b"));
+	cl_free(&r);
+	ffhttpcl_poolstat(gconf.pool.conns, &st);
+	x(st.reused == st0.reused + 1);
+	xieq(1, st.idle);
+	xieq(1, srv.nconns);
+	x(NULL != (rq = srv_find("/b")) && rq->conn == 0);
+
+	// the server has closed the pooled connection:  it's dropped and a new connection is established
+	srv_close(0);
+	cl_get_wait(&r, "http://127.0.0.1:64010/c");
+	x(ffstr_eqcz(&r.body, "/c"));
+	cl_free(&r);
+	ffhttpcl_poolstat(gconf.pool.conns, &st);
+	x(st.broken == st0.broken + 1);
+	x(st.reused == st0.reused + 1);
+	xieq(1, st.idle);
+	xieq(2, srv.nconns);
+	x(NULL != (rq = srv_find("/c")) && rq->conn == 1);
+
+	// the pool is keyed by host:port:  another port needs another connection
+	cl_get_wait(&r, "http://127.0.0.1:64011/d");
+	cl_free(&r);
+	xieq(3, srv.nconns);
+	x(srv.conns[2].lsn == 1);
+	x(NULL != (rq = srv_find("/d")) && rq->conn == 2);
+
+	// ... and by proxy:  the proxied request doesn't use the direct connection to the same server
+	gconf.proxy.host = "127.0.0.1";
+	gconf.proxy.port = SRV_PORT;
+	cl_get_wait(&r, "http://example.com/e");
+	x(ffstr_eqcz(&r.body, "http://example.com/e"));
+	cl_free(&r);
+	xieq(4, srv.nconns);
+	x(NULL != (rq = srv_find("http://example.com/e")) && rq->conn == 3);
+	ffhttpcl_poolstat(gconf.pool.conns, &st);
+	x(st.reused == st0.reused + 1);
+	xieq(3, st.idle);
+
+	// each request gets the connection with its own key
+	cl_get_wait(&r, "http://example.com/f");
+	cl_free(&r);
+	x(NULL != (rq = srv_find("http://example.com/f")) && rq->conn == 3);
+
+	gconf.proxy.host = NULL;
+	gconf.proxy.port = 0;
+	cl_get_wait(&r, "http://127.0.0.1:64010/g");
+	cl_free(&r);
+	x(NULL != (rq = srv_find("/g")) && rq->conn == 1);
+
+	cl_get_wait(&r, "http://127.0.0.1:64011/h");
+	cl_free(&r);
+	x(NULL != (rq = srv_find("/h")) && rq->conn == 2);
+
+	ffhttpcl_poolstat(gconf.pool.conns, &st);
+	x(st.reused == st0.reused + 4);
+	xieq(3, st.idle);
+	xieq(4, srv.nconns);
+
+	gconf.pool.idle_timeout = 0;
+}
+
+static void test_http_client_pipeline(void)
+{
+	struct req r[3];
+	struct sreq *rq;
+	struct ffhttpcl_poolstat st, st0;
+	char url[64], path[8];
+	ffhttpcl_poolstat(gconf.pool.conns, &st0);
+	gconf.pool.pipeline = 4;
+	uint nconns = srv.nconns;
+
+	// the requests are sent over one connection without waiting for the responses;
+	//  the responses are received all at once and passed to the requests in order
+	srv.hold = 3;
+	gdone = 0;
+	for (uint i = 0;  i != 3;  i++) {
+		ffs_fmt(url, url + sizeof(url), "http://127.0.0.1:64010/p%u%Z", i);
+		cl_get(&r[i], i, url);
+		if (i == 0)
+			loop(&r[0].sent, 1); // the connection is established and the first request is sent
+	}
+	loop(&gdone, 3);
+	for (uint i = 0;  i != 3;  i++) {
+		ffs_fmt(path, path + sizeof(path), "/p%u%Z", i);
+		xieq(i, gorder[i]);
+		xieq(FFHTTPCL_DONE, r[i].status);
+		x(ffstr_eqz(&r[i].body, path));
+		x(NULL != (rq = srv_find(path)) && rq->conn == nconns);
+		cl_free(&r[i]);
+	}
+	xieq(nconns + 1, srv.nconns);
+	ffhttpcl_poolstat(gconf.pool.conns, &st);
+	x(st.pipelined == st0.pipelined + 2);
+
+	// the server closes the connection after the first response:
+	//  the queued requests are restarted over new connections without pipelining
+	nconns = srv.nconns;
+	srv.hold = 3;
+	srv.fail = 1;
+	gdone = 0;
+	for (uint i = 0;  i != 3;  i++) {
+		ffs_fmt(url, url + sizeof(url), "http://127.0.0.1:64010/q%u%Z", i);
+		cl_get(&r[i], i, url);
+		if (i == 0)
+			loop(&r[0].sent, 1);
+	}
+	loop(&gdone, 3);
+	xieq(0, gorder[0]);
+	for (uint i = 0;  i != 3;  i++) {
+		ffs_fmt(path, path + sizeof(path), "/q%u%Z", i);
+		xieq(FFHTTPCL_DONE, r[i].status);
+		x(ffstr_eqz(&r[i].body, path));
+		cl_free(&r[i]);
+	}
+	x(NULL != (rq = srv_find("/q0")) && rq->conn == nconns);
+	xieq(nconns + 3, srv.nconns);
+	ffhttpcl_poolstat(gconf.pool.conns, &st);
+	x(st.pipelined == st0.pipelined + 4);
+
+	gconf.pool.pipeline = 0;
+}
+
+static void test_http_client_body(void)
+{
+	struct req r[2];
+	struct sreq *rq;
+	static const char *const chunked[] = { "part1", "part-two", NULL };
+	static const char *const contlen[] = { "abcd", "efghi", NULL };
+	ffstr name, val;
+	gdone = 0;
+
+	// HTTP headers and each part of the body are sent by one vectored write
+	cl_new(&r[0], 0, "POST", "http://127.0.0.1:64010/chunked");
+	ffstr_setz(&name, "Transfer-Encoding");
+	ffstr_setz(&val, "chunked");
+	ffhttpcl_header(r[0].c, &name, &val, 0);
+	r[0].parts = chunked;
+	ffhttpcl_send(r[0].c, NULL);
+
+	cl_new(&r[1], 1, "POST", "http://127.0.0.1:64010/contlen");
+	ffstr_setz(&name, "Content-Length");
+	ffstr_setz(&val, "9");
+	ffhttpcl_header(r[1].c, &name, &val, 0);
+	r[1].parts = contlen;
+	ffhttpcl_send(r[1].c, NULL);
+
+	loop(&gdone, 2);
+
+	xieq(FFHTTPCL_DONE, r[0].status);
+	x(ffstr_eqcz(&r[0].body, "/chunked"));
+	x(NULL != (rq = srv_find("/chunked")));
+	x(ffstr_eqcz(&rq->body, "5\r\npart1\r\n" "8\r\npart-two\r\n" "0\r\n\r\n"));
+
+	xieq(FFHTTPCL_DONE, r[1].status);
+	x(ffstr_eqcz(&r[1].body, "/contlen"));
+	x(NULL != (rq = srv_find("/contlen")));
+	x(ffstr_eqcz(&rq->body, "abcdefghi"));
+
+	cl_free(&r[0]);
+	cl_free(&r[1]);
+}
+
+void test_http_client(void)
+{
+	FFTEST_FUNC;
+
+	ffskt_init(FFSKT_WSA | FFSKT_WSAFUNCS);
+	srv_init();
+
+	fffd kq = ffkqu_create();
+	x(kq != FF_BADFD);
+	fftmrq_init(&tq);
+	fftmrq_start(&tq, kq, 100);
+	gconf.kq = kq;
+	gconf.log = &cl_log;
+	gconf.timer = &cl_timer;
+	x(NULL != (gconf.pool.conns = ffhttpcl_pool_create()));
+
+	test_http_client_pool();
+	test_http_client_pipeline();
+	test_http_client_body();
+
+	ffhttpcl_pool_free(gconf.pool.conns);
+	ffhttpcl_deinit();
+	ffkqu_close(kq);
+	fftmrq_destroy(&tq, kq);
+	srv_free();
+}
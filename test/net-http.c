@@ -3,6 +3,7 @@ Copyright (c) 2013 Simon Zolin
 */
 
 #include <FFOS/test.h>
+#include <FFOS/random.h>
 #include <FF/net/http.h>
 
 
@@ -322,6 +323,163 @@ static int test_hdrs()
 	return 0;
 }
 
+/** Generate random header lines with random damage. */
+static size_t hdrs_gen(char *buf)
+{
+	static const char name[] = "abcXYZ019_-";
+	static const char any[] = "aZ0_-: \r\n\x01\x80\xff@[`{";
+	size_t n = 0;
+	uint lines = ffrnd_get() % 6;
+	for (uint l = 0;  l != lines;  l++) {
+		uint k = 1 + ffrnd_get() % 40;
+		while (k-- != 0)
+			buf[n++] = name[ffrnd_get() % FFSLEN(name)];
+		buf[n++] = ':';
+		k = ffrnd_get() % 3;
+		while (k-- != 0)
+			buf[n++] = ' ';
+		k = ffrnd_get() % 60;
+		while (k-- != 0)
+			buf[n++] = (ffrnd_get() % 4 == 0) ? ' ' : name[ffrnd_get() % FFSLEN(name)];
+		if (ffrnd_get() % 2)
+			buf[n++] = '\r';
+		buf[n++] = '\n';
+	}
+	buf[n++] = '\r';
+	buf[n++] = '\n';
+
+	if (ffrnd_get() % 2)
+		buf[ffrnd_get() % n] = any[ffrnd_get() % FFSLEN(any)];
+	if (ffrnd_get() % 4 == 0)
+		n = ffrnd_get() % (n + 1);
+	return n;
+}
+
+/** Parsing the whole data at once (vectorized path)
+ must give the same results as parsing it byte by byte (scalar path). */
+static void test_hdrs_diff()
+{
+	char buf[6 * 128];
+	ffhttp_hdr a, b;
+
+	ffrnd_seed(1);
+	for (uint it = 0;  it != 100000;  it++) {
+		size_t n = hdrs_gen(buf);
+		ffhttp_inithdr(&a);
+		ffhttp_inithdr(&b);
+
+		for (;;) {
+			int ra = ffhttp_nexthdr(&a, buf, n);
+			int rb;
+			size_t k = b.len;
+			do {
+				k = ffmin(k + 1, n);
+				rb = ffhttp_nexthdr(&b, buf, k);
+			} while (rb == FFHTTP_MORE && k != n);
+
+			xieq(rb, ra);
+			x(a.len == b.len && a.idx == b.idx);
+			if (ra != FFHTTP_OK)
+				break;
+			x(a.key.off == b.key.off && a.key.len == b.key.len);
+			x(a.val.off == b.val.off && a.val.len == b.val.len);
+			x(a.crc == b.crc && a.ihdr == b.ihdr);
+		}
+	}
+}
+
+/** Headers larger than 64k. */
+static void test_hdrs_large()
+{
+	ffstr buf = {};
+	ffhttp_headers h;
+	ffstr val;
+	int r;
+
+	ffstr_alloc(&buf, 128*1024);
+	ffstr_add(&buf, -1, "Cookie: ", 8);
+	ffstr_addfill(&buf, -1, 'c', 100*1024);
+	ffstr_add(&buf, -1, "\r\nHost: host\r\n\r\n", 16);
+
+	ffhttp_init(&h);
+	while (FFHTTP_OK == (r = ffhttp_parsehdr(&h, buf.ptr, buf.len))) {
+	}
+	xieq(FFHTTP_ETOOLARGE, r);
+	ffhttp_fin(&h);
+
+	ffhttp_init(&h);
+	h.hdr.max_len = 1024*1024;
+	while (FFHTTP_OK == (r = ffhttp_parsehdr(&h, buf.ptr, buf.len))) {
+	}
+	xieq(FFHTTP_DONE, r);
+	x(h.len == buf.len);
+	x(0 != ffhttp_findihdr(&h, FFHTTP_COOKIE, &val));
+	x(val.len == 100*1024);
+	x(0 != ffhttp_findihdr(&h, FFHTTP_HOST, &val));
+	x(ffstr_eqcz(&val, "host"));
+	ffhttp_fin(&h);
+
+	// request line
+	ffhttp_request req;
+	buf.len = 0;
+	ffstr_add(&buf, -1, "GET /", 5);
+	ffstr_addfill(&buf, -1, 'a', 100*1024);
+	ffstr_add(&buf, -1, " HTTP/1.1\r\nHost: host\r\n\r\n", 27);
+
+	ffhttp_req_init(&req);
+	xieq(FFHTTP_ETOOLARGE, ffhttp_req_line(&req, buf.ptr, buf.len));
+	ffhttp_req_free(&req);
+
+	ffhttp_req_init(&req);
+	req.h.hdr.max_len = 1024*1024;
+	xieq(FFHTTP_OK, ffhttp_req_line(&req, buf.ptr, buf.len));
+	x(req.h.firstline_len == 5 + 100*1024 + FFSLEN(" HTTP/1.1\r\n"));
+	val = ffhttp_requrl(&req, FFURL_PATH);
+	x(val.len == 1 + 100*1024 && val.ptr == buf.ptr + 4);
+	xieq(FFHTTP_DONE, ffhttp_reqparsehdrs(&req, buf.ptr, buf.len));
+	x(0 != ffhttp_findihdr(&req.h, FFHTTP_HOST, &val));
+	x(ffstr_eqcz(&val, "host"));
+	ffhttp_req_free(&req);
+	ffstr_free(&buf);
+}
+
+/** Headers split between buffers at any position. */
+static void test_hdrstream()
+{
+	static const char data[] = "Host: host\r\nAge: 1\r\nX-Hdr: value\r\n\r\nbody";
+	ffhttp_hdrstream s;
+	ffstr in[2];
+	char res[64];
+	int r;
+
+	for (uint split = 0;  split <= FFSLEN(data) - FFSLEN("body");  split++) {
+		ffstr_set(&in[0], data, split);
+		ffstr_set(&in[1], data + split, FFSLEN(data) - split);
+		ffhttp_hdrstream_init(&s);
+		char *p = res;
+		uint i = 0;
+
+		for (;;) {
+			r = ffhttp_hdrstream_next(&s, &in[i]);
+			if (r == FFHTTP_MORE) {
+				x(in[i].len == 0);
+				i++;
+				x(i != 2);
+				continue;
+			} else if (r == FFHTTP_DONE) {
+				break;
+			}
+			xieq(FFHTTP_OK, r);
+			p += ffs_fmt(p, res + sizeof(res), "%S=%S;", &s.key, &s.val);
+		}
+
+		x(ffs_eqcz(res, p - res, "Host=host;Age=1;X-Hdr=value;"));
+		x(s.total == FFSLEN(data) - FFSLEN("body"));
+		x(ffstr_eqcz(&in[1], "body"));
+		ffhttp_hdrstream_free(&s);
+	}
+}
+
 static int test_findhdr()
 {
 	char buf[4096];
@@ -337,6 +495,7 @@ static int test_findhdr()
 		pbuf += ffs_fmt(pbuf, end, "%S: %u\r\n"
 			, &ffhttp_shdr[i], i);
 	}
+	pbuf = ffs_copyz(pbuf, end, "X-Custom: custom\r\n");
 	pbuf = ffs_copyz(pbuf, end, "\r\n");
 
 	ffhttp_init(&h);
@@ -351,11 +510,25 @@ static int test_findhdr()
 		x(0 != ffhttp_findhdr(&h, ffhttp_shdr[i].ptr, ffhttp_shdr[i].len, &val));
 		x(ffstr_to_uint32(&val, &n));
 		x(i == n);
+
+		x(0 != ffhttp_findihdr(&h, i, &val));
+		x(ffstr_to_uint32(&val, &n));
+		x(i == n);
 	}
 
+	x(0 != ffhttp_findhdr(&h, FFSTR("x-CUSTOM"), &val));
+	x(ffstr_eqcz(&val, "custom"));
+	x(0 == ffhttp_findhdr(&h, FFSTR("X-Custo"), NULL));
+	x(h.hidx.ptr != NULL); // more than FFHTTP_HIDX_INLINE headers
+
 	for (i = 1;  ihdr = ffhttp_gethdr(&h, (int)i - 1, &key, &val), ihdr != FFHTTP_DONE;  i++) {
 		int n = 0;
 
+		if (i == FFHTTP_HLAST) {
+			x(ihdr == FFHTTP_HUKN);
+			x(ffstr_eqcz(&key, "X-Custom"));
+			continue;
+		}
 		x(ihdr == i);
 		x(ffstr_eq2(&key, &ffhttp_shdr[i]));
 
@@ -489,6 +662,9 @@ int test_http()
 	test_req();
 	test_resp();
 	test_hdrs();
+	test_hdrs_diff();
+	test_hdrs_large();
+	test_hdrstream();
 	test_findhdr();
 	test_cook();
 	test_chunked();
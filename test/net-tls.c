@@ -71,6 +71,12 @@ static const char tls13_serverhello[] =
 "\xc8\xe9\xed\x72\xf8\x64\x76\x3c\x65\x00\x2b\x00\x02\x7f\x17";
 
 static void test_tls_long_rec();
+static void test_tls_fragmented();
+static void test_tls_many_exts();
+static void test_tls_sni();
+
+static const char tls13_clienthello_ja3[] = "771,4865-4867-4866-49195-49199-52393-52392-49196-49200-49171-49172-47-53"
+	",0-23-65281-10-11-35-16-5-51-43-13-45-21,29-23-24-25-256-257,0";
 
 int test_tls(void)
 {
@@ -107,6 +113,11 @@ int test_tls(void)
 	x(FFTLS_RDONE == fftls_read(&tls));
 	x(fftls_ver(&tls) == 0x7f17);
 
+	char ja3[512];
+	size_t n = fftls_ja3(&tls, ja3, sizeof(ja3));
+	x(ffs_eqcz(ja3, n, tls13_clienthello_ja3));
+	x(0 == fftls_ja3(&tls, ja3, 10));
+
 	ffmem_tzero(&tls);
 	fftls_input(&tls, tls13_serverhello, FFSLEN(tls13_serverhello));
 	x(FFTLS_RSERVER_HELLO == fftls_read(&tls));
@@ -117,9 +128,121 @@ int test_tls(void)
 	x(fftls_ver(&tls) == 0x7f17);
 
 	test_tls_long_rec();
+	test_tls_fragmented();
+	test_tls_many_exts();
+	test_tls_sni();
 	return 0;
 }
 
+/* Client Hello split into 2 records */
+static void test_tls_fragmented()
+{
+	fftls tls;
+	char buf[FFSLEN(tls13_clienthello) + 5];
+	uint n1 = 100, n2 = FFSLEN(tls13_clienthello) - 5 - n1;
+	memcpy(buf, tls13_clienthello, 3);
+	ffint_hton16(buf + 3, n1);
+	memcpy(buf + 5, tls13_clienthello + 5, n1);
+	memcpy(buf + 5 + n1, tls13_clienthello, 3);
+	ffint_hton16(buf + 5 + n1 + 3, n2);
+	memcpy(buf + 5 + n1 + 5, tls13_clienthello + 5 + n1, n2);
+
+	ffmem_tzero(&tls);
+	fftls_input(&tls, buf, 5 + n1 + 5 + 10);
+	x(FFTLS_RMORE == fftls_read(&tls));
+	fftls_input(&tls, buf, sizeof(buf));
+	x(FFTLS_RCLIENT_HELLO == fftls_read(&tls));
+	x(ffstr_eq(&tls.ciphers, tls13_clienthello_ciphers, FFSLEN(tls13_clienthello_ciphers)));
+	x(FFTLS_RCLIENT_HELLO_SNI == fftls_read(&tls));
+	x(ffstr_eqz(&tls.hostname, "www.google.com"));
+	x(FFTLS_RHELLO_ALPN == fftls_read(&tls));
+	x(FFTLS_RDONE == fftls_read(&tls));
+	x(tls.in.len == 0);
+
+	char ja3[512];
+	size_t n = fftls_ja3(&tls, ja3, sizeof(ja3));
+	x(ffs_eqcz(ja3, n, tls13_clienthello_ja3));
+}
+
+/* Client Hello with 100 empty extensions */
+static void test_tls_many_exts()
+{
+	char buf[1024], ja3[1024], *p = buf + 5 + 4;
+	ffarr exp = {};
+	ffstr_catfmt(&exp, "771,4865,");
+
+	ffmemcpy(p, "\x03\x03", 2); // version
+	ffmem_zero(p + 2, 32 + 1); // random, session ID
+	ffmemcpy(p + 2 + 32 + 1, "\x00\x02\x13\x01" "\x01\x00", 6); // ciphers, compression methods
+	p += 2 + 32 + 1 + 6;
+	ffint_hton16(p, 100 * 4);
+	p += 2;
+	for (uint i = 0;  i != 100;  i++) {
+		ffint_hton16(p, 0x1000 + i);
+		ffint_hton16(p + 2, 0);
+		p += 4;
+		ffstr_catfmt(&exp, (i != 99) ? "%u-" : "%u,,", 0x1000 + i);
+	}
+
+	uint n = p - (buf + 5 + 4);
+	ffmemcpy(buf, "\x16\x03\x01", 3);
+	ffint_hton16(buf + 3, 4 + n);
+	buf[5] = 1; // Client Hello
+	buf[6] = 0;
+	ffint_hton16(buf + 7, n);
+
+	fftls tls;
+	ffmem_tzero(&tls);
+	fftls_input(&tls, buf, p - buf);
+	x(FFTLS_RCLIENT_HELLO == fftls_read(&tls));
+	x(FFTLS_RDONE == fftls_read(&tls));
+
+	size_t r = fftls_ja3(&tls, ja3, sizeof(ja3));
+	x(ffstr_eq(&exp, ja3, r));
+	x(0 == fftls_ja3(&tls, ja3, exp.len - 1));
+	ffarr_free(&exp);
+}
+
+static void test_tls_sni()
+{
+	fftls_sni sni;
+	ffstr s;
+	fftls_sni_init(&sni);
+	x(-1 == fftls_sni_find(&sni, FFSTR("www.example.com")));
+
+	ffstr_setz(&s, "www.example.com");
+	x(0 == fftls_sni_add(&sni, &s, 1));
+	ffstr_setz(&s, "*.example.com");
+	x(0 == fftls_sni_add(&sni, &s, 2));
+	ffstr_setz(&s, "*.API.example.com.");
+	x(0 == fftls_sni_add(&sni, &s, 3));
+	ffstr_setz(&s, "example.org");
+	x(0 == fftls_sni_add(&sni, &s, 4));
+	ffstr_setz(&s, "a.*.org");
+	x(0 != fftls_sni_add(&sni, &s, 5));
+	x(0 == fftls_sni_compile(&sni));
+
+	x(1 == fftls_sni_find(&sni, FFSTR("www.example.com")));
+	x(1 == fftls_sni_find(&sni, FFSTR("WWW.Example.COM.")));
+	x(2 == fftls_sni_find(&sni, FFSTR("a.example.com")));
+	x(2 == fftls_sni_find(&sni, FFSTR("a.b.example.com")));
+	x(3 == fftls_sni_find(&sni, FFSTR("v1.api.example.com")));
+	x(2 == fftls_sni_find(&sni, FFSTR("api.example.com")));
+	x(-1 == fftls_sni_find(&sni, FFSTR("example.com")));
+	x(4 == fftls_sni_find(&sni, FFSTR("example.org")));
+	x(-1 == fftls_sni_find(&sni, FFSTR("www.example.org")));
+
+	ffstr_setz(&s, "*");
+	x(0 == fftls_sni_add(&sni, &s, 9));
+	x(9 == fftls_sni_find(&sni, FFSTR("www.example.org")));
+
+	ffstr_setz(&s, "EXAMPLE.org");
+	x(0 == fftls_sni_add(&sni, &s, 5));
+	x(0 != fftls_sni_compile(&sni));
+
+	fftls_sni_free(&sni);
+}
+
 // Server Hello + Certificate + Server Key Exchange + Server Hello Done
 static const char tls_long_rec[] =
 "\x16\x03\x03\x0c\xf6\x02\x00\x00\x51\x03\x03\x5b\xfb\xc5\xb6\x39" \
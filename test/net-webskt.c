@@ -36,6 +36,44 @@ static void test_webskt_reader()
 	x(FFWEBSKT_RMORE == ffwebskt_parse(&w));
 }
 
+/* Masked body is unmasked in the caller's buffer;  chunk boundaries aren't aligned to the mask key */
+static void test_webskt_reader_inplace()
+{
+	ffwebskt w = {};
+	char data[sizeof(ws_data)];
+	memcpy(data, ws_data, sizeof(ws_data));
+	w.inplace = 1;
+
+	ffwebskt_input(&w, data, 6 + 3);
+	x(FFWEBSKT_RMSG == ffwebskt_parse(&w));
+	x(ffwebskt_datalen(&w) == 6);
+	x(FFWEBSKT_RDATA == ffwebskt_parse(&w));
+	x(w.out.ptr == data + 6
+		&& w.out.len == 3 && !memcmp(w.out.ptr, "myd", 3));
+	x(FFWEBSKT_RMORE == ffwebskt_parse(&w));
+
+	ffwebskt_input(&w, data + 6 + 3, 3);
+	x(FFWEBSKT_RDATA == ffwebskt_parse(&w));
+	x(w.out.ptr == data + 9
+		&& w.out.len == 3 && !memcmp(w.out.ptr, "ata", 3));
+	x(FFWEBSKT_RDATA_FIN == ffwebskt_parse(&w));
+
+	// wide XOR with a rotated key gives the same result as byte-by-byte XOR
+	byte src[100], d1[100], d2[100];
+	const byte key[] = "\x01\x02\x04\x08";
+	uint k;
+	memcpy(&k, key, 4);
+	for (uint i = 0;  i != sizeof(src);  i++) {
+		src[i] = i;
+	}
+	ffmem_xor(d1, src, sizeof(src), key, 4);
+	uint off = ffmem_xor4_off(d2, src, 7, k, 0);
+	x(off == 3);
+	off = ffmem_xor4_off(d2 + 7, src + 7, sizeof(src) - 7, k, off);
+	x(off == 0);
+	x(!memcmp(d1, d2, sizeof(src)));
+}
+
 static void test_webskt_writer()
 {
 	ffwebskt_cook w = {};
@@ -59,9 +97,89 @@ static void test_webskt_writer()
 	x(FFWEBSKT_RDATA_FIN == ffwebskt_writenext(&w));
 }
 
+static void test_webskt_writer_vec()
+{
+	ffwebskt_cook w = {};
+	ffiovec iov[2];
+	char data[6];
+	uint mask;
+	memcpy(data, "mydata", 6);
+	memcpy(&mask, ws_data + 2, 4);
+
+	ffwebskt_input(&w, data, 6);
+	x(2 == ffwebskt_cookv(&w, mask, FFWEBSKT_OP_TEXT, iov));
+	x(iov[0].iov_len == 6
+		&& !memcmp(iov[0].iov_base, ws_data, 6));
+	x(iov[1].iov_base == data
+		&& iov[1].iov_len == 6 && !memcmp(data, ws_data + 6, 6));
+
+	ffwebskt_input(&w, NULL, 0);
+	x(1 == ffwebskt_cookv(&w, 0, FFWEBSKT_OP_PING, iov));
+	x(iov[0].iov_len == 2);
+}
+
+static void test_webskt_deflate_neg()
+{
+	ffwebskt_deflate_conf c = {};
+	ffstr s;
+	char buf[256];
+	size_t n;
+
+	// server: the first acceptable offer is chosen
+	ffstr_setz(&s, "x-foo, permessage-deflate; server_max_window_bits=8, permessage-deflate; client_max_window_bits; server_no_context_takeover");
+	c.client_max_window_bits = 12;
+	x(0 == ffwebskt_deflate_accept(&c, &s));
+	x(c.server_max_window_bits == 0);
+	x(c.client_max_window_bits == 12);
+	x(c.server_no_context_takeover && !c.client_no_context_takeover);
+	n = ffwebskt_deflate_hdr(&c, buf, sizeof(buf));
+	x(ffs_eqcz(buf, n, "permessage-deflate; server_no_context_takeover; client_max_window_bits=12"));
+
+	ffmem_tzero(&c);
+	ffstr_setz(&s, "permessage-deflate; foo=1, x-bar");
+	x(1 == ffwebskt_deflate_accept(&c, &s));
+
+	// server: 256-byte window isn't supported for our side
+	ffmem_tzero(&c);
+	ffstr_setz(&s, "permessage-deflate; server_max_window_bits=8");
+	x(1 == ffwebskt_deflate_accept(&c, &s));
+	c.server_max_window_bits = 8;
+	ffstr_setz(&s, "permessage-deflate");
+	x(0 == ffwebskt_deflate_accept(&c, &s));
+	x(c.server_max_window_bits == 9);
+
+	// client: check response
+	ffmem_tzero(&c);
+	c.client_max_window_bits = 15;
+	ffstr_setz(&s, "permessage-deflate; server_max_window_bits=10; client_max_window_bits=9");
+	x(0 == ffwebskt_deflate_check(&c, &s));
+	x(c.server_max_window_bits == 10 && c.client_max_window_bits == 9);
+
+	ffmem_tzero(&c);
+	x(-1 == ffwebskt_deflate_check(&c, &s)); //client_max_window_bits wasn't offered
+	c.client_max_window_bits = 15;
+	ffstr_setz(&s, "permessage-deflate; client_max_window_bits=8");
+	x(-1 == ffwebskt_deflate_check(&c, &s));
+	ffstr_setz(&s, "x-bar");
+	x(1 == ffwebskt_deflate_check(&c, &s));
+
+	// RSV1 bit is allowed only after negotiation
+	ffwebskt w = {};
+	ffwebskt_input(&w, "\xc1\x01\x00", 3);
+	x(FFWEBSKT_RERR == ffwebskt_parse(&w));
+	ffmem_tzero(&w);
+	w.deflate = 1;
+	ffwebskt_input(&w, "\xc1\x01\x00", 3);
+	x(FFWEBSKT_RMSG == ffwebskt_parse(&w));
+	x(ffwebskt_compressed(&w));
+}
+
 int test_webskt()
 {
 	test_webskt_reader();
+	test_webskt_reader_inplace();
 	test_webskt_writer();
+	test_webskt_writer_vec();
+	test_webskt_deflate_neg();
 	return 0;
 }
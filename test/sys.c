@@ -9,6 +9,8 @@ Copyright (c) 2017 Simon Zolin
 #include <FF/sys/dir.h>
 #include <FF/sys/fileread.h>
 #include <FF/sys/filewrite.h>
+#include <FF/sys/uring.h>
+#include <FF/sys/thpool.h>
 #include <FF/net/url.h>
 #include <FFOS/process.h>
 #include <FFOS/thread.h>
@@ -301,6 +303,325 @@ static void onread()
 	syncvar = 1;
 }
 
+static ffatomic tp_ntasks;
+
+static void tp_task(ffthpool_task *t)
+{
+	ffatom_inc(&tp_ntasks);
+}
+
+static void test_thpool_run(uint flags)
+{
+	enum { N = 1000 };
+	ffthpool *p;
+	ffthpoolconf conf = {};
+	conf.maxthreads = 4;
+	conf.maxqueue = 1024;
+	conf.flags = flags;
+	x(NULL != (p = ffthpool_create(&conf)));
+	ffatom_set(&tp_ntasks, 0);
+
+	ffthpool_task *tasks[N];
+	for (uint i = 0;  i != N;  i++) {
+		x(NULL != (tasks[i] = ffthpool_task_new(0)));
+		tasks[i]->handler = &tp_task;
+	}
+
+	x(N / 2 == ffthpool_add_batch(p, tasks, N / 2));
+	for (uint i = N / 2;  i != N;  i++) {
+		x(0 == ffthpool_add(p, tasks[i]));
+	}
+	for (uint i = 0;  i != N;  i++) {
+		ffthpool_task_free(tasks[i]);
+	}
+
+	while (ffatom_get(&tp_ntasks) != N) {
+		ffthd_sleep(10);
+	}
+
+	struct ffthpool_stat st;
+	ffthpool_stat(p, &st);
+	x(st.queued == 0);
+	x(st.wakeups != 0);
+	fffile_fmt(ffstdout, NULL, "thpool: steals:%L  wakeups:%L\n", st.steals, st.wakeups);
+
+	x(0 == ffthpool_free(p));
+}
+
+enum { TP_KEYS = 8, TP_KEYTASKS = 200 };
+static uint tp_keyseq[TP_KEYS];
+
+struct tp_keytask {
+	uint key, seq;
+};
+
+static void tp_keytask(ffthpool_task *t)
+{
+	struct tp_keytask *kt = (void*)t->ext;
+	// tasks with the same key are executed sequentially by one thread
+	x(tp_keyseq[kt->key] == kt->seq);
+	tp_keyseq[kt->key] = kt->seq + 1;
+	ffatom_inc(&tp_ntasks);
+}
+
+static void test_thpool_affinity()
+{
+	ffthpool *p;
+	ffthpoolconf conf = {};
+	conf.maxthreads = 4;
+	conf.maxqueue = 1024;
+	conf.flags = FFTHPOOL_WORKSTEAL;
+	x(NULL != (p = ffthpool_create(&conf)));
+	ffatom_set(&tp_ntasks, 0);
+	ffmem_zero(tp_keyseq, sizeof(tp_keyseq));
+
+	for (uint i = 0;  i != TP_KEYTASKS;  i++) {
+		for (uint k = 0;  k != TP_KEYS;  k++) {
+			ffthpool_task *t;
+			x(NULL != (t = ffthpool_task_new(sizeof(struct tp_keytask))));
+			t->handler = &tp_keytask;
+			t->affinity = k + 1;
+			struct tp_keytask *kt = (void*)t->ext;
+			kt->key = k;
+			kt->seq = i;
+			x(0 == ffthpool_add(p, t));
+			ffthpool_task_free(t);
+		}
+	}
+
+	while (ffatom_get(&tp_ntasks) != TP_KEYS * TP_KEYTASKS) {
+		ffthd_sleep(10);
+	}
+	for (uint k = 0;  k != TP_KEYS;  k++) {
+		x(tp_keyseq[k] == TP_KEYTASKS);
+	}
+	x(0 == ffthpool_free(p));
+}
+
+/** A batch of pinned and unpinned tasks is added completely while the queues have free space. */
+static void test_thpool_mixed()
+{
+	enum { N = 64 };
+	ffthpool *p;
+	ffthpoolconf conf = {};
+	conf.maxthreads = 4;
+	conf.maxqueue = 1024;
+	conf.flags = FFTHPOOL_WORKSTEAL;
+	x(NULL != (p = ffthpool_create(&conf)));
+	ffatom_set(&tp_ntasks, 0);
+
+	ffthpool_task *tasks[N];
+	for (uint i = 0;  i != N;  i++) {
+		x(NULL != (tasks[i] = ffthpool_task_new(0)));
+		tasks[i]->handler = &tp_task;
+		tasks[i]->affinity = (i % 2) ? i : 0;
+	}
+	x(N == ffthpool_add_batch(p, tasks, N));
+	for (uint i = 0;  i != N;  i++) {
+		ffthpool_task_free(tasks[i]);
+	}
+
+	while (ffatom_get(&tp_ntasks) != N) {
+		ffthd_sleep(10);
+	}
+	x(0 == ffthpool_free(p));
+}
+
+static uint tp_blocked;
+static char tp_order[4];
+
+static void tp_block(ffthpool_task *t)
+{
+	FF_WRITEONCE(tp_blocked, 1);
+	while (FF_READONCE(tp_blocked) == 1) {
+		ffthd_sleep(1);
+	}
+}
+
+static void tp_prio(ffthpool_task *t)
+{
+	tp_order[ffatom_get(&tp_ntasks)] = *(char*)t->udata;
+	ffatom_inc(&tp_ntasks);
+}
+
+/** Tasks with a higher priority are executed first. */
+static void test_thpool_prio(uint flags)
+{
+	ffthpool *p;
+	ffthpoolconf conf = {};
+	conf.maxthreads = 1;
+	conf.maxqueue = 4;
+	conf.flags = flags;
+	x(NULL != (p = ffthpool_create(&conf)));
+	ffatom_set(&tp_ntasks, 0);
+
+	// occupy the only thread
+	ffthpool_task *t = ffthpool_task_new(0);
+	t->handler = &tp_block;
+	tp_blocked = 0;
+	x(0 == ffthpool_add(p, t));
+	ffthpool_task_free(t);
+	while (FF_READONCE(tp_blocked) == 0) {
+		ffthd_sleep(1);
+	}
+
+	static const uint prio[] = { FFTHPOOL_PRIO_LOW, FFTHPOOL_PRIO_NORMAL, FFTHPOOL_PRIO_HIGH };
+	ffthpool_task *tasks[3];
+	for (uint i = 0;  i != 3;  i++) {
+		tasks[i] = ffthpool_task_new(0);
+		tasks[i]->handler = &tp_prio;
+		tasks[i]->udata = (void*)&"lnh"[i];
+		tasks[i]->prio = prio[i];
+	}
+	x(3 == ffthpool_add_batch(p, tasks, 3));
+	for (uint i = 0;  i != 3;  i++) {
+		ffthpool_task_free(tasks[i]);
+	}
+
+	FF_WRITEONCE(tp_blocked, 2);
+	while (ffatom_get(&tp_ntasks) != 3) {
+		ffthd_sleep(10);
+	}
+	x(!ffmemcmp(tp_order, "hnl", 3));
+	x(0 == ffthpool_free(p));
+}
+
+int test_thpool()
+{
+	FFTEST_FUNC;
+	test_thpool_run(0);
+	test_thpool_run(FFTHPOOL_WORKSTEAL);
+	test_thpool_affinity();
+	test_thpool_mixed();
+	test_thpool_prio(0);
+	test_thpool_prio(FFTHPOOL_WORKSTEAL);
+	return 0;
+}
+
+#ifdef FF_LINUX
+/** Read the whole file sequentially with read-ahead.
+Return the number of asynchronous requests. */
+static uint fileread_uring_all(fffileread *fr, ffuring *u, const ffarr *a, struct fffileread_stat *st)
+{
+	ffstr d;
+	uint64 off = 0;
+	uint nasync = 0;
+	for (;;) {
+		int r = fffileread_getdata(fr, &d, off, FFFILEREAD_FREADAHEAD);
+		if (r == FFFILEREAD_RASYNC) {
+			nasync++;
+			syncvar = 0;
+			while (syncvar == 0) {
+				x(0 <= ffuring_wait(u));
+			}
+			continue;
+		} else if (r == FFFILEREAD_REOF)
+			break;
+		x(r == FFFILEREAD_RREAD);
+		x(!ffmemcmp(d.ptr, a->ptr + off, d.len));
+		off += d.len;
+	}
+	x(off == a->len);
+
+	// wait for read-ahead requests past EOF
+	for (;;) {
+		fffileread_stat(fr, st);
+		if (st->nsubmit == st->ncomplete)
+			break;
+		x(0 <= ffuring_wait(u));
+	}
+	return nasync;
+}
+
+/** Sequential reading with read-ahead via io_uring and shared cache. */
+static void test_fileread_uring()
+{
+	char *fn = TESTDIR "/fftest-filerw";
+	ffuring *u;
+	ffuring_conf uconf;
+	ffuring_conf_init(&uconf);
+	if (NULL == (u = ffuring_create(&uconf))) {
+		x(fferr_last() == ENOSYS);
+		return;
+	}
+
+	ffcache *cache;
+	ffcache_conf cconf;
+	ffcache_conf_init(&cconf);
+	x(NULL != (cache = ffcache_create(&cconf)));
+
+	ffarr a = {};
+	ffarr_alloc(&a, 10*4096 + 9);
+	for (uint i = 0;  i != a.cap;  i++) {
+		a.ptr[i] = (char)(i * 13 + i / 4096);
+	}
+	a.len = a.cap;
+	x(0 == fffile_writeall(fn, a.ptr, a.len, 0));
+
+	fffileread *fr;
+	fffileread_conf conf;
+	fffileread_setconf(&conf);
+	conf.uring = u;
+	conf.cache = cache;
+	conf.log = &onlog;
+	conf.onread = &onread;
+	conf.bufsize = 4096;
+	conf.nbufs = 8;
+	conf.directio = 1;
+	x(NULL != (fr = fffileread_create(fn, &conf)));
+
+	// read-ahead blocks were submitted in batches;  the window has grown
+	struct fffileread_stat st;
+	x(fileread_uring_all(fr, u, &a, &st) < 11);
+	x(st.nread >= 11);
+	x(st.nra_hit != 0 && st.nra_hit <= st.nra);
+	x(st.nshared_hit == 0);
+	fffileread_free(fr);
+
+	// all blocks are in the shared cache
+	x(NULL != (fr = fffileread_create(fn, &conf)));
+	x(0 == fileread_uring_all(fr, u, &a, &st));
+	x(st.nread == 0);
+	x(st.nshared_hit == 11);
+	fffileread_free(fr);
+
+	// read-ahead probes aren't counted as cache hits
+	struct ffcache_stat cst;
+	ffcache_stat(cache, &cst);
+	x(cst.hits == 11);
+
+	// the key is file identity, not its name
+	char *fn2 = TESTDIR "/fftest-filerw2";
+	x(0 == fffile_rename(fn, fn2));
+	x(NULL != (fr = fffileread_create(fn2, &conf)));
+	x(0 == fileread_uring_all(fr, u, &a, &st));
+	x(st.nshared_hit == 11);
+	fffileread_free(fr);
+
+	// a new file under the old name
+	a.ptr[0]++;
+	x(0 == fffile_writeall(fn, a.ptr, a.len, 0));
+	x(NULL != (fr = fffileread_create(fn, &conf)));
+	fileread_uring_all(fr, u, &a, &st);
+	x(st.nshared_hit == 0);
+	fffileread_free(fr);
+	fffile_rm(fn2);
+
+	// close while a request is pending
+	conf.cache = NULL;
+	x(NULL != (fr = fffileread_create(fn, &conf)));
+	ffstr d;
+	x(FFFILEREAD_RASYNC == fffileread_getdata(fr, &d, 0, 0));
+	fffileread_free(fr);
+	x(1 == ffuring_wait(u));
+
+	ffcache_free(cache);
+	ffuring_free(u);
+	ffarr_free(&a);
+	fffile_rm(fn);
+}
+#endif
+
 int test_fileread()
 {
 	FFTEST_FUNC;
@@ -308,7 +629,7 @@ int test_fileread()
 	char *fn = TESTDIR "/fftest-filerw";
 
 	ffthpool *thpool;
-	ffthpoolconf ioconf;
+	ffthpoolconf ioconf = {};
 	ioconf.maxqueue = 4;
 	ioconf.maxthreads = 2;
 	x(NULL != (thpool = ffthpool_create(&ioconf)));
@@ -365,6 +686,10 @@ int test_fileread()
 	fffileread_free(fr);
 	ffthpool_free(thpool);
 	fffile_rm(fn);
+
+#ifdef FF_LINUX
+	test_fileread_uring();
+#endif
 	return 0;
 }
 
@@ -378,6 +703,192 @@ static void onwrite()
 	syncvar = 1;
 }
 
+static uint nreleased;
+static void onrelease(void *udata, void *param)
+{
+	nreleased++;
+}
+
+/** Write small data via internal buffer and large data directly from user buffers. */
+static void test_filewrite_v(const char *fn)
+{
+	fffilewrite *fw;
+	fffilewrite_stat st;
+	fffilewrite_conf conf;
+	ffarr aread = {};
+	ffstr a = {};
+	fffilewrite_setconf(&conf);
+	conf.log = &onlogw;
+	conf.bufsize = 64*1024;
+	conf.release = &onrelease;
+	conf.overwrite = 1;
+	x(NULL != (fw = fffilewrite_create(fn, &conf)));
+
+	ffstr_alloc(&a, 128*1024);
+	ffstr_addfill(&a, 128*1024, 'A', 128*1024);
+
+	ffiovec iov[2];
+	ffiov_set(&iov[0], "01", 2);
+	ffiov_set(&iov[1], "23", 2);
+	x(4 == fffilewrite_writev(fw, iov, 2, -1, 0, NULL)); // buf0@0: "0123"
+	x(nreleased == 1);
+
+	ffiov_set(&iov[0], a.ptr, 64*1024);
+	ffiov_set(&iov[1], a.ptr + 64*1024, 64*1024);
+	x(128*1024 == fffilewrite_writev(fw, iov, 2, -1, FFFILEWRITE_FFLUSH, NULL)); // file: "0123A[128k]"
+	x(nreleased == 2);
+
+	fffilewrite_getstat(fw, &st);
+	x(st.ncopied == 4);
+	x(st.npassthru == 128*1024);
+	x(st.nfwrite == 2);
+	fffilewrite_free(fw);
+
+	x(0 == fffile_readall(&aread, fn, -1));
+	x(aread.len == 4 + 128*1024);
+	x(!ffmemcmp(aread.ptr, "0123", 4));
+	x(!ffmemcmp(aread.ptr + 4, a.ptr, 128*1024));
+	ffstr_free(&a);
+	ffarr_free(&aread);
+}
+
+/** Wait for onwrite() after FFFILEWRITE_RASYNC. */
+static void filewrite_wait(ffuring *u)
+{
+	while (FF_READONCE(syncvar) == 0) {
+		if (u != NULL)
+			x(0 <= ffuring_wait(u));
+		else
+			ffthd_sleep(1);
+	}
+}
+
+/** Write an array larger than the max. number of buffers written with 1 request.
+release() is called once, after the last part of the array is written. */
+static void test_filewrite_batch(const char *fn, ffthpool *thpool, ffuring *u)
+{
+	enum { N = 40, BUF = 8*1024 };
+	fffilewrite *fw;
+	fffilewrite_stat st;
+	fffilewrite_conf conf;
+	ffarr aread = {};
+	ffstr a = {}, empty = {};
+	ssize_t r;
+	fffilewrite_setconf(&conf);
+	conf.log = &onlogw;
+	conf.bufsize = 64*1024;
+	conf.release = &onrelease;
+	conf.onwrite = &onwrite;
+	conf.thpool = thpool;
+	conf.uring = u;
+	conf.overwrite = 1;
+	x(NULL != (fw = fffilewrite_create(fn, &conf)));
+
+	ffstr_alloc(&a, N * BUF);
+	ffiovec iov[N];
+	for (uint i = 0;  i != N;  i++) {
+		ffiov_set(&iov[i], a.ptr + a.len, BUF);
+		ffstr_addfill(&a, N * BUF, 'A' + i, BUF);
+	}
+
+	uint rel = nreleased;
+	uint i = 0;
+	while (i != N) {
+		syncvar = 0;
+		r = fffilewrite_writev(fw, &iov[i], N - i, -1, FFFILEWRITE_FFLUSH, &conf);
+		if (r == FFFILEWRITE_RASYNC) {
+			filewrite_wait(u);
+			continue;
+		}
+		x(r > 0 && r % BUF == 0);
+		i += r / BUF;
+		if (i != N)
+			x(nreleased == rel); // the array is accepted partially
+	}
+
+	for (;;) {
+		syncvar = 0;
+		r = fffilewrite_write(fw, empty, -1, FFFILEWRITE_FFLUSH);
+		if (r != FFFILEWRITE_RASYNC)
+			break;
+		filewrite_wait(u);
+	}
+	x(r == 0);
+	x(nreleased == rel + 1);
+
+	fffilewrite_getstat(fw, &st);
+	x(st.npassthru == N * BUF);
+	x(st.ncopied == 0);
+	x(st.nfwrite >= (N + 15) / 16);
+	if (thpool != NULL || u != NULL)
+		x(st.nasync >= (N + 15) / 16);
+	fffilewrite_free(fw);
+
+	x(0 == fffile_readall(&aread, fn, -1));
+	x(ffstr_eq2(&aread, &a));
+	ffstr_free(&a);
+	ffarr_free(&aread);
+}
+
+#ifdef FF_LINUX
+/** Write data via internal buffers with io_uring. */
+static void test_filewrite_uring(const char *fn, ffuring *u)
+{
+	enum { N = 20, PART = 10000 };
+	fffilewrite *fw;
+	fffilewrite_stat st;
+	fffilewrite_conf conf;
+	ffarr aread = {};
+	ffstr a = {}, data, empty = {};
+	ssize_t r;
+	fffilewrite_setconf(&conf);
+	conf.log = &onlogw;
+	conf.bufsize = 64*1024;
+	conf.nbufs = 2;
+	conf.onwrite = &onwrite;
+	conf.uring = u;
+	conf.overwrite = 1;
+	x(NULL != (fw = fffilewrite_create(fn, &conf)));
+
+	ffstr_alloc(&a, N * PART);
+	for (uint i = 0;  i != N;  i++) {
+		ffstr_addfill(&a, N * PART, 'a' + i, PART);
+	}
+
+	ffstr_set2(&data, &a);
+	while (data.len != 0) {
+		syncvar = 0;
+		r = fffilewrite_write(fw, data, -1, 0);
+		if (r == FFFILEWRITE_RASYNC) {
+			filewrite_wait(u);
+			continue;
+		}
+		x(r > 0);
+		ffstr_shift(&data, r);
+	}
+
+	for (;;) {
+		syncvar = 0;
+		r = fffilewrite_write(fw, empty, -1, FFFILEWRITE_FFLUSH);
+		if (r != FFFILEWRITE_RASYNC)
+			break;
+		filewrite_wait(u);
+	}
+	x(r == 0);
+
+	fffilewrite_getstat(fw, &st);
+	x(st.ncopied == N * PART);
+	x(st.npassthru == 0);
+	x(st.nasync == (N * PART + 64*1024 - 1) / (64*1024));
+	fffilewrite_free(fw);
+
+	x(0 == fffile_readall(&aread, fn, -1));
+	x(ffstr_eq2(&aread, &a));
+	ffstr_free(&a);
+	ffarr_free(&aread);
+}
+#endif
+
 int test_filewrite()
 {
 	FFTEST_FUNC;
@@ -388,7 +899,7 @@ int test_filewrite()
 	ffstr a = {};
 
 	ffthpool *thpool;
-	ffthpoolconf ioconf;
+	ffthpoolconf ioconf = {};
 	ioconf.maxqueue = 4;
 	ioconf.maxthreads = 2;
 	x(NULL != (thpool = ffthpool_create(&ioconf)));
@@ -466,6 +977,22 @@ int test_filewrite()
 	x(0 == fffile_readall(&aread, fn, -1));
 	x(ffstr_eq2(&aread, &a));
 
+	test_filewrite_v(fn);
+	test_filewrite_batch(fn, NULL, NULL);
+	test_filewrite_batch(fn, thpool, NULL);
+
+#ifdef FF_LINUX
+	ffuring *u;
+	ffuring_conf uconf;
+	ffuring_conf_init(&uconf);
+	if (NULL != (u = ffuring_create(&uconf))) {
+		test_filewrite_batch(fn, NULL, u);
+		test_filewrite_uring(fn, u);
+		ffuring_free(u);
+	} else
+		x(fferr_last() == ENOSYS);
+#endif
+
 	ffthpool_free(thpool);
 	fffile_rm(fn);
 	ffstr_free(&a);
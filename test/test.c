@@ -9,6 +9,7 @@ Copyright (c) 2013 Simon Zolin
 #include <FFOS/dir.h>
 #include <FF/array.h>
 #include <FF/crc.h>
+#include <FF/hash.h>
 #include <FF/net/dns.h>
 #include <FF/audio/icy.h>
 
@@ -32,6 +33,27 @@ static int test_crc()
 {
 	x(0x7052c01a == ffcrc32_get("hello, man!", FFSLEN("hello, man!")));
 	x(0x7052c01a == ffcrc32_iget(FFSTR("HELLO, MAN!")));
+
+	static const char s[] = "Accept-Encoding: X-Forwarded-For @[`{ \xc1\xda";
+	for (uint i = 0;  i != FFSLEN(s);  i++) {
+		x(ffcrc32_iget(s, i) == ffcrc32_iget4(s, i));
+		x(ffcrc32_iget(s + i, FFSLEN(s) - i) == ffcrc32_iget4(s + i, FFSLEN(s) - i));
+	}
+	return 0;
+}
+
+static int test_hash()
+{
+	x(0xef46db3751d8e999ULL == ffhash64("", 0, 0));
+	x(0xd24ec4f1a98c6e5bULL == ffhash64("a", 1, 0));
+	x(0x51fcd75e61014c12ULL == ffhash64("hello, man!", FFSLEN("hello, man!"), 0));
+
+	static const char s[] = "Hello, World! 0123456789 ABCDEFGHIJKLMNOPQRSTUVWXYZ [@`{]";
+	char lower[sizeof(s)];
+	ffs_lower(lower, sizeof(lower), s, FFSLEN(s));
+	for (uint i = 0;  i <= FFSLEN(s);  i++) {
+		x(ffhash64(lower, i, 1) == ffhash64_i(s, i, 1));
+	}
 	return 0;
 }
 
@@ -77,6 +99,7 @@ static int test_icy(void)
 extern int test_file(void);
 extern int test_fileread();
 extern int test_filewrite();
+extern int test_thpool();
 FF_EXTN int test_ring(void);
 FF_EXTN int test_ringbuf(void);
 FF_EXTN int test_tq(void);
@@ -93,6 +116,7 @@ extern void test_conf_write(void);
 extern void test_dns(void);
 extern int test_domain();
 extern void test_dns_client(void);
+extern void test_http_client(void);
 extern int test_cache(void);
 extern int test_ip();
 extern int test_cmdarg();
@@ -106,14 +130,15 @@ struct test_s {
 #define F(nm) { #nm, (int (*)())&test_ ## nm }
 static const struct test_s _fftests[] = {
 	F(str), F(regex),
-	F(num), F(bits), F(rbtree), F(rbtlist), F(htable), F(ring), F(ringbuf), F(tq), F(crc),
-	F(file), F(fmap), F(time), F(timerq), F(sendfile), F(path), F(direxp),
+	F(num), F(bits), F(rbtree), F(rbtlist), F(htable), F(ring), F(ringbuf), F(tq), F(crc), F(hash),
+	F(file), F(fmap), F(time), F(timerq), F(thpool), F(sendfile), F(path), F(direxp),
 	F(ip), F(url), F(http), F(dns), F(icy), F(tls), F(webskt),
 	F(domain),
 	F(json),
 	F(cmdarg),
 	F(conf2), F(conf), F(conf_write), F(args), F(cue), F(xml),
 	F(dns_client),
+	F(http_client),
 	F(cache),
 };
 #undef F
@@ -200,7 +200,31 @@ static void t4_func(void *param) {
 	x(0); //this handler must not be called
 }
 
-int test_timerq()
+static void test_timerq_wheel_rm()
+{
+	fftimer_queue tq;
+	fftmrq_entry t[100];
+	x(0 == fftmrq_init2(&tq, FFTMRQ_WHEEL));
+	for (uint i = 0;  i != FFCNT(t);  i++) {
+		// spread timers over all levels of the wheel
+		fftmrq_add(&tq, &t[i], -(int64)((1ULL << (i % 40)) + i));
+		x(fftmrq_active(&tq, &t[i]));
+	}
+	x(tq.items.len == FFCNT(t));
+	for (uint i = 0;  i != FFCNT(t);  i += 2) {
+		fftmrq_rm(&tq, &t[i]);
+		x(!fftmrq_active(&tq, &t[i]));
+	}
+	fftmrq_add(&tq, &t[0], 10);
+	fftmrq_rm(&tq, &t[0]);
+	for (uint i = 1;  i < FFCNT(t);  i += 2) {
+		fftmrq_rm(&tq, &t[i]);
+	}
+	x(fftmrq_empty(&tq));
+	fftmrq_destroy(&tq, FF_BADFD);
+}
+
+static void test_timerq_run(uint flags)
 {
 	fffd kq;
 	ffkqu_time tt;
@@ -211,13 +235,11 @@ int test_timerq()
 	fftmrq_entry t1, t2, t3, t4;
 	int num = 0;
 
-	FFTEST_FUNC;
-
 	kq = ffkqu_create();
 	x(kq != FF_BADFD);
 	ffkqu_settm(&tt, -1);
 
-	fftmrq_init(&tq);
+	x(0 == fftmrq_init2(&tq, flags));
 	t1.handler = &t1_func;
 	t2.handler = &t2_func;
 	t3.handler = &t3_func;
@@ -248,7 +270,17 @@ int test_timerq()
 
 	fftmrq_destroy(&tq, kq);
 	x(0 == ffkqu_close(kq));
+}
+
+int test_timerq()
+{
+	FFTEST_FUNC;
+
+	test_timerq_run(0);
+	test_timerq_run(FFTMRQ_WHEEL);
+	test_timerq_run(FFTMRQ_WHEEL | FFTMRQ_COARSE);
 
 	test_timerq_rm();
+	test_timerq_wheel_rm();
 	return 0;
 }
@@ -0,0 +1,147 @@
+/** Test WebSocket permessage-deflate.
+Copyright (c) 2020 Simon Zolin
+*/
+
+#include <FF/net/webskt-deflate.h>
+#include <FFOS/test.h>
+
+
+/* "Hello" compressed by permessage-deflate, unmasked (RFC 7692, 7.2.3.1) */
+static const char ws_hello[] = "\xc1\x07\xf2\x48\xcd\xc9\xc9\x07\x00";
+
+static void test_wsdeflate_reader()
+{
+	ffwebskt w = {};
+	ffwebskt_zconf zc;
+	ffwebskt_zconf_init(&zc);
+	ffwebskt_inflate *z = ffwebskt_inflate_create(&zc);
+	x(z != NULL);
+	w.deflate = 1;
+
+	ffwebskt_input(&w, ws_hello, sizeof(ws_hello) - 1);
+	x(FFWEBSKT_RMSG == ffwebskt_parse_z(&w, z));
+	x(ffwebskt_compressed(&w));
+	x(FFWEBSKT_RDATA == ffwebskt_parse_z(&w, z));
+	x(ffstr_eqcz(&w.out, "Hello"));
+	x(FFWEBSKT_RDATA_FIN == ffwebskt_parse_z(&w, z));
+	x(FFWEBSKT_RMORE == ffwebskt_parse_z(&w, z));
+
+	ffwebskt_inflate_free(z);
+}
+
+/* Compress messages, then decompress them with the shared window */
+static void test_wsdeflate_roundtrip()
+{
+	ffwebskt_zconf zc;
+	ffwebskt_zconf_init(&zc);
+	ffwebskt_deflate *zd = ffwebskt_deflate_create(&zc);
+	ffwebskt_inflate *zi = ffwebskt_inflate_create(&zc);
+	x(zd != NULL && zi != NULL);
+
+	ffwebskt_cook c = {};
+	ffwebskt w = {};
+	w.deflate = 1;
+	w.server = 1;
+	char msg[] = "{\"id\":1,\"status\":\"ok\",\"items\":[1,2,3]}";
+	ffiovec iov[2];
+	ffarr frame = {};
+
+	for (uint i = 0;  i != 3;  i++) {
+		ffwebskt_input(&c, msg, sizeof(msg) - 1);
+		x(2 == ffwebskt_cookv_z(&c, zd, 0x12345678, FFWEBSKT_OP_TEXT, iov));
+		frame.len = 0;
+		ffarr_append(&frame, iov[0].iov_base, iov[0].iov_len);
+		ffarr_append(&frame, iov[1].iov_base, iov[1].iov_len);
+		if (i != 0)
+			x(iov[1].iov_len < sizeof(msg) / 2); //the repeated message is referenced in the window
+
+		ffwebskt_input(&w, frame.ptr, frame.len);
+		x(FFWEBSKT_RMSG == ffwebskt_parse_z(&w, zi));
+		x(ffwebskt_compressed(&w));
+		x(FFWEBSKT_RDATA == ffwebskt_parse_z(&w, zi));
+		x(w.out.len == sizeof(msg) - 1
+			&& !ffmemcmp(w.out.ptr, msg, sizeof(msg) - 1));
+		x(FFWEBSKT_RDATA_FIN == ffwebskt_parse_z(&w, zi));
+	}
+
+	ffarr_free(&frame);
+	ffwebskt_deflate_free(zd);
+	ffwebskt_inflate_free(zi);
+}
+
+/* Compress messages into frames of up to 64 bytes, then decompress them */
+static void test_wsdeflate_frag()
+{
+	ffwebskt_zconf zc;
+	ffwebskt_zconf_init(&zc);
+	zc.bufsize = 64;
+	zc.no_context_takeover = 1;
+	ffwebskt_deflate *zd = ffwebskt_deflate_create(&zc);
+	ffwebskt_inflate *zi = ffwebskt_inflate_create(&zc);
+	x(zd != NULL && zi != NULL);
+
+	ffwebskt_cook c = {};
+	ffwebskt w = {};
+	w.deflate = 1;
+	w.server = 1;
+	char msg[2000];
+	uint rnd = 1;
+	for (uint i = 0;  i != sizeof(msg);  i++) {
+		rnd = rnd * 1103515245 + 12345;
+		msg[i] = 'a' + (rnd >> 16) % 26;
+	}
+	ffiovec iov[2];
+	ffarr frames = {}, data = {};
+
+	for (uint len = 0;  len <= sizeof(msg);  len += 50) {
+		frames.len = 0;
+		uint nframes = 0;
+		ffwebskt_input(&c, msg, len);
+		do {
+			int n = ffwebskt_cookv_z(&c, zd, 0x12345678, FFWEBSKT_OP_TEXT, iov);
+			x(n == 1 || n == 2);
+			const byte *hdr = iov[0].iov_base;
+			if (nframes == 0)
+				x((hdr[0] & 0x7f) == (0x40 | FFWEBSKT_OP_TEXT)); //RSV1 is set only in the first frame
+			else
+				x((hdr[0] & 0x7f) == FFWEBSKT_OP_CONT);
+			x(!(hdr[0] & 0x80) == !!ffwebskt_deflate_more(zd)); //FIN is set only in the last frame
+			x(n == 1 || iov[1].iov_len <= 64);
+			for (int i = 0;  i != n;  i++) {
+				ffarr_append(&frames, iov[i].iov_base, iov[i].iov_len);
+			}
+			nframes++;
+		} while (ffwebskt_deflate_more(zd));
+		x(c.in.len == 0);
+		if (len >= 1000)
+			x(nframes > 10);
+
+		data.len = 0;
+		ffwebskt_input(&w, frames.ptr, frames.len);
+		for (;;) {
+			int r = ffwebskt_parse_z(&w, zi);
+			if (r == FFWEBSKT_RDATA)
+				ffarr_append(&data, w.out.ptr, w.out.len);
+			else if (r == FFWEBSKT_RDATA_FIN && !w.cont)
+				break;
+			else
+				x(r == FFWEBSKT_RMSG || r == FFWEBSKT_RDATA_FIN);
+		}
+		x(w.in.len == 0);
+		x(data.len == len && (len == 0 || !ffmemcmp(data.ptr, msg, len)));
+	}
+
+	ffarr_free(&frames);
+	ffarr_free(&data);
+	ffwebskt_deflate_free(zd);
+	ffwebskt_inflate_free(zi);
+}
+
+int main()
+{
+	ffmem_init();
+	FFTEST_TIMECALL( test_wsdeflate_reader() );
+	FFTEST_TIMECALL( test_wsdeflate_roundtrip() );
+	FFTEST_TIMECALL( test_wsdeflate_frag() );
+	return 0;
+}